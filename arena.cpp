@@ -0,0 +1,114 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "arena.h"
+#include "util.h"
+
+struct Arena::Block {
+	Block *next;
+	uint32_t size;
+	uint32_t used;
+};
+
+struct Arena::Adopted {
+	Adopted *next;
+	void *ptr;
+	uint32_t size;
+	uint8_t level;
+};
+
+static uint32_t alignSize(uint32_t size) {
+	return (size + Arena::kAlignment - 1) & ~(Arena::kAlignment - 1);
+}
+
+static const uint32_t kBlockHeaderSize = (sizeof(Arena::Block) + Arena::kAlignment - 1) & ~(Arena::kAlignment - 1);
+
+Arena::Arena(const char *name, int memTag, uint32_t blockSize)
+	: _name(name), _memTag(memTag), _blockSize(blockSize), _blocks(0), _adopted(0), _size(0), _reservedSize(0), _peakSize(0), _allocationsCount(0) {
+}
+
+Arena::~Arena() {
+	reset();
+}
+
+void *Arena::allocate(uint32_t size) {
+	size = alignSize(size);
+	Block *b = _blocks;
+	if (!b || b->used + size > b->size) {
+		const uint32_t blockSize = MAX(size, _blockSize);
+		Block *nb = (Block *)memAlloc(_memTag, kBlockHeaderSize + blockSize);
+		if (!nb) {
+			error("Arena '%s' failed to allocate %d bytes", _name, blockSize);
+			return 0;
+		}
+		nb->size = blockSize;
+		nb->used = 0;
+		if (b && size > _blockSize / 2) {
+			// large allocation, keep filling the current block
+			nb->next = b->next;
+			b->next = nb;
+		} else {
+			nb->next = b;
+			_blocks = nb;
+		}
+		_reservedSize += kBlockHeaderSize + blockSize;
+		b = nb;
+	}
+	uint8_t *p = (uint8_t *)b + kBlockHeaderSize + b->used;
+	b->used += size;
+	_size += size;
+	if (_size > _peakSize) {
+		_peakSize = _size;
+	}
+	++_allocationsCount;
+	return p;
+}
+
+void *Arena::allocateZero(uint32_t size) {
+	void *p = allocate(size);
+	if (p) {
+		memset(p, 0, size);
+	}
+	return p;
+}
+
+void Arena::adopt(void *ptr, uint32_t size) {
+	if (!ptr) {
+		return;
+	}
+	Adopted *a = (Adopted *)allocate(sizeof(Adopted));
+	a->ptr = ptr;
+	a->size = size;
+	a->level = g_memoryStats._level;
+	a->next = _adopted;
+	_adopted = a;
+	_size += size;
+	_reservedSize += size;
+	if (_size > _peakSize) {
+		_peakSize = _size;
+	}
+	g_memoryStats.add(_memTag, size, a->level);
+}
+
+void Arena::reset() {
+	if (_allocationsCount != 0) {
+		debug(kDebug_RESOURCE, "Arena '%s' release %d allocations, %d bytes (%d reserved) peak %d", _name, _allocationsCount, _size, _reservedSize, _peakSize);
+	}
+	// the adopted list nodes are stored in the blocks
+	for (Adopted *a = _adopted; a; a = a->next) {
+		g_memoryStats.remove(_memTag, a->size, a->level);
+		free(a->ptr);
+	}
+	_adopted = 0;
+	Block *b = _blocks;
+	while (b) {
+		Block *next = b->next;
+		memFree(b);
+		b = next;
+	}
+	_blocks = 0;
+	_size = _reservedSize = _peakSize = 0;
+	_allocationsCount = 0;
+}
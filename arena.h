@@ -0,0 +1,45 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include "intern.h"
+#include "stats.h"
+
+// bump allocator, the allocations are released together with reset()
+struct Arena {
+	enum {
+		kDefaultBlockSize = 64 * 1024,
+		kAlignment = 8
+	};
+
+	struct Block;
+	struct Adopted;
+
+	const char *_name;
+	int _memTag;
+	uint32_t _blockSize;
+	Block *_blocks; // the head block is the one being filled
+	Adopted *_adopted; // malloc'ed buffers freed on reset
+	uint32_t _size; // bytes in use
+	uint32_t _reservedSize; // bytes in use and allocated blocks
+	uint32_t _peakSize; // high-water mark since the last reset
+	uint32_t _allocationsCount;
+
+	Arena(const char *name = "", int memTag = kMemTag_Resource, uint32_t blockSize = kDefaultBlockSize);
+	~Arena();
+
+	void *allocate(uint32_t size);
+	void *allocateZero(uint32_t size);
+	void adopt(void *ptr, uint32_t size);
+	void reset();
+
+private:
+	Arena(const Arena &);
+	Arena &operator=(const Arena &);
+};
+
+#endif // ARENA_H__
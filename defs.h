@@ -184,6 +184,7 @@ struct LvlObject {
 };
 
 struct SssFilter;
+struct SssOpcode;
 struct SssPcm;
 
 struct SssObject {
@@ -205,10 +206,10 @@ struct SssObject {
 	int32_t pcmFramesCount; // 0x2C
 	SssObject *prevPtr; // 0x30
 	SssObject *nextPtr; // 0x34
-	const uint8_t *codeDataStage1; // 0x38
-	const uint8_t *codeDataStage2; // 0x3C
-	const uint8_t *codeDataStage3; // 0x40
-	const uint8_t *codeDataStage4; // 0x44
+	const SssOpcode *codeDataStage1; // 0x38
+	const SssOpcode *codeDataStage2; // 0x3C
+	const SssOpcode *codeDataStage3; // 0x40
+	const SssOpcode *codeDataStage4; // 0x44
 	int32_t repeatCounter; // 0x48
 	int32_t pauseCounter; // 0x4C
 	int32_t delayCounter; // 0x50
@@ -224,6 +225,8 @@ struct SssObject {
 	int32_t nextSoundBank; // 0x78
 	int32_t nextSoundSample; // 0x7C
 	SssFilter *filter;
+	int priorityHeapIndex; // -1 if not playing
+	uint32_t priorityOrder; // position in the playing list
 };
 
 struct Sprite {
@@ -268,7 +271,7 @@ struct ShootLvlObjectData {
 	int32_t xPosObject; // 0x14
 	int32_t yPosObject; // 0x18
 	LvlObject *o; // 0x1C
-	ShootLvlObjectData *nextPtr; // 0x20 pointer to the next free entry
+	ShootLvlObjectData *nextPtr; // 0x20 unused, the free entries are tracked by Game::_shootLvlObjectDataPool
 };
 
 struct ScreenMask { // ShadowScreenMask
@@ -4,6 +4,10 @@
  */
 
 #include <sys/param.h>
+#if !defined(PSP) && !defined(WII) && !defined(__3DS__) && !defined(__vita__) && !defined(__SWITCH__) && !defined(_WIN32)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "fileio.h"
 #include "util.h"
 
@@ -42,6 +46,22 @@ int File::read(uint8_t *ptr, int size) {
 	return fread(ptr, 1, size, _fp);
 }
 
+// FNV-1a of the file data
+uint32_t File::checksum(uint32_t *size) {
+	uint32_t checksum = 0x811C9DC5;
+	*size = 0;
+	fseek(_fp, 0, SEEK_SET);
+	uint8_t buf[4096];
+	int count;
+	while ((count = fread(buf, 1, sizeof(buf), _fp)) > 0) {
+		for (int i = 0; i < count; ++i) {
+			checksum = (checksum ^ buf[i]) * 0x01000193;
+		}
+		*size += count;
+	}
+	return checksum;
+}
+
 uint8_t File::readByte() {
 	uint8_t buf;
 	read(&buf, 1);
@@ -69,12 +89,34 @@ int fioAlignSizeTo2048(int size) {
 	return ((size + 2043) / 2044) * 2048;
 }
 
+uint32_t fioFlatSectorSize(uint32_t size) {
+	return (size / 2048) * 2044;
+}
+
+// the xor is computed per byte lane : the words are accumulated in native order
+// with 4 independent accumulators (vectorized by the compiler) and the result is
+// converted to little endian once
 uint32_t fioUpdateCRC(uint32_t sum, const uint8_t *buf, uint32_t size) {
 	assert((size & 3) == 0);
-	for (uint32_t offset = 0; offset < size; offset += 4) {
-		sum ^= READ_LE_UINT32(buf + offset);
+	uint32_t acc[4] = { 0, 0, 0, 0 };
+	uint32_t offset = 0;
+	for (; offset + 16 <= size; offset += 16) {
+		uint32_t w[4];
+		memcpy(w, buf + offset, sizeof(w));
+		acc[0] ^= w[0];
+		acc[1] ^= w[1];
+		acc[2] ^= w[2];
+		acc[3] ^= w[3];
+	}
+	for (; offset < size; offset += 4) {
+		uint32_t w;
+		memcpy(&w, buf + offset, sizeof(w));
+		acc[0] ^= w;
 	}
-	return sum;
+	acc[0] ^= acc[1] ^ acc[2] ^ acc[3];
+	uint8_t le[4];
+	memcpy(le, &acc[0], sizeof(le));
+	return sum ^ READ_LE_UINT32(le);
 }
 
 void SectorFile::refillBuffer(uint8_t *ptr) {
@@ -156,3 +198,100 @@ int SectorFile::read(uint8_t *ptr, int size) {
 	}
 	return 0;
 }
+
+MappedFile::MappedFile()
+	: _data(0), _size(0), _pos(0), _mapped(false) {
+}
+
+MappedFile::~MappedFile() {
+	unmap();
+}
+
+void MappedFile::unmap() {
+	if (_data) {
+#ifdef HAVE_MMAP
+		if (_mapped) {
+			munmap(_data, _size);
+		} else
+#endif
+		free(_data);
+		_data = 0;
+	}
+	_size = _pos = 0;
+	_mapped = false;
+}
+
+void MappedFile::setFp(FILE *fp) {
+	unmap();
+	File::setFp(fp);
+	if (!fp) {
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	const long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size <= 0) {
+		return;
+	}
+	_size = size;
+#ifdef HAVE_MMAP
+	void *p = mmap(0, _size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (p != MAP_FAILED) {
+		_data = (uint8_t *)p;
+		_mapped = true;
+		return;
+	}
+#endif
+	_data = (uint8_t *)malloc(_size);
+	if (!_data) {
+		error("Failed to allocate %d bytes for file data", _size);
+		return;
+	}
+	const int count = fread(_data, 1, _size, fp);
+	if (count != (int)_size) {
+		warning("Read %d bytes, expected %d", count, _size);
+		_size = count;
+	}
+}
+
+void MappedFile::seekAlign(uint32_t pos) {
+	_pos = pos;
+}
+
+void MappedFile::seek(int pos, int whence) {
+	switch (whence) {
+	case SEEK_SET:
+		_pos = pos;
+		break;
+	case SEEK_CUR:
+		_pos += pos;
+		break;
+	case SEEK_END:
+		_pos = _size + pos;
+		break;
+	}
+}
+
+int MappedFile::read(uint8_t *ptr, int size) {
+	const int count = (_pos < _size) ? MIN<int>(size, _size - _pos) : 0;
+	if (count != 0) {
+		memcpy(ptr, _data + _pos, count);
+		_pos += count;
+	}
+	return count;
+}
+
+void FlatSectorFile::seekAlign(uint32_t pos) {
+	pos += (pos / 2048) * 4;
+	MappedFile::seekAlign((pos / 2048) * 2044 + (pos & 2047));
+}
+
+void FlatSectorFile::seek(int pos, int whence) {
+	if (whence == SEEK_SET) {
+		assert((pos & 2047) == 0);
+		pos = (pos / 2048) * 2044;
+	} else {
+		assert(whence == SEEK_CUR && pos >= 0);
+	}
+	MappedFile::seek(pos, whence);
+}
@@ -15,11 +15,12 @@ struct File {
 	File();
 	virtual ~File();
 
-	void setFp(FILE *fp);
+	virtual void setFp(FILE *fp);
 
 	virtual void seekAlign(uint32_t pos);
 	virtual void seek(int pos, int whence);
 	virtual int read(uint8_t *ptr, int size);
+	virtual uint32_t checksum(uint32_t *size);
 	uint8_t readByte();
 	uint16_t readUint16();
 	uint32_t readUint32();
@@ -46,7 +47,34 @@ struct SectorFile : File {
 	virtual int read(uint8_t *ptr, int size);
 };
 
+// the whole file is mapped (or read in a single buffer where mmap is not available)
+struct MappedFile : File {
+
+	uint8_t *_data;
+	uint32_t _size;
+	uint32_t _pos;
+	bool _mapped;
+
+	MappedFile();
+	virtual ~MappedFile();
+
+	void unmap();
+
+	virtual void setFp(FILE *fp);
+	virtual void seekAlign(uint32_t pos);
+	virtual void seek(int pos, int whence);
+	virtual int read(uint8_t *ptr, int size);
+};
+
+// SectorFile data with the checksums stripped, the offsets are translated to the sector layout
+struct FlatSectorFile : MappedFile {
+
+	virtual void seekAlign(uint32_t pos);
+	virtual void seek(int pos, int whence);
+};
+
 int fioAlignSizeTo2048(int size);
+uint32_t fioFlatSectorSize(uint32_t size);
 uint32_t fioUpdateCRC(uint32_t sum, const uint8_t *buf, uint32_t size);
 
 #endif // FILEIO_H__
@@ -4,22 +4,48 @@
 
 #include <stdio.h>
 
+struct PackArchive;
+struct PackedFile;
+
 struct FileSystem {
+	enum {
+		kScanDepthUnlimited = -1
+	};
 
 	const char *_dataPath;
 	const char *_savePath;
+	int _scanDepth; // subdirectories levels of the data path searched for the game files
+	bool _indexed;
 	int _filesCount;
 	char **_filesList;
-
-	FileSystem(const char *dataPath, const char *savePath);
+	int *_filesHash; // open addressing on the lowercase file name, indexes _filesList
+	int _filesHashSize;
+	int _dirsCount;
+	char **_dirsList;
+	long *_dirsTime; // modification time, validates the cached index
+	PackArchive *_archive;
+	bool _archiveChecked;
+	bool _archiveInSavePath;
+
+	FileSystem(const char *dataPath, const char *savePath, int scanDepth = kScanDepthUnlimited);
 	~FileSystem();
 
 	FILE *openAssetFile(const char *filename);
 	FILE *openSaveFile(const char *filename, bool write);
+	void removeSaveFile(const char *filename);
 	int closeFile(FILE *);
 
+	PackedFile *openPackedFile(const char *name);
+	void closePackArchive();
+
 	void addFilePath(const char *path);
-	void listFiles(const char *dir);
+	void addDirPath(const char *path, long mtime);
+	void listFiles(const char *dir, int depth);
+	void buildIndex();
+	void clearIndex();
+	bool loadIndex();
+	void saveIndex();
+	int findFile(const char *name) const;
 };
 
 #endif // FS_H__
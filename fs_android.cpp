@@ -66,7 +66,7 @@ FILE *android_fopen(const char *fname, const char *mode) {
 // FileSystem
 //
 
-FileSystem::FileSystem(const char *dataPath, const char *savePath) {
+FileSystem::FileSystem(const char *dataPath, const char *savePath, int scanDepth) {
 	JNIEnv *env = (JNIEnv *)SDL_AndroidGetJNIEnv();
 	jobject activity = (jobject)SDL_AndroidGetActivity();
 
@@ -82,10 +82,14 @@ FileSystem::FileSystem(const char *dataPath, const char *savePath) {
 	_assetManager = AAssetManager_fromJava(env, globalAssetManager);
 	_dataPath = dataPath;
 	_savePath = savePath;
+	_archive = 0;
+	_archiveChecked = false;
+	_archiveInSavePath = false;
 	__android_log_print(ANDROID_LOG_INFO, LOG_TAG, "dataPath %s _assetManager %p", _dataPath, _assetManager);
 }
 
 FileSystem::~FileSystem() {
+	closePackArchive();
 }
 
 FILE *FileSystem::openAssetFile(const char *filename) {
@@ -114,6 +118,16 @@ FILE *FileSystem::openSaveFile(const char *filename, bool write) {
 	return fp;
 }
 
+void FileSystem::removeSaveFile(const char *filename) {
+	char *prefPath = SDL_GetPrefPath(ANDROID_PACKAGE_NAME, "hode");
+	if (prefPath) {
+		char path[MAXPATHLEN];
+		snprintf(path, sizeof(path), "%s/%s", prefPath, filename);
+		remove(path);
+		SDL_free(prefPath);
+	}
+}
+
 int FileSystem::closeFile(FILE *fp) {
 	const int err = ferror(fp);
 	fclose(fp);
@@ -1,10 +1,12 @@
 
 #include <assert.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
 #include "fs.h"
+#include "system.h"
 #include "util.h"
 
 static const char *_suffixes[] = {
@@ -12,12 +14,17 @@ static const char *_suffixes[] = {
 	"setup.dat",
 	"setup.dax",
 	".paf",
+	"hode.pak",
 	"_hod.lvl",
 	"_hod.sss",
 	"_hod.mst",
 	0
 };
 
+// list of the game files found in the data path, stored in the save path
+static const char *_indexFile = "hode_files.idx";
+static const int kIndexVersion = 1;
+
 static bool matchGameData(const char *path) {
 	const int len = strlen(path);
 	for (int i = 0; _suffixes[i]; ++i) {
@@ -29,29 +36,64 @@ static bool matchGameData(const char *path) {
 	return false;
 }
 
-FileSystem::FileSystem(const char *dataPath, const char *savePath)
-	: _dataPath(dataPath), _savePath(savePath), _filesCount(0), _filesList(0) {
-	listFiles(dataPath);
+static uint32_t hashFileName(const char *name) {
+	uint32_t hash = 0x811C9DC5;
+	for (; *name; ++name) {
+		hash = (hash ^ tolower((unsigned char)*name)) * 0x01000193;
+	}
+	return hash;
 }
 
-FileSystem::~FileSystem() {
-	for (int i = 0; i < _filesCount; ++i) {
-		free(_filesList[i]);
+static const char *getFileName(const char *path) {
+	const char *p = strrchr(path, '/');
+	assert(p);
+	return p + 1;
+}
+
+static FILE *openFile(const char *path) {
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+		return fopen(path, "rb");
 	}
-	free(_filesList);
+	return 0;
+}
+
+FileSystem::FileSystem(const char *dataPath, const char *savePath, int scanDepth)
+	: _dataPath(dataPath), _savePath(savePath), _scanDepth(scanDepth), _indexed(false),
+	_filesCount(0), _filesList(0), _filesHash(0), _filesHashSize(0),
+	_dirsCount(0), _dirsList(0), _dirsTime(0),
+	_archive(0), _archiveChecked(false), _archiveInSavePath(false) {
+}
+
+FileSystem::~FileSystem() {
+	closePackArchive();
+	clearIndex();
 }
 
 FILE *FileSystem::openAssetFile(const char *name) {
-	FILE *fp = 0;
-	for (int i = 0; i < _filesCount; ++i) {
-		const char *p = strrchr(_filesList[i], '/');
-		assert(p);
-		if (strcasecmp(name, p + 1) == 0) {
-			fp = fopen(_filesList[i], "rb");
-			break;
+	if (!matchGameData(name)) {
+		return 0;
+	}
+	if (!_indexed) {
+		// the game files are usually at the root of the data path, the directories are only scanned when not found there
+		char path[MAXPATHLEN];
+		const int len = snprintf(path, sizeof(path), "%s/%s", _dataPath, name);
+		if (len < (int)sizeof(path)) {
+			char *filename = path + len - strlen(name);
+			for (int i = 0; i < 3; ++i) {
+				for (char *p = filename; i != 0 && *p; ++p) {
+					*p = (i == 1) ? tolower((unsigned char)*p) : toupper((unsigned char)*p);
+				}
+				FILE *fp = openFile(path);
+				if (fp) {
+					return fp;
+				}
+			}
 		}
+		buildIndex();
 	}
-	return fp;
+	const int i = findFile(name);
+	return (i < 0) ? 0 : fopen(_filesList[i], "rb");
 }
 
 FILE *FileSystem::openSaveFile(const char *filename, bool write) {
@@ -60,6 +102,12 @@ FILE *FileSystem::openSaveFile(const char *filename, bool write) {
 	return fopen(path, write ? "wb" : "rb");
 }
 
+void FileSystem::removeSaveFile(const char *filename) {
+	char path[MAXPATHLEN];
+	snprintf(path, sizeof(path), "%s/%s", _savePath, filename);
+	remove(path);
+}
+
 int FileSystem::closeFile(FILE *fp) {
 	const int err = ferror(fp);
 	fclose(fp);
@@ -74,9 +122,21 @@ void FileSystem::addFilePath(const char *path) {
 	}
 }
 
-void FileSystem::listFiles(const char *dir) {
+void FileSystem::addDirPath(const char *path, long mtime) {
+	_dirsList = (char **)realloc(_dirsList, (_dirsCount + 1) * sizeof(char *));
+	_dirsTime = (long *)realloc(_dirsTime, (_dirsCount + 1) * sizeof(long));
+	if (_dirsList && _dirsTime) {
+		_dirsList[_dirsCount] = strdup(path);
+		_dirsTime[_dirsCount] = mtime;
+		++_dirsCount;
+	}
+}
+
+void FileSystem::listFiles(const char *dir, int depth) {
 	DIR *d = opendir(dir);
 	if (d) {
+		struct stat st;
+		addDirPath(dir, (stat(dir, &st) == 0) ? (long)st.st_mtime : 0);
 		dirent *de;
 		while ((de = readdir(d)) != NULL) {
 			if (de->d_name[0] == '.') {
@@ -84,10 +144,11 @@ void FileSystem::listFiles(const char *dir) {
 			}
 			char filePath[MAXPATHLEN];
 			snprintf(filePath, sizeof(filePath), "%s/%s", dir, de->d_name);
-			struct stat st;
 			if (stat(filePath, &st) == 0) {
 				if (S_ISDIR(st.st_mode)) {
-					listFiles(filePath);
+					if (_scanDepth == kScanDepthUnlimited || depth < _scanDepth) {
+						listFiles(filePath, depth + 1);
+					}
 				} else if (matchGameData(filePath)) {
 					addFilePath(filePath);
 				}
@@ -96,3 +157,131 @@ void FileSystem::listFiles(const char *dir) {
 		closedir(d);
 	}
 }
+
+void FileSystem::buildIndex() {
+	const uint32_t t0 = System_getTimeStampUs();
+	const bool cached = loadIndex();
+	if (!cached) {
+		listFiles(_dataPath, 0);
+		saveIndex();
+	}
+	_filesHashSize = 16;
+	while (_filesHashSize < _filesCount * 2) {
+		_filesHashSize *= 2;
+	}
+	_filesHash = (int *)malloc(_filesHashSize * sizeof(int));
+	if (_filesHash) {
+		const uint32_t mask = _filesHashSize - 1;
+		memset(_filesHash, 0xFF, _filesHashSize * sizeof(int));
+		for (int i = 0; i < _filesCount; ++i) {
+			const char *name = getFileName(_filesList[i]);
+			uint32_t h = hashFileName(name) & mask;
+			while (_filesHash[h] >= 0 && strcasecmp(getFileName(_filesList[_filesHash[h]]), name) != 0) {
+				h = (h + 1) & mask;
+			}
+			// keep the first path found for a name
+			if (_filesHash[h] < 0) {
+				_filesHash[h] = i;
+			}
+		}
+	}
+	debug(kDebug_RESOURCE, "Indexed %d files in %d directories (%s) in %d us", _filesCount, _dirsCount, cached ? "cached" : "scanned", System_getTimeStampUs() - t0);
+	_indexed = true;
+}
+
+void FileSystem::clearIndex() {
+	_indexed = false;
+	for (int i = 0; i < _filesCount; ++i) {
+		free(_filesList[i]);
+	}
+	free(_filesList);
+	_filesList = 0;
+	_filesCount = 0;
+	free(_filesHash);
+	_filesHash = 0;
+	_filesHashSize = 0;
+	for (int i = 0; i < _dirsCount; ++i) {
+		free(_dirsList[i]);
+	}
+	free(_dirsList);
+	_dirsList = 0;
+	free(_dirsTime);
+	_dirsTime = 0;
+	_dirsCount = 0;
+}
+
+static bool readIndexLine(FILE *fp, char *buf, int size) {
+	if (!fgets(buf, size, fp)) {
+		return false;
+	}
+	char *p = strchr(buf, '\n');
+	if (p) {
+		*p = 0;
+	}
+	return true;
+}
+
+// the cached index is valid as long as the modification times of the scanned directories are unchanged
+bool FileSystem::loadIndex() {
+	FILE *fp = openSaveFile(_indexFile, false);
+	if (!fp) {
+		return false;
+	}
+	char buf[MAXPATHLEN + 32];
+	char hdr[MAXPATHLEN + 64];
+	snprintf(hdr, sizeof(hdr), "HODE_FILES %d %d %s", kIndexVersion, _scanDepth, _dataPath);
+	bool valid = readIndexLine(fp, buf, sizeof(buf)) && strcmp(buf, hdr) == 0;
+	while (valid && readIndexLine(fp, buf, sizeof(buf))) {
+		if (buf[0] == 'f' && buf[1] == ' ') {
+			addFilePath(buf + 2);
+		} else if (buf[0] == 'd' && buf[1] == ' ') {
+			char *path = 0;
+			const long mtime = strtol(buf + 2, &path, 10);
+			struct stat st;
+			valid = (*path == ' ') && stat(path + 1, &st) == 0 && S_ISDIR(st.st_mode) && (long)st.st_mtime == mtime;
+			if (valid) {
+				addDirPath(path + 1, mtime);
+			}
+		} else {
+			valid = false;
+		}
+	}
+	closeFile(fp);
+	if (!valid || _dirsCount == 0) {
+		debug(kDebug_RESOURCE, "Ignoring outdated '%s'", _indexFile);
+		clearIndex();
+		return false;
+	}
+	return true;
+}
+
+void FileSystem::saveIndex() {
+	FILE *fp = openSaveFile(_indexFile, true);
+	if (!fp) {
+		return;
+	}
+	fprintf(fp, "HODE_FILES %d %d %s\n", kIndexVersion, _scanDepth, _dataPath);
+	for (int i = 0; i < _dirsCount; ++i) {
+		fprintf(fp, "d %ld %s\n", _dirsTime[i], _dirsList[i]);
+	}
+	for (int i = 0; i < _filesCount; ++i) {
+		fprintf(fp, "f %s\n", _filesList[i]);
+	}
+	if (closeFile(fp) != 0) {
+		warning("Failed to write '%s'", _indexFile);
+	}
+}
+
+int FileSystem::findFile(const char *name) const {
+	if (!_filesHash) {
+		return -1;
+	}
+	const uint32_t mask = _filesHashSize - 1;
+	for (uint32_t h = hashFileName(name) & mask; _filesHash[h] >= 0; h = (h + 1) & mask) {
+		const int i = _filesHash[h];
+		if (strcasecmp(getFileName(_filesList[i]), name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
@@ -9,6 +9,7 @@
 #include "lzw.h"
 #include "paf.h"
 #include "screenshot.h"
+#include "stats.h"
 #include "system.h"
 #include "util.h"
 #include "video.h"
@@ -16,8 +17,8 @@
 // starting level cutscene number
 static const uint8_t _cutscenes[] = { 0, 2, 4, 5, 6, 8, 10, 14, 19 };
 
-Game::Game(const char *dataPath, const char *savePath, uint32_t cheats)
-	: _fs(dataPath, savePath) {
+Game::Game(const char *dataPath, const char *savePath, uint32_t cheats, int scanDepth)
+	: _fs(dataPath, savePath, scanDepth) {
 
 	_level = 0;
 	_res = new Resource(&_fs);
@@ -28,6 +29,11 @@ Game::Game(const char *dataPath, const char *savePath, uint32_t cheats)
 	_playDemo = false;
 
 	_frameMs = kFrameDuration;
+	_turboTicks = 1;
+	_turboTick = 0;
+	_presentFrame = true;
+	_displayRate = 0;
+	_displayShakeDx = _displayShakeDy = 0;
 	_difficulty = 1; // normal
 
 	memset(_screenLvlObjectsList, 0, sizeof(_screenLvlObjectsList));
@@ -35,6 +41,7 @@ Game::Game(const char *dataPath, const char *savePath, uint32_t cheats)
 	_plasmaExplosionObject = 0;
 	_plasmaCannonObject = 0;
 	memset(_spritesTable, 0, sizeof(_spritesTable));
+	_spritesPool.init("sprites", _spritesTable);
 	memset(_typeSpritesList, 0, sizeof(_typeSpritesList));
 
 	_directionKeyMask = 0;
@@ -48,25 +55,31 @@ Game::Game(const char *dataPath, const char *savePath, uint32_t cheats)
 	_lvlObjectsList3 = 0;
 	memset(_screenMaskBuffer, 0, sizeof(_screenMaskBuffer));
 	memset(_shootLvlObjectDataTable, 0, sizeof(_shootLvlObjectDataTable));
+	_shootLvlObjectDataPool.init("shoots", _shootLvlObjectDataTable);
 	_mstAndyCurrentScreenNum = -1;
 	_plasmaCannonDirection = 0;
+	_prevAndyFlags0 = 0;
 	_andyActionKeyMaskAnd = 0xFF;
 	_andyActionKeyMaskOr = 0;
 	_andyDirectionKeyMaskAnd = 0xFF;
 	_andyDirectionKeyMaskOr = 0;
 
 	_mstDisabled = false;
+	_mstThreadedCode = true;
+	_mstWalkPathCache = true;
 	_specialAnimMask = 0; // original only clears ~0x30
 	_mstCurrentAnim = 0;
 	_mstOriginPosX = Video::W / 2;
 	_mstOriginPosY = Video::H / 2;
 	memset(_declaredLvlObjectsList, 0, sizeof(_declaredLvlObjectsList));
-	_declaredLvlObjectsNextPtr = 0;
-	_declaredLvlObjectsListCount = 0;
+	_declaredLvlObjectsPool.init("objects", _declaredLvlObjectsList);
 
 	memset(_animBackgroundDataTable, 0, sizeof(_animBackgroundDataTable));
 	_animBackgroundDataCount = 0;
 
+	memset(_tasksTable, 0, sizeof(_tasksTable));
+	_tasksPool.init("tasks", _tasksTable);
+
 	memset(_monsterObjects1Table, 0, sizeof(_monsterObjects1Table));
 	memset(_monsterObjects2Table, 0, sizeof(_monsterObjects2Table));
 
@@ -78,37 +91,48 @@ Game::Game(const char *dataPath, const char *savePath, uint32_t cheats)
 	_sssObjectsCount = 0;
 	_sssObjectsList1 = 0;
 	_sssObjectsList2 = 0;
+	memset(_sssObjectsUsedMask, 0, sizeof(_sssObjectsUsedMask));
+	_sssObjectsPriorityHeapSize = 0;
 	_playingSssObjectsMax = 16; // 10 if (lowMemory || slowCPU)
+
+	_saveStates = true;
+	_checkpointStates = true;
+	_replayFileName = 0;
+	_stateReplay = false;
+	_stateReplaySkipCutscenes = false;
+	_levelSerial = 0;
+	memset(&_gameState, 0, sizeof(_gameState));
+	memset(&_checkpointState, 0, sizeof(_checkpointState));
+	memset(&_stateInputs, 0, sizeof(_stateInputs));
+	_stateInputsCapacity = 0;
 }
 
 Game::~Game() {
+	freeGameState(&_gameState);
+	freeGameState(&_checkpointState);
+	free(_stateInputs.actionKeyMask);
+	free(_stateInputs.directionKeyMask);
 	delete _paf;
 	delete _res;
 	delete _video;
 }
 
 void Game::resetShootLvlObjectDataTable() {
-	_shootLvlObjectDataNextPtr = &_shootLvlObjectDataTable[0];
-	for (int i = 0; i < kMaxShootLvlObjectData - 1; ++i) {
-		_shootLvlObjectDataTable[i].nextPtr = &_shootLvlObjectDataTable[i + 1];
-	}
-	_shootLvlObjectDataTable[kMaxShootLvlObjectData - 1].nextPtr = 0;
+	_shootLvlObjectDataPool.reset();
 }
 
 void Game::clearShootLvlObjectData(LvlObject *ptr) {
 	ShootLvlObjectData *dat = (ShootLvlObjectData *)getLvlObjectDataPtr(ptr, kObjectDataTypeShoot);
-	dat->nextPtr = _shootLvlObjectDataNextPtr;
-	_shootLvlObjectDataNextPtr = dat;
+	_shootLvlObjectDataPool.release(dat);
 	ptr->dataPtr = 0;
 }
 
 void Game::addShootLvlObject(LvlObject *vd, LvlObject *ptr) {
-	vd->dataPtr = _shootLvlObjectDataNextPtr;
-	if (_shootLvlObjectDataNextPtr) {
-		_shootLvlObjectDataNextPtr = _shootLvlObjectDataNextPtr->nextPtr;
+	vd->dataPtr = _shootLvlObjectDataPool.acquire();
+	if (vd->dataPtr) {
 		memset(vd->dataPtr, 0, sizeof(ShootLvlObjectData));
 	} else {
-		warning("Nothing free in _shootLvlObjectDataNextPtr");
+		warning("Nothing free in _shootLvlObjectDataPool");
 	}
 	vd->xPos = ptr->xPos;
 	vd->yPos = ptr->yPos;
@@ -171,7 +195,11 @@ void Game::fadeScreenPalette() {
 void Game::shakeScreen() {
 	if (_video->_displayShadowLayer) {
 		const int num = (_currentLevel == kLvl_lava || _currentLevel == kLvl_lar1) ? 1 : 4;
-		transformShadowLayer(num);
+		if (_presentFrame) {
+			transformShadowLayer(num);
+		} else {
+			_video->_transformShadowLayerDelta += num;
+		}
 	}
 	if (_shakeScreenDuration != 0) {
 		--_shakeScreenDuration;
@@ -187,6 +215,8 @@ void Game::shakeScreen() {
 				dy = -dy;
 			}
 			g_system->shakeScreen(dx, dy);
+			_displayShakeDx = dx;
+			_displayShakeDy = dy;
 		}
 	}
 	if (_levelRestartCounter != 0) {
@@ -353,14 +383,15 @@ void Game::setupBackgroundBitmap() {
 }
 
 void Game::addToSpriteList(Sprite *spr) {
-	_spritesNextPtr = spr->nextPtr;
+	Sprite *next = _spritesPool.acquire();
+	assert(next == spr);
 	const int index = spr->num & 0x1F;
 	spr->nextPtr = _typeSpritesList[index];
 	_typeSpritesList[index] = spr;
 }
 
 void Game::addToSpriteList(LvlObject *ptr) {
-	Sprite *spr = _spritesNextPtr;
+	Sprite *spr = _spritesPool.peek();
 	if (spr) {
 		const uint8_t num = _res->_currentScreenResourceNum;
 		const uint8_t *grid = _res->_screensGrid[num];
@@ -454,18 +485,18 @@ void Game::setupScreenPosTable(uint8_t num) {
 	for (int i = 0; i < 4; ++i) {
 		if (src[i] != kNoScreen) {
 			int index = _res->_resLvlScreenBackgroundDataTable[src[i]].currentMaskId;
-			const uint8_t *p = _res->getLvlScreenPosDataPtr(src[i] * 4 + index);
+			const uint8_t *p = _res->getLvlScreenPos(src[i] * 4 + index);
 			if (p) {
-				Video::decodeRLE(p, _screenPosTable[i], 32 * 24);
+				memcpy(_screenPosTable[i], p, 32 * 24);
 				continue;
 			}
 		}
 		memset(_screenPosTable[i], 0, 32 * 24);
 	}
 	int index = _res->_resLvlScreenBackgroundDataTable[num].currentMaskId;
-	const uint8_t *p = _res->getLvlScreenPosDataPtr(num * 4 + index);
+	const uint8_t *p = _res->getLvlScreenPos(num * 4 + index);
 	if (p) {
-		Video::decodeRLE(p, _screenPosTable[4], 32 * 24);
+		memcpy(_screenPosTable[4], p, 32 * 24);
 	} else {
 		memset(_screenPosTable[4], 0, 32 * 24);
 	}
@@ -479,15 +510,14 @@ void Game::setupScreenMask(uint8_t num) {
 	if (_res->_screensState[num].s3 != mask) {
 		debug(kDebug_GAME, "setupScreenMask num %d mask %d", num, mask);
 		_res->_screensState[num].s3 = mask;
-		const uint8_t *maskData = _res->getLvlScreenMaskDataPtr(num * 4 + mask);
-		if (maskData) {
-			Video::decodeRLE(maskData, _screenTempMaskBuffer, 32 * 24);
-		} else {
-			memset(_screenTempMaskBuffer, 0, 32 * 24);
-		}
+		const uint8_t *maskData = _res->getLvlScreenMask(num * 4 + mask);
 		uint8_t *p = _screenMaskBuffer + screenMaskOffset(_res->_screensBasePos[num].u, _res->_screensBasePos[num].v);
 		for (int i = 0; i < 24; ++i) {
-			memcpy(p, _screenTempMaskBuffer + i * 32, 32);
+			if (maskData) {
+				memcpy(p, maskData + i * 32, 32);
+			} else {
+				memset(p, 0, 32);
+			}
 			p += 512;
 		}
 	}
@@ -508,8 +538,8 @@ void Game::setScreenMaskRectHelper(int x1, int y1, int x2, int y2, int screenNum
 	if (screenNum != kNoScreen) {
 
 		int index = _res->_resLvlScreenBackgroundDataTable[screenNum].currentMaskId;
-		const uint8_t *p = _res->getLvlScreenMaskDataPtr(screenNum * 4 + index);
-		Video::decodeRLE(p, _screenTempMaskBuffer, 32 * 24);
+		const uint8_t *maskData = _res->getLvlScreenMask(screenNum * 4 + index);
+		assert(maskData);
 
 		int h = (y2 - y1 + 7) >> 3;
 		int w = (x2 - x1 + 7) >> 3;
@@ -522,7 +552,7 @@ void Game::setScreenMaskRectHelper(int x1, int y1, int x2, int y2, int screenNum
 			++w;
 		}
 
-		const uint8_t *src = _screenTempMaskBuffer + screenGridOffset(x, y);
+		const uint8_t *src = maskData + screenGridOffset(x, y);
 		uint8_t *dst = _screenMaskBuffer + screenMaskOffset(x1, y1);
 		for (int i = 0; i < h; ++i) {
 			memcpy(dst, src, w);
@@ -746,9 +776,6 @@ void Game::destroyLvlObject(LvlObject *o) {
 	assert(o);
 	if (o->type == 8) {
 		_res->decLvlSpriteDataRefCounter(o);
-		o->nextPtr = _declaredLvlObjectsNextPtr;
-		--_declaredLvlObjectsListCount;
-		_declaredLvlObjectsNextPtr = o;
 		switch (o->spriteNum) {
 		case 0:
 		case 2:
@@ -767,6 +794,14 @@ void Game::destroyLvlObject(LvlObject *o) {
 		o->sssObject = 0;
 	}
 	o->bitmapBits = 0;
+	if (o->type == 8) {
+		_declaredLvlObjectsPool.release(o);
+	}
+}
+
+bool Game::isDestroyedLvlObject(const LvlObject *o) const {
+	const int i = o - _declaredLvlObjectsList;
+	return i >= 0 && i < kMaxLvlObjects && _declaredLvlObjectsPool.isFree(i);
 }
 
 void Game::setupPlasmaCannonPoints(LvlObject *ptr) {
@@ -916,6 +951,8 @@ endDir:
 
 void Game::preloadLevelScreenData(uint8_t num, uint8_t prev) {
 	assert(num != kNoScreen);
+	_res->collectLvlScreensPrefetch();
+	// loaded here when it was not prefetched or the worker has not read it yet
 	if (!_res->isLvlBackgroundDataLoaded(num)) {
 		_res->loadLvlScreenBackgroundData(num);
 	}
@@ -929,6 +966,27 @@ void Game::preloadLevelScreenData(uint8_t num, uint8_t prev) {
 			}
 		}
 	}
+	prefetchLevelScreenData(num, prev);
+}
+
+void Game::prefetchLevelScreenData(uint8_t num, uint8_t prev) {
+	// the screen in the direction Andy is moving first, then the sides and the screen he comes from
+	int direction = kPosRightScreen;
+	if (prev != kNoScreen) {
+		for (int i = 0; i < 4; ++i) {
+			if (_res->_screensGrid[prev][i] == num) {
+				direction = i;
+				break;
+			}
+		}
+	}
+	const uint8_t *grid = _res->_screensGrid[num];
+	uint8_t screens[4];
+	screens[0] = grid[direction];
+	screens[1] = grid[(direction + 1) & 3];
+	screens[2] = grid[(direction + 3) & 3];
+	screens[3] = grid[(direction + 2) & 3];
+	_res->startLvlScreensPrefetch(screens, 4, num);
 }
 
 void Game::setLvlObjectPosRelativeToObject(LvlObject *ptr1, int num1, LvlObject *ptr2, int num2) {
@@ -1258,6 +1316,9 @@ void Game::resetScreen() {
 }
 
 void Game::restartLevel() {
+	if (restoreCheckpointState()) {
+		return;
+	}
 	setupAndyLvlObject();
 	clearLvlObjectsList2();
 	clearLvlObjectsList3();
@@ -1280,6 +1341,7 @@ void Game::restartLevel() {
 		preloadLevelScreenData(_andyObject->screenNum, kNoScreen);
 	}
 	setupScreen(_andyObject->screenNum);
+	saveCheckpointState();
 }
 
 void Game::playAndyFallingCutscene(int type) {
@@ -1364,7 +1426,6 @@ int8_t Game::updateLvlObjectScreen(LvlObject *ptr) {
 }
 
 void Game::setAndyAnimationForArea(BoundingBox *box, int dx) {
-	static uint8_t _prevAndyFlags0 = 0;
 	BoundingBox objBox;
 	objBox.x1 = _andyObject->xPos;
 	objBox.x2 = _andyObject->xPos + _andyObject->posTable[3].x;
@@ -1825,12 +1886,8 @@ void Game::updateBackgroundPsx(int num) {
 	}
 }
 
-void Game::drawScreen() {
-	memcpy(_video->_frontLayer, _video->_backgroundLayer, Video::W * Video::H);
-	_video->copyYuvBackBuffer();
-
-	// redraw background animation sprites
-	LvlBackgroundData *dat = &_res->_resLvlScreenBackgroundDataTable[_res->_currentScreenResourceNum];
+// redraw background animation sprites
+void Game::drawBackgroundSprites() {
 	if (_res->_isPsx) {
 		for (Sprite *spr = _typeSpritesList[0]; spr; spr = spr->nextPtr) {
 			assert((spr->num & 0x1F) == 0);
@@ -1844,6 +1901,14 @@ void Game::drawScreen() {
 			}
 		}
 	}
+}
+
+void Game::drawScreen() {
+	memcpy(_video->_frontLayer, _video->_backgroundLayer, Video::W * Video::H);
+	_video->copyYuvBackBuffer();
+	drawBackgroundSprites();
+
+	LvlBackgroundData *dat = &_res->_resLvlScreenBackgroundDataTable[_res->_currentScreenResourceNum];
 	memset(_video->_shadowLayer, 0, Video::W * Video::H + 1);
 	for (int i = 1; i < 8; ++i) {
 		for (Sprite *spr = _typeSpritesList[i]; spr; spr = spr->nextPtr) {
@@ -1916,7 +1981,11 @@ static void gamePafCallback(void *userdata) {
 }
 
 void Game::mainLoop(int level, int checkpoint, bool levelChanged) {
-	if (_playDemo && _res->loadHodDem()) {
+	if (_replayFileName) {
+		_stateReplay = readReplayFile(_replayFileName);
+		_replayFileName = 0;
+	}
+	if (_stateReplay || (_playDemo && _res->loadHodDem())) {
 		_rnd._rndSeed = _res->_dem.randSeed;
 		level = _res->_dem.level;
 		checkpoint = _res->_dem.checkpoint;
@@ -1940,6 +2009,12 @@ void Game::mainLoop(int level, int checkpoint, bool levelChanged) {
 		// resume once, on the starting level
 		_resumeGame = false;
 	}
+	if (_stateReplay) {
+		// the frames are not paced until the end of the inputs
+		_stateReplaySkipCutscenes = _paf->_skipCutscenes;
+		_paf->_skipCutscenes = true;
+	}
+	++_levelSerial;
 
 	PafCallback pafCb;
 	pafCb.frameProc = 0;
@@ -1953,12 +2028,19 @@ void Game::mainLoop(int level, int checkpoint, bool levelChanged) {
 	createLevel();
 	assert(checkpoint < _res->_datHdr.levelCheckpointsCount[level]);
 	_currentLevelCheckpoint = _level->_checkpoint = checkpoint;
+	g_memoryStats.startLevel(_currentLevel);
+	_spritesPool._stats.resetStats();
+	_shootLvlObjectDataPool._stats.resetStats();
+	_declaredLvlObjectsPool._stats.resetStats();
+	_tasksPool._stats.resetStats();
 	_mix._lock(1);
 	_res->loadLevelData(_currentLevel);
+	mstProfilerStartLevel();
 	clearSoundObjects();
 	_mix._lock(0);
 	_mstAndyCurrentScreenNum = -1;
-	const int rounds = _playDemo ? _res->_dem.randRounds : ((g_system->getTimeStamp() & 15) + 1);
+	const int rounds = (_playDemo || _stateReplay) ? _res->_dem.randRounds : ((g_system->getTimeStamp() & 15) + 1);
+	startStateInputs(_rnd._rndSeed, rounds);
 	_rnd.initTable(rounds);
 	const int screenNum = _level->getCheckpointData(checkpoint)->screenNum;
 	if (_mstDisabled) {
@@ -1996,21 +2078,74 @@ void Game::mainLoop(int level, int checkpoint, bool levelChanged) {
 	resetShootLvlObjectDataTable();
 	callLevel_initialize();
 	restartLevel();
+	g_stateTrace.startLevel(_currentLevel);
+	_turboTick = 0;
+	const uint32_t turboTimeStamp = g_system->getTimeStamp();
+	uint32_t turboTicksCount = 0;
+	int frameTimeStamp = 0;
 	while (true) {
-		const int frameTimeStamp = g_system->getTimeStamp() + _frameMs;
+		if (_turboTick == 0) { // first tick of the presented frame
+			frameTimeStamp = g_system->getTimeStamp() + _frameMs;
+		}
 		levelMainLoop();
+		++turboTicksCount;
+		if (g_stateTrace.isOpen()) {
+			updateStateTrace();
+		}
 		if (g_system->inp.quit || _endLevel) {
 			break;
 		}
+		updateSaveStates();
+		if (g_audioRender.isOpen()) {
+			// headless clock, mix one frame of sound and do not wait
+			renderAudioFrame();
+			if (_res->_dem.keyMaskLen != 0 && _res->_demOffset >= _res->_dem.keyMaskLen) {
+				break;
+			}
+			continue;
+		}
+		if (_stateReplay || !_presentFrame) {
+			continue;
+		}
 		const int delay = MAX<int>(10, frameTimeStamp - g_system->getTimeStamp());
-		g_system->sleep(delay);
+		if (_displayRate > 0) {
+			presentInterpolatedFrames(frameTimeStamp - _frameMs, delay);
+		} else {
+			g_system->sleep(delay);
+		}
+	}
+	if (_turboTicks > 1) {
+		const uint32_t ms = g_system->getTimeStamp() - turboTimeStamp;
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Level %d ran %u ticks in %u ms, %d ticks per presented frame", _currentLevel, turboTicksCount, ms, _turboTicks);
+		System_printLog(stdout, buffer);
 	}
 	_animBackgroundDataCount = 0;
 	callLevel_terminate();
+	g_memoryStats.dump();
+	dumpPoolsStats();
+	g_mstProfiler.dump();
+	g_memoryStats.startLevel(MemoryStats::kNoLevel);
+}
+
+void Game::dumpPoolsStats() {
+	if (!g_memoryStats._enabled) {
+		return;
+	}
+	const PoolStats *pools[] = { &_tasksPool._stats, &_declaredLvlObjectsPool._stats, &_shootLvlObjectDataPool._stats, &_spritesPool._stats };
+	for (unsigned int i = 0; i < ARRAYSIZE(pools); ++i) {
+		const PoolStats *p = pools[i];
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Pool level %d %-7s used %d peak %d/%d, %u acquired, %u failed, %u invalid releases",
+			_currentLevel, p->name, p->used, p->peak, p->capacity, p->acquiredCount, p->failedCount, p->invalidReleasesCount);
+		System_printLog(stdout, buffer);
+	}
 }
 
 void Game::mixAudio(int16_t *buf, int len) {
 
+	AudioStatsTimer timer(&g_audioStats._mixAudio);
+
 	if (_snd_muted) {
 		return;
 	}
@@ -2040,6 +2175,9 @@ void Game::mixAudio(int16_t *buf, int len) {
 			mixSoundObjects17640(false);
 			++count;
 		}
+		if (g_audioStats._enabled) {
+			g_audioStats.addTick(_mix._mixingQueueSize, _playingSssObjectsCount);
+		}
 
 		if (len >= kStereoSamples) {
 			_mix.mix(buf, kStereoSamples);
@@ -2054,6 +2192,23 @@ void Game::mixAudio(int16_t *buf, int len) {
 			break;
 		}
 	}
+	if (g_audioStats._enabled) {
+		g_audioStats.setCarryOver(_snd_bufferSize);
+	}
+}
+
+void Game::renderAudioFrame() {
+	int16_t buf[1024];
+	int len = g_audioRender.getFrameSamples(_frameMs) * 2;
+	while (len > 0) {
+		const int count = MIN<int>(len, ARRAYSIZE(buf));
+		memset(buf, 0, count * sizeof(int16_t));
+		const uint32_t t0 = System_getTimeStampUs();
+		mixAudio(buf, count);
+		g_audioRender._mixUs += System_getTimeStampUs() - t0;
+		g_audioRender.write(buf, count);
+		len -= count;
+	}
 }
 
 void Game::updateLvlObjectList(LvlObject **list) {
@@ -2067,6 +2222,10 @@ void Game::updateLvlObjectList(LvlObject **list) {
 		}
 		if (ptr->callbackFuncPtr) {
 			(this->*(ptr->callbackFuncPtr))(ptr);
+			if (isDestroyedLvlObject(ptr)) {
+				ptr = next;
+				continue;
+			}
 		}
 		if (ptr->bitmapBits && list != &_lvlObjectsList3) {
 			addToSpriteList(ptr);
@@ -2092,7 +2251,7 @@ LvlObject *Game::updateAnimatedLvlObjectType0(LvlObject *ptr) {
 			playSound(ptr->currentSound, ptr, 0, 3);
 			ptr->currentSound = 0xFFFF;
 		}
-		Sprite *spr = _spritesNextPtr;
+		Sprite *spr = _spritesPool.peek();
 		if (spr && READ_LE_UINT16(data + 2) > 8) {
 			if (isPsx) {
 				assert((ptr->flags2 & 0x1F) == 0);
@@ -2157,7 +2316,7 @@ LvlObject *Game::updateAnimatedLvlObjectType0(LvlObject *ptr) {
 		}
 		data = vg->currentSpriteData + soundDataLen;
 		if (_res->_currentScreenResourceNum == ptr->screenNum) {
-			Sprite *spr = _spritesNextPtr;
+			Sprite *spr = _spritesPool.peek();
 			if (spr && READ_LE_UINT16(data + 2) > 8) {
 				if (isPsx) {
 					assert((ptr->flags2 & 0x1F) == 0);
@@ -2220,7 +2379,7 @@ LvlObject *Game::updateAnimatedLvlObjectType1(LvlObject *ptr) {
 				ptr->currentSound = 0xFFFF;
 			}
 			const uint8_t *data = (const uint8_t *)getLvlObjectDataPtr(ptr, kObjectDataTypeLvlBackgroundSound);
-			Sprite *spr = _spritesNextPtr;
+			Sprite *spr = _spritesPool.peek();
 			if (spr && READ_LE_UINT16(data + 2) > 8) {
 				spr->w = READ_LE_UINT16(data + 4);
 				spr->h = READ_LE_UINT16(data + 6);
@@ -2273,7 +2432,7 @@ LvlObject *Game::updateAnimatedLvlObjectType2(LvlObject *ptr) {
 		const int f1 = (ptr->flags1 >> 4) & 3;
 		const int f2 = (ash->flags1 >> 4) & 3;
 		const int num = ((f1 ^ f2) << 14) | ptr->flags2;
-		Sprite *spr = _spritesNextPtr;
+		Sprite *spr = _spritesPool.peek();
 		if (spr && bitmap) {
 			spr->yPos = ptr->yPos;
 			spr->xPos = ptr->xPos;
@@ -2515,16 +2674,24 @@ void Game::updateInput() {
 }
 
 void Game::levelMainLoop() {
-	memset(_typeSpritesList, 0, sizeof(_typeSpritesList));
-	_spritesNextPtr = &_spritesTable[0];
-	for (int i = 0; i < kMaxSprites - 1; ++i) {
-		_spritesTable[i].nextPtr = &_spritesTable[i + 1];
+	_presentFrame = true;
+	if (_turboTicks > 1) {
+		if (++_turboTick < _turboTicks) {
+			_presentFrame = false;
+		} else {
+			_turboTick = 0;
+		}
+	}
+	if (_displayRate > 0) {
+		// poll the input just before the frame, the screen is updated while waiting for it
+		g_system->processEvents();
 	}
-	_spritesTable[kMaxSprites - 1].nextPtr = 0;
+	memset(_typeSpritesList, 0, sizeof(_typeSpritesList));
+	_spritesPool.reset();
 	_directionKeyMask = 0;
 	_actionKeyMask = 0;
 	updateInput();
-	if (_playDemo && _res->_demOffset < _res->_dem.keyMaskLen) {
+	if ((_playDemo || _stateReplay) && _res->_demOffset < _res->_dem.keyMaskLen) {
 		_andyObject->actionKeyMask = _res->_dem.actionKeyMask[_res->_demOffset];
 		_andyObject->directionKeyMask = _res->_dem.directionKeyMask[_res->_demOffset];
 		++_res->_demOffset;
@@ -2532,7 +2699,12 @@ void Game::levelMainLoop() {
 		_andyObject->directionKeyMask = _directionKeyMask;
 		_andyObject->actionKeyMask = _actionKeyMask;
 	}
-	_video->clearBackBuffer();
+	if (_saveStates) {
+		recordStateInputs();
+	}
+	if (_presentFrame) {
+		_video->clearBackBuffer();
+	}
 	if (_andyObject->screenNum != _res->_currentScreenResourceNum) {
 		preloadLevelScreenData(_andyObject->screenNum, _res->_currentScreenResourceNum);
 		setupScreen(_andyObject->screenNum);
@@ -2570,6 +2742,33 @@ void Game::levelMainLoop() {
 			updatePlasmaCannonExplosionLvlObject(_plasmaExplosionObject->nextPtr);
 		}
 	}
+	if (_presentFrame) {
+		drawLevelFrame();
+	} else {
+		// the animations of the PC backgrounds are decoded to the background layer, the other sprites are redrawn each frame
+		if (!_res->_isPsx) {
+			drawBackgroundSprites();
+		}
+		if (_shakeScreenDuration != 0 || _levelRestartCounter != 0 || _video->_displayShadowLayer) {
+			shakeScreen();
+		}
+	}
+	_rnd.update();
+	if (_displayRate == 0) {
+		g_system->processEvents();
+	}
+	if (g_system->inp.keyPressed(SYS_INP_ESC) || g_system->inp.exit) { // display exit confirmation screen
+		if (displayHintScreen(-1, 0)) {
+			g_system->inp.quit = true;
+		}
+	} else if (_presentFrame) {
+		// displayHintScreen(1, 0);
+		_video->updateScreen();
+	}
+}
+
+void Game::drawLevelFrame() {
+	_displayShakeDx = _displayShakeDy = 0;
 	if (_video->_paletteChanged) {
 		_video->_paletteChanged = false;
 		_video->updateGamePalette(_video->_displayPaletteBuffer);
@@ -2585,20 +2784,54 @@ void Game::levelMainLoop() {
 		snprintf(buffer, sizeof(buffer), "P%d S%02d %d R%d", _currentLevel, _andyObject->screenNum, _res->_screensState[_andyObject->screenNum].s0, _level->_checkpoint);
 		_video->drawString(buffer, (Video::W - strlen(buffer) * 8) / 2, 8, _video->findWhiteColor(), _video->_frontLayer);
 	}
+	if (g_audioStats._enabled) {
+		g_audioStats.update(g_system->getTimeStamp());
+		const char *buffer = g_audioStats._summary;
+		_video->drawString(buffer, (Video::W - strlen(buffer) * 8) / 2, Video::H - 24, _video->findWhiteColor(), _video->_frontLayer);
+	}
+	if (g_memoryStats._enabled) {
+		g_memoryStats.updateSummary();
+		for (int i = 0; i < MemoryStats::kSummaryLines; ++i) {
+			const char *buffer = g_memoryStats._summary[i];
+			_video->drawString(buffer, (Video::W - strlen(buffer) * 8) / 2, Video::H - 64 + i * 10, _video->findWhiteColor(), _video->_frontLayer);
+		}
+	}
 	if (_shakeScreenDuration != 0 || _levelRestartCounter != 0 || _video->_displayShadowLayer) {
 		shakeScreen();
 		_video->updateGameDisplay(_video->_displayShadowLayer ? _video->_shadowLayer : _video->_frontLayer);
 	} else {
 		_video->updateGameDisplay(_video->_frontLayer);
 	}
-	_rnd.update();
-	g_system->processEvents();
-	if (g_system->inp.keyPressed(SYS_INP_ESC) || g_system->inp.exit) { // display exit confirmation screen
-		if (displayHintScreen(-1, 0)) {
-			g_system->inp.quit = true;
+}
+
+// updates the screen at the display rate until the next game frame, the game timing is unchanged
+void Game::presentInterpolatedFrames(uint32_t frameTimeStamp, int duration) {
+	const uint32_t endTimeStamp = g_system->getTimeStamp() + duration;
+	const int interval = MAX(1, 1000 / _displayRate);
+	// the palette fade is linear, the current palette is displayed on the next frame
+	const bool fadePalette = _video->_paletteChanged && _levelRestartCounter != 0;
+	while (true) {
+		const int remaining = endTimeStamp - g_system->getTimeStamp();
+		if (remaining <= 0) {
+			break;
 		}
-	} else {
-		// displayHintScreen(1, 0);
+		g_system->sleep(MIN(interval, remaining));
+		const uint32_t timeStamp = g_system->getTimeStamp();
+		if ((int)(endTimeStamp - timeStamp) <= 0) {
+			break;
+		}
+		// position between the last frame and the next one, 0 to 256
+		const int t = MIN<int>(256, (timeStamp - frameTimeStamp) * 256 / _frameMs);
+		if (fadePalette) {
+			uint8_t palette[256 * 3];
+			for (int i = 0; i < 256 * 3; ++i) {
+				const int color = _video->_palette[i];
+				palette[i] = color + ((_video->_displayPaletteBuffer[i] >> 8) - color) * t / 256;
+			}
+			g_system->setPalette(palette, 256, 8);
+		}
+		// the screen shake offsets are random, they are eased back to the center
+		g_system->shakeScreen(_displayShakeDx * (256 - t) / 256, _displayShakeDy * (256 - t) / 256);
 		_video->updateScreen();
 	}
 }
@@ -3371,6 +3604,7 @@ int Game::lvlObjectType7Callback(LvlObject *ptr) {
 			removeLvlObjectFromList(&_lvlObjectsList2, ptr);
 		}
 		destroyLvlObject(ptr);
+		return 0;
 	} else {
 		--dat->counter;
 		updateAndyObject(ptr);
@@ -3800,6 +4034,7 @@ int Game::lvlObjectSpecialPowersCallback(LvlObject *o) {
 			removeLvlObjectFromList(&_lvlObjectsList2, o);
 		}
 		destroyLvlObject(o);
+		return 0;
 	} else {
 		--dat->counter;
 		updateAndyObject(o);
@@ -3937,11 +4172,12 @@ int Game::setLvlObjectPosInScreenGrid(LvlObject *o, int pos) {
 }
 
 LvlObject *Game::declareLvlObject(uint8_t type, uint8_t num) {
-	if ((type != 8 || _res->_resLevelData0x2988PtrTable[num] != 0) && _declaredLvlObjectsListCount < kMaxLvlObjects) {
-		assert(_declaredLvlObjectsNextPtr);
-		LvlObject *ptr = _declaredLvlObjectsNextPtr;
-		_declaredLvlObjectsNextPtr = _declaredLvlObjectsNextPtr->nextPtr;
-		++_declaredLvlObjectsListCount;
+	LvlObject *ptr;
+	if ((type != 8 || _res->_resLevelData0x2988PtrTable[num] != 0) && (ptr = _declaredLvlObjectsPool.acquire()) != 0) {
+		if (kPoolPoisonReleased) {
+			// the fields not set here are kept from the previous object, start from the level state
+			memset(ptr, 0, sizeof(LvlObject));
+		}
 		ptr->spriteNum = num;
 		ptr->type = type;
 		if (type == 8) {
@@ -3959,12 +4195,7 @@ LvlObject *Game::declareLvlObject(uint8_t type, uint8_t num) {
 
 void Game::clearDeclaredLvlObjectsList() {
 	memset(_declaredLvlObjectsList, 0, sizeof(_declaredLvlObjectsList));
-	for (int i = 0; i < kMaxLvlObjects - 1; ++i) {
-		_declaredLvlObjectsList[i].nextPtr = &_declaredLvlObjectsList[i + 1];
-	}
-	_declaredLvlObjectsList[kMaxLvlObjects - 1].nextPtr = 0;
-	_declaredLvlObjectsNextPtr = &_declaredLvlObjectsList[0];
-	_declaredLvlObjectsListCount = 0;
+	_declaredLvlObjectsPool.reset();
 }
 
 void Game::initLvlObjects() {
@@ -4499,7 +4730,7 @@ void Game::updateWormHoleSprites() {
 			int xOffset = 0;
 			for (int j = 0; j < 11; ++j) {
 				uint8_t _al = (*flags >> (j * 2)) & 3;
-				if (_al != 0 && _spritesNextPtr) {
+				if (_al != 0 && _spritesPool.peek()) {
 					const int xPos = spr->xPos + xOffset + 12;
 					const int yPos = spr->yPos + yOffset + 16;
 					if (rect_contains(spr->rect1_x1, spr->rect1_y1, spr->rect1_x2, spr->rect1_y2, xPos, yPos)) {
@@ -4514,7 +4745,7 @@ void Game::updateWormHoleSprites() {
 						tmp.yPos -= 16;
 					}
 					if (tmp.bitmapBits) {
-						Sprite *spr = _spritesNextPtr;
+						Sprite *spr = _spritesPool.peek();
 						spr->xPos = tmp.xPos;
 						spr->yPos = tmp.yPos;
 						spr->w = tmp.width;
@@ -4604,12 +4835,14 @@ void Game::captureScreenshot() {
 			}
 			_fs.closeFile(fp);
 		}
+		const int num = _res->_currentScreenResourceNum;
+		const uint8_t *maskData = _res->getLvlScreenMask(num * 4 + _res->_resLvlScreenBackgroundDataTable[num].currentMaskId);
 		snprintf(name, sizeof(name), "screenshot-%03d-mask.txt", screenshot);
-		fp = _fs.openSaveFile(name, true);
+		fp = maskData ? _fs.openSaveFile(name, true) : 0;
 		if (fp) {
 			for (int y = 0; y < 24; ++y) {
 				for (int x = 0; x < 32; ++x) {
-					fprintf(fp, "%02x ", _screenTempMaskBuffer[y * 32 + x]);
+					fprintf(fp, "%02x ", maskData[y * 32 + x]);
 				}
 				fputc('\n', fp);
 			}
@@ -11,8 +11,10 @@
 #include "fileio.h"
 #include "fs.h"
 #include "mixer.h"
+#include "pool.h"
 #include "random.h"
 #include "resource.h"
+#include "savestate.h"
 
 struct Game;
 struct Level;
@@ -55,12 +57,16 @@ struct Game {
 		kMaxAndyShoots = 8,
 		kMaxShootLvlObjectData = 32,
 		kMaxSssObjects = 32,
+		kSssObjectsMaskSize = (kMaxSssObjects + 31) / 32, // slots are tracked with arrays of 32 bits masks
+		kSssObjectsHashSize = 64,
 		kMaxMonsterObjects1 = 32,
 		kMaxMonsterObjects2 = 64,
 		kMaxBackgroundAnims = 64,
 		kMaxSprites = 128,
 		kMaxLvlObjects = 160,
-		kMaxBoundingBoxes = 64,
+		kMaxBoundingBoxes = 64, // indexes fit in the _mstBoundingBoxesGrid masks
+		kBoundingBoxesGridShift = 6, // 64x64 cells
+		kBoundingBoxesGridSize = 16, // the level coordinates wrap around the grid
 
 		kDefaultSoundPanning = 64,
 		kDefaultSoundVolume = 128
@@ -93,6 +99,11 @@ struct Game {
 	Video *_video;
 	uint32_t _cheats;
 	int _frameMs;
+	int _turboTicks; // logic ticks per presented frame
+	int _turboTick;
+	bool _presentFrame; // false for the intermediate turbo ticks
+	int _displayRate; // screen updates per second between the game frames, 0 for one per frame
+	int _displayShakeDx, _displayShakeDy;
 	int _difficulty;
 
 	SetupConfig _setupConfig;
@@ -109,7 +120,7 @@ struct Game {
 	int _currentLevelCheckpoint;
 	bool _endLevel;
 	Sprite _spritesTable[kMaxSprites];
-	Sprite *_spritesNextPtr; // pointer to the next free entry
+	Pool<Sprite, kMaxSprites> _spritesPool; // reset on each frame
 	Sprite *_typeSpritesList[kMaxSpriteTypes];
 	uint8_t _directionKeyMask;
 	uint8_t _actionKeyMask;
@@ -119,14 +130,14 @@ struct Game {
 	int8_t _levelRestartCounter;
 	bool _fadePalette;
 	bool _hideAndyObjectFlag;
+	uint8_t _prevAndyFlags0; // setAndyAnimationForArea
 	ShootLvlObjectData _shootLvlObjectDataTable[kMaxShootLvlObjectData];
-	ShootLvlObjectData *_shootLvlObjectDataNextPtr; // pointer to the next free entry
+	Pool<ShootLvlObjectData, kMaxShootLvlObjectData> _shootLvlObjectDataPool;
 	LvlObject *_lvlObjectsList0;
 	LvlObject *_lvlObjectsList1;
 	LvlObject *_lvlObjectsList2;
 	LvlObject *_lvlObjectsList3;
 	uint8_t _screenPosTable[5][24 * 32];
-	uint8_t _screenTempMaskBuffer[24 * 32];
 	uint8_t _screenMaskBuffer[(16 * 6) * 24 * 32]; // level screens mask : 16 horizontal screens x 6 vertical screens
 	int _mstAndyCurrentScreenNum;
 	uint8_t _shakeScreenDuration;
@@ -176,9 +187,10 @@ struct Game {
 	int _mstOp54Counter;
 	int _mstOp56Counter;
 	bool _mstDisabled;
+	bool _mstThreadedCode; // false to run the .mst code through the checked switch
+	bool _mstWalkPathCache; // false to recompute all the walk paths routes when a gate changes
 	LvlObject _declaredLvlObjectsList[kMaxLvlObjects];
-	LvlObject *_declaredLvlObjectsNextPtr; // pointer to the next free entry
-	int _declaredLvlObjectsListCount;
+	Pool<LvlObject, kMaxLvlObjects> _declaredLvlObjectsPool;
 	AndyLvlObjectData _andyObjectScreenData;
 	AnimBackgroundData _animBackgroundDataTable[kMaxBackgroundAnims];
 	int _animBackgroundDataCount;
@@ -186,6 +198,7 @@ struct Game {
 	int _executeMstLogicCounter;
 	int _executeMstLogicPrevCounter;
 	Task _tasksTable[kMaxTasks];
+	Pool<Task, kMaxTasks> _tasksPool; // the free entries have a null codeData
 	Task *_tasksList;
 	Task *_monsterObjects1TasksList;
 	Task *_monsterObjects2TasksList;
@@ -215,12 +228,13 @@ struct Game {
 	int _mstCurrentPosX, _mstCurrentPosY;
 	int _mstBoundingBoxesCount;
 	MstBoundingBox _mstBoundingBoxesTable[kMaxBoundingBoxes];
+	uint64_t _mstBoundingBoxesGrid[kBoundingBoxesGridSize * kBoundingBoxesGridSize]; // the boxes in use below _mstBoundingBoxesCount overlapping each cell
 	Task *_mstCurrentTask;
 	MstCollision _mstCollisionTable[2][kMaxMonsterObjects1]; // 0:facingRight, 1:facingLeft
 	int _wormHoleSpritesCount;
 	WormHoleSprite _wormHoleSpritesTable[6];
 
-	Game(const char *dataPath, const char *savePath, uint32_t cheats);
+	Game(const char *dataPath, const char *savePath, uint32_t cheats, int scanDepth);
 	~Game();
 
 	// 32*24 pitch=512
@@ -240,6 +254,7 @@ struct Game {
 	// game.cpp
 	void mainLoop(int level, int checkpoint, bool levelChanged);
 	void mixAudio(int16_t *buf, int len);
+	void renderAudioFrame();
 	void resetShootLvlObjectDataTable();
 	void clearShootLvlObjectData(LvlObject *ptr);
 	void addShootLvlObject(LvlObject *_edx, LvlObject *ptr);
@@ -269,9 +284,11 @@ struct Game {
 	void destroyLvlObjectPlasmaExplosion(LvlObject *o);
 	void shuffleArray(uint8_t *p, int count);
 	void destroyLvlObject(LvlObject *o);
+	bool isDestroyedLvlObject(const LvlObject *o) const;
 	void setupPlasmaCannonPoints(LvlObject *ptr);
 	int testPlasmaCannonPointsDirection(int x1, int y1, int x2, int y2);
 	void preloadLevelScreenData(uint8_t num, uint8_t prev);
+	void prefetchLevelScreenData(uint8_t num, uint8_t prev);
 	void setLvlObjectPosRelativeToObject(LvlObject *ptr1, int num1, LvlObject *ptr2, int num2);
 	void setLvlObjectPosRelativeToPoint(LvlObject *ptr, int num, int x, int y);
 	void clearLvlObjectsList0();
@@ -305,6 +322,7 @@ struct Game {
 	int updateAndyLvlObject();
 	void drawPlasmaCannon();
 	void updateBackgroundPsx(int num);
+	void drawBackgroundSprites();
 	void drawScreen();
 	void updateLvlObjectList(LvlObject **list);
 	void updateLvlObjectLists();
@@ -318,6 +336,9 @@ struct Game {
 	void updateAndyMonsterObjects();
 	void updateInput();
 	void levelMainLoop();
+	void drawLevelFrame();
+	void presentInterpolatedFrames(uint32_t frameTimeStamp, int duration);
+	void dumpPoolsStats();
 	Level *createLevel();
 	void callLevel_postScreenUpdate(int num);
 	void callLevel_preScreenUpdate(int num);
@@ -396,6 +417,8 @@ struct Game {
 	int mstTaskSetNextWalkCode(Task *t);
 
 	void mstBoundingBoxClear(MonsterObject1 *m, int dir);
+	uint64_t mstBoundingBoxGridQuery(int x1, int y1, int x2, int y2) const;
+	void mstBoundingBoxGridUpdate(int num, bool add);
 	int mstBoundingBoxCollides1(int num, int x1, int y1, int x2, int y2) const;
 	int mstBoundingBoxUpdate(int num, int monster1Index, int x1, int y1, int x2, int y2);
 	int mstBoundingBoxCollides2(int monster1Index, int x1, int y1, int x2, int y2) const;
@@ -409,8 +432,10 @@ struct Game {
 	void resetMstCode();
 	void startMstCode();
 	void executeMstCode();
-	void mstWalkPathUpdateIndex(MstWalkPath *walkPath, int index);
+	uint32_t mstWalkPathUpdateIndex(MstWalkPath *walkPath, uint32_t i, int index);
 	int mstWalkPathUpdateWalkNode(MstWalkPath *walkPath, MstWalkNode *walkNode, int num, int index);
+	void mstWalkPathUpdateCoords(MstWalkPath *walkPath);
+	void mstWalkPathUpdateRoutes(MstWalkPath *walkPath, MstWalkPathRoutes *routes);
 	void executeMstCodeHelper1();
 	void mstUpdateMonster1ObjectsPosition();
 	void mstLvlObjectSetActionDirection(LvlObject *o, const uint8_t *ptr, uint8_t mask1, uint8_t mask2);
@@ -462,6 +487,7 @@ struct Game {
 
 	// Task list
 	Task *findFreeTask();
+	void freeTask(Task *t);
 	Task *createTask(const uint8_t *codeData);
 	void updateTask(Task *t, int num, const uint8_t *codeData);
 	void resetTask(Task *t, const uint8_t *codeData);
@@ -476,6 +502,8 @@ struct Game {
 	int getTaskFlag(Task *t, int index, int type) const;
 
 	// Task.run functions
+	void mstProfilerStartLevel();
+	void mstRunTask(Task *t);
 	int mstTask_main(Task *t);
 	int mstTask_wait1(Task *t);
 	int mstTask_wait2(Task *t);
@@ -510,8 +538,14 @@ struct Game {
 	SssObject *_sssObjectsList1; // playing
 	SssObject *_sssObjectsList2; // paused/idle
 	SssObject *_lowPrioritySssObject;
+	uint32_t _sssObjectsUsedMask[kSssObjectsMaskSize]; // slots linked to list1 or list2
+	uint32_t _sssObjectsByFlags0[kSssObjectsHashSize][kSssObjectsMaskSize]; // slots masks hashed by source and bank
+	uint32_t _sssObjectsByFlags1[kSssObjectsHashSize][kSssObjectsMaskSize];
+	SssObject *_sssObjectsPriorityHeap[kMaxSssObjects]; // list1 objects, lowest priority first
+	int _sssObjectsPriorityHeapSize;
+	uint32_t _sssObjectsPriorityOrder;
 	bool _sssUpdatedObjectsTable[kMaxSssObjects];
-	int _playingSssObjectsMax;
+	int _playingSssObjectsMax; // 0 for no limit, at most kMaxSssObjects
 	int _playingSssObjectsCount;
 
 	void muteSound();
@@ -520,13 +554,20 @@ struct Game {
 	int getSoundPosition(const SssObject *so);
 	void setSoundPanning(SssObject *so, int panning);
 	SssObject *findLowPrioritySoundObject() const;
+	void linkSoundObject(SssObject *so);
+	void unlinkSoundObject(SssObject *so);
+	void updateSoundObjectPriorityHeap(int index);
+	void addSoundObjectToPriorityHeap(SssObject *so, uint32_t order);
+	void removeSoundObjectFromPriorityHeap(SssObject *so);
+	void updateSoundObjectPriority(SssObject *so, int priority);
+	bool hasSoundObjectInGroup(uint32_t flags) const;
 	void removeSoundObjectFromList(SssObject *so);
 	void updateSoundObject(SssObject *so);
 	void sssOp4_removeSounds(uint32_t flags);
 	void sssOp12_removeSounds2(int num, uint8_t source, uint8_t sampleIndex);
 	void sssOp16_resumeSound(SssObject *so);
 	void sssOp17_pauseSound(SssObject *so);
-	const uint8_t *executeSssCode(SssObject *so, const uint8_t *code, bool tempSssObject = false);
+	const SssOpcode *executeSssCode(SssObject *so, const SssOpcode *code, bool tempSssObject = false);
 	SssObject *addSoundObject(SssPcm *pcm, int priority, uint32_t flags_a, uint32_t flags_b);
 	void prependSoundObjectToList(SssObject *so);
 	void updateSssGroup2(uint32_t flags);
@@ -565,6 +606,33 @@ struct Game {
 	void setupAndyObjectMoveData(LvlObject *ptr);
 	void setupAndyObjectMoveState();
 	void updateAndyObject(LvlObject *ptr);
+
+	// savestate.cpp
+	bool _saveStates; // F5 saves the state in memory and writes the inputs since the level start, F9 restores the state
+	bool _checkpointStates; // the level restarts restore the state saved on the first restart from the checkpoint
+	const char *_replayFileName; // inputs replayed on the next level start
+	bool _stateReplay;
+	bool _stateReplaySkipCutscenes;
+	int _levelSerial;
+	GameState _gameState;
+	GameState _checkpointState;
+	Dem _stateInputs;
+	uint32_t _stateInputsCapacity;
+
+	void startStateInputs(uint32_t randSeed, int randRounds);
+	void recordStateInputs();
+	void computeStateHashes(uint32_t *hashes) const;
+	uint32_t computeStateChecksum() const;
+	void updateStateTrace();
+	bool saveGameState(GameState *state);
+	bool loadGameState(GameState *state);
+	void freeGameState(GameState *state);
+	void saveCheckpointState();
+	bool restoreCheckpointState();
+	bool writeReplayFile(const char *name);
+	bool readReplayFile(const char *name);
+	void finishStateReplay();
+	void updateSaveStates();
 };
 
 #endif // GAME_H__
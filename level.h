@@ -9,7 +9,17 @@ struct Resource;
 struct PafPlayer;
 struct Video;
 
+// level specific data modified by the scripts, copied by the save states
+struct LevelStateData {
+	void *ptr;
+	uint32_t size;
+};
+
 struct Level {
+	enum {
+		kMaxStateData = 4
+	};
+
 	virtual ~Level() {
 	}
 
@@ -29,6 +39,7 @@ struct Level {
 	virtual void preScreenUpdate(int screenNum) = 0;
 	virtual void postScreenUpdate(int screenNum) = 0;
 	virtual void setupScreenCheckpoint(int screenNum) {}
+	virtual int getStateData(LevelStateData *data) { return 0; }
 
 	Game *_g;
 	LvlObject *_andyObject;
@@ -29,6 +29,24 @@ static const uint8_t _rock_screenStartData[56] = {
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+// shadow screen2, the last bytes are updated by objectUpdate_rockShadow
+static uint8_t _rock_shadowScreen2Data[68] = {
+	0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+	0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+	0x0C, 0x07, 0x00, 0x00
+};
+
+// shadow screen3
+static uint8_t _rock_shadowScreen3Data[68] = {
+	0x00, 0x00, 0x00, 0x00, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+	0x06, 0x06, 0x06, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x04, 0x04, 0x04, 0x04, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x04, 0x04, 0x04, 0x04, 0x04,
+	0x06, 0x0B, 0x00, 0x00
+};
+
 struct Level_rock: Level {
 	virtual const CheckpointData *getCheckpointData(int num) const { return &_rock_checkpointData[num]; }
 	virtual const uint8_t *getScreenRestartData() const { return _rock_screenStartData; }
@@ -38,6 +56,7 @@ struct Level_rock: Level {
 	virtual void preScreenUpdate(int screenNum);
 	virtual void postScreenUpdate(int screenNum);
 	virtual void setupScreenCheckpoint(int screenNum);
+	virtual int getStateData(LevelStateData *data);
 
 	void postScreenUpdate_rock_screen0();
 	void postScreenUpdate_rock_screen4();
@@ -502,15 +521,8 @@ bool Game::plasmaCannonHit(LvlObject *ptr) {
 
 // shadow screen2
 int Game::objectUpdate_rock_case1(LvlObject *o) {
-	static uint8_t data[68] = {
-		0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
-		0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
-		0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
-		0x0C, 0x07, 0x00, 0x00
-	};
 	if (_level->_screenCounterTable[2] == 0) {
-		objectUpdate_rockShadow(o, data);
+		objectUpdate_rockShadow(o, _rock_shadowScreen2Data);
 		if ((o->flags0 & 0x3FF) == 0x4B) {
 			_level->_screenCounterTable[2] = 1;
 		}
@@ -521,15 +533,8 @@ int Game::objectUpdate_rock_case1(LvlObject *o) {
 
 // shadow screen3
 int Game::objectUpdate_rock_case2(LvlObject *o) {
-	static uint8_t data[68] = {
-		0x00, 0x00, 0x00, 0x00, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-		0x06, 0x06, 0x06, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x04, 0x04, 0x04, 0x04, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
-		0x80, 0x80, 0x80, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x04, 0x04, 0x04, 0x04, 0x04,
-		0x06, 0x0B, 0x00, 0x00
-	};
 	if (_level->_screenCounterTable[3] == 0) {
-		objectUpdate_rockShadow(o, data);
+		objectUpdate_rockShadow(o, _rock_shadowScreen3Data);
 		if ((o->flags0 & 0x3FF) == 0x4B) {
 			_level->_screenCounterTable[3] = 1;
 		}
@@ -923,3 +928,11 @@ void Level_rock::setupScreenCheckpoint(int num) {
 		break;
 	}
 }
+
+int Level_rock::getStateData(LevelStateData *data) {
+	data[0].ptr = _rock_shadowScreen2Data;
+	data[0].size = sizeof(_rock_shadowScreen2Data);
+	data[1].ptr = _rock_shadowScreen3Data;
+	data[1].size = sizeof(_rock_shadowScreen3Data);
+	return 2;
+}
@@ -31,6 +31,7 @@ struct Level_lava: Level {
 	virtual void preScreenUpdate(int screenNum);
 	virtual void postScreenUpdate(int screenNum);
 	virtual void setupScreenCheckpoint(int screenNum);
+	virtual int getStateData(LevelStateData *data);
 
 	void postScreenUpdate_lava_screen0();
 	void postScreenUpdate_lava_screen1();
@@ -145,11 +146,8 @@ void Level_lava::postScreenUpdate_lava_screen2_updateMask(int x, int y, int h, i
 
 void Level_lava::postScreenUpdate_lava_screen2_addLvlObjects(const uint8_t *p) {
 	do {
-		LvlObject *ptr = 0;
-		if (_g->_declaredLvlObjectsListCount < Game::kMaxLvlObjects) {
-			ptr = _g->_declaredLvlObjectsNextPtr;
-			_g->_declaredLvlObjectsNextPtr = _g->_declaredLvlObjectsNextPtr->nextPtr;
-			++_g->_declaredLvlObjectsListCount;
+		LvlObject *ptr = _g->_declaredLvlObjectsPool.acquire();
+		if (ptr) {
 			ptr->spriteNum = 22;
 			ptr->type = 8;
 			_res->incLvlSpriteDataRefCounter(ptr);
@@ -618,3 +616,11 @@ void Level_lava::setupScreenCheckpoint(int num) {
 		break;
 	}
 }
+
+int Level_lava::getStateData(LevelStateData *data) {
+	data[0].ptr = &_screen1Counter;
+	data[0].size = sizeof(_screen1Counter);
+	data[1].ptr = &_screen2Counter;
+	data[1].size = sizeof(_screen2Counter);
+	return 2;
+}
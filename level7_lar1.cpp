@@ -35,6 +35,7 @@ struct Level_lar1: Level {
 	virtual void preScreenUpdate(int screenNum);
 	virtual void postScreenUpdate(int screenNum);
 	virtual void setupScreenCheckpoint(int screenNum);
+	virtual int getStateData(LevelStateData *data);
 
 	void postScreenUpdate_lar1_screen0();
 	void postScreenUpdate_lar1_screen3();
@@ -916,3 +917,13 @@ void Level_lar1::setupScreenCheckpoint(int num) {
 		break;
 	}
 }
+
+int Level_lar1::getStateData(LevelStateData *data) {
+	data[0].ptr = _lar1_gatesData;
+	data[0].size = sizeof(_lar1_gatesData);
+	data[1].ptr = _lar1_switchesData;
+	data[1].size = sizeof(_lar1_switchesData);
+	data[2].ptr = Game::_lar1_maskData;
+	data[2].size = 15 * 6;
+	return 3;
+}
@@ -38,6 +38,7 @@ struct Level_lar2: Level {
 	virtual void preScreenUpdate(int screenNum);
 	virtual void postScreenUpdate(int screenNum);
 	virtual void setupScreenCheckpoint(int screenNum);
+	virtual int getStateData(LevelStateData *data);
 
 	bool postScreenUpdate_lar2_screen2_updateGateSwitches(BoundingBox *b);
 
@@ -575,3 +576,11 @@ void Level_lar2::setupScreenCheckpoint(int num) {
 		break;
 	}
 }
+
+int Level_lar2::getStateData(LevelStateData *data) {
+	data[0].ptr = _lar2_gatesData;
+	data[0].size = sizeof(_lar2_gatesData);
+	data[1].ptr = _lar2_switchesData;
+	data[1].size = sizeof(_lar2_switchesData);
+	return 2;
+}
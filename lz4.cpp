@@ -0,0 +1,150 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "lz4.h"
+
+enum {
+	kMinMatch = 4,
+	kLastLiterals = 5, // the block ends with literals
+	kMatchFindLimit = 12, // the last match starts before this
+	kMaxOffset = 65535,
+	kHashBits = 12
+};
+
+static uint8_t *writeLength(uint8_t *op, int len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+// matchLen is 0 for the last sequence
+static uint8_t *writeSequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, int literalsLen, int offset, int matchLen) {
+	if (oend - op < 1 + literalsLen / 255 + 1 + literalsLen + 2 + matchLen / 255 + 1) {
+		return 0;
+	}
+	uint8_t *token = op++;
+	if (literalsLen >= 15) {
+		*token = 15 << 4;
+		op = writeLength(op, literalsLen - 15);
+	} else {
+		*token = literalsLen << 4;
+	}
+	memcpy(op, literals, literalsLen);
+	op += literalsLen;
+	if (matchLen != 0) {
+		*op++ = offset & 255;
+		*op++ = offset >> 8;
+		matchLen -= kMinMatch;
+		if (matchLen >= 15) {
+			*token |= 15;
+			op = writeLength(op, matchLen - 15);
+		} else {
+			*token |= matchLen;
+		}
+	}
+	return op;
+}
+
+int encodeLZ4(const uint8_t *src, int srcSize, uint8_t *dst, int dstSize) {
+	int table[1 << kHashBits];
+	memset(table, 0xFF, sizeof(table));
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *iend = src + srcSize;
+	uint8_t *op = dst;
+	const uint8_t *oend = dst + dstSize;
+	if (srcSize >= kMatchFindLimit) {
+		const uint8_t *mflimit = iend - kMatchFindLimit;
+		const uint8_t *matchlimit = iend - kLastLiterals;
+		while (ip < mflimit) {
+			const uint32_t seq = READ_LE_UINT32(ip);
+			const uint32_t h = (seq * 2654435761U) >> (32 - kHashBits);
+			const int ref = table[h];
+			table[h] = ip - src;
+			if (ref < 0 || (ip - src) - ref > kMaxOffset || READ_LE_UINT32(src + ref) != seq) {
+				++ip;
+				continue;
+			}
+			const uint8_t *match = src + ref;
+			while (ip > anchor && match > src && ip[-1] == match[-1]) {
+				--ip;
+				--match;
+			}
+			int len = 0;
+			while (ip + len < matchlimit && ip[len] == match[len]) {
+				++len;
+			}
+			op = writeSequence(op, oend, anchor, ip - anchor, ip - match, len);
+			if (!op) {
+				return 0;
+			}
+			ip += len;
+			anchor = ip;
+		}
+	}
+	op = writeSequence(op, oend, anchor, iend - anchor, 0, 0);
+	return op ? op - dst : 0;
+}
+
+static bool readLength(const uint8_t *&ip, const uint8_t *iend, int *len) {
+	int b;
+	do {
+		if (ip >= iend) {
+			return false;
+		}
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+int decodeLZ4(const uint8_t *src, int srcSize, uint8_t *dst, int dstSize) {
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + srcSize;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dstSize;
+	while (ip < iend) {
+		const int token = *ip++;
+		int len = token >> 4;
+		if (len == 15 && !readLength(ip, iend, &len)) {
+			return -1;
+		}
+		if (len > iend - ip || len > oend - op) {
+			return -1;
+		}
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip >= iend) {
+			break;
+		}
+		if (iend - ip < 2) {
+			return -1;
+		}
+		const int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - dst) {
+			return -1;
+		}
+		len = token & 15;
+		if (len == 15 && !readLength(ip, iend, &len)) {
+			return -1;
+		}
+		len += kMinMatch;
+		if (len > oend - op) {
+			return -1;
+		}
+		// the match can overlap the output
+		const uint8_t *match = op - offset;
+		for (int i = 0; i < len; ++i) {
+			op[i] = match[i];
+		}
+		op += len;
+	}
+	return op - dst;
+}
@@ -0,0 +1,16 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef LZ4_H__
+#define LZ4_H__
+
+#include "intern.h"
+
+// LZ4 block format, returns 0 if the data does not fit in dst
+int encodeLZ4(const uint8_t *src, int srcSize, uint8_t *dst, int dstSize);
+// returns the decoded size or -1 if the data is corrupted
+int decodeLZ4(const uint8_t *src, int srcSize, uint8_t *dst, int dstSize);
+
+#endif // LZ4_H__
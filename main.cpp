@@ -16,6 +16,7 @@
 #include "paf.h"
 #include "util.h"
 #include "resource.h"
+#include "stats.h"
 #include "system.h"
 #include "video.h"
 
@@ -43,6 +44,15 @@ static const char *_usage =
 	"  --savepath=PATH   Path to save files (default '.')\n"
 	"  --level=NUM       Start at level NUM\n"
 	"  --checkpoint=NUM  Start at checkpoint NUM\n"
+	"  --render-audio=FILE  Replay HOD.DEM and write the sound output to FILE (.wav)\n"
+	"  --flatten-data    Write copies of the sector aligned data files without checksums to the save path\n"
+	"  --scan-depth=NUM  Search the data files NUM subdirectories deep in the data path (default unlimited)\n"
+	"  --pack-data       Write the game data files to a compressed archive in the save path\n"
+	"  --verify-data     Check the sector checksums of the game data files and exit\n"
+	"  --replay=FILE     Replay the inputs FILE (written by F5) from the save path\n"
+	"  --record-trace=FILE  Write the state hashes of each frame to FILE\n"
+	"  --compare-trace=FILE  Compare the state hashes of each frame with FILE\n"
+	"  --turbo=NUM       Run NUM game frames for each frame displayed\n"
 ;
 
 static bool _fullscreen = false;
@@ -51,6 +61,9 @@ static bool _widescreen = false;
 static const bool _runBenchmark = false;
 static bool _runMenu = true;
 static bool _displayLoadingScreen = true;
+static bool _flattenData = false;
+static bool _packData = false;
+static bool _verifyData = false;
 
 static void lockAudio(int flag) {
 	if (flag) {
@@ -102,18 +115,47 @@ static void handleConfigIni(Game *g, const char *section, const char *name, cons
 			}
 		} else if (strcmp(name, "disable_mst") == 0) {
 			g->_mstDisabled = configBool(value);
+		} else if (strcmp(name, "mst_threaded_code") == 0) {
+			g->_mstThreadedCode = configBool(value);
+		} else if (strcmp(name, "mst_walk_path_cache") == 0) {
+			g->_mstWalkPathCache = configBool(value);
+		} else if (strcmp(name, "mst_profiler") == 0) {
+			g_mstProfiler._enabled = configBool(value);
 		} else if (strcmp(name, "disable_sss") == 0) {
 			g->_sssDisabled = configBool(value);
 		} else if (strcmp(name, "disable_menu") == 0) {
 			_runMenu = !configBool(value);
 		} else if (strcmp(name, "max_active_sounds") == 0) {
-			g->_playingSssObjectsMax = atoi(value);
+			// the objects table has kMaxSssObjects slots
+			g->_playingSssObjectsMax = CLIP(atoi(value), 0, (int)Game::kMaxSssObjects);
 		} else if (strcmp(name, "difficulty") == 0) {
 			g->_difficulty = atoi(value);
 		} else if (strcmp(name, "frame_duration") == 0) {
 			g->_frameMs = g->_paf->_frameMs = atoi(value);
 		} else if (strcmp(name, "loading_screen") == 0) {
 			_displayLoadingScreen = configBool(value);
+		} else if (strcmp(name, "preload_backgrounds") == 0) {
+			g->_res->_preloadLvlBackgroundData = configBool(value);
+		} else if (strcmp(name, "max_resident_screens") == 0) {
+			g->_res->_lvlScreensResidentMax = atoi(value);
+		} else if (strcmp(name, "flatten_data") == 0) {
+			_flattenData = configBool(value);
+		} else if (strcmp(name, "pack_data") == 0) {
+			_packData = configBool(value);
+		} else if (strcmp(name, "audio_stats") == 0) {
+			g_audioStats._enabled = configBool(value);
+		} else if (strcmp(name, "audio_stats_csv") == 0) {
+			g_audioStats.openCsv(value);
+		} else if (strcmp(name, "audio_stats_interval") == 0) {
+			g_audioStats._intervalMs = MAX(100, atoi(value));
+		} else if (strcmp(name, "memory_stats") == 0) {
+			g_memoryStats._enabled = configBool(value);
+		} else if (strcmp(name, "save_states") == 0) {
+			g->_saveStates = configBool(value);
+		} else if (strcmp(name, "checkpoint_states") == 0) {
+			g->_checkpointStates = configBool(value);
+		} else if (strcmp(name, "turbo_ticks") == 0) {
+			g->_turboTicks = MAX(1, atoi(value));
 		}
 	} else if (strcmp(section, "display") == 0) {
 		if (strcmp(name, "scale_factor") == 0) {
@@ -127,6 +169,8 @@ static void handleConfigIni(Game *g, const char *section, const char *name, cons
 			_fullscreen = configBool(value);
 		} else if (strcmp(name, "widescreen") == 0) {
 			_widescreen = configBool(value);
+		} else if (strcmp(name, "display_rate") == 0) {
+			g->_displayRate = MAX(0, atoi(value));
 		}
 	}
 }
@@ -210,6 +254,12 @@ int main(int argc, char *argv[]) {
 
 	g_debugMask = 0; //kDebug_GAME | kDebug_RESOURCE | kDebug_SOUND | kDebug_MONSTER;
 	int cheats = 0;
+	const char *renderAudioPath = 0;
+	const char *replayPath = 0;
+	const char *traceRecordPath = 0;
+	const char *traceComparePath = 0;
+	int turboTicks = 0;
+	int scanDepth = FileSystem::kScanDepthUnlimited;
 
 #ifdef WII
 	System_earlyInit();
@@ -243,6 +293,15 @@ int main(int argc, char *argv[]) {
 				{ "checkpoint", required_argument, 0, 4 },
 				{ "debug",      required_argument, 0, 5 },
 				{ "cheats",     required_argument, 0, 6 },
+				{ "render-audio", required_argument, 0, 7 },
+				{ "flatten-data", no_argument,       0, 8 },
+				{ "scan-depth", required_argument, 0, 9 },
+				{ "pack-data",  no_argument,       0, 10 },
+				{ "verify-data", no_argument,      0, 11 },
+				{ "replay",     required_argument, 0, 12 },
+				{ "record-trace", required_argument, 0, 13 },
+				{ "compare-trace", required_argument, 0, 14 },
+				{ "turbo",      required_argument, 0, 15 },
 				{ 0, 0, 0, 0 },
 			};
 			int index;
@@ -280,22 +339,81 @@ int main(int argc, char *argv[]) {
 			case 6:
 				cheats |= atoi(optarg);
 				break;
+			case 7:
+				renderAudioPath = optarg;
+				resume = false;
+				break;
+			case 8:
+				_flattenData = true;
+				break;
+			case 9:
+				scanDepth = atoi(optarg);
+				break;
+			case 10:
+				_packData = true;
+				break;
+			case 11:
+				_verifyData = true;
+				break;
+			case 12:
+				replayPath = optarg;
+				resume = false;
+				break;
+			case 13:
+				traceRecordPath = optarg;
+				break;
+			case 14:
+				traceComparePath = optarg;
+				break;
+			case 15:
+				turboTicks = atoi(optarg);
+				break;
 			default:
 				fprintf(stdout, "%s\n", _usage);
 				return -1;
 			}
 		}
 	}
-	Game *g = new Game(dataPath ? dataPath : _defaultDataPath, savePath ? savePath : _defaultSavePath, cheats);
+	Game *g = new Game(dataPath ? dataPath : _defaultDataPath, savePath ? savePath : _defaultSavePath, cheats, scanDepth);
 	readConfigIni(_configIni, g);
+	g->_replayFileName = replayPath;
+	if (turboTicks > 0) {
+		g->_turboTicks = turboTicks;
+	}
 	if (_runBenchmark) {
 		g->benchmarkCpu();
 	}
+	if (_verifyData) {
+		const bool ret = g->_res->verifyDataFiles();
+		delete g;
+#if !defined(__vita__) && !defined(__3DS__)
+		free(dataPath);
+		free(savePath);
+#endif
+		return ret ? 0 : 1;
+	}
+	if (_flattenData) {
+		g->_res->flattenSectorFiles();
+	}
+	if (_packData) {
+		g->_res->packDataFiles();
+	}
 	// load setup.dat (PC) or setup.dax (PSX)
 	g->_res->loadSetupDat();
 	const bool isPsx = g->_res->_isPsx;
 	g_system->init(_title, Video::W, Video::H, _fullscreen, _widescreen, isPsx);
-	setupAudio(g);
+	if (renderAudioPath && g_audioRender.open(renderAudioPath)) {
+		// the game frames drive Game::mixAudio, the audio device is not started
+		g->_playDemo = true;
+		g->_paf->_skipCutscenes = true;
+	} else {
+		setupAudio(g);
+	}
+	if (traceComparePath) {
+		g_stateTrace.open(traceComparePath, true);
+	} else if (traceRecordPath) {
+		g_stateTrace.open(traceRecordPath, false);
+	}
 	if (isPsx) {
 		g->_video->initPsx();
 	}
@@ -322,7 +440,7 @@ int main(int argc, char *argv[]) {
 			if (resume) {
 				g->saveSetupCfg();
 			}
-			if (g->_res->_isDemo) {
+			if (g->_res->_isDemo || g_audioRender.isOpen()) {
 				break;
 			}
 			level = g->_currentLevel + 1;
@@ -330,6 +448,9 @@ int main(int argc, char *argv[]) {
 			levelChanged = true;
 		}
 	} while (!g_system->inp.quit && resume && !isPsx); // do not return to menu when starting from a specific level checkpoint
+	g_audioRender.close();
+	g_stateTrace.close();
+	g_audioStats.closeCsv();
 	g_system->stopAudio();
 	g_system->destroy();
 	delete g;
@@ -1,5 +1,6 @@
 
 #include "mixer.h"
+#include "stats.h"
 #include "util.h"
 
 static void nullMixerLock(int lock) {
@@ -17,6 +18,7 @@ Mixer::~Mixer() {
 void Mixer::queue(const int16_t *ptr, const int16_t *end, int panType, int panL, int panR, bool stereo) {
 	if (_mixingQueueSize >= kMixingQueueSize) {
 		warning("MixingQueue overflow %d", _mixingQueueSize);
+		++g_audioStats._mixingQueueOverflows;
 		return;
 	}
 	MixerChannel *channel = &_mixingQueue[_mixingQueueSize];
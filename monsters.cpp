@@ -6,8 +6,33 @@
 #include "game.h"
 #include "level.h"
 #include "resource.h"
+#include "stats.h"
+#include "system.h"
 #include "util.h"
 
+// run the pre-decoded .mst instructions with computed gotos, each handler jumps to the next one
+#if defined(__GNUC__)
+#define MST_THREADED_CODE
+#define MST_OPCODE_LABEL(num) op_##num:
+// the task state changes and the profiler go through the end of the loop
+#define MST_NEXT_INSTRUCTION() \
+	if (threaded && ret == 0 && (t->state & 2) == 0 && _runTaskOpcodesCount < 127 && !g_mstProfiler._enabled) { \
+		p += 4; \
+		++ins; \
+		++_runTaskOpcodesCount; \
+		goto *ins->handler; \
+	} \
+	break
+#define MST_SYNC_INSTRUCTION() \
+	if (threaded) { \
+		ins = _res->getMstInstruction(p + 4) - 1; \
+	}
+#else
+#define MST_OPCODE_LABEL(num)
+#define MST_NEXT_INSTRUCTION() break
+#define MST_SYNC_INSTRUCTION()
+#endif
+
 #ifdef __3DS__
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
@@ -171,7 +196,7 @@ bool Game::addChasingMonster(MstMonsterAction *m48, uint8_t direction) {
 		if (!t) {
 			return false;
 		}
-		while ((this->*(t->run))(t) == 0);
+		mstRunTask(t);
 	}
 	_mstActionNum = m48 - &_res->_mstMonsterActionData[0];
 	_mstChasingMonstersCount = 0;
@@ -443,10 +468,55 @@ int Game::mstTaskSetNextWalkCode(Task *t) {
 	return m->executeCounter - counter;
 }
 
+static void getBoundingBoxGridCells(int a, int b, int *first, int *last) {
+	if (a > b) {
+		SWAP(a, b);
+	}
+	*first = a >> Game::kBoundingBoxesGridShift;
+	*last = b >> Game::kBoundingBoxesGridShift;
+	if (*last - *first >= Game::kBoundingBoxesGridSize) {
+		*first = 0;
+		*last = Game::kBoundingBoxesGridSize - 1;
+	}
+}
+
+uint64_t Game::mstBoundingBoxGridQuery(int x1, int y1, int x2, int y2) const {
+	int cx1, cx2, cy1, cy2;
+	getBoundingBoxGridCells(x1, x2, &cx1, &cx2);
+	getBoundingBoxGridCells(y1, y2, &cy1, &cy2);
+	uint64_t mask = 0;
+	for (int y = cy1; y <= cy2; ++y) {
+		const uint64_t *row = &_mstBoundingBoxesGrid[(y & (kBoundingBoxesGridSize - 1)) * kBoundingBoxesGridSize];
+		for (int x = cx1; x <= cx2; ++x) {
+			mask |= row[x & (kBoundingBoxesGridSize - 1)];
+		}
+	}
+	return mask;
+}
+
+void Game::mstBoundingBoxGridUpdate(int num, bool add) {
+	const MstBoundingBox *p = &_mstBoundingBoxesTable[num];
+	int cx1, cx2, cy1, cy2;
+	getBoundingBoxGridCells(p->x1, p->x2, &cx1, &cx2);
+	getBoundingBoxGridCells(p->y1, p->y2, &cy1, &cy2);
+	const uint64_t bit = ((uint64_t)1) << num;
+	for (int y = cy1; y <= cy2; ++y) {
+		uint64_t *row = &_mstBoundingBoxesGrid[(y & (kBoundingBoxesGridSize - 1)) * kBoundingBoxesGridSize];
+		for (int x = cx1; x <= cx2; ++x) {
+			if (add) {
+				row[x & (kBoundingBoxesGridSize - 1)] |= bit;
+			} else {
+				row[x & (kBoundingBoxesGridSize - 1)] &= ~bit;
+			}
+		}
+	}
+}
+
 void Game::mstBoundingBoxClear(MonsterObject1 *m, int dir) {
 	assert(dir == 0 || dir == 1);
 	uint8_t num = m->bboxNum[dir];
 	if (num < _mstBoundingBoxesCount && _mstBoundingBoxesTable[num].monster1Index == m->monster1Index) {
+		mstBoundingBoxGridUpdate(num, false);
 		_mstBoundingBoxesTable[num].monster1Index = 0xFF;
 		int i = num;
 		for (; i < _mstBoundingBoxesCount; ++i) {
@@ -461,8 +531,13 @@ void Game::mstBoundingBoxClear(MonsterObject1 *m, int dir) {
 	m->bboxNum[dir] = 0xFF;
 }
 
+// the candidates are visited in the table order, the first match is the one of a linear scan
 int Game::mstBoundingBoxCollides1(int num, int x1, int y1, int x2, int y2) const {
-	for (int i = 0; i < _mstBoundingBoxesCount; ++i) {
+	uint64_t mask = mstBoundingBoxGridQuery(x1, y1, x2, y2);
+	for (int i = 0; mask != 0; ++i, mask >>= 1) {
+		if ((mask & 1) == 0) {
+			continue;
+		}
 		const MstBoundingBox *p = &_mstBoundingBoxesTable[i];
 		if (p->monster1Index == 0xFF || num == p->monster1Index) {
 			continue;
@@ -491,20 +566,27 @@ int Game::mstBoundingBoxUpdate(int num, int monster1Index, int x1, int y1, int x
 		if (num == _mstBoundingBoxesCount) {
 			++_mstBoundingBoxesCount;
 		}
+		mstBoundingBoxGridUpdate(num, true);
 	} else if (num < _mstBoundingBoxesCount) {
 		MstBoundingBox *p = &_mstBoundingBoxesTable[num];
 		if (p->monster1Index == monster1Index) {
+			mstBoundingBoxGridUpdate(num, false);
 			p->x1 = x1;
 			p->y1 = y1;
 			p->x2 = x2;
 			p->y2 = y2;
+			mstBoundingBoxGridUpdate(num, true);
 		}
 	}
 	return num;
 }
 
 int Game::mstBoundingBoxCollides2(int monster1Index, int x1, int y1, int x2, int y2) const {
-	for (int i = 0; i < _mstBoundingBoxesCount; ++i) {
+	uint64_t mask = mstBoundingBoxGridQuery(x1, y1, x2, y2);
+	for (int i = 0; mask != 0; ++i, mask >>= 1) {
+		if ((mask & 1) == 0) {
+			continue;
+		}
 		const MstBoundingBox *p = &_mstBoundingBoxesTable[i];
 		if (p->monster1Index == 0xFF || p->monster1Index == monster1Index) {
 			continue;
@@ -840,6 +922,7 @@ void Game::resetMstCode() {
 	memset(_monsterObjects2Table, 0, sizeof(_monsterObjects2Table));
 	memset(_mstVars, 0, sizeof(_mstVars));
 	memset(_tasksTable, 0, sizeof(_tasksTable));
+	_tasksPool.reset();
 	_m43Num3 = _m43Num1 = _m43Num2 = _mstActionNum = -1;
 	_mstOp54Counter = 0; // bugfix: not reset in the original, causes uninitialized reads at the beginning of 'fort'
 	_executeMstLogicPrevCounter = _executeMstLogicCounter = 0;
@@ -847,6 +930,7 @@ void Game::resetMstCode() {
 	_specialAnimFlag = false;
 	_mstAndyRectNum = 0xFF;
 	_mstBoundingBoxesCount = 0;
+	memset(_mstBoundingBoxesGrid, 0, sizeof(_mstBoundingBoxesGrid));
 	_mstOp67_y1 = 0;
 	_mstOp67_y2 = 0;
 	_mstOp67_screenNum = -1;
@@ -910,7 +994,7 @@ void Game::startMstCode() {
 			Task *t = createTask(_res->_mstCodeData + codeData * 4);
 			if (t) {
 				_runTaskOpcodesCount = 0;
-				while ((this->*(t->run))(t) == 0);
+				mstRunTask(t);
 			}
 		}
 	}
@@ -1029,7 +1113,7 @@ void Game::executeMstCode() {
 	}
 	for (Task *t = _tasksList; t; t = t->nextPtr) {
 		_runTaskOpcodesCount = 0;
-		while ((this->*(t->run))(t) == 0);
+		mstRunTask(t);
 	}
 	for (int i = 0; i < _andyShootsCount; ++i) {
 		AndyShootData *p = &_andyShootsTable[i];
@@ -1078,81 +1162,83 @@ void Game::executeMstCode() {
 	for (Task *t = _monsterObjects1TasksList; t; t = t->nextPtr) {
 		_runTaskOpcodesCount = 0;
 		if (mstUpdateTaskMonsterObject1(t) == 0) {
-			while ((this->*(t->run))(t) == 0);
+			mstRunTask(t);
 		}
 	}
 	for (Task *t = _monsterObjects2TasksList; t; t = t->nextPtr) {
 		_runTaskOpcodesCount = 0;
 		if (mstUpdateTaskMonsterObject2(t) == 0) {
-			while ((this->*(t->run))(t) == 0);
+			mstRunTask(t);
 		}
 	}
 }
 
-void Game::mstWalkPathUpdateIndex(MstWalkPath *walkPath, int index) {
+// updates the unk60 table of walk node 'i', returns the _mstAndyVarMask bits tested by the search
+uint32_t Game::mstWalkPathUpdateIndex(MstWalkPath *walkPath, uint32_t i, int index) {
 	uint32_t _walkNodesTable[32];
 	int _walkNodesFirstIndex, _walkNodesLastIndex;
 	int32_t buffer[64];
-	for (uint32_t i = 0; i < walkPath->count; ++i) {
-		MstWalkNode *walkNode = &walkPath->data[i];
-		memset(buffer, 0xFF, sizeof(buffer));
-		memset(walkNode->unk60[index], 0, walkPath->count);
-		_walkNodesTable[0] = i;
-		_walkNodesLastIndex = 1;
-		buffer[i] = 0;
-		_walkNodesFirstIndex = 0;
-		while (_walkNodesFirstIndex != _walkNodesLastIndex) {
-			uint32_t vf = _walkNodesTable[_walkNodesFirstIndex];
-			++_walkNodesFirstIndex;
-			if (_walkNodesFirstIndex >= 32) {
-				_walkNodesFirstIndex = 0;
-			}
-			const uint32_t indexWalkBox = walkPath->data[vf].walkBox;
-			const MstWalkBox *m34 = &_res->_mstWalkBoxData[indexWalkBox];
-			for (int j = 0; j < 4; ++j) {
-				const uint32_t indexWalkNode = walkPath->data[vf].neighborWalkNode[j];
-				if (indexWalkNode == kNone) {
-					continue;
-				}
-				assert(indexWalkNode < walkPath->count);
-				uint32_t mask;
-				const uint8_t flags = m34->flags[j];
-				if (flags & 0x80) {
-					mask = _mstAndyVarMask & (1 << (flags & 0x7F));
-				} else {
-					mask = flags & (1 << index);
-				}
-				if (mask != 0) {
-					continue;
-				}
-				int delta;
-				if (j == 0 || j == 1) {
-					delta = m34->right - m34->left + buffer[vf];
-				} else {
-					delta = m34->bottom - m34->top + buffer[vf];
-				}
-				if (delta >= buffer[i]) {
-					continue;
-				}
-				if (buffer[indexWalkNode] == -1) {
-					_walkNodesTable[_walkNodesLastIndex] = indexWalkNode;
-					++_walkNodesLastIndex;
-					if (_walkNodesLastIndex >= 32) {
-						_walkNodesLastIndex = 0;
-					}
-				}
-				buffer[i] = delta;
-				uint8_t value;
-				if (vf == i) {
-					static const uint8_t directions[] = { 2, 8, 4, 1 };
-					value = directions[j];
-				} else {
-					value = walkNode->unk60[index][vf];
+	uint32_t varMask = 0;
+	MstWalkNode *walkNode = &walkPath->data[i];
+	memset(buffer, 0xFF, sizeof(buffer));
+	memset(walkNode->unk60[index], 0, walkPath->count);
+	_walkNodesTable[0] = i;
+	_walkNodesLastIndex = 1;
+	buffer[i] = 0;
+	_walkNodesFirstIndex = 0;
+	while (_walkNodesFirstIndex != _walkNodesLastIndex) {
+		uint32_t vf = _walkNodesTable[_walkNodesFirstIndex];
+		++_walkNodesFirstIndex;
+		if (_walkNodesFirstIndex >= 32) {
+			_walkNodesFirstIndex = 0;
+		}
+		const uint32_t indexWalkBox = walkPath->data[vf].walkBox;
+		const MstWalkBox *m34 = &_res->_mstWalkBoxData[indexWalkBox];
+		for (int j = 0; j < 4; ++j) {
+			const uint32_t indexWalkNode = walkPath->data[vf].neighborWalkNode[j];
+			if (indexWalkNode == kNone) {
+				continue;
+			}
+			assert(indexWalkNode < walkPath->count);
+			uint32_t mask;
+			const uint8_t flags = m34->flags[j];
+			if (flags & 0x80) {
+				varMask |= 1 << (flags & 0x7F);
+				mask = _mstAndyVarMask & (1 << (flags & 0x7F));
+			} else {
+				mask = flags & (1 << index);
+			}
+			if (mask != 0) {
+				continue;
+			}
+			int delta;
+			if (j == 0 || j == 1) {
+				delta = m34->right - m34->left + buffer[vf];
+			} else {
+				delta = m34->bottom - m34->top + buffer[vf];
+			}
+			if (delta >= buffer[i]) {
+				continue;
+			}
+			if (buffer[indexWalkNode] == -1) {
+				_walkNodesTable[_walkNodesLastIndex] = indexWalkNode;
+				++_walkNodesLastIndex;
+				if (_walkNodesLastIndex >= 32) {
+					_walkNodesLastIndex = 0;
 				}
-				walkNode->unk60[index][i] = value;
 			}
+			buffer[i] = delta;
+			uint8_t value;
+			if (vf == i) {
+				static const uint8_t directions[] = { 2, 8, 4, 1 };
+				value = directions[j];
+			} else {
+				value = walkNode->unk60[index][vf];
+			}
+			walkNode->unk60[index][i] = value;
 		}
 	}
+	return varMask;
 }
 
 int Game::mstWalkPathUpdateWalkNode(MstWalkPath *walkPath, MstWalkNode *walkNode, int num, int index) {
@@ -1190,29 +1276,104 @@ int Game::mstWalkPathUpdateWalkNode(MstWalkPath *walkPath, MstWalkNode *walkNode
 	return walkNode->coords[num][index];
 }
 
+void Game::mstWalkPathUpdateCoords(MstWalkPath *walkPath) {
+	for (uint32_t j = 0; j < walkPath->count; ++j) {
+		for (int k = 0; k < 2; ++k) {
+			walkPath->data[j].coords[0][k] = -1;
+			walkPath->data[j].coords[1][k] = -1;
+			walkPath->data[j].coords[2][k] = -1;
+			walkPath->data[j].coords[3][k] = -1;
+		}
+	}
+	for (uint32_t j = 0; j < walkPath->count; ++j) {
+		MstWalkNode *walkNode = &walkPath->data[j];
+		for (int k = 0; k < 4; ++k) {
+			mstWalkPathUpdateWalkNode(walkPath, walkNode, k, 0);
+			mstWalkPathUpdateWalkNode(walkPath, walkNode, k, 1);
+		}
+	}
+}
+
+// the tables only depend on the _mstAndyVarMask bits tested by the walk boxes, the
+// last configurations are cached and on a miss only the searches testing a toggled
+// bit are run again
+void Game::mstWalkPathUpdateRoutes(MstWalkPath *walkPath, MstWalkPathRoutes *routes) {
+	const uint32_t count = walkPath->count;
+	const uint32_t key = _mstAndyVarMask & routes->varMask;
+	if (routes->keyValid && routes->key == key) {
+		return;
+	}
+	const uint32_t coordsSize = count * sizeof(walkPath->data[0].coords);
+	const uint32_t varMaskSize = count * sizeof(uint32_t);
+	for (int i = 0; i < routes->cacheCount; ++i) {
+		if (routes->cacheKeys[i] == key) {
+			const uint8_t *p = routes->cacheData[i];
+			for (uint32_t j = 0; j < count; ++j) {
+				memcpy(walkPath->data[j].coords, p, sizeof(walkPath->data[j].coords));
+				p += sizeof(walkPath->data[j].coords);
+			}
+			for (int k = 0; k < 2; ++k) {
+				memcpy(routes->sourceVarMask[k], p, varMaskSize);
+				p += varMaskSize;
+				for (uint32_t j = 0; j < count; ++j) {
+					memcpy(walkPath->data[j].unk60[k], p, count);
+					p += count;
+				}
+			}
+			routes->key = key;
+			return;
+		}
+	}
+	mstWalkPathUpdateCoords(walkPath);
+	const uint32_t changedMask = routes->key ^ key;
+	for (int k = 0; k < 2; ++k) {
+		for (uint32_t j = 0; j < count; ++j) {
+			if (!routes->keyValid || (routes->sourceVarMask[k][j] & changedMask) != 0) {
+				routes->sourceVarMask[k][j] = mstWalkPathUpdateIndex(walkPath, j, k);
+			}
+		}
+	}
+	routes->key = key;
+	routes->keyValid = true;
+	debug(kDebug_MONSTER, "mstWalkPathUpdateRoutes walkPath %d key 0x%x", (int)(walkPath - &_res->_mstWalkPathData[0]), key);
+	int num = routes->cacheNext;
+	if (routes->cacheCount < MstWalkPathRoutes::kCacheSize) {
+		num = routes->cacheCount++;
+		routes->cacheData[num] = (uint8_t *)_res->_mstArena.allocate(coordsSize + 2 * (varMaskSize + count * count));
+	} else {
+		routes->cacheNext = (num + 1) % MstWalkPathRoutes::kCacheSize;
+	}
+	routes->cacheKeys[num] = key;
+	uint8_t *p = routes->cacheData[num];
+	for (uint32_t j = 0; j < count; ++j) {
+		memcpy(p, walkPath->data[j].coords, sizeof(walkPath->data[j].coords));
+		p += sizeof(walkPath->data[j].coords);
+	}
+	for (int k = 0; k < 2; ++k) {
+		memcpy(p, routes->sourceVarMask[k], varMaskSize);
+		p += varMaskSize;
+		for (uint32_t j = 0; j < count; ++j) {
+			memcpy(p, walkPath->data[j].unk60[k], count);
+			p += count;
+		}
+	}
+}
+
 void Game::executeMstCodeHelper1() {
 	int count = 0;
 	for (int i = 0; i < _res->_mstHdr.walkPathDataCount; ++i) {
 		MstWalkPath *walkPath = &_res->_mstWalkPathData[i];
 		if (walkPath->mask & _mstLevelGatesMask) {
 			++count;
-			for (uint32_t j = 0; j < walkPath->count; ++j) {
-				for (int k = 0; k < 2; ++k) {
-					walkPath->data[j].coords[0][k] = -1;
-					walkPath->data[j].coords[1][k] = -1;
-					walkPath->data[j].coords[2][k] = -1;
-					walkPath->data[j].coords[3][k] = -1;
-				}
+			if (_mstWalkPathCache) {
+				mstWalkPathUpdateRoutes(walkPath, &_res->_mstWalkPathRoutes[i]);
+				continue;
 			}
+			mstWalkPathUpdateCoords(walkPath);
 			for (uint32_t j = 0; j < walkPath->count; ++j) {
-				MstWalkNode *walkNode = &walkPath->data[j];
-				for (int k = 0; k < 4; ++k) {
-					mstWalkPathUpdateWalkNode(walkPath, walkNode, k, 0);
-					mstWalkPathUpdateWalkNode(walkPath, walkNode, k, 1);
-				}
+				mstWalkPathUpdateIndex(walkPath, j, 0);
+				mstWalkPathUpdateIndex(walkPath, j, 1);
 			}
-			mstWalkPathUpdateIndex(walkPath, 0);
-			mstWalkPathUpdateIndex(walkPath, 1);
 		}
 	}
 	if (count != 0) {
@@ -1949,6 +2110,19 @@ int Game::mstMonster1FindWalkPathRect(MonsterObject1 *m, MstWalkPath *walkPath,
 	int currentIndex = -1;
 	int xDist = 0;
 	int yDist = 0;
+	uint32_t count;
+	const uint32_t *indexes = _res->_mstWalkPathGrids[walkPath - &_res->_mstWalkPathData[0]].find(x, y, &count);
+	for (uint32_t i = 0; i < count; ++i) {
+		const uint32_t j = indexes[i];
+		if (m->walkNode->unk60[num][j] == 0 && m->walkNode != &walkPath->data[j]) {
+			continue;
+		}
+		const MstWalkBox *m34 = &_res->_mstWalkBoxData[walkPath->data[j].walkBox];
+		if (rect_contains(m34->left, m34->top, m34->right, m34->bottom, x, y)) {
+			return j;
+		}
+	}
+	// no walk box contains the point, look for the closest one
 	for (uint32_t i = 0; i < walkPath->count; ++i, --currentIndex) {
 		MstWalkNode *walkNode = &walkPath->data[i];
 		if (m->walkNode->unk60[num][i] == 0 && m->walkNode != walkNode) {
@@ -2341,7 +2515,7 @@ int Game::mstUpdateTaskMonsterObject1(Task *t) {
 			mstBoundingBoxClear(m, 1);
 		}
 		if (t->child) {
-			t->child->codeData = 0;
+			freeTask(t->child);
 			t->child = 0;
 		}
 		if (_mstActionNum != -1 && (m->flagsA5 & 8) != 0 && m->action) {
@@ -3046,7 +3220,7 @@ void Game::mstTaskAttack(Task *t, uint32_t codeData, uint8_t flags) {
 	Task *c = t->child;
 	if (c) {
 		t->child = 0;
-		c->codeData = 0;
+		freeTask(c);
 	}
 	if (m->flagsA5 & 8) {
 		Task *n = findFreeTask();
@@ -3163,18 +3337,25 @@ int Game::mstTaskSetActionDirection(Task *t, int num, int delay) {
 	return 1;
 }
 
+// the lowest free entry, as the original scan of _tasksTable
 Task *Game::findFreeTask() {
-	for (int i = 0; i < kMaxTasks; ++i) {
-		Task *t = &_tasksTable[i];
-		if (!t->codeData) {
+	Task *t;
+	while ((t = _tasksPool.acquireFirst()) != 0) {
+		if (!t->codeData || _tasksPool.isPoisoned(t)) {
 			memset(t, 0, sizeof(Task));
 			return t;
 		}
+		// entry reused through a stale pointer, it stays allocated until freed
 	}
 	warning("findFreeTask() no free task");
 	return 0;
 }
 
+void Game::freeTask(Task *t) {
+	t->codeData = 0;
+	_tasksPool.release(t);
+}
+
 Task *Game::createTask(const uint8_t *codeData) {
 	Task *t = findFreeTask();
 	if (t) {
@@ -3201,11 +3382,10 @@ void Game::updateTask(Task *t, int num, const uint8_t *codeData) {
 			if (current != t) {
 				if (!codeData) {
 					if (current->child) {
-						current->child->codeData = 0;
+						freeTask(current->child);
 						current->child = 0;
 					}
 					Task *prev = current->prevPtr;
-					current->codeData = 0;
 					Task *next = current->nextPtr;
 					if (next) {
 						next->prevPtr = prev;
@@ -3215,6 +3395,7 @@ void Game::updateTask(Task *t, int num, const uint8_t *codeData) {
 					} else {
 						_tasksList = next;
 					}
+					freeTask(current);
 				} else {
 					current->codeData = codeData;
 					current->run = &Game::mstTask_main;
@@ -3265,11 +3446,10 @@ void Game::resetTask(Task *t, const uint8_t *codeData) {
 void Game::removeTask(Task **tasksList, Task *t) {
 	Task *c = t->child;
 	if (c) {
-		c->codeData = 0;
+		freeTask(c);
 		t->child = 0;
 	}
 	Task *prev = t->prevPtr;
-	t->codeData = 0;
 	Task *next = t->nextPtr;
 	if (next) {
 		next->prevPtr = prev;
@@ -3279,6 +3459,7 @@ void Game::removeTask(Task **tasksList, Task *t) {
 	} else {
 		*tasksList = next;
 	}
+	freeTask(t);
 }
 
 void Game::appendTask(Task **tasksList, Task *t) {
@@ -3632,20 +3813,166 @@ int Game::getTaskFlag(Task *t, int num, int type) const {
 	return 0;
 }
 
+// the mstTask_* handlers, for the profiler
+static int (Game::*const _mstTaskHandlers[])(Task *t) = {
+	&Game::mstTask_main,
+	&Game::mstTask_wait1,
+	&Game::mstTask_wait2,
+	&Game::mstTask_wait3,
+	&Game::mstTask_idle,
+	&Game::mstTask_mstOp231,
+	&Game::mstTask_mstOp232,
+	&Game::mstTask_mstOp233,
+	&Game::mstTask_mstOp234,
+	&Game::mstTask_monsterWait1,
+	&Game::mstTask_monsterWait2,
+	&Game::mstTask_monsterWait3,
+	&Game::mstTask_monsterWait4,
+	&Game::mstTask_monsterWait5,
+	&Game::mstTask_monsterWait6,
+	&Game::mstTask_monsterWait7,
+	&Game::mstTask_monsterWait8,
+	&Game::mstTask_monsterWait9,
+	&Game::mstTask_monsterWait10,
+	&Game::mstTask_monsterWait11
+};
+
+static const char *const _mstTaskHandlerNames[] = {
+	"main",
+	"wait1",
+	"wait2",
+	"wait3",
+	"idle",
+	"mstOp231",
+	"mstOp232",
+	"mstOp233",
+	"mstOp234",
+	"monsterWait1",
+	"monsterWait2",
+	"monsterWait3",
+	"monsterWait4",
+	"monsterWait5",
+	"monsterWait6",
+	"monsterWait7",
+	"monsterWait8",
+	"monsterWait9",
+	"monsterWait10",
+	"monsterWait11"
+};
+
+static int findMstTaskHandler(int (Game::*run)(Task *t)) {
+	for (unsigned int i = 0; i < ARRAYSIZE(_mstTaskHandlers); ++i) {
+		if (_mstTaskHandlers[i] == run) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void Game::mstProfilerStartLevel() {
+	g_mstProfiler.startLevel(_currentLevel, _res->_mstHdr.codeSize, _mstTaskHandlerNames, ARRAYSIZE(_mstTaskHandlerNames));
+}
+
+// runs the task handlers until the task yields
+void Game::mstRunTask(Task *t) {
+	if (!g_mstProfiler._enabled) {
+		while ((this->*(t->run))(t) == 0);
+		return;
+	}
+	const uint8_t *codeData = t->codeData;
+	const uint32_t codeOffset = (codeData >= _res->_mstCodeData && codeData < _res->_mstCodeData + _res->_mstHdr.codeSize * 4) ? (codeData - _res->_mstCodeData) >> 2 : kNone;
+	const int opcodesCount = _runTaskOpcodesCount;
+	const uint32_t t0 = System_getTimeStampUs();
+	int ret;
+	do {
+		int (Game::*run)(Task *t) = t->run;
+		const uint32_t t1 = System_getTimeStampUs();
+		ret = (this->*run)(t);
+		g_mstProfiler.addHandler(findMstTaskHandler(run), System_getTimeStampUs() - t1);
+	} while (ret == 0);
+	g_mstProfiler.addTaskRun(codeOffset, _currentScreen, _runTaskOpcodesCount - opcodesCount, System_getTimeStampUs() - t0);
+}
+
+#ifdef MST_THREADED_CODE
+// computed gotos and label addresses are GNU extensions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
 int Game::mstTask_main(Task *t) {
 	assert(t->codeData);
 	const int taskNum = t - _tasksTable;
 	int ret = 0;
 	t->state &= ~2;
 	const uint8_t *p = t->codeData;
+	MstInstruction checkedIns;
+	const MstInstruction *ins = &checkedIns;
+#ifdef MST_THREADED_CODE
+	// indexed by opcode, the unhandled opcodes and the instructions failing validation go through the checked switch
+	static const void *const kOpcodeLabels[kMstOpcodesCount + 1] = {
+		&&op_0, &&op_1, &&op_2, &&op_3, &&op_4, &&op_fallback, &&op_fallback, &&op_fallback,
+		&&op_3, &&op_fallback, &&op_fallback, &&op_fallback, &&op_fallback, &&op_13, &&op_fallback, &&op_fallback,
+		&&op_fallback, &&op_fallback, &&op_fallback, &&op_fallback, &&op_fallback, &&op_fallback, &&op_fallback, &&op_23,
+		&&op_24, &&op_25, &&op_26, &&op_27, &&op_28, &&op_fallback, &&op_30, &&op_fallback,
+		&&op_32, &&op_33, &&op_34, &&op_35, &&op_36, &&op_fallback, &&op_fallback, &&op_39,
+		&&op_40, &&op_41, &&op_42, &&op_43, &&op_44, &&op_45, &&op_fallback, &&op_47,
+		&&op_47, &&op_47, &&op_47, &&op_47, &&op_47, &&op_47, &&op_47, &&op_47,
+		&&op_47, &&op_57, &&op_57, &&op_57, &&op_57, &&op_57, &&op_57, &&op_57,
+		&&op_57, &&op_57, &&op_57, &&op_67, &&op_67, &&op_67, &&op_67, &&op_67,
+		&&op_67, &&op_67, &&op_67, &&op_67, &&op_67, &&op_77, &&op_77, &&op_77,
+		&&op_77, &&op_77, &&op_77, &&op_77, &&op_77, &&op_77, &&op_77, &&op_87,
+		&&op_87, &&op_87, &&op_87, &&op_87, &&op_87, &&op_87, &&op_87, &&op_87,
+		&&op_87, &&op_97, &&op_97, &&op_97, &&op_97, &&op_97, &&op_97, &&op_97,
+		&&op_97, &&op_97, &&op_97, &&op_107, &&op_107, &&op_107, &&op_107, &&op_107,
+		&&op_107, &&op_107, &&op_107, &&op_107, &&op_107, &&op_117, &&op_117, &&op_117,
+		&&op_117, &&op_117, &&op_117, &&op_117, &&op_117, &&op_117, &&op_117, &&op_127,
+		&&op_127, &&op_127, &&op_127, &&op_127, &&op_127, &&op_127, &&op_127, &&op_127,
+		&&op_127, &&op_137, &&op_137, &&op_137, &&op_137, &&op_137, &&op_137, &&op_137,
+		&&op_137, &&op_137, &&op_137, &&op_147, &&op_147, &&op_147, &&op_147, &&op_147,
+		&&op_147, &&op_147, &&op_147, &&op_147, &&op_147, &&op_157, &&op_157, &&op_157,
+		&&op_157, &&op_157, &&op_157, &&op_157, &&op_157, &&op_157, &&op_157, &&op_167,
+		&&op_167, &&op_167, &&op_167, &&op_167, &&op_167, &&op_167, &&op_167, &&op_167,
+		&&op_167, &&op_177, &&op_177, &&op_177, &&op_177, &&op_177, &&op_177, &&op_177,
+		&&op_177, &&op_177, &&op_177, &&op_187, &&op_187, &&op_187, &&op_187, &&op_187,
+		&&op_187, &&op_187, &&op_187, &&op_187, &&op_187, &&op_197, &&op_198, &&op_199,
+		&&op_200, &&op_201, &&op_202, &&op_203, &&op_204, &&op_fallback, &&op_fallback, &&op_207,
+		&&op_207, &&op_207, &&op_210, &&op_211, &&op_212, &&op_213, &&op_214, &&op_215,
+		&&op_fallback, &&op_217, &&op_218, &&op_fallback, &&op_220, &&op_220, &&op_220, &&op_220,
+		&&op_220, &&op_220, &&op_226, &&op_227, &&op_228, &&op_33, &&op_fallback, &&op_231,
+		&&op_231, &&op_233, &&op_233, &&op_fallback, &&op_fallback, &&op_237, &&op_238, &&op_239,
+		&&op_240, &&op_fallback, &&op_242, &&op_fallback
+	};
+	// the instructions are not traced, run with mst_threaded_code=false for the debug output
+	bool threaded = _mstThreadedCode;
+	if (threaded && !_res->_mstInstructionsLinked) {
+		for (int i = 0; i <= _res->_mstHdr.codeSize; ++i) {
+			MstInstruction *decoded = &_res->_mstInstructions[i];
+			decoded->handler = kOpcodeLabels[decoded->valid ? decoded->op : (int)kMstOpcodesCount];
+		}
+		_res->_mstInstructionsLinked = true;
+	}
+#endif
 	do {
+		if (g_mstProfiler._enabled) {
+			g_mstProfiler.countOpcode(p[0]);
+		}
+#ifdef MST_THREADED_CODE
+		if (threaded) {
+			ins = _res->getMstInstruction(p);
+			goto *ins->handler;
+		}
+op_fallback:
+		// the rest of the run goes through the checked switch
+		threaded = false;
+#endif
 		assert(p >= _res->_mstCodeData && p < _res->_mstCodeData + _res->_mstHdr.codeSize * 4);
 		assert(((p - t->codeData) & 3) == 0);
-		const uint32_t codeOffset = p - _res->_mstCodeData;
-		debug(kDebug_MONSTER, "executeMstCode task %d %p code %d offset 0x%04x", taskNum, t, p[0], codeOffset);
+		debug(kDebug_MONSTER, "executeMstCode task %d %p code %d offset 0x%04x", taskNum, t, p[0], (uint32_t)(p - _res->_mstCodeData));
 		assert(p[0] <= 242);
-		switch (p[0]) {
-		case 0: { // 0
+		_res->decodeMstInstruction(p, &checkedIns);
+		ins = &checkedIns;
+		switch (ins->op) {
+		case 0: MST_OPCODE_LABEL(0) { // 0
 				LvlObject *o = 0;
 				if (t->monster1) {
 					if ((t->monster1->flagsA6 & 2) == 0) {
@@ -3660,12 +3987,12 @@ int Game::mstTask_main(Task *t) {
 				}
 			}
 			// fall-through
-		case 1: { // 1
-				const int num = READ_LE_UINT16(p + 2);
-				const int delay = getTaskVar(t, num, p[1]);
+		case 1: MST_OPCODE_LABEL(1) { // 1
+				const int num = ins->num;
+				const int delay = getTaskVar(t, num, ins->arg1);
 				t->arg1 = delay;
 				if (delay > 0) {
-					if (p[0] == 0) {
+					if (ins->op == 0) {
 						t->run = &Game::mstTask_wait2;
 						ret = 1;
 					} else {
@@ -3674,9 +4001,9 @@ int Game::mstTask_main(Task *t) {
 					}
 				}
 			}
-			break;
-		case 2: { // 2 - set_var_random_range
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 2: MST_OPCODE_LABEL(2) { // 2 - set_var_random_range
+				const int num = ins->num;
 				MstOp2Data *m = &_res->_mstOp2Data[num];
 				int a = getTaskVar(t, m->indexVar1, m->maskVars >> 4);
 				int b = getTaskVar(t, m->indexVar2, m->maskVars & 15);
@@ -3686,42 +4013,42 @@ int Game::mstTask_main(Task *t) {
 				a += _rnd.update() % (b - a + 1);
 				setTaskVar(t, m->unkA, m->unk9, a);
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 3:
-		case 8: // 3 - set_monster_action_direction_imm
+		case 8: MST_OPCODE_LABEL(3) // 3 - set_monster_action_direction_imm
 			if (t->monster1) {
-				const int num = READ_LE_UINT16(p + 2);
+				const int num = ins->num;
 				const int arg = _res->_mstActionDirectionData[num].unk3;
 				t->codeData = p;
 				ret = mstTaskSetActionDirection(t, num, (arg == 0xFF) ? -1 : arg);
 			}
-			break;
-		case 4: // 4 - set_monster_action_direction_task_var
+			MST_NEXT_INSTRUCTION();
+		case 4: MST_OPCODE_LABEL(4) // 4 - set_monster_action_direction_task_var
 			if (t->monster1) {
-				const int num = READ_LE_UINT16(p + 2);
+				const int num = ins->num;
 				const int arg = _res->_mstActionDirectionData[num].unk3;
 				t->codeData = p;
 				assert(arg < kMaxLocals);
 				ret = mstTaskSetActionDirection(t, num, t->localVars[arg]);
 			}
-			break;
-		case 13: // 8
+			MST_NEXT_INSTRUCTION();
+		case 13: MST_OPCODE_LABEL(13) // 8
 			if (t->monster1) {
-				const int num = READ_LE_UINT16(p + 2);
+				const int num = ins->num;
 				if (mstTestActionDirection(t->monster1, num)) {
 					const int arg = _res->_mstActionDirectionData[num].unk3;
 					t->codeData = p;
 					ret = mstTaskSetActionDirection(t, num, (arg == 0xFF) ? -1 : arg);
 				}
 			}
-			break;
-		case 23: // 13 - set_flag_global
-			_mstFlags |= (1 << p[1]);
-			break;
-		case 24: // 14 - set_flag_task
-			t->flags |= (1 << p[1]);
-			break;
-		case 25: { // 15 - set_flag_mst
+			MST_NEXT_INSTRUCTION();
+		case 23: MST_OPCODE_LABEL(23) // 13 - set_flag_global
+			_mstFlags |= (1 << ins->arg1);
+			MST_NEXT_INSTRUCTION();
+		case 24: MST_OPCODE_LABEL(24) // 14 - set_flag_task
+			t->flags |= (1 << ins->arg1);
+			MST_NEXT_INSTRUCTION();
+		case 25: MST_OPCODE_LABEL(25) { // 15 - set_flag_mst
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3729,17 +4056,17 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					m->flags48 |= (1 << p[1]);
+					m->flags48 |= (1 << ins->arg1);
 				}
 			}
-			break;
-		case 26: // 16 - clear_flag_global
-			_mstFlags &= ~(1 << p[1]);
-			break;
-		case 27: // 17 - clear_flag_task
-			t->flags &= ~(1 << p[1]);
-			break;
-		case 28: { // 18 - clear_flag_mst
+			MST_NEXT_INSTRUCTION();
+		case 26: MST_OPCODE_LABEL(26) // 16 - clear_flag_global
+			_mstFlags &= ~(1 << ins->arg1);
+			MST_NEXT_INSTRUCTION();
+		case 27: MST_OPCODE_LABEL(27) // 17 - clear_flag_task
+			t->flags &= ~(1 << ins->arg1);
+			MST_NEXT_INSTRUCTION();
+		case 28: MST_OPCODE_LABEL(28) { // 18 - clear_flag_mst
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3747,14 +4074,14 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					m->flags48 &= ~(1 << p[1]);
+					m->flags48 &= ~(1 << ins->arg1);
 				}
 			}
-			break;
-		case 30: { // 20
+			MST_NEXT_INSTRUCTION();
+		case 30: MST_OPCODE_LABEL(30) { // 20
 				t->arg1 = 3;
-				t->arg2 = p[1];
-				if (((1 << p[1]) & _mstFlags) == 0) {
+				t->arg2 = ins->arg1;
+				if (((1 << ins->arg1) & _mstFlags) == 0) {
 					LvlObject *o = 0;
 					if (t->monster1) {
 						if ((t->monster1->flagsA6 & 2) == 0) {
@@ -3771,8 +4098,8 @@ int Game::mstTask_main(Task *t) {
 					ret = 1;
 				}
 			}
-			break;
-		case 32: { // 22
+			MST_NEXT_INSTRUCTION();
+		case 32: MST_OPCODE_LABEL(32) { // 22
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3781,8 +4108,8 @@ int Game::mstTask_main(Task *t) {
 				}
 				if (m) {
 					t->arg1 = 5;
-					t->arg2 = p[1];
-					if (((1 << p[1]) & m->flags48) == 0) {
+					t->arg2 = ins->arg1;
+					if (((1 << ins->arg1) & m->flags48) == 0) {
 						LvlObject *o = 0;
 						if (t->monster1) {
 							if ((t->monster1->flagsA6 & 2) == 0) {
@@ -3800,54 +4127,53 @@ int Game::mstTask_main(Task *t) {
 					}
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 33:
-		case 229: { // 23 - jmp_imm
-				const int num = READ_LE_UINT16(p + 2);
-				p = _res->_mstCodeData + num * 4 - 4;
-			}
-			break;
-		case 34:
+		case 229: MST_OPCODE_LABEL(33) // 23 - jmp_imm
+			p = ins->target - 4;
+			MST_SYNC_INSTRUCTION();
+			MST_NEXT_INSTRUCTION();
+		case 34: MST_OPCODE_LABEL(34)
 			// no-op
-			break;
-		case 35: { // 24 - enable_trigger
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 35: MST_OPCODE_LABEL(35) { // 24 - enable_trigger
+				const int num = ins->num;
 				_res->flagMstCodeForPos(num, 1);
 			}
-			break;
-		case 36: { // 25 - disable_trigger
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 36: MST_OPCODE_LABEL(36) { // 25 - disable_trigger
+				const int num = ins->num;
 				_res->flagMstCodeForPos(num, 0);
 			}
-			break;
-		case 39: // 26 - remove_monsters_screen
-			if (p[1] < _res->_mstHdr.screensCount) {
-				mstOp26_removeMstTaskScreen(&_monsterObjects1TasksList, p[1]);
-				mstOp26_removeMstTaskScreen(&_monsterObjects2TasksList, p[1]);
-				// mstOp26_removeMstTaskScreen(&_mstTasksList3, p[1]);
-				// mstOp26_removeMstTaskScreen(&_mstTasksList4, p[1]);
-			}
-			break;
-		case 40: // 27 - remove_monsters_screen_type
-			if (p[1] < _res->_mstHdr.screensCount) {
-				mstOp27_removeMstTaskScreenType(&_monsterObjects1TasksList, p[1], p[2]);
-				mstOp27_removeMstTaskScreenType(&_monsterObjects2TasksList, p[1], p[2]);
-				// mstOp27_removeMstTaskScreenType(&_mstTasksList3, p[1], p[2]);
-				// mstOp27_removeMstTaskScreenType(&_mstTasksList4, p[1], p[2]);
-			}
-			break;
-		case 41: { // 28 - increment_task_var
-				assert(p[1] < kMaxLocals);
-				++t->localVars[p[1]];
-			}
-			break;
-		case 42: { // 29 - increment_global_var
-				const int num = p[1];
+			MST_NEXT_INSTRUCTION();
+		case 39: MST_OPCODE_LABEL(39) // 26 - remove_monsters_screen
+			if (ins->arg1 < _res->_mstHdr.screensCount) {
+				mstOp26_removeMstTaskScreen(&_monsterObjects1TasksList, ins->arg1);
+				mstOp26_removeMstTaskScreen(&_monsterObjects2TasksList, ins->arg1);
+				// mstOp26_removeMstTaskScreen(&_mstTasksList3, ins->arg1);
+				// mstOp26_removeMstTaskScreen(&_mstTasksList4, ins->arg1);
+			}
+			MST_NEXT_INSTRUCTION();
+		case 40: MST_OPCODE_LABEL(40) // 27 - remove_monsters_screen_type
+			if (ins->arg1 < _res->_mstHdr.screensCount) {
+				mstOp27_removeMstTaskScreenType(&_monsterObjects1TasksList, ins->arg1, ins->arg2);
+				mstOp27_removeMstTaskScreenType(&_monsterObjects2TasksList, ins->arg1, ins->arg2);
+				// mstOp27_removeMstTaskScreenType(&_mstTasksList3, ins->arg1, ins->arg2);
+				// mstOp27_removeMstTaskScreenType(&_mstTasksList4, ins->arg1, ins->arg2);
+			}
+			MST_NEXT_INSTRUCTION();
+		case 41: MST_OPCODE_LABEL(41) { // 28 - increment_task_var
+				assert(ins->arg1 < kMaxLocals);
+				++t->localVars[ins->arg1];
+			}
+			MST_NEXT_INSTRUCTION();
+		case 42: MST_OPCODE_LABEL(42) { // 29 - increment_global_var
+				const int num = ins->arg1;
 				assert(num < kMaxVars);
 				++_mstVars[num];
 			}
-			break;
-		case 43: { // 30 - increment_monster_var
+			MST_NEXT_INSTRUCTION();
+		case 43: MST_OPCODE_LABEL(43) { // 30 - increment_monster_var
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3855,24 +4181,24 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					const int num = p[1];
+					const int num = ins->arg1;
 					assert(num < kMaxLocals);
 					++m->localVars[num];
 				}
 			}
-			break;
-		case 44: { // 31 - decrement_task_var
-				const int num = p[1];
+			MST_NEXT_INSTRUCTION();
+		case 44: MST_OPCODE_LABEL(44) { // 31 - decrement_task_var
+				const int num = ins->arg1;
 				assert(num < kMaxLocals);
 				--t->localVars[num];
 			}
-			break;
-		case 45: { // 32 - decrement_global_var
-				const int num = p[1];
+			MST_NEXT_INSTRUCTION();
+		case 45: MST_OPCODE_LABEL(45) { // 32 - decrement_global_var
+				const int num = ins->arg1;
 				assert(num < kMaxVars);
 				--_mstVars[num];
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 47:
 		case 48:
 		case 49:
@@ -3882,12 +4208,12 @@ int Game::mstTask_main(Task *t) {
 		case 53:
 		case 54:
 		case 55:
-		case 56: { // 34 - arith_task_var_task_var
-				assert(p[1] < kMaxLocals);
-				assert(p[2] < kMaxLocals);
-				arithOp(p[0] - 47, &t->localVars[p[1]], t->localVars[p[2]]);
+		case 56: MST_OPCODE_LABEL(47) { // 34 - arith_task_var_task_var
+				assert(ins->arg1 < kMaxLocals);
+				assert(ins->arg2 < kMaxLocals);
+				arithOp(ins->op - 47, &t->localVars[ins->arg1], t->localVars[ins->arg2]);
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 57:
 		case 58:
 		case 59:
@@ -3897,15 +4223,15 @@ int Game::mstTask_main(Task *t) {
 		case 63:
 		case 64:
 		case 65:
-		case 66: { // 35 - arith_global_var_task_var
-				assert(p[1] < kMaxVars);
-				assert(p[2] < kMaxLocals);
-				arithOp(p[0] - 57, &_mstVars[p[1]], t->localVars[p[2]]);
-				if (p[1] == 31 && _mstVars[31] > 0) {
+		case 66: MST_OPCODE_LABEL(57) { // 35 - arith_global_var_task_var
+				assert(ins->arg1 < kMaxVars);
+				assert(ins->arg2 < kMaxLocals);
+				arithOp(ins->op - 57, &_mstVars[ins->arg1], t->localVars[ins->arg2]);
+				if (ins->arg1 == 31 && _mstVars[31] > 0) {
 					_mstTickDelay = _mstVars[31];
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 67:
 		case 68:
 		case 69:
@@ -3915,7 +4241,7 @@ int Game::mstTask_main(Task *t) {
 		case 73:
 		case 74:
 		case 75:
-		case 76: { // 36
+		case 76: MST_OPCODE_LABEL(67) { // 36
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3923,12 +4249,12 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					assert(p[1] < kMaxLocals);
-					assert(p[2] < kMaxLocals);
-					arithOp(p[0] - 67, &m->localVars[p[1]], t->localVars[p[2]]);
+					assert(ins->arg1 < kMaxLocals);
+					assert(ins->arg2 < kMaxLocals);
+					arithOp(ins->op - 67, &m->localVars[ins->arg1], t->localVars[ins->arg2]);
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 77:
 		case 78:
 		case 79:
@@ -3938,7 +4264,7 @@ int Game::mstTask_main(Task *t) {
 		case 83:
 		case 84:
 		case 85:
-		case 86: { // 37
+		case 86: MST_OPCODE_LABEL(77) { // 37
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3946,12 +4272,12 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					assert(p[1] < kMaxLocals);
-					assert(p[2] < kMaxLocals);
-					arithOp(p[0] - 77, &t->localVars[p[1]], m->localVars[p[2]]);
+					assert(ins->arg1 < kMaxLocals);
+					assert(ins->arg2 < kMaxLocals);
+					arithOp(ins->op - 77, &t->localVars[ins->arg1], m->localVars[ins->arg2]);
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 87:
 		case 88:
 		case 89:
@@ -3961,7 +4287,7 @@ int Game::mstTask_main(Task *t) {
 		case 93:
 		case 94:
 		case 95:
-		case 96: { // 38
+		case 96: MST_OPCODE_LABEL(87) { // 38
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3969,15 +4295,15 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					assert(p[1] < kMaxVars);
-					assert(p[2] < kMaxLocals);
-					arithOp(p[0] - 87, &_mstVars[p[1]], m->localVars[p[2]]);
-					if (p[1] == 31 && _mstVars[31] > 0) {
+					assert(ins->arg1 < kMaxVars);
+					assert(ins->arg2 < kMaxLocals);
+					arithOp(ins->op - 87, &_mstVars[ins->arg1], m->localVars[ins->arg2]);
+					if (ins->arg1 == 31 && _mstVars[31] > 0) {
 						_mstTickDelay = _mstVars[31];
 					}
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 97:
 		case 98:
 		case 99:
@@ -3987,7 +4313,7 @@ int Game::mstTask_main(Task *t) {
 		case 103:
 		case 104:
 		case 105:
-		case 106: { // 39
+		case 106: MST_OPCODE_LABEL(97) { // 39
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -3995,12 +4321,12 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					assert(p[1] < kMaxLocals);
-					assert(p[2] < kMaxLocals);
-					arithOp(p[0] - 97, &m->localVars[p[1]], m->localVars[p[2]]);
+					assert(ins->arg1 < kMaxLocals);
+					assert(ins->arg2 < kMaxLocals);
+					arithOp(ins->op - 97, &m->localVars[ins->arg1], m->localVars[ins->arg2]);
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 107:
 		case 108:
 		case 109:
@@ -4010,12 +4336,12 @@ int Game::mstTask_main(Task *t) {
 		case 113:
 		case 114:
 		case 115:
-		case 116: { // 40
-				assert(p[1] < kMaxLocals);
-				assert(p[2] < kMaxVars);
-				arithOp(p[0] - 107, &t->localVars[p[1]], _mstVars[p[2]]);
+		case 116: MST_OPCODE_LABEL(107) { // 40
+				assert(ins->arg1 < kMaxLocals);
+				assert(ins->arg2 < kMaxVars);
+				arithOp(ins->op - 107, &t->localVars[ins->arg1], _mstVars[ins->arg2]);
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 117:
 		case 118:
 		case 119:
@@ -4025,15 +4351,15 @@ int Game::mstTask_main(Task *t) {
 		case 123:
 		case 124:
 		case 125:
-		case 126: { // 41
-				assert(p[1] < kMaxVars);
-				assert(p[2] < kMaxVars);
-				arithOp(p[0] - 117, &_mstVars[p[1]], _mstVars[p[2]]);
-				if (p[1] == 31 && _mstVars[31] > 0) {
+		case 126: MST_OPCODE_LABEL(117) { // 41
+				assert(ins->arg1 < kMaxVars);
+				assert(ins->arg2 < kMaxVars);
+				arithOp(ins->op - 117, &_mstVars[ins->arg1], _mstVars[ins->arg2]);
+				if (ins->arg1 == 31 && _mstVars[31] > 0) {
 					_mstTickDelay = _mstVars[31];
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 127:
 		case 128:
 		case 129:
@@ -4043,7 +4369,7 @@ int Game::mstTask_main(Task *t) {
 		case 133:
 		case 134:
 		case 135:
-		case 136: { // 42
+		case 136: MST_OPCODE_LABEL(127) { // 42
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -4051,12 +4377,12 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					assert(p[1] < kMaxLocals);
-					assert(p[2] < kMaxVars);
-					arithOp(p[0] - 127, &m->localVars[p[1]], _mstVars[p[2]]);
+					assert(ins->arg1 < kMaxLocals);
+					assert(ins->arg2 < kMaxVars);
+					arithOp(ins->op - 127, &m->localVars[ins->arg1], _mstVars[ins->arg2]);
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 137:
 		case 138:
 		case 139:
@@ -4066,12 +4392,12 @@ int Game::mstTask_main(Task *t) {
 		case 143:
 		case 144:
 		case 145:
-		case 146: { // 43
-				const int num = p[2];
-				assert(p[1] < kMaxLocals);
-				arithOp(p[0] - 137, &t->localVars[p[1]], getTaskOtherVar(num, t));
+		case 146: MST_OPCODE_LABEL(137) { // 43
+				const int num = ins->arg2;
+				assert(ins->arg1 < kMaxLocals);
+				arithOp(ins->op - 137, &t->localVars[ins->arg1], getTaskOtherVar(num, t));
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 147:
 		case 148:
 		case 149:
@@ -4081,15 +4407,15 @@ int Game::mstTask_main(Task *t) {
 		case 153:
 		case 154:
 		case 155:
-		case 156: { // 44
-				const int num = p[2];
-				assert(p[1] < kMaxVars);
-				arithOp(p[0] - 147, &_mstVars[p[1]], getTaskOtherVar(num, t));
-				if (p[1] == 31 && _mstVars[31] > 0) {
+		case 156: MST_OPCODE_LABEL(147) { // 44
+				const int num = ins->arg2;
+				assert(ins->arg1 < kMaxVars);
+				arithOp(ins->op - 147, &_mstVars[ins->arg1], getTaskOtherVar(num, t));
+				if (ins->arg1 == 31 && _mstVars[31] > 0) {
 					_mstTickDelay = _mstVars[31];
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 157:
 		case 158:
 		case 159:
@@ -4099,7 +4425,7 @@ int Game::mstTask_main(Task *t) {
 		case 163:
 		case 164:
 		case 165:
-		case 166: { // 45
+		case 166: MST_OPCODE_LABEL(157) { // 45
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -4107,12 +4433,12 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					const int num = p[2];
-					assert(p[1] < kMaxLocals);
-					arithOp(p[0] - 157, &m->localVars[p[1]], getTaskOtherVar(num, t));
+					const int num = ins->arg2;
+					assert(ins->arg1 < kMaxLocals);
+					arithOp(ins->op - 157, &m->localVars[ins->arg1], getTaskOtherVar(num, t));
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 167:
 		case 168:
 		case 169:
@@ -4122,12 +4448,12 @@ int Game::mstTask_main(Task *t) {
 		case 173:
 		case 174:
 		case 175:
-		case 176: { // 46
-				const int16_t num = READ_LE_UINT16(p + 2);
-				assert(p[1] < kMaxLocals);
-				arithOp(p[0] - 167, &t->localVars[p[1]], num);
+		case 176: MST_OPCODE_LABEL(167) { // 46
+				const int16_t num = ins->num;
+				assert(ins->arg1 < kMaxLocals);
+				arithOp(ins->op - 167, &t->localVars[ins->arg1], num);
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 177:
 		case 178:
 		case 179:
@@ -4137,15 +4463,15 @@ int Game::mstTask_main(Task *t) {
 		case 183:
 		case 184:
 		case 185:
-		case 186: { // 47
-				const int16_t num = READ_LE_UINT16(p + 2);
-				assert(p[1] < kMaxVars);
-				arithOp(p[0] - 177, &_mstVars[p[1]], num);
-				if (p[1] == 31 && _mstVars[31] > 0) {
+		case 186: MST_OPCODE_LABEL(177) { // 47
+				const int16_t num = ins->num;
+				assert(ins->arg1 < kMaxVars);
+				arithOp(ins->op - 177, &_mstVars[ins->arg1], num);
+				if (ins->arg1 == 31 && _mstVars[31] > 0) {
 					_mstTickDelay = _mstVars[31];
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 187:
 		case 188:
 		case 189:
@@ -4155,7 +4481,7 @@ int Game::mstTask_main(Task *t) {
 		case 193:
 		case 194:
 		case 195:
-		case 196: { // 48 - arith_monster_var_imm
+		case 196: MST_OPCODE_LABEL(187) { // 48 - arith_monster_var_imm
 				MonsterObject1 *m = 0;
 				if (t->monster2) {
 					m = t->monster2->monster1;
@@ -4163,15 +4489,15 @@ int Game::mstTask_main(Task *t) {
 					m = t->monster1;
 				}
 				if (m) {
-					const int16_t num = READ_LE_UINT16(p + 2);
-					assert(p[1] < kMaxLocals);
-					arithOp(p[0] - 187, &m->localVars[p[1]], num);
+					const int16_t num = ins->num;
+					assert(ins->arg1 < kMaxLocals);
+					arithOp(ins->op - 187, &m->localVars[ins->arg1], num);
 				}
 			}
-			break;
-		case 197: // 49
+			MST_NEXT_INSTRUCTION();
+		case 197: MST_OPCODE_LABEL(197) // 49
 			if (t->monster1) {
-				const int num = READ_LE_UINT16(p + 2);
+				const int num = ins->num;
 				const MstOp197Data *op197Data = &_res->_mstOp197Data[num];
 				const uint32_t mask = op197Data->maskVars;
 				int a = getTaskVar(t, op197Data->unk0, (mask >> 16) & 15); // var1C
@@ -4182,91 +4508,91 @@ int Game::mstTask_main(Task *t) {
 				const int screenNum = CLIP(e, -4, _res->_mstHdr.screensCount - 1);
 				ret = mstOp49_setMovingBounds(a, b, c, d, screenNum, t, num);
 			}
-			break;
-		case 198: { // 50 - call_task
+			MST_NEXT_INSTRUCTION();
+		case 198: MST_OPCODE_LABEL(198) { // 50 - call_task
 				Task *child = findFreeTask();
 				if (child) {
 					t->codeData = p + 4;
 					memcpy(child, t, sizeof(Task));
 					t->child = child;
-					const uint16_t num = READ_LE_UINT16(p + 2);
-					const uint32_t codeData = _res->_mstUnk60[num];
-					assert(codeData != kNone);
-					p = _res->_mstCodeData + codeData * 4;
+					assert(ins->target);
+					p = ins->target;
 					t->codeData = p;
 					t->state &= ~2;
 					p -= 4;
+					MST_SYNC_INSTRUCTION();
 				}
 			}
-			break;
-		case 199: // 51 - stop_monster
+			MST_NEXT_INSTRUCTION();
+		case 199: MST_OPCODE_LABEL(199) // 51 - stop_monster
 			mstTaskStopMonsterObject1(t);
 			return 0;
-		case 200: // 52 - stop_monster_action
+		case 200: MST_OPCODE_LABEL(200) // 52 - stop_monster_action
 			if (t->monster1 && t->monster1->action) {
 				mstOp52();
 				return 1;
 			}
 			mstOp52();
-			break;
-		case 201: { // 53 - start_monster_action
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 201: MST_OPCODE_LABEL(201) { // 53 - start_monster_action
+				const int num = ins->num;
 				mstOp53(&_res->_mstMonsterActionData[num]);
 			}
-			break;
-		case 202: // 54 - continue_monster_action
+			MST_NEXT_INSTRUCTION();
+		case 202: MST_OPCODE_LABEL(202) // 54 - continue_monster_action
 			mstOp54();
-			break;
-		case 203: // 55 - monster_attack
+			MST_NEXT_INSTRUCTION();
+		case 203: MST_OPCODE_LABEL(203) // 55 - monster_attack
 			// _mstCurrentMonster1 = t->monster1;
 			if (t->monster1) {
-				const int num = READ_LE_UINT16(p + 2);
+				const int num = ins->num;
 				if (mstCollidesByFlags(t->monster1, _res->_mstOp240Data[num].flags)) {
 					t->codeData = p + 4;
 					mstTaskAttack(t, _res->_mstOp240Data[num].codeData, 0x10);
 					t->state &= ~2;
 					p = t->codeData - 4;
+					MST_SYNC_INSTRUCTION();
 				}
 			}
-			break;
-		case 204: // 56 - special_action
-			ret = mstOp56_specialAction(t, p[1], READ_LE_UINT16(p + 2));
-			break;
+			MST_NEXT_INSTRUCTION();
+		case 204: MST_OPCODE_LABEL(204) // 56 - special_action
+			ret = mstOp56_specialAction(t, ins->arg1, ins->num);
+			MST_NEXT_INSTRUCTION();
 		case 207:
 		case 208:
-		case 209: // 79
-			break;
-		case 210: // 57 - add_worm
+		case 209: MST_OPCODE_LABEL(207) // 79
+			MST_NEXT_INSTRUCTION();
+		case 210: MST_OPCODE_LABEL(210) // 57 - add_worm
 			{
 				MonsterObject1 *m = t->monster1;
-				mstOp57_addWormHoleSprite(m->xPos + (int8_t)p[2], m->yPos + (int8_t)p[3], m->o16->screenNum);
+				mstOp57_addWormHoleSprite(m->xPos + (int8_t)ins->arg2, m->yPos + (int8_t)ins->arg3, m->o16->screenNum);
 			}
-			break;
-		case 211: // 58 - add_lvl_object
-			mstOp58_addLvlObject(t, READ_LE_UINT16(p + 2));
-			break;
-		case 212: { // 59
+			MST_NEXT_INSTRUCTION();
+		case 211: MST_OPCODE_LABEL(211) // 58 - add_lvl_object
+			mstOp58_addLvlObject(t, ins->num);
+			MST_NEXT_INSTRUCTION();
+		case 212: MST_OPCODE_LABEL(212) { // 59
 				LvlObject *o = 0;
 				if (t->monster2) {
 					o = t->monster2->o;
 				} else if (t->monster1) {
 					o = t->monster1->o16;
 				} else {
-					break;
+					MST_NEXT_INSTRUCTION();
 				}
 				assert(o);
 				int xPos = o->xPos + o->posTable[6].x;
 				int yPos = o->yPos + o->posTable[6].y;
 				const uint16_t flags1 = o->flags1;
 				if (flags1 & 0x10) {
-					xPos -= (int8_t)p[2];
+					xPos -= (int8_t)ins->arg2;
 				} else {
-					xPos += (int8_t)p[2];
+					xPos += (int8_t)ins->arg2;
 				}
 				if (flags1 & 0x20) {
-					yPos -= (int8_t)p[3];
+					yPos -= (int8_t)ins->arg3;
 				} else {
-					yPos += (int8_t)p[3];
+					yPos += (int8_t)ins->arg3;
 				}
 				int dirMask = 0;
 				if ((t->monster1 && (t->monster1->monsterInfos[944] == 10 || t->monster1->monsterInfos[944] == 25)) || (t->monster2 && (t->monster2->monster2Info->type == 10 || t->monster2->monster2Info->type == 25))) {
@@ -4285,7 +4611,7 @@ int Game::mstTask_main(Task *t) {
 				} else {
 					dirMask = ((flags1 & 0x10) != 0) ? 8 : 0;
 				}
-				if (p[1] == 255) {
+				if (ins->arg1 == 255) {
 					int type = 0;
 					switch (dirMask) {
 					case 1:
@@ -4336,11 +4662,11 @@ int Game::mstTask_main(Task *t) {
 						type = 2;
 						break;
 					}
-					mstOp59_addShootFireball(xPos, yPos, o->screenNum, p[1], type, (o->flags2 + 1) & 0xDFFF);
+					mstOp59_addShootFireball(xPos, yPos, o->screenNum, ins->arg1, type, (o->flags2 + 1) & 0xDFFF);
 				}
 			}
-			break;
-		case 213: { // 60 - monster_set_action_direction
+			MST_NEXT_INSTRUCTION();
+		case 213: MST_OPCODE_LABEL(213) { // 60 - monster_set_action_direction
 				LvlObject *o = 0;
 				if (t->monster2) {
 					o = t->monster2->o;
@@ -4348,29 +4674,29 @@ int Game::mstTask_main(Task *t) {
 					o = t->monster1->o16;
 				}
 				if (o) {
-					o->actionKeyMask = getTaskVar(t, p[2], p[1] >> 4);
-					o->directionKeyMask = getTaskVar(t, p[3], p[1] & 15);
+					o->actionKeyMask = getTaskVar(t, ins->arg2, ins->arg1 >> 4);
+					o->directionKeyMask = getTaskVar(t, ins->arg3, ins->arg1 & 15);
 				}
 			}
-			break;
-		case 214: { // 61 - reset_monster_energy
+			MST_NEXT_INSTRUCTION();
+		case 214: MST_OPCODE_LABEL(214) { // 61 - reset_monster_energy
 				MonsterObject1 *m = t->monster1;
 				if (m) {
 					m->flagsA5 &= ~0xC0;
 					m->localVars[7] = m->behaviorState->energy;
 				}
 			}
-			break;
-		case 215: { // 62
+			MST_NEXT_INSTRUCTION();
+		case 215: MST_OPCODE_LABEL(215) { // 62
 				if (_m43Num3 != -1) {
 					assert(_m43Num3 < _res->_mstHdr.monsterActionIndexDataCount);
 					shuffleMstMonsterActionIndex(&_res->_mstMonsterActionIndexData[_m43Num3]);
 				}
 				_mstOp54Counter = 0;
 			}
-			break;
-		case 217: { // 64
-				const int16_t num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 217: MST_OPCODE_LABEL(217) { // 64
+				const int16_t num = ins->num;
 				if (_m43Num3 != num) {
 					_m43Num3 = num;
 					assert(num >= 0 && num < _res->_mstHdr.monsterActionIndexDataCount);
@@ -4378,9 +4704,9 @@ int Game::mstTask_main(Task *t) {
 					_mstOp54Counter = 0;
 				}
 			}
-			break;
-		case 218: { // 65
-				const int16_t num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 218: MST_OPCODE_LABEL(218) { // 65
+				const int16_t num = ins->num;
 				if (num != _m43Num1) {
 					_m43Num1 = num;
 					_m43Num2 = num;
@@ -4388,14 +4714,14 @@ int Game::mstTask_main(Task *t) {
 					shuffleMstMonsterActionIndex(&_res->_mstMonsterActionIndexData[num]);
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 220:
 		case 221:
 		case 222:
 		case 223:
 		case 224:
-		case 225: { // 67 - add_monster
-				const int num = READ_LE_UINT16(p + 2);
+		case 225: MST_OPCODE_LABEL(220) { // 67 - add_monster
+				const int num = ins->num;
 				MstOp223Data *m = &_res->_mstOp223Data[num];
 				const int mask = m->maskVars; // var8
 				int a = getTaskVar(t, m->indexVar1, (mask >> 16) & 15); // var1C
@@ -4442,7 +4768,7 @@ int Game::mstTask_main(Task *t) {
 					e = o->screenNum;
 				}
 				e = CLIP(e, -1, _res->_mstHdr.screensCount - 1);
-				if (p[0] == 224) {
+				if (ins->op == 224) {
 					_mstOp67_type = m->type;
 					_mstOp67_flags1 = m->flags1;
 					// _mstOp67_flags2 = m->flags2;
@@ -4451,8 +4777,8 @@ int Game::mstTask_main(Task *t) {
 					_mstOp67_y1 = c;
 					_mstOp67_y2 = d;
 					_mstOp67_screenNum = e;
-					break;
-				} else if (p[0] == 225) {
+					MST_NEXT_INSTRUCTION();
+				} else if (ins->op == 225) {
 					_mstOp68_type = m->type;
 					_mstOp68_flags1 = m->flags1;
 					_mstOp68_flags2 = m->flags2;
@@ -4461,24 +4787,24 @@ int Game::mstTask_main(Task *t) {
 					_mstOp68_y1 = c;
 					_mstOp68_y2 = d;
 					_mstOp68_screenNum = e;
-					break;
+					MST_NEXT_INSTRUCTION();
 				} else {
 					t->flags |= 0x80;
-					if (p[0] == 222 || p[0] == 220) {
+					if (ins->op == 222 || ins->op == 220) {
 						if (e == -1) {
 							if (a >= -_mstAndyScreenPosX && a <= 255 - _mstAndyScreenPosX) {
-								break;
+								MST_NEXT_INSTRUCTION();
 							}
 						} else if (e == _currentScreen) {
-							break;
+							MST_NEXT_INSTRUCTION();
 						}
 					}
 				}
 				mstOp67_addMonster(t, a, b, c, d, e, m->type, m->flags1, m->flags2, m->unkB, 0, m->unkE);
 			}
-			break;
-		case 226: { // 68 - add_monster_group
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 226: MST_OPCODE_LABEL(226) { // 68 - add_monster_group
+				const int num = ins->num;
 				const MstOp226Data *m226Data = &_res->_mstOp226Data[num];
 				int xPos = _res->_mstPointOffsets[_currentScreen].xOffset;
 				int yPos = _res->_mstPointOffsets[_currentScreen].yOffset;
@@ -4505,7 +4831,7 @@ int Game::mstTask_main(Task *t) {
 				t->flags |= 0x80;
 				const int total = countRight + countLeft;
 				if (total >= m226Data->unk3) {
-					break;
+					MST_NEXT_INSTRUCTION();
 				}
 				int vc = m226Data->unk3 - total;
 
@@ -4543,39 +4869,41 @@ int Game::mstTask_main(Task *t) {
 					mstOp68_addMonsterGroup(t, _res->_mstMonsterInfos + m226Data->unk0 * kMonsterInfoDataSize, countType1, countType2, vc, m226Data->unk6);
 				}
 			}
-			break;
-		case 227: { // 69 - compare_vars
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 227: MST_OPCODE_LABEL(227) { // 69 - compare_vars
+				const int num = ins->num;
 				assert(num < _res->_mstHdr.op227DataCount);
 				const MstOp227Data *m = &_res->_mstOp227Data[num];
 				const int a = getTaskVar(t, m->indexVar1, m->maskVars & 15);
 				const int b = getTaskVar(t, m->indexVar2, m->maskVars >> 4);
 				if (compareOp(m->compare, a, b)) {
-					assert(m->codeData < _res->_mstHdr.codeSize);
-					p = _res->_mstCodeData + m->codeData * 4 - 4;
+					assert(ins->target);
+					p = ins->target - 4;
+					MST_SYNC_INSTRUCTION();
 				}
 			}
-			break;
-		case 228: { // 70 - compare_flags
-				const int num = READ_LE_UINT16(p + 2);
+			MST_NEXT_INSTRUCTION();
+		case 228: MST_OPCODE_LABEL(228) { // 70 - compare_flags
+				const int num = ins->num;
 				assert(num < _res->_mstHdr.op227DataCount);
 				const MstOp227Data *m = &_res->_mstOp227Data[num];
 				const int a = getTaskFlag(t, m->indexVar1, m->maskVars & 15);
 				const int b = getTaskFlag(t, m->indexVar2, m->maskVars >> 4);
 				if (compareOp(m->compare, a, b)) {
-					assert(m->codeData < _res->_mstHdr.codeSize);
-					p = _res->_mstCodeData + m->codeData * 4 - 4;
+					assert(ins->target);
+					p = ins->target - 4;
+					MST_SYNC_INSTRUCTION();
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 231:
-		case 232: { // 71 - compare_flags_monster
-				const int num = READ_LE_UINT16(p + 2);
+		case 232: MST_OPCODE_LABEL(231) { // 71 - compare_flags_monster
+				const int num = ins->num;
 				const MstOp234Data *m = &_res->_mstOp234Data[num];
 				const int a = getTaskFlag(t, m->indexVar1, m->maskVars & 15);
 				const int b = getTaskFlag(t, m->indexVar2, m->maskVars >> 4);
 				if (compareOp(m->compare, a, b)) {
-					if (p[0] == 231) {
+					if (ins->op == 231) {
 						LvlObject *o = 0;
 						if (t->monster1) {
 							if ((t->monster1->flagsA6 & 2) == 0) {
@@ -4593,7 +4921,7 @@ int Game::mstTask_main(Task *t) {
 						ret = 1;
 					}
 				} else {
-					if (p[0] == 232) {
+					if (ins->op == 232) {
 						LvlObject *o = 0;
 						if (t->monster1) {
 							if ((t->monster1->flagsA6 & 2) == 0) {
@@ -4612,15 +4940,15 @@ int Game::mstTask_main(Task *t) {
 					}
 				}
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		case 233:
-		case 234: { // 72 - compare_vars_monster
-				const int num = READ_LE_UINT16(p + 2);
+		case 234: MST_OPCODE_LABEL(233) { // 72 - compare_vars_monster
+				const int num = ins->num;
 				const MstOp234Data *m = &_res->_mstOp234Data[num];
 				const int a = getTaskVar(t, m->indexVar1, m->maskVars & 15);
 				const int b = getTaskVar(t, m->indexVar2, m->maskVars >> 4);
 				if (compareOp(m->compare, a, b)) {
-					if (p[0] == 233) {
+					if (ins->op == 233) {
 						LvlObject *o = 0;
 						if (t->monster1) {
 							if ((t->monster1->flagsA6 & 2) == 0) {
@@ -4638,7 +4966,7 @@ int Game::mstTask_main(Task *t) {
 						ret = 1;
 					}
 				} else {
-					if (p[0] == 234) {
+					if (ins->op == 234) {
 						LvlObject *o = 0;
 						if (t->monster1) {
 							if ((t->monster1->flagsA6 & 2) == 0) {
@@ -4657,8 +4985,8 @@ int Game::mstTask_main(Task *t) {
 					}
 				}
 			}
-			break;
-		case 237: // 74 - remove_monster_task
+			MST_NEXT_INSTRUCTION();
+		case 237: MST_OPCODE_LABEL(237) // 74 - remove_monster_task
 			if (t->monster1) {
 				if (!t->monster2) {
 					mstRemoveMonsterObject1(t, &_monsterObjects1TasksList);
@@ -4672,31 +5000,22 @@ int Game::mstTask_main(Task *t) {
 					return 1;
 				}
 			}
-			break;
-		case 238: { // 75 - jmp
-				const int i = READ_LE_UINT16(p + 2);
-				const uint32_t codeData = _res->_mstUnk60[i];
-				assert(codeData != kNone);
-				p = _res->_mstCodeData + codeData * 4;
-				t->codeData = p;
-				p -= 4;
-			}
-			break;
-		case 239: { // 76  - create_task
-				const int i = READ_LE_UINT16(p + 2);
-				const uint32_t codeData = _res->_mstUnk60[i];
-				assert(codeData != kNone);
-				createTask(_res->_mstCodeData + codeData * 4);
-			}
-			break;
-		case 240: { // 77 - update_task
-				const int num = READ_LE_UINT16(p + 2);
-				MstOp240Data *m = &_res->_mstOp240Data[num];
-				const uint8_t *codeData = (m->codeData == kNone) ? 0 : (_res->_mstCodeData + m->codeData * 4);
-				updateTask(t, m->flags, codeData);
-			}
-			break;
-		case 242: // 78 - terminate
+			MST_NEXT_INSTRUCTION();
+		case 238: MST_OPCODE_LABEL(238) // 75 - jmp
+			assert(ins->target);
+			p = ins->target;
+			t->codeData = p;
+			p -= 4;
+			MST_SYNC_INSTRUCTION();
+			MST_NEXT_INSTRUCTION();
+		case 239: MST_OPCODE_LABEL(239) // 76  - create_task
+			assert(ins->target);
+			createTask(ins->target);
+			MST_NEXT_INSTRUCTION();
+		case 240: MST_OPCODE_LABEL(240) // 77 - update_task
+			updateTask(t, _res->_mstOp240Data[ins->num].flags, ins->target);
+			MST_NEXT_INSTRUCTION();
+		case 242: MST_OPCODE_LABEL(242) // 78 - terminate
 			debug(kDebug_MONSTER, "child %p monster1 %p monster2 %p", t->child, t->monster1, t->monster2);
 			if (t->child) {
 				Task *child = t->child;
@@ -4705,7 +5024,7 @@ int Game::mstTask_main(Task *t) {
 				memcpy(t, child, sizeof(Task));
 				t->child = 0;
 				t->state &= ~2;
-				child->codeData = 0;
+				freeTask(child);
 				MonsterObject1 *m = t->monster1;
 				if (m) {
 					m->flagsA5 &= ~0x70;
@@ -4733,6 +5052,7 @@ int Game::mstTask_main(Task *t) {
 									resetTask(t, _res->_mstCodeData + codeData * 4);
 									t->state &= ~2;
 									p = t->codeData - 4;
+									MST_SYNC_INSTRUCTION();
 								}
 								break;
 							case 5:
@@ -4748,6 +5068,7 @@ int Game::mstTask_main(Task *t) {
 							const int counter = m->executeCounter;
 							m->executeCounter = _executeMstLogicCounter;
 							p = t->codeData - 4;
+							MST_SYNC_INSTRUCTION();
 							if (m->executeCounter == counter) {
 								if ((m->flagsA6 & 2) == 0) {
 									if (m->o16) {
@@ -4791,7 +5112,7 @@ int Game::mstTask_main(Task *t) {
 				removeTask(&_tasksList, t);
 				ret = 1;
 			}
-			break;
+			MST_NEXT_INSTRUCTION();
 		default:
 			warning("Unhandled opcode %d in mstTask_main", *p);
 			break;
@@ -4813,6 +5134,10 @@ int Game::mstTask_main(Task *t) {
 	return 1;
 }
 
+#ifdef MST_THREADED_CODE
+#pragma GCC diagnostic pop
+#endif
+
 void Game::mstOp26_removeMstTaskScreen(Task **tasksList, int screenNum) {
 	Task *current = *tasksList;
 	while (current) {
@@ -5547,6 +5872,9 @@ int Game::mstOp56_specialAction(Task *t, int code, int num) {
 			_specialAnimFlag = true;
 		}
 		if (_mstAndyRectNum != 0xFF) {
+			if (_mstAndyRectNum < _mstBoundingBoxesCount && _mstBoundingBoxesTable[_mstAndyRectNum].monster1Index != 0xFF) {
+				mstBoundingBoxGridUpdate(_mstAndyRectNum, false);
+			}
 			_mstBoundingBoxesTable[_mstAndyRectNum].monster1Index = 0xFF;
 		}
 		break;
@@ -6013,9 +6341,8 @@ void Game::mstOp58_addLvlObject(Task *t, int num) {
 void Game::mstOp59_addShootSpecialPowers(int x, int y, int screenNum, int state, uint16_t flags) {
 	LvlObject *o = addLvlObjectToList0(3);
 	if (o) {
-		o->dataPtr = _shootLvlObjectDataNextPtr;
-		if (_shootLvlObjectDataNextPtr) {
-			_shootLvlObjectDataNextPtr = _shootLvlObjectDataNextPtr->nextPtr;
+		o->dataPtr = _shootLvlObjectDataPool.acquire();
+		if (o->dataPtr) {
 			memset(o->dataPtr, 0, sizeof(ShootLvlObjectData));
 		}
 		ShootLvlObjectData *s = (ShootLvlObjectData *)o->dataPtr;
@@ -6043,9 +6370,8 @@ void Game::mstOp59_addShootSpecialPowers(int x, int y, int screenNum, int state,
 void Game::mstOp59_addShootFireball(int x, int y, int screenNum, int type, int state, uint16_t flags) {
 	LvlObject *o = addLvlObjectToList2(7);
 	if (o) {
-		o->dataPtr = _shootLvlObjectDataNextPtr;
-		if (_shootLvlObjectDataNextPtr) {
-			_shootLvlObjectDataNextPtr = _shootLvlObjectDataNextPtr->nextPtr;
+		o->dataPtr = _shootLvlObjectDataPool.acquire();
+		if (o->dataPtr) {
 			memset(o->dataPtr, 0, sizeof(ShootLvlObjectData));
 		}
 		ShootLvlObjectData *s = (ShootLvlObjectData *)o->dataPtr;
@@ -0,0 +1,362 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "fileio.h"
+#include "fs.h"
+#include "lz4.h"
+#include "pack.h"
+#include "util.h"
+
+static const uint32_t _packTag = 0x4B415048; // 'HPAK'
+static const uint32_t _packVersion = 1;
+
+enum {
+	kPackHeaderSize = 24,
+	kPackEntrySize = PackEntry::kNameSize + 5 * 4,
+	kPackChunkSize = 8
+};
+
+PackArchive::PackArchive()
+	: _entriesCount(0), _entries(0), _chunksCount(0), _chunks(0) {
+}
+
+PackArchive::~PackArchive() {
+	free(_entries);
+	free(_chunks);
+}
+
+bool PackArchive::open(FILE *fp) {
+	uint8_t hdr[kPackHeaderSize];
+	if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || READ_LE_UINT32(hdr) != _packTag) {
+		return false;
+	}
+	const uint32_t version = READ_LE_UINT32(hdr + 4);
+	const uint32_t chunkSize = READ_LE_UINT32(hdr + 8);
+	if (version != _packVersion || chunkSize != kChunkSize) {
+		warning("Unsupported archive version %d chunk size %d", version, chunkSize);
+		return false;
+	}
+	_entriesCount = READ_LE_UINT32(hdr + 12);
+	_chunksCount = READ_LE_UINT32(hdr + 16);
+	const uint32_t indexOffset = READ_LE_UINT32(hdr + 20);
+	const uint32_t indexSize = _entriesCount * kPackEntrySize + _chunksCount * kPackChunkSize;
+	uint8_t *buf = (uint8_t *)malloc(indexSize);
+	_entries = (PackEntry *)calloc(_entriesCount, sizeof(PackEntry));
+	_chunks = (PackChunk *)calloc(_chunksCount, sizeof(PackChunk));
+	bool ret = buf && _entries && _chunks && fseek(fp, indexOffset, SEEK_SET) == 0 && fread(buf, 1, indexSize, fp) == indexSize;
+	if (ret) {
+		const uint8_t *p = buf;
+		for (uint32_t i = 0; i < _entriesCount; ++i, p += kPackEntrySize) {
+			PackEntry *e = &_entries[i];
+			memcpy(e->name, p, PackEntry::kNameSize);
+			e->name[PackEntry::kNameSize - 1] = 0;
+			e->size = READ_LE_UINT32(p + 32);
+			e->firstChunk = READ_LE_UINT32(p + 36);
+			e->flags = READ_LE_UINT32(p + 40);
+			e->sourceSize = READ_LE_UINT32(p + 44);
+			e->sourceChecksum = READ_LE_UINT32(p + 48);
+			const uint32_t chunksCount = (e->size + kChunkSize - 1) / kChunkSize;
+			if (e->firstChunk > _chunksCount || chunksCount > _chunksCount - e->firstChunk) {
+				ret = false;
+			}
+		}
+		for (uint32_t i = 0; i < _chunksCount; ++i, p += kPackChunkSize) {
+			_chunks[i].offset = READ_LE_UINT32(p);
+			_chunks[i].size = READ_LE_UINT32(p + 4);
+			if (_chunks[i].size > kChunkSize) {
+				ret = false;
+			}
+		}
+	}
+	free(buf);
+	debug(kDebug_RESOURCE, "Archive %d files %d chunks", _entriesCount, _chunksCount);
+	return ret;
+}
+
+const PackEntry *PackArchive::findEntry(const char *name) const {
+	for (uint32_t i = 0; i < _entriesCount; ++i) {
+		if (strcasecmp(_entries[i].name, name) == 0) {
+			return &_entries[i];
+		}
+	}
+	return 0;
+}
+
+PackedFile::PackedFile(const PackArchive *archive, const PackEntry *entry)
+	: _archive(archive), _entry(entry), _pos(0), _chunkNum(-1) {
+	_chunkBuffer = (uint8_t *)malloc(PackArchive::kChunkSize);
+	_compressedBuffer = (uint8_t *)malloc(PackArchive::kChunkSize);
+	if (!_chunkBuffer || !_compressedBuffer) {
+		error("Failed to allocate archive buffers");
+	}
+}
+
+PackedFile::~PackedFile() {
+	free(_chunkBuffer);
+	free(_compressedBuffer);
+}
+
+bool PackedFile::readChunk(int num, uint8_t *dst) {
+	const PackChunk *chunk = &_archive->_chunks[_entry->firstChunk + num];
+	const uint32_t size = MIN<uint32_t>(PackArchive::kChunkSize, _entry->size - num * PackArchive::kChunkSize);
+	fseek(_fp, chunk->offset, SEEK_SET);
+	if (chunk->size == size) { // stored
+		return fread(dst, 1, size, _fp) == size;
+	}
+	if (fread(_compressedBuffer, 1, chunk->size, _fp) != chunk->size || decodeLZ4(_compressedBuffer, chunk->size, dst, size) != (int)size) {
+		warning("Failed to decompress chunk %d of '%s'", num, _entry->name);
+		return false;
+	}
+	return true;
+}
+
+// the offsets of the sector aligned files are translated like FlatSectorFile
+void PackedFile::seekAlign(uint32_t pos) {
+	if (flatSectors()) {
+		pos += (pos / 2048) * 4;
+		pos = (pos / 2048) * 2044 + (pos & 2047);
+	}
+	_pos = pos;
+}
+
+void PackedFile::seek(int pos, int whence) {
+	if (flatSectors()) {
+		if (whence == SEEK_SET) {
+			assert((pos & 2047) == 0);
+			pos = (pos / 2048) * 2044;
+		} else {
+			assert(whence == SEEK_CUR && pos >= 0);
+		}
+	}
+	switch (whence) {
+	case SEEK_SET:
+		_pos = pos;
+		break;
+	case SEEK_CUR:
+		_pos += pos;
+		break;
+	case SEEK_END:
+		_pos = _entry->size + pos;
+		break;
+	}
+}
+
+int PackedFile::read(uint8_t *ptr, int size) {
+	int count = 0;
+	while (size > 0 && _pos < _entry->size) {
+		const int num = _pos / PackArchive::kChunkSize;
+		const uint32_t offset = _pos % PackArchive::kChunkSize;
+		const uint32_t chunkSize = MIN<uint32_t>(PackArchive::kChunkSize, _entry->size - num * PackArchive::kChunkSize);
+		const int len = MIN<int>(size, chunkSize - offset);
+		if (num != _chunkNum) {
+			if (offset == 0 && len == (int)chunkSize) {
+				// whole chunk, decompress to the destination buffer
+				if (!readChunk(num, ptr)) {
+					break;
+				}
+				ptr += len;
+				size -= len;
+				_pos += len;
+				count += len;
+				continue;
+			}
+			if (!readChunk(num, _chunkBuffer)) {
+				_chunkNum = -1;
+				break;
+			}
+			_chunkNum = num;
+		}
+		memcpy(ptr, _chunkBuffer + offset, len);
+		ptr += len;
+		size -= len;
+		_pos += len;
+		count += len;
+	}
+	return count;
+}
+
+uint32_t PackedFile::checksum(uint32_t *size) {
+	*size = _entry->sourceSize;
+	return _entry->sourceChecksum;
+}
+
+PackWriter::PackWriter()
+	: _fp(0), _offset(0), _entriesCount(0), _entries(0), _chunksCount(0), _chunks(0), _chunkSize(0) {
+	_chunkBuffer = (uint8_t *)malloc(PackArchive::kChunkSize);
+	_compressedBuffer = (uint8_t *)malloc(PackArchive::kChunkSize);
+}
+
+PackWriter::~PackWriter() {
+	free(_entries);
+	free(_chunks);
+	free(_chunkBuffer);
+	free(_compressedBuffer);
+}
+
+bool PackWriter::open(FILE *fp) {
+	if (!_chunkBuffer || !_compressedBuffer) {
+		return false;
+	}
+	_fp = fp;
+	uint8_t hdr[kPackHeaderSize];
+	memset(hdr, 0, sizeof(hdr));
+	_offset = fwrite(hdr, 1, sizeof(hdr), _fp);
+	return _offset == sizeof(hdr);
+}
+
+bool PackWriter::writeChunk() {
+	PackChunk *chunks = (PackChunk *)realloc(_chunks, (_chunksCount + 1) * sizeof(PackChunk));
+	if (!chunks) {
+		return false;
+	}
+	_chunks = chunks;
+	// store the chunk if it does not compress
+	int size = encodeLZ4(_chunkBuffer, _chunkSize, _compressedBuffer, _chunkSize - 1);
+	const uint8_t *data = _compressedBuffer;
+	if (size == 0) {
+		size = _chunkSize;
+		data = _chunkBuffer;
+	}
+	PackChunk *chunk = &_chunks[_chunksCount++];
+	chunk->offset = _offset;
+	chunk->size = size;
+	_offset += size;
+	_chunkSize = 0;
+	return fwrite(data, 1, size, _fp) == (size_t)size;
+}
+
+bool PackWriter::addFile(const char *name, FILE *src, bool flatSectors) {
+	if (strlen(name) >= PackEntry::kNameSize) {
+		return false;
+	}
+	// the entry is added once the whole file is packed
+	PackEntry entry;
+	PackEntry *e = &entry;
+	memset(e, 0, sizeof(PackEntry));
+	strcpy(e->name, name);
+	e->firstChunk = _chunksCount;
+	e->flags = flatSectors ? PackEntry::kFlagFlatSectors : 0;
+	e->sourceChecksum = 0x811C9DC5;
+	uint8_t buf[2048];
+	while (1) {
+		const int count = fread(buf, 1, sizeof(buf), src);
+		if (count <= 0) {
+			if (ferror(src)) {
+				warning("Failed to read '%s'", name);
+				return false;
+			}
+			break;
+		}
+		for (int i = 0; i < count; ++i) {
+			e->sourceChecksum = (e->sourceChecksum ^ buf[i]) * 0x01000193;
+		}
+		e->sourceSize += count;
+		int len = count;
+		if (flatSectors) {
+			if (count != (int)sizeof(buf)) {
+				warning("Truncated sector %u in '%s'", (e->sourceSize - count) / 2048, name);
+				return false;
+			}
+			if (fioUpdateCRC(0, buf, sizeof(buf)) != 0) {
+				warning("Bad checksum for sector %u in '%s'", (e->sourceSize - count) / 2048, name);
+				return false;
+			}
+			len = 2044;
+		}
+		const uint8_t *p = buf;
+		while (len > 0) {
+			const int n = MIN<int>(len, PackArchive::kChunkSize - _chunkSize);
+			memcpy(_chunkBuffer + _chunkSize, p, n);
+			_chunkSize += n;
+			e->size += n;
+			p += n;
+			len -= n;
+			if (_chunkSize == PackArchive::kChunkSize && !writeChunk()) {
+				return false;
+			}
+		}
+	}
+	if (_chunkSize != 0 && !writeChunk()) {
+		return false;
+	}
+	PackEntry *entries = (PackEntry *)realloc(_entries, (_entriesCount + 1) * sizeof(PackEntry));
+	if (!entries) {
+		return false;
+	}
+	_entries = entries;
+	_entries[_entriesCount++] = entry;
+	return true;
+}
+
+bool PackWriter::close() {
+	const uint32_t indexOffset = _offset;
+	uint8_t buf[kPackEntrySize];
+	bool ret = true;
+	for (uint32_t i = 0; i < _entriesCount; ++i) {
+		const PackEntry *e = &_entries[i];
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, e->name, PackEntry::kNameSize);
+		WRITE_LE_UINT32(buf + 32, e->size);
+		WRITE_LE_UINT32(buf + 36, e->firstChunk);
+		WRITE_LE_UINT32(buf + 40, e->flags);
+		WRITE_LE_UINT32(buf + 44, e->sourceSize);
+		WRITE_LE_UINT32(buf + 48, e->sourceChecksum);
+		ret &= fwrite(buf, 1, kPackEntrySize, _fp) == kPackEntrySize;
+	}
+	for (uint32_t i = 0; i < _chunksCount; ++i) {
+		WRITE_LE_UINT32(buf, _chunks[i].offset);
+		WRITE_LE_UINT32(buf + 4, _chunks[i].size);
+		ret &= fwrite(buf, 1, kPackChunkSize, _fp) == kPackChunkSize;
+	}
+	WRITE_LE_UINT32(buf, _packTag);
+	WRITE_LE_UINT32(buf + 4, _packVersion);
+	WRITE_LE_UINT32(buf + 8, PackArchive::kChunkSize);
+	WRITE_LE_UINT32(buf + 12, _entriesCount);
+	WRITE_LE_UINT32(buf + 16, _chunksCount);
+	WRITE_LE_UINT32(buf + 20, indexOffset);
+	ret &= fseek(_fp, 0, SEEK_SET) == 0 && fwrite(buf, 1, kPackHeaderSize, _fp) == kPackHeaderSize;
+	_fp = 0;
+	return ret;
+}
+
+// the archive is looked up in the data path, then in the save path where --pack-data writes it
+PackedFile *FileSystem::openPackedFile(const char *name) {
+	if (!_archiveChecked) {
+		_archiveChecked = true;
+		FILE *fp = openAssetFile(kPackFileName);
+		_archiveInSavePath = false;
+		if (!fp) {
+			fp = openSaveFile(kPackFileName, false);
+			_archiveInSavePath = true;
+		}
+		if (fp) {
+			_archive = new PackArchive;
+			if (!_archive->open(fp)) {
+				warning("Ignoring invalid archive '%s'", kPackFileName);
+				delete _archive;
+				_archive = 0;
+			}
+			closeFile(fp);
+		}
+	}
+	const PackEntry *e = _archive ? _archive->findEntry(name) : 0;
+	if (!e) {
+		return 0;
+	}
+	// each file has its own handle, the files can be read from different threads
+	FILE *fp = _archiveInSavePath ? openSaveFile(kPackFileName, false) : openAssetFile(kPackFileName);
+	if (!fp) {
+		return 0;
+	}
+	PackedFile *f = new PackedFile(_archive, e);
+	f->setFp(fp);
+	return f;
+}
+
+void FileSystem::closePackArchive() {
+	delete _archive;
+	_archive = 0;
+	_archiveChecked = false;
+}
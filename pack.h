@@ -0,0 +1,94 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PACK_H__
+#define PACK_H__
+
+#include "intern.h"
+#include "fileio.h"
+
+// 'hode.pak' stores the game files in independently compressed chunks
+static const char *const kPackFileName = "hode.pak";
+
+struct PackEntry {
+	enum {
+		kNameSize = 32,
+		kFlagFlatSectors = 1 << 0 // sector aligned data stored without the checksums
+	};
+
+	char name[kNameSize];
+	uint32_t size;
+	uint32_t firstChunk;
+	uint32_t flags;
+	uint32_t sourceSize; // size and FNV-1a checksum of the original file
+	uint32_t sourceChecksum;
+};
+
+struct PackChunk {
+	uint32_t offset;
+	uint32_t size; // equal to the uncompressed size for stored chunks
+};
+
+struct PackArchive {
+	enum {
+		kChunkSize = 32 * 1024
+	};
+
+	uint32_t _entriesCount;
+	PackEntry *_entries;
+	uint32_t _chunksCount;
+	PackChunk *_chunks;
+
+	PackArchive();
+	~PackArchive();
+
+	bool open(FILE *fp);
+	const PackEntry *findEntry(const char *name) const;
+};
+
+// reads a file stored in the archive, the last decompressed chunk is cached
+struct PackedFile : File {
+
+	const PackArchive *_archive;
+	const PackEntry *_entry;
+	uint32_t _pos;
+	int _chunkNum;
+	uint8_t *_chunkBuffer;
+	uint8_t *_compressedBuffer;
+
+	PackedFile(const PackArchive *archive, const PackEntry *entry);
+	virtual ~PackedFile();
+
+	bool flatSectors() const { return (_entry->flags & PackEntry::kFlagFlatSectors) != 0; }
+	bool readChunk(int num, uint8_t *dst);
+
+	virtual void seekAlign(uint32_t pos);
+	virtual void seek(int pos, int whence);
+	virtual int read(uint8_t *ptr, int size);
+	virtual uint32_t checksum(uint32_t *size);
+};
+
+struct PackWriter {
+
+	FILE *_fp;
+	uint32_t _offset;
+	uint32_t _entriesCount;
+	PackEntry *_entries;
+	uint32_t _chunksCount;
+	PackChunk *_chunks;
+	uint8_t *_chunkBuffer;
+	uint32_t _chunkSize;
+	uint8_t *_compressedBuffer;
+
+	PackWriter();
+	~PackWriter();
+
+	bool open(FILE *fp);
+	bool close();
+	bool addFile(const char *name, FILE *src, bool flatSectors); // fails on read errors and wrong sector checksums
+	bool writeChunk();
+};
+
+#endif // PACK_H__
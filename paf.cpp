@@ -4,11 +4,13 @@
  */
 
 #include "fs.h"
+#include "pack.h"
 #include "paf.h"
+#include "stats.h"
 #include "system.h"
 #include "util.h"
 
-static const char *_filenames[] = {
+const char *PafPlayer::_filenames[] = {
 	"hod.paf",
 	"hod_demo.paf",
 	"hod_demo2.paf",
@@ -16,14 +18,20 @@ static const char *_filenames[] = {
 	0
 };
 
-static bool openPaf(FileSystem *fs, File *f) {
-	for (int i = 0; _filenames[i]; ++i) {
-		FILE *fp = fs->openAssetFile(_filenames[i]);
+static bool openPaf(FileSystem *fs, File *&f) {
+	for (int i = 0; PafPlayer::_filenames[i]; ++i) {
+		f = fs->openPackedFile(PafPlayer::_filenames[i]);
+		if (f) {
+			return true;
+		}
+		FILE *fp = fs->openAssetFile(PafPlayer::_filenames[i]);
 		if (fp) {
+			f = new File;
 			f->setFp(fp);
 			return true;
 		}
 	}
+	f = new File;
 	return false;
 }
 
@@ -36,7 +44,7 @@ static void closePaf(FileSystem *fs, File *f) {
 
 PafPlayer::PafPlayer(FileSystem *fs)
 	: _fs(fs) {
-	_skipCutscenes = !openPaf(_fs, &_file);
+	_skipCutscenes = !openPaf(_fs, _file);
 	_videoNum = -1;
 	memset(&_pafHdr, 0, sizeof(_pafHdr));
 	memset(_pageBuffers, 0, sizeof(_pageBuffers));
@@ -51,7 +59,8 @@ PafPlayer::PafPlayer(FileSystem *fs)
 
 PafPlayer::~PafPlayer() {
 	unload();
-	closePaf(_fs, &_file);
+	closePaf(_fs, _file);
+	delete _file;
 }
 
 void PafPlayer::setVolume(int volume) {
@@ -65,15 +74,15 @@ void PafPlayer::preload(int num) {
 		unload(_videoNum);
 		_videoNum = num;
 	}
-	_file.seek(num * 4, SEEK_SET);
-	_videoOffset = _file.readUint32();
-	_file.seek(_videoOffset, SEEK_SET);
+	_file->seek(num * 4, SEEK_SET);
+	_videoOffset = _file->readUint32();
+	_file->seek(_videoOffset, SEEK_SET);
 	memset(&_pafHdr, 0, sizeof(_pafHdr));
 	if (!readPafHeader()) {
 		unload();
 		return;
 	}
-	uint8_t *buffer = (uint8_t *)calloc(kPageBufferSize * 4 + 256 * 4, 1);
+	uint8_t *buffer = (uint8_t *)memCalloc(kMemTag_Paf, kPageBufferSize * 4 + 256 * 4, 1);
 	if (!buffer) {
 		warning("preloadPaf() Unable to allocate page buffers");
 		unload();
@@ -82,9 +91,9 @@ void PafPlayer::preload(int num) {
 	for (int i = 0; i < 4; ++i) {
 		_pageBuffers[i] = buffer + i * kPageBufferSize;
 	}
-	_demuxVideoFrameBlocks = (uint8_t *)calloc(_pafHdr.maxVideoFrameBlocksCount, _pafHdr.readBufferSize);
+	_demuxVideoFrameBlocks = (uint8_t *)memCalloc(kMemTag_Paf, _pafHdr.maxVideoFrameBlocksCount, _pafHdr.readBufferSize);
 	if (_pafHdr.maxAudioFrameBlocksCount != 0) {
-		_demuxAudioFrameBlocks = (uint8_t *)calloc(_pafHdr.maxAudioFrameBlocksCount, _pafHdr.readBufferSize);
+		_demuxAudioFrameBlocks = (uint8_t *)memCalloc(kMemTag_Paf, _pafHdr.maxAudioFrameBlocksCount, _pafHdr.readBufferSize);
 		_flushAudioSize = (_pafHdr.maxAudioFrameBlocksCount - 1) * _pafHdr.readBufferSize;
 	} else {
 		_demuxAudioFrameBlocks = 0;
@@ -110,15 +119,15 @@ void PafPlayer::unload(int num) {
 	if (_videoNum < 0) {
 		return;
 	}
-	free(_pageBuffers[0]);
+	memFree(_pageBuffers[0]);
 	memset(_pageBuffers, 0, sizeof(_pageBuffers));
-	free(_demuxVideoFrameBlocks);
+	memFree(_demuxVideoFrameBlocks);
 	_demuxVideoFrameBlocks = 0;
-	free(_demuxAudioFrameBlocks);
+	memFree(_demuxAudioFrameBlocks);
 	_demuxAudioFrameBlocks = 0;
-	free(_pafHdr.frameBlocksCountTable);
-	free(_pafHdr.framesOffsetTable);
-	free(_pafHdr.frameBlocksOffsetTable);
+	memFree(_pafHdr.frameBlocksCountTable);
+	memFree(_pafHdr.framesOffsetTable);
+	memFree(_pafHdr.frameBlocksOffsetTable);
 	memset(&_pafHdr, 0, sizeof(_pafHdr));
 	_videoNum = -1;
 	while (_audioQueue) {
@@ -132,7 +141,7 @@ void PafPlayer::unload(int num) {
 
 bool PafPlayer::readPafHeader() {
 	static const char *kSignature = "Packed Animation File V1.0\n(c) 1992-96 Amazing Studio\n";
-	_file.read(_bufferBlock, kBufferBlockSize);
+	_file->read(_bufferBlock, kBufferBlockSize);
 	if (memcmp(_bufferBlock, kSignature, strlen(kSignature)) != 0) {
 		warning("readPafHeader() Unexpected signature");
 		return false;
@@ -161,17 +170,17 @@ bool PafPlayer::readPafHeader() {
 }
 
 uint32_t *PafPlayer::readPafHeaderTable(int count) {
-	uint32_t *dst = (uint32_t *)malloc(count * sizeof(uint32_t));
+	uint32_t *dst = (uint32_t *)memAlloc(kMemTag_Paf, count * sizeof(uint32_t));
 	if (!dst) {
 		warning("readPafHeaderTable() Unable to allocate %d bytes", count * sizeof(uint32_t));
 		return 0;
 	}
 	for (int i = 0; i < count; ++i) {
-		dst[i] = _file.readUint32();
+		dst[i] = _file->readUint32();
 	}
 	const int align = (count * 4) & 0x7FF;
 	if (align != 0) {
-		_file.seek(0x800 - align, SEEK_CUR);
+		_file->seek(0x800 - align, SEEK_CUR);
 	}
 	return dst;
 }
@@ -436,6 +445,7 @@ void PafPlayer::decodeAudioFrame(const uint8_t *src, uint32_t offset, uint32_t s
 }
 
 void PafPlayer::mix(int16_t *buf, int samples) {
+	AudioStatsTimer timer(&g_audioStats._pafMix);
 	while (_audioQueue && samples > 0) {
 		assert(_audioQueue->size != 0);
 		const int count = MIN(samples, _audioQueue->size - _audioQueue->offset);
@@ -456,6 +466,7 @@ void PafPlayer::mix(int16_t *buf, int samples) {
 	}
 	if (samples > 0) {
 		debug(kDebug_PAF, "audioQueue underrun %d", samples);
+		g_audioStats.addPafUnderrun(samples);
 	}
 }
 
@@ -464,7 +475,7 @@ static void mixAudio(void *userdata, int16_t *buf, int len) {
 }
 
 void PafPlayer::mainLoop() {
-	_file.seek(_videoOffset + _pafHdr.startOffset, SEEK_SET);
+	_file->seek(_videoOffset + _pafHdr.startOffset, SEEK_SET);
 	for (int i = 0; i < 4; ++i) {
 		memset(_pageBuffers[i], 0, kPageBufferSize);
 	}
@@ -493,7 +504,7 @@ void PafPlayer::mainLoop() {
 //		printf("frametime= %lu \n",_pafHdr.readBufferSize);
 		int blocksize = _pafHdr.readBufferSize*blocksCountForFrame;
 		uint8_t* betterbuffer = (uint8_t*)malloc(blocksize);
-		_file.read(betterbuffer,blocksize);
+		_file->read(betterbuffer,blocksize);
 		int counter =0;
 		while (blocksCountForFrame != 0) {
 			
@@ -513,7 +524,7 @@ void PafPlayer::mainLoop() {
 #else
 
 		while (blocksCountForFrame != 0) {
-			_file.read(_bufferBlock, _pafHdr.readBufferSize);
+			_file->read(_bufferBlock, _pafHdr.readBufferSize);
 			const uint32_t dstOffset = _pafHdr.frameBlocksOffsetTable[currentFrameBlock] & ~(1 << 31);
 			if (_pafHdr.frameBlocksOffsetTable[currentFrameBlock] & (1 << 31)) {
 				assert(dstOffset + _pafHdr.readBufferSize <= _pafHdr.maxAudioFrameBlocksCount * _pafHdr.readBufferSize);
@@ -547,6 +558,7 @@ void PafPlayer::mainLoop() {
 #ifdef __3DS__
 		free(betterbuffer);
 #endif
+		g_audioStats.update(g_system->getTimeStamp());
 		const int delay = MAX<int>(10, frameTime - g_system->getTimeStamp());
 		g_system->sleep(delay);
 		frameTime = g_system->getTimeStamp() + frameMs;
@@ -81,7 +81,7 @@ struct PafPlayer {
 
 	bool _skipCutscenes;
 	FileSystem *_fs;
-	File _file;
+	File *_file;
 	int _videoNum;
 	uint32_t _videoOffset;
 	PafHeader _pafHdr;
@@ -101,6 +101,8 @@ struct PafPlayer {
 	int _volume;
 	int _frameMs;
 
+	static const char *_filenames[];
+
 	PafPlayer(FileSystem *fs);
 	~PafPlayer();
 
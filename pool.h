@@ -0,0 +1,162 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef POOL_H__
+#define POOL_H__
+
+#include "intern.h"
+
+// fills the released entries, to catch the accesses through stale pointers
+static const bool kPoolPoisonReleased = false;
+
+struct PoolStats {
+	const char *name;
+	int capacity;
+	int used;
+	int peak; // high-water mark since the last resetStats()
+	uint32_t acquiredCount;
+	uint32_t failedCount; // no free entry
+	uint32_t invalidReleasesCount; // entries released twice
+
+	void resetStats() {
+		peak = used;
+		acquiredCount = 0;
+		failedCount = 0;
+		invalidReleasesCount = 0;
+	}
+};
+
+// fixed capacity pool over an existing table, the free entries are kept in a stack
+template <typename T, int N>
+struct Pool {
+	enum {
+		kPoisonByte = 0xA5,
+		kMaskSize = (N + 31) / 32
+	};
+
+	T *_table;
+	uint16_t _free[N]; // the top is the next entry returned by acquire()
+	uint16_t _freePos[N]; // position in _free of the free entries
+	int _freeCount;
+	uint32_t _freeMask[kMaskSize];
+	bool _ordered; // _free has not been modified since the last reset()
+	PoolStats _stats;
+
+	void init(const char *name, T *table) {
+		_table = table;
+		_stats.name = name;
+		_stats.capacity = N;
+		_ordered = false;
+		reset();
+		_stats.resetStats();
+	}
+
+	// all the entries are free, acquire() returns them in the table order
+	void reset() {
+		if (!_ordered) {
+			for (int i = 0; i < N; ++i) {
+				_free[i] = N - 1 - i;
+				_freePos[N - 1 - i] = i;
+			}
+			_ordered = true;
+		}
+		_freeCount = N;
+		for (int i = 0; i < kMaskSize; ++i) {
+			_freeMask[i] = 0xFFFFFFFF;
+		}
+		if (N & 31) {
+			_freeMask[kMaskSize - 1] = (1U << (N & 31)) - 1;
+		}
+		_stats.used = 0;
+	}
+
+	bool isFree(int i) const {
+		return (_freeMask[i >> 5] & (1U << (i & 31))) != 0;
+	}
+
+	// the entry was not written since its release
+	bool isPoisoned(const T *p) const {
+		if (!kPoolPoisonReleased) {
+			return false;
+		}
+		const uint8_t *b = (const uint8_t *)p;
+		for (unsigned int i = 0; i < sizeof(T); ++i) {
+			if (b[i] != kPoisonByte) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// the entry returned by the next acquire() call, not counted as a failure if the pool is full
+	T *peek() const {
+		if (_freeCount == 0) {
+			return 0;
+		}
+		return &_table[_free[_freeCount - 1]];
+	}
+
+	T *acquire() {
+		if (_freeCount == 0) {
+			++_stats.failedCount;
+			return 0;
+		}
+		const int i = _free[--_freeCount];
+		take(i);
+		return &_table[i];
+	}
+
+	// the free entry with the lowest index
+	T *acquireFirst() {
+		for (int j = 0; j < kMaskSize; ++j) {
+			uint32_t mask = _freeMask[j];
+			if (mask != 0) {
+				int i = j * 32;
+				for (; (mask & 1) == 0; mask >>= 1) {
+					++i;
+				}
+				// the top of the stack is moved in place of the entry
+				const int pos = _freePos[i];
+				const int top = _free[--_freeCount];
+				_free[pos] = top;
+				_freePos[top] = pos;
+				_ordered = false;
+				take(i);
+				return &_table[i];
+			}
+		}
+		++_stats.failedCount;
+		return 0;
+	}
+
+	void release(T *p) {
+		const int i = p - _table;
+		assert(i >= 0 && i < N);
+		if (isFree(i)) {
+			++_stats.invalidReleasesCount;
+			return;
+		}
+		_freeMask[i >> 5] |= 1U << (i & 31);
+		_freePos[i] = _freeCount;
+		_free[_freeCount++] = i;
+		_ordered = false;
+		--_stats.used;
+		if (kPoolPoisonReleased) {
+			memset(p, kPoisonByte, sizeof(T));
+		}
+	}
+
+private:
+	void take(int i) {
+		_freeMask[i >> 5] &= ~(1U << (i & 31));
+		++_stats.used;
+		if (_stats.used > _stats.peak) {
+			_stats.peak = _stats.used;
+		}
+		++_stats.acquiredCount;
+	}
+};
+
+#endif // POOL_H__
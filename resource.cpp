@@ -3,19 +3,37 @@
  * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <stddef.h>
 #include "fileio.h"
 #include "fs.h"
 #include "game.h"
 #include "lzw.h"
+#include "pack.h"
+#include "paf.h"
 #include "resource.h"
+#include "system.h"
 #include "util.h"
+#include "video.h"
 
 // load and uncompress .sss pcm on level start
 static const bool kPreloadSssPcm = true;
 
-static const bool kPreloadLvlBackgroundData = true;
+// load the .lvl, .mst and .sss files of a level on separate threads
+static const bool kParallelLevelDataLoad = true;
 
-static const bool kCheckSssBytecode = false;
+// cache the parsed .mst data in the save path
+static const bool kMstSnapshot = true;
+
+// maximum number of threads decoding the .sss PCM on level load
+static const int kMaxSssPcmDecodeThreads = 4;
+
+static const uint32_t kLvlScreenArenaBlockSize = 1024;
+
+// --verify-data reads the files in 1MB jobs, 64KB at a time
+static const uint32_t kSectorSize = 2048;
+static const uint32_t kVerifyJobSectors = 512;
+static const uint32_t kVerifyReadSectors = 32;
+static const int kMaxVerifyThreads = 8;
 
 // menu settings and player progress
 static const char *_setupCfg = "setup.cfg";
@@ -55,6 +73,70 @@ static void closeDat(FileSystem *fs, File *f) {
 	}
 }
 
+// reads from the archive if the file is packed
+static File *openAssetDat(FileSystem *fs, const char *name) {
+	File *f = fs->openPackedFile(name);
+	if (!f) {
+		f = new File;
+		if (!openDat(fs, name, f)) {
+			delete f;
+			return 0;
+		}
+	}
+	return f;
+}
+
+static void closeAssetDat(FileSystem *fs, File *f) {
+	if (f) {
+		closeDat(fs, f);
+		delete f;
+	}
+}
+
+static uint32_t getFileSize(FILE *fp) {
+	fseek(fp, 0, SEEK_END);
+	const long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	return (size < 0) ? 0 : size;
+}
+
+// de-sectored copies of the game data files are stored in the save path
+static void getFlatSectorDatName(const char *name, char *buf, int bufSize) {
+	snprintf(buf, bufSize, "%s.flat", name);
+}
+
+static FILE *openFlatSectorDat(FileSystem *fs, const char *name) {
+	char flatName[64];
+	getFlatSectorDatName(name, flatName, sizeof(flatName));
+	FILE *fp = fs->openSaveFile(flatName, false);
+	if (fp) {
+		FILE *sectorFp = fs->openAssetFile(name);
+		const uint32_t size = sectorFp ? fioFlatSectorSize(getFileSize(sectorFp)) : 0;
+		if (sectorFp) {
+			fs->closeFile(sectorFp);
+		}
+		if (size == 0 || getFileSize(fp) != size) {
+			debug(kDebug_RESOURCE, "Ignoring outdated '%s'", flatName);
+			fs->closeFile(fp);
+			fp = 0;
+		}
+	}
+	return fp;
+}
+
+static bool openSectorDat(FileSystem *fs, const char *name, File *&f) {
+	assert(!f->_fp);
+	delete f;
+	FILE *fp = openFlatSectorDat(fs, name);
+	if (fp) {
+		f = new FlatSectorFile;
+		f->setFp(fp);
+		return true;
+	}
+	f = new SectorFile;
+	return openDat(fs, name, f);
+}
+
 static int skipBytesAlign(File *f, int len) {
 	const int size = (len + 3) & ~3;
 	f->seek(size, SEEK_CUR);
@@ -70,7 +152,7 @@ static int readBytesAlign(File *f, uint8_t *buf, int len) {
 }
 
 Resource::Resource(FileSystem *fs)
-	: _fs(fs), _isPsx(false), _isDemo(false), _version(V1_1) {
+	: _fs(fs), _isPsx(false), _isDemo(false), _version(V1_1), _lvlArena("lvl", kMemTag_Lvl), _sssArena("sss", kMemTag_Sss), _sssPcmArena("sss pcm", kMemTag_SssPcm), _mstArena("mst", kMemTag_Mst) {
 
 	memset(_screensGrid, 0, sizeof(_screensGrid));
 	memset(_screensBasePos, 0, sizeof(_screensBasePos));
@@ -80,6 +162,8 @@ Resource::Resource(FileSystem *fs)
 	_resLevelData0x470CTable = 0;
 	_resLevelData0x470CTablePtrHdr = 0;
 	_resLevelData0x470CTablePtrData = 0;
+	memset(_lvlScreenMasksTable, 0, sizeof(_lvlScreenMasksTable));
+	memset(_lvlScreenPosTable, 0, sizeof(_lvlScreenPosTable));
 
 	_lvlSssOffset = 0;
 
@@ -93,10 +177,30 @@ Resource::Resource(FileSystem *fs)
 	memset(_resLvlScreenBackgroundDataTable, 0, sizeof(_resLvlScreenBackgroundDataTable));
 	memset(_resLvlScreenBackgroundDataPtrTable, 0, sizeof(_resLvlScreenBackgroundDataPtrTable));
 	memset(_resLevelData0x2B88SizeTable, 0, sizeof(_resLevelData0x2B88SizeTable));
+	for (unsigned int i = 0; i < kMaxScreens; ++i) {
+		// a background is a single allocation, the small blocks are for the LvlObjectData
+		_lvlScreenArenas[i]._name = "lvl screen";
+		_lvlScreenArenas[i]._memTag = kMemTag_Lvl;
+		_lvlScreenArenas[i]._blockSize = kLvlScreenArenaBlockSize;
+	}
 
 	memset(_resLvlScreenObjectDataTable, 0, sizeof(_resLvlScreenObjectDataTable));
 	memset(&_dummyObject, 0, sizeof(_dummyObject));
 
+	_levelName = 0;
+	_mstSnapshotData = 0;
+	_mstInstructions = 0;
+	_mstInstructionsLinked = false;
+	_mstWalkPathRoutes = 0;
+	_mstScreenAreaGrids = 0;
+	_mstWalkPathGrids = 0;
+	_preloadLvlBackgroundData = true;
+	_lvlScreensPrefetch = 0;
+	_lvlScreensResidentMax = 0;
+	_lvlScreensUseCounter = 0;
+	memset(_lvlScreensLastUse, 0, sizeof(_lvlScreensLastUse));
+	memset(_lvlScreensEvicted, 0, sizeof(_lvlScreensEvicted));
+
 	if (sectorAlignedGameData()) {
 		_datFile = new SectorFile;
 		_lvlFile = new SectorFile;
@@ -106,27 +210,30 @@ Resource::Resource(FileSystem *fs)
 		_version = V1_2;
 	} else {
 		_datFile = new File;
-		_lvlFile = new File;
-		_mstFile = new File;
-		_sssFile = new File;
+		// the level files are parsed with many small reads, map them in memory
+		_lvlFile = new MappedFile;
+		_mstFile = new MappedFile;
+		_sssFile = new MappedFile;
 		// detect if this is version 1.0 by reading the size of the first screen background using the v1.1 offset
 		char filename[32];
 		snprintf(filename, sizeof(filename), "%s_HOD.LVL", _prefixes[0]);
-		if (openDat(_fs, filename, _lvlFile)) {
-			_lvlFile->seek(0x2B88, SEEK_SET);
-			_lvlFile->skipUint32();
-			const int size = _lvlFile->readUint32();
+		File *f = openAssetDat(_fs, filename);
+		if (f) {
+			f->seek(0x2B88, SEEK_SET);
+			f->skipUint32();
+			const int size = f->readUint32();
 			if (size == 0) {
 				_version = V1_0;
 			}
-			closeDat(_fs, _lvlFile);
+			closeAssetDat(_fs, f);
 		}
 	}
 	// detect if this is a demo version by trying to open the second level data files
 	char filename[32];
 	snprintf(filename, sizeof(filename), "%s_HOD.LVL", _prefixes[1]);
-	if (openDat(_fs, filename, _lvlFile)) {
-		closeDat(_fs, _lvlFile);
+	File *f = openAssetDat(_fs, filename);
+	if (f) {
+		closeAssetDat(_fs, f);
 	} else {
 		_isDemo = true;
 	}
@@ -151,6 +258,7 @@ Resource::Resource(FileSystem *fs)
 }
 
 Resource::~Resource() {
+	finishLvlScreensPrefetch();
 	delete _datFile;
 	delete _lvlFile;
 	delete _mstFile;
@@ -158,6 +266,15 @@ Resource::~Resource() {
 }
 
 bool Resource::sectorAlignedGameData() {
+	PackedFile *packed = _fs->openPackedFile(_setupDat);
+	if (!packed) {
+		packed = _fs->openPackedFile(_setupDax);
+	}
+	if (packed) {
+		const bool ret = packed->flatSectors();
+		closeAssetDat(_fs, packed);
+		return ret;
+	}
 	FILE *fp = _fs->openAssetFile(_setupDat);
 	if (!fp) {
 		fp = _fs->openAssetFile(_setupDax);
@@ -176,8 +293,8 @@ bool Resource::sectorAlignedGameData() {
 }
 
 void Resource::loadSetupDat() {
-	if (!openDat(_fs, _setupDat, _datFile)) {
-		_isPsx = openDat(_fs, _setupDax, _datFile);
+	if (!openLevelDat(_setupDat, _datFile)) {
+		_isPsx = openLevelDat(_setupDax, _datFile);
 	}
 
 	_datHdr.version = _datFile->readUint32();
@@ -208,7 +325,7 @@ void Resource::loadSetupDat() {
 	}
 	_datFile->seek(2048, SEEK_SET); // align to next sector
 
-	_loadingImageBuffer = (uint8_t *)malloc(_datHdr.loadingImageSize);
+	_loadingImageBuffer = (uint8_t *)memAlloc(kMemTag_Resource, _datHdr.loadingImageSize);
 	if (_loadingImageBuffer) {
 		_datFile->read(_loadingImageBuffer, _datHdr.loadingImageSize);
 
@@ -226,7 +343,7 @@ void Resource::loadSetupDat() {
 
 		// font
 		static const int kFontSize = 16 * 16 * 64;
-		_fontBuffer = (uint8_t *)malloc(kFontSize);
+		_fontBuffer = (uint8_t *)memAlloc(kMemTag_Resource, kFontSize);
 		if (_fontBuffer) {
 			/* size = READ_LE_UINT32(_loadingImageBuffer + offset); */ offset += 4;
 			if (_datHdr.version == 11) {
@@ -285,43 +402,370 @@ void Resource::loadDatMenuBuffers() {
 
 	const uint32_t baseOffset = _menuBuffersOffset;
 	_datFile->seek(baseOffset, SEEK_SET);
-	_menuBuffer1 = (uint8_t *)malloc(_datHdr.bufferSize1);
+	_menuBuffer1 = (uint8_t *)memAlloc(kMemTag_Menu, _datHdr.bufferSize1);
 	if (_menuBuffer1) {
 		_datFile->read(_menuBuffer1, _datHdr.bufferSize1);
 	}
 	if (_datHdr.version == 11) {
 		_datFile->seek(baseOffset + fioAlignSizeTo2048(_datHdr.bufferSize1), SEEK_SET); // align to next sector
 	}
-	_menuBuffer0 = (uint8_t *)malloc(_datHdr.bufferSize0);
+	_menuBuffer0 = (uint8_t *)memAlloc(kMemTag_Menu, _datHdr.bufferSize0);
 	if (_menuBuffer0) {
 		_datFile->read(_menuBuffer0, _datHdr.bufferSize0);
 	}
 }
 
 void Resource::unloadDatMenuBuffers() {
-	free(_menuBuffer1);
+	memFree(_menuBuffer1);
 	_menuBuffer1 = 0;
-	free(_menuBuffer0);
+	memFree(_menuBuffer0);
 	_menuBuffer0 = 0;
 }
 
+bool Resource::openLevelDat(const char *name, File *&f) {
+	assert(!f->_fp);
+	File *packed = _fs->openPackedFile(name);
+	if (packed) {
+		delete f;
+		f = packed;
+		return true;
+	}
+	if (_version == V1_2) {
+		return openSectorDat(_fs, name, f);
+	}
+	// the previous file may have been read from the archive
+	const bool mapped = (&f != &_datFile);
+	delete f;
+	f = mapped ? new MappedFile : new File;
+	return openDat(_fs, name, f);
+}
+
+void Resource::flattenSectorDat(const char *name) {
+	char flatName[64];
+	getFlatSectorDatName(name, flatName, sizeof(flatName));
+	FILE *fp = openFlatSectorDat(_fs, name);
+	if (fp) {
+		_fs->closeFile(fp);
+		return;
+	}
+	FILE *sectorFp = _fs->openAssetFile(name);
+	if (!sectorFp) {
+		return;
+	}
+	fp = _fs->openSaveFile(flatName, true);
+	if (!fp) {
+		warning("Unable to open '%s' for writing", flatName);
+		_fs->closeFile(sectorFp);
+		return;
+	}
+	uint8_t buf[2048];
+	int sectorsCount = 0;
+	while (fread(buf, 1, sizeof(buf), sectorFp) == sizeof(buf)) {
+		if (fioUpdateCRC(0, buf, sizeof(buf)) != 0) {
+			warning("Bad checksum for sector %d in '%s'", sectorsCount, name);
+		}
+		fwrite(buf, 1, 2044, fp);
+		++sectorsCount;
+	}
+	_fs->closeFile(sectorFp);
+	if (_fs->closeFile(fp) != 0) {
+		warning("I/O error writing '%s'", flatName);
+	}
+	debug(kDebug_RESOURCE, "Wrote '%s' %d sectors", flatName, sectorsCount);
+}
+
+void Resource::flattenSectorFiles() {
+	if (_version != V1_2) {
+		return;
+	}
+	flattenSectorDat(_setupDat);
+	static const char *kExtensions[] = { "LVL", "MST", "SSS", 0 };
+	for (int i = 0; i < kLvl_test; ++i) {
+		for (int j = 0; kExtensions[j]; ++j) {
+			char filename[32];
+			snprintf(filename, sizeof(filename), "%s_HOD.%s", _prefixes[i], kExtensions[j]);
+			flattenSectorDat(filename);
+		}
+	}
+}
+
+static bool packDataFile(FileSystem *fs, PackWriter *pw, const char *name, bool flatSectors) {
+	FILE *fp = fs->openAssetFile(name);
+	if (!fp) {
+		return true;
+	}
+	const bool ret = pw->addFile(name, fp, flatSectors);
+	fs->closeFile(fp);
+	debug(kDebug_RESOURCE, "Packed '%s'", name);
+	return ret;
+}
+
+void Resource::packDataFiles() {
+	PackedFile *packed = _fs->openPackedFile(_setupDat);
+	if (!packed) {
+		packed = _fs->openPackedFile(_setupDax);
+	}
+	if (packed) {
+		closeAssetDat(_fs, packed);
+		debug(kDebug_RESOURCE, "Game data files already packed");
+		return;
+	}
+	FILE *fp = _fs->openSaveFile(kPackFileName, true);
+	if (!fp) {
+		warning("Unable to open '%s' for writing", kPackFileName);
+		return;
+	}
+	// the sector checksums are verified when packing and dropped from the archive
+	const bool flatSectors = (_version == V1_2);
+	PackWriter pw;
+	bool ret = pw.open(fp);
+	ret = ret && packDataFile(_fs, &pw, _setupDat, flatSectors);
+	ret = ret && packDataFile(_fs, &pw, _setupDax, false);
+	ret = ret && packDataFile(_fs, &pw, _hodDem, false);
+	static const char *kExtensions[] = { "LVL", "MST", "SSS", 0 };
+	for (int i = 0; ret && i < kLvl_test; ++i) {
+		for (int j = 0; ret && kExtensions[j]; ++j) {
+			char filename[32];
+			snprintf(filename, sizeof(filename), "%s_HOD.%s", _prefixes[i], kExtensions[j]);
+			ret = packDataFile(_fs, &pw, filename, flatSectors);
+		}
+	}
+	for (int i = 0; ret && PafPlayer::_filenames[i]; ++i) {
+		ret = packDataFile(_fs, &pw, PafPlayer::_filenames[i], false);
+	}
+	// the header is only written for a complete archive
+	ret = ret && pw.close();
+	if (_fs->closeFile(fp) != 0 || !ret) {
+		warning("I/O error writing '%s'", kPackFileName);
+		_fs->removeSaveFile(kPackFileName);
+	}
+	// the next lookups read the new archive
+	_fs->closePackArchive();
+}
+
+struct SectorVerifyJob {
+	enum {
+		kMaxBadSectors = 8
+	};
+	const char *name;
+	uint32_t firstSector;
+	uint32_t sectorsCount;
+	uint32_t badSectorsCount;
+	uint32_t badSectors[kMaxBadSectors];
+	bool readError;
+};
+
+struct SectorVerifyWorker {
+	FileSystem *fs;
+	SectorVerifyJob *jobs;
+	int jobsCount;
+	int first, step;
+};
+
+static void verifySectors(FileSystem *fs, SectorVerifyJob *job, uint8_t *buf) {
+	FILE *fp = fs->openAssetFile(job->name);
+	if (!fp || fseek(fp, job->firstSector * kSectorSize, SEEK_SET) != 0) {
+		job->readError = true;
+	} else {
+		for (uint32_t sector = 0; sector < job->sectorsCount; ) {
+			const uint32_t count = MIN<uint32_t>(job->sectorsCount - sector, kVerifyReadSectors);
+			if (fread(buf, kSectorSize, count, fp) != count) {
+				job->readError = true;
+				break;
+			}
+			for (uint32_t i = 0; i < count; ++i) {
+				if (fioUpdateCRC(0, buf + i * kSectorSize, kSectorSize) != 0) {
+					if (job->badSectorsCount < SectorVerifyJob::kMaxBadSectors) {
+						job->badSectors[job->badSectorsCount] = job->firstSector + sector + i;
+					}
+					++job->badSectorsCount;
+				}
+			}
+			sector += count;
+		}
+	}
+	if (fp) {
+		fs->closeFile(fp);
+	}
+}
+
+static int verifySectorsWorker(void *arg) {
+	const SectorVerifyWorker *worker = (const SectorVerifyWorker *)arg;
+	uint8_t *buf = (uint8_t *)malloc(kVerifyReadSectors * kSectorSize);
+	if (!buf) {
+		return -1;
+	}
+	for (int i = worker->first; i < worker->jobsCount; i += worker->step) {
+		verifySectors(worker->fs, &worker->jobs[i], buf);
+	}
+	free(buf);
+	return 0;
+}
+
+// adds the jobs checking the sectors of a file, the name is resolved on the calling thread
+static bool addSectorVerifyJobs(FileSystem *fs, const char *name, SectorVerifyJob **jobs, int *jobsCount, uint32_t *totalSize) {
+	FILE *fp = fs->openAssetFile(name);
+	if (!fp) {
+		return true;
+	}
+	const uint32_t size = getFileSize(fp);
+	fs->closeFile(fp);
+	*totalSize += size;
+	const uint32_t sectorsCount = size / kSectorSize;
+	for (uint32_t sector = 0; sector < sectorsCount; sector += kVerifyJobSectors) {
+		SectorVerifyJob *p = (SectorVerifyJob *)realloc(*jobs, (*jobsCount + 1) * sizeof(SectorVerifyJob));
+		if (!p) {
+			warning("Unable to allocate the sector verification jobs for '%s'", name);
+			return false;
+		}
+		*jobs = p;
+		SectorVerifyJob *job = &(*jobs)[(*jobsCount)++];
+		memset(job, 0, sizeof(SectorVerifyJob));
+		job->name = name;
+		job->firstSector = sector;
+		job->sectorsCount = MIN<uint32_t>(sectorsCount - sector, kVerifyJobSectors);
+	}
+	if ((size % kSectorSize) != 0) {
+		warning("'%s' size %d is not a multiple of the sector size", name, size);
+		return false;
+	}
+	return true;
+}
+
+bool Resource::verifyDataFiles() {
+	if (_version != V1_2) {
+		warning("The game data files are not sector aligned, nothing to verify");
+		return true;
+	}
+	const uint32_t t0 = System_getTimeStampUs();
+
+	static const char *kExtensions[] = { "LVL", "MST", "SSS", 0 };
+	static const int kFilesCount = 1 + kLvl_test * 3;
+	char filenames[kFilesCount][32];
+	snprintf(filenames[0], sizeof(filenames[0]), "%s", _setupDat);
+	for (int i = 0; i < kLvl_test; ++i) {
+		for (int j = 0; kExtensions[j]; ++j) {
+			snprintf(filenames[1 + i * 3 + j], sizeof(filenames[0]), "%s_HOD.%s", _prefixes[i], kExtensions[j]);
+		}
+	}
+	bool ret = true;
+	SectorVerifyJob *jobs = 0;
+	int jobsCount = 0;
+	uint32_t totalSize = 0;
+	for (int i = 0; i < kFilesCount; ++i) {
+		ret &= addSectorVerifyJobs(_fs, filenames[i], &jobs, &jobsCount, &totalSize);
+	}
+
+	// the jobs are statically split between the threads
+	SectorVerifyWorker workers[kMaxVerifyThreads];
+	void *threads[kMaxVerifyThreads];
+	const int threadsCount = CLIP(MIN(System_getCpuCount(), (int)kMaxVerifyThreads), 1, MAX(jobsCount, 1));
+	for (int i = 0; i < threadsCount; ++i) {
+		workers[i].fs = _fs;
+		workers[i].jobs = jobs;
+		workers[i].jobsCount = jobsCount;
+		workers[i].first = i;
+		workers[i].step = threadsCount;
+		threads[i] = (i == 0) ? 0 : System_createThread(verifySectorsWorker, &workers[i]);
+	}
+	for (int i = 0; i < threadsCount; ++i) {
+		const int status = threads[i] ? System_waitThread(threads[i]) : verifySectorsWorker(&workers[i]);
+		if (status != 0) {
+			warning("Sector verification thread %d failed", i);
+			ret = false;
+		}
+	}
+
+	uint32_t badSectorsCount = 0;
+	for (int i = 0; i < jobsCount; ++i) {
+		const SectorVerifyJob *job = &jobs[i];
+		if (job->readError) {
+			warning("Read error in '%s' sectors %d-%d", job->name, job->firstSector, job->firstSector + job->sectorsCount - 1);
+			ret = false;
+		}
+		for (uint32_t j = 0; j < MIN<uint32_t>(job->badSectorsCount, SectorVerifyJob::kMaxBadSectors); ++j) {
+			const uint32_t sector = job->badSectors[j];
+			warning("Bad checksum for sector %d (offset 0x%x) in '%s'", sector, sector * kSectorSize, job->name);
+		}
+		if (job->badSectorsCount > SectorVerifyJob::kMaxBadSectors) {
+			warning("%d more bad sectors in '%s'", job->badSectorsCount - SectorVerifyJob::kMaxBadSectors, job->name);
+		}
+		badSectorsCount += job->badSectorsCount;
+	}
+	free(jobs);
+	if (badSectorsCount != 0) {
+		ret = false;
+	}
+
+	const uint32_t us = MAX<uint32_t>(System_getTimeStampUs() - t0, 1);
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Verified %d bytes in %d us with %d threads (%.1f MB/s), %d bad sectors, data files %s",
+		totalSize, us, threadsCount, totalSize / (double)us, badSectorsCount, ret ? "OK" : "CORRUPT");
+	System_printLog(stdout, buffer);
+	return ret;
+}
+
+enum {
+	kLevelDataLvl,
+	kLevelDataMst,
+	kLevelDataSss,
+	kLevelDataCount
+};
+
+struct LevelDataLoader {
+	Resource *res;
+	int type;
+	File *fp;
+	uint32_t loadUs;
+};
+
+static int loadLevelDataWorker(void *arg) {
+	LevelDataLoader *loader = (LevelDataLoader *)arg;
+	const uint32_t t0 = System_getTimeStampUs();
+	switch (loader->type) {
+	case kLevelDataLvl:
+		loader->res->loadLvlData(loader->fp);
+		break;
+	case kLevelDataMst:
+		loader->res->loadMstData(loader->fp);
+		break;
+	case kLevelDataSss:
+		loader->res->loadSssData(loader->fp);
+		break;
+	}
+	loader->loadUs = System_getTimeStampUs() - t0;
+	return 0;
+}
+
 void Resource::loadLevelData(int levelNum) {
 
+	finishLvlScreensPrefetch();
+
 	char filename[32];
 	const char *levelName = _prefixes[levelNum];
+	_levelName = levelName;
+
+	const uint32_t t0 = System_getTimeStampUs();
+
+	LevelDataLoader loaders[kLevelDataCount];
+	int loadersCount = 0;
 
 	closeDat(_fs, _lvlFile);
 	snprintf(filename, sizeof(filename), "%s_HOD.LVL", levelName);
-	if (openDat(_fs, filename, _lvlFile)) {
-		loadLvlData(_lvlFile);
+	if (openLevelDat(filename, _lvlFile)) {
+		loaders[loadersCount].type = kLevelDataLvl;
+		loaders[loadersCount].fp = _lvlFile;
+		++loadersCount;
 	} else {
 		error("Unable to open '%s'", filename);
 	}
 
 	closeDat(_fs, _mstFile);
 	snprintf(filename, sizeof(filename), "%s_HOD.MST", levelName);
-	if (openDat(_fs, filename, _mstFile)) {
-		loadMstData(_mstFile);
+	if (openLevelDat(filename, _mstFile)) {
+		loaders[loadersCount].type = kLevelDataMst;
+		loaders[loadersCount].fp = _mstFile;
+		++loadersCount;
 	} else {
 		warning("Unable to open '%s'", filename);
 		memset(&_mstHdr, 0, sizeof(_mstHdr));
@@ -329,16 +773,67 @@ void Resource::loadLevelData(int levelNum) {
 
 	closeDat(_fs, _sssFile);
 	snprintf(filename, sizeof(filename), "%s_HOD.SSS", levelName);
-	if (openDat(_fs, filename, _sssFile)) {
-		loadSssData(_sssFile);
-	} else if (_isPsx) {
-		assert((_lvlSssOffset & 0x7FF) == 0);
-		_lvlFile->seek(_lvlSssOffset, SEEK_SET);
-		loadSssData(_lvlFile, _lvlSssOffset);
-	} else {
-		warning("Unable to open '%s'", filename);
-		memset(&_sssHdr, 0, sizeof(_sssHdr));
+	const bool sssFile = openLevelDat(filename, _sssFile);
+	if (sssFile) {
+		loaders[loadersCount].type = kLevelDataSss;
+		loaders[loadersCount].fp = _sssFile;
+		++loadersCount;
+	}
+
+	// the files are independent, each loader has its own File
+	void *threads[kLevelDataCount];
+	for (int i = 0; i < loadersCount; ++i) {
+		loaders[i].res = this;
+		loaders[i].loadUs = 0;
+		threads[i] = (kParallelLevelDataLoad && i != 0) ? System_createThread(loadLevelDataWorker, &loaders[i]) : 0;
+	}
+	for (int i = 0; i < loadersCount; ++i) {
+		if (threads[i]) {
+			System_waitThread(threads[i]);
+		} else {
+			loadLevelDataWorker(&loaders[i]);
+		}
+	}
+
+	if (!sssFile) {
+		if (_isPsx) {
+			// the .sss data is stored in the .lvl file, after the level data
+			assert((_lvlSssOffset & 0x7FF) == 0);
+			loaders[loadersCount].res = this;
+			loaders[loadersCount].type = kLevelDataSss;
+			loaders[loadersCount].fp = _lvlFile;
+			const uint32_t sssT0 = System_getTimeStampUs();
+			_lvlFile->seek(_lvlSssOffset, SEEK_SET);
+			loadSssData(_lvlFile, _lvlSssOffset);
+			loaders[loadersCount].loadUs = System_getTimeStampUs() - sssT0;
+			++loadersCount;
+		} else {
+			warning("Unable to open '%s'", filename);
+			memset(&_sssHdr, 0, sizeof(_sssHdr));
+		}
+	}
+
+	static const char *kNames[] = { "lvl", "mst", "sss" };
+	for (int i = 0; i < loadersCount; ++i) {
+		debug(kDebug_RESOURCE, "Resource::loadLevelData() %s_hod.%s %d ms", levelName, kNames[loaders[i].type], loaders[i].loadUs / 1000);
+	}
+	debug(kDebug_RESOURCE, "Resource::loadLevelData() level %d total %d ms", levelNum, (System_getTimeStampUs() - t0) / 1000);
+	dumpArenasUsage();
+}
+
+void Resource::dumpArenasUsage() {
+	const Arena *arenas[] = { &_lvlArena, &_sssArena, &_sssPcmArena, &_mstArena };
+	for (unsigned int i = 0; i < ARRAYSIZE(arenas); ++i) {
+		const Arena *a = arenas[i];
+		debug(kDebug_RESOURCE, "Arena '%s' %d allocations, %d bytes (%d reserved) peak %d", a->_name, a->_allocationsCount, a->_size, a->_reservedSize, a->_peakSize);
+	}
+	uint32_t size = 0, reservedSize = 0, peakSize = 0;
+	for (unsigned int i = 0; i < kMaxScreens; ++i) {
+		size += _lvlScreenArenas[i]._size;
+		reservedSize += _lvlScreenArenas[i]._reservedSize;
+		peakSize += _lvlScreenArenas[i]._peakSize;
 	}
+	debug(kDebug_RESOURCE, "Arena 'lvl screen' %d screens, %d bytes (%d reserved) peak %d", kMaxScreens, size, reservedSize, peakSize);
 }
 
 void Resource::loadLvlScreenObjectData(LvlObject *dat, const uint8_t *src) {
@@ -382,7 +877,7 @@ void Resource::loadLvlScreenObjectData(LvlObject *dat, const uint8_t *src) {
 	assert((src - start) == 96);
 }
 
-static uint32_t resFixPointersLevelData0x2988(uint8_t *src, uint8_t *ptr, LvlObjectData *dat, bool isPsx) {
+static uint32_t resFixPointersLevelData0x2988(uint8_t *src, uint8_t *ptr, LvlObjectData *dat, bool isPsx, Arena *arena) {
 	uint8_t *base = src;
 
 	dat->unk0 = *src++;
@@ -457,7 +952,7 @@ static uint32_t resFixPointersLevelData0x2988(uint8_t *src, uint8_t *ptr, LvlObj
 
 	if (dat->unk0 == 1) { // fixed size offset table
 		assert(isPsx);
-		dat->framesOffsetsTable = (uint8_t *)malloc(dat->framesCount * sizeof(uint32_t));
+		dat->framesOffsetsTable = (uint8_t *)arena->allocate(dat->framesCount * sizeof(uint32_t));
 		uint32_t framesOffset = 6 * dat->framesCount;
 		if (READ_LE_UINT16(dat->framesData + framesOffset) == 0) {
 			framesOffset += 2;
@@ -505,12 +1000,12 @@ void Resource::loadLvlSpriteData(int num, const uint8_t *buf) {
 	}
 	const uint32_t readSize = READ_LE_UINT32(&buf[8]);
 	assert(readSize <= size);
-	uint8_t *ptr = (uint8_t *)malloc(size);
+	uint8_t *ptr = (uint8_t *)_lvlArena.allocate(size);
 	_lvlFile->seek(_isPsx ? _lvlSssOffset + offset : offset, SEEK_SET);
 	_lvlFile->read(ptr, readSize);
 
 	LvlObjectData *dat = &_resLevelData0x2988Table[num];
-	const uint32_t readOffsetsSize = resFixPointersLevelData0x2988(ptr, ptr + readSize, dat, _isPsx);
+	const uint32_t readOffsetsSize = resFixPointersLevelData0x2988(ptr, ptr + readSize, dat, _isPsx, &_lvlArena);
 	const uint32_t allocatedOffsetsSize = size - readSize;
 	assert(allocatedOffsetsSize == readOffsetsSize);
 
@@ -531,15 +1026,42 @@ const uint8_t *Resource::getLvlScreenPosDataPtr(int num) const {
 	return (offset != 0) ? _resLevelData0x470CTable + offset : 0;
 }
 
+uint8_t *Resource::decodeLvlScreenGrid(const uint8_t *data) {
+	if (!data) {
+		return 0;
+	}
+	uint8_t *grid = (uint8_t *)_lvlArena.allocate(32 * 24);
+	Video::decodeRLE(data, grid, 32 * 24);
+	return grid;
+}
+
+const uint8_t *Resource::getLvlScreenMask(int num) {
+	assert((unsigned int)num < kMaxScreens * 4);
+	if (!_lvlScreenMasksTable[num]) {
+		_lvlScreenMasksTable[num] = decodeLvlScreenGrid(getLvlScreenMaskDataPtr(num));
+	}
+	return _lvlScreenMasksTable[num];
+}
+
+const uint8_t *Resource::getLvlScreenPos(int num) {
+	assert((unsigned int)num < kMaxScreens * 4);
+	if (!_lvlScreenPosTable[num]) {
+		_lvlScreenPosTable[num] = decodeLvlScreenGrid(getLvlScreenPosDataPtr(num));
+	}
+	return _lvlScreenPosTable[num];
+}
+
 void Resource::loadLvlScreenMaskData() {
 	_lvlFile->seekAlign(_lvlMasksOffset);
 	const uint32_t offset = _lvlFile->readUint32();
 	const uint32_t size = _lvlFile->readUint32();
-	_resLevelData0x470CTable = (uint8_t *)malloc(size);
+	_resLevelData0x470CTable = (uint8_t *)_lvlArena.allocate(size);
 	_lvlFile->seek(offset, SEEK_SET);
 	_lvlFile->read(_resLevelData0x470CTable, size);
 	_resLevelData0x470CTablePtrHdr = _resLevelData0x470CTable;
 	_resLevelData0x470CTablePtrData = _resLevelData0x470CTable + (kMaxScreens * 4) * (2 * sizeof(uint32_t));
+	memset(_lvlScreenMasksTable, 0, sizeof(_lvlScreenMasksTable));
+	memset(_lvlScreenPosTable, 0, sizeof(_lvlScreenPosTable));
 	// .sss is embedded in .lvl on PSX
 	_lvlSssOffset = offset + fioAlignSizeTo2048(size);
 }
@@ -609,7 +1131,7 @@ void Resource::loadLvlData(File *fp) {
 
 	memset(_resLevelData0x2B88SizeTable, 0, sizeof(_resLevelData0x2B88SizeTable));
 
-	if (kPreloadLvlBackgroundData) {
+	if (_preloadLvlBackgroundData) {
 		_lvlFile->seekAlign(_lvlBackgroundsOffset);
 		uint8_t buf[kMaxScreens * 16];
 		assert(_lvlHdr.screensCount <= kMaxScreens);
@@ -621,23 +1143,25 @@ void Resource::loadLvlData(File *fp) {
 }
 
 void Resource::unloadLvlData() {
-	free(_resLevelData0x470CTable);
+	_lvlArena.reset();
 	_resLevelData0x470CTable = 0;
+	memset(_lvlScreenMasksTable, 0, sizeof(_lvlScreenMasksTable));
+	memset(_lvlScreenPosTable, 0, sizeof(_lvlScreenPosTable));
 	for (unsigned int i = 0; i < kMaxScreens; ++i) {
 		unloadLvlScreenBackgroundData(i);
 	}
+	memset(_resLvlScreenBackgroundDataTable, 0, sizeof(_resLvlScreenBackgroundDataTable));
+	memset(_lvlScreensEvicted, 0, sizeof(_lvlScreensEvicted));
 	for (unsigned int i = 0; i < kMaxSpriteTypes; ++i) {
 		LvlObjectData *dat = &_resLevelData0x2988Table[i];
 		if (dat->unk0 == 1) {
-			free(dat->framesOffsetsTable);
 			dat->framesOffsetsTable = 0;
 		}
-		free(_resLvlSpriteDataPtrTable[i]);
 		_resLvlSpriteDataPtrTable[i] = 0;
 	}
 }
 
-static uint32_t resFixPointersLevelData0x2B88(const uint8_t *src, uint8_t *ptr, uint8_t *offsetsPtr, LvlBackgroundData *dat, bool isPsx) {
+static uint32_t resFixPointersLevelData0x2B88(const uint8_t *src, uint8_t *ptr, uint8_t *offsetsPtr, LvlBackgroundData *dat, bool isPsx, Arena *arena) {
 	const uint8_t *start = src;
 
 	dat->backgroundCount = *src++;
@@ -682,8 +1206,8 @@ static uint32_t resFixPointersLevelData0x2B88(const uint8_t *src, uint8_t *ptr,
 	for (int i = 0; i < 8; ++i) {
 		const uint32_t offs = READ_LE_UINT32(src); src += 4;
 		if (offs != 0) {
-			dat->backgroundLvlObjectDataTable[i] = (LvlObjectData *)malloc(sizeof(LvlObjectData));
-			offsetsSize += resFixPointersLevelData0x2988(ptr + offs, offsetsPtr + offsetsSize, dat->backgroundLvlObjectDataTable[i], isPsx);
+			dat->backgroundLvlObjectDataTable[i] = (LvlObjectData *)arena->allocate(sizeof(LvlObjectData));
+			offsetsSize += resFixPointersLevelData0x2988(ptr + offs, offsetsPtr + offsetsSize, dat->backgroundLvlObjectDataTable[i], isPsx, arena);
 		} else {
 			dat->backgroundLvlObjectDataTable[i] = 0;
 		}
@@ -692,52 +1216,82 @@ static uint32_t resFixPointersLevelData0x2B88(const uint8_t *src, uint8_t *ptr,
 	return offsetsSize;
 }
 
-void Resource::loadLvlScreenBackgroundData(int num, const uint8_t *buf) {
-	assert((unsigned int)num < kMaxScreens);
-
-	static const uint32_t baseOffset = _lvlBackgroundsOffset;
-
+// reads the data of a screen background, the pointers are fixed up by installLvlScreenBackgroundData
+// the buffer is malloc'ed when no arena is passed (prefetch thread)
+static uint8_t *readLvlScreenBackgroundData(File *f, int num, const uint8_t *buf, uint32_t baseOffset, uint32_t dataOffset, uint32_t *size, uint32_t *readSize, uint8_t *hdr, Arena *arena) {
 	uint8_t header[3 * sizeof(uint32_t)];
 	if (!buf) {
-		_lvlFile->seekAlign(baseOffset + num * 16);
-		_lvlFile->read(header, sizeof(header));
+		f->seekAlign(baseOffset + num * 16);
+		f->read(header, sizeof(header));
 		buf = header;
 	}
 	const uint32_t offset = READ_LE_UINT32(&buf[0]);
-	const uint32_t size = READ_LE_UINT32(&buf[4]);
-	if (size == 0) {
-		return;
+	*size = READ_LE_UINT32(&buf[4]);
+	if (*size == 0) {
+		return 0;
 	}
-	const uint32_t readSize = READ_LE_UINT32(&buf[8]);
-	assert(readSize <= size);
-	uint8_t *ptr = (uint8_t *)malloc(size);
-	_lvlFile->seek(_isPsx ? _lvlSssOffset + offset : offset, SEEK_SET);
-	_lvlFile->read(ptr, readSize);
+	*readSize = READ_LE_UINT32(&buf[8]);
+	assert(*readSize <= *size);
+	uint8_t *ptr = arena ? (uint8_t *)arena->allocate(*size) : (uint8_t *)malloc(*size);
+	f->seek(dataOffset + offset, SEEK_SET);
+	f->read(ptr, *readSize);
+
+	f->seekAlign(baseOffset + kMaxScreens * 16 + num * 160);
+	f->read(hdr, 160);
+	return ptr;
+}
+
+void Resource::loadLvlScreenBackgroundData(int num, const uint8_t *buf) {
+	assert((unsigned int)num < kMaxScreens);
 
+	uint32_t size, readSize;
 	uint8_t hdr[160];
-	_lvlFile->seekAlign(baseOffset + kMaxScreens * 16 + num * 160);
-	_lvlFile->read(hdr, 160);
+	uint8_t *ptr = readLvlScreenBackgroundData(_lvlFile, num, buf, _lvlBackgroundsOffset, _isPsx ? _lvlSssOffset : 0, &size, &readSize, hdr, &_lvlScreenArenas[num]);
+	if (ptr) {
+		installLvlScreenBackgroundData(num, ptr, size, readSize, hdr);
+	}
+}
+
+void Resource::installLvlScreenBackgroundData(int num, uint8_t *ptr, uint32_t size, uint32_t readSize, const uint8_t *hdr) {
 	LvlBackgroundData *dat = &_resLvlScreenBackgroundDataTable[num];
-	const uint32_t readOffsetsSize = resFixPointersLevelData0x2B88(hdr, ptr, ptr + readSize, dat, _isPsx);
+	const LvlBackgroundData state = *dat;
+	const uint32_t readOffsetsSize = resFixPointersLevelData0x2B88(hdr, ptr, ptr + readSize, dat, _isPsx, &_lvlScreenArenas[num]);
 	const uint32_t allocatedOffsetsSize = size - readSize;
 	assert(allocatedOffsetsSize == readOffsetsSize);
+	if (_lvlScreensEvicted[num]) {
+		// keep the state set by the level scripts
+		dat->currentBackgroundId = state.currentBackgroundId;
+		dat->currentMaskId = state.currentMaskId;
+		dat->currentShadowId = state.currentShadowId;
+		dat->currentSoundId = state.currentSoundId;
+		_lvlScreensEvicted[num] = false;
+	}
 
 	_resLvlScreenBackgroundDataPtrTable[num] = ptr;
 	_resLevelData0x2B88SizeTable[num] = size;
+	_lvlScreensLastUse[num] = ++_lvlScreensUseCounter;
 }
 
 void Resource::unloadLvlScreenBackgroundData(int num) {
 	if (_resLevelData0x2B88SizeTable[num] != 0) {
-		free(_resLvlScreenBackgroundDataPtrTable[num]);
 		_resLvlScreenBackgroundDataPtrTable[num] = 0;
 		_resLevelData0x2B88SizeTable[num] = 0;
-
-		LvlBackgroundData *dat = &_resLvlScreenBackgroundDataTable[num];
-		for (int i = 0; i < 4; ++i) {
-			free(dat->backgroundLvlObjectDataTable[i]);
-		}
-		memset(dat, 0, sizeof(LvlBackgroundData));
+		memset(&_resLvlScreenBackgroundDataTable[num], 0, sizeof(LvlBackgroundData));
 	}
+	_lvlScreenArenas[num].reset();
+}
+
+void Resource::evictLvlScreenBackgroundData(int num) {
+	LvlBackgroundData *dat = &_resLvlScreenBackgroundDataTable[num];
+	const LvlBackgroundData state = *dat;
+	unloadLvlScreenBackgroundData(num);
+	dat->currentBackgroundId = state.currentBackgroundId;
+	dat->currentMaskId = state.currentMaskId;
+	dat->currentShadowId = state.currentShadowId;
+	dat->currentSoundId = state.currentSoundId;
+	_lvlScreensEvicted[num] = true;
+	// the screen objects point to the background data, they are setup again on the next visit
+	_screensState[num].s2 = 0;
 }
 
 bool Resource::isLvlSpriteDataLoaded(int num) const {
@@ -802,6 +1356,122 @@ int Resource::findScreenGridIndex(int screenNum) const {
 	return -1;
 }
 
+static int8_t sext8(uint8_t x, int bits) {
+	const int shift = 8 - bits;
+	return ((int8_t)(x << shift)) >> shift;
+}
+
+// decodes PSX SPU ADPCM, each 16 bytes unit holds 28 samples upsampled to 56
+struct SpuAdpcmDecoder {
+	static void decode(const uint8_t *src, int16_t *dst, int &l0, int &l1) {
+		static const int16_t K0_1024[] = { 0, 960, 1840, 1568, 1952 };
+		static const int16_t K1_1024[] = { 0,   0, -832, -880, -960 };
+		const uint8_t param = *src++;
+		const int shift = 12 - (param & 15);
+		assert(shift >= 0);
+		const int filter = param >> 4;
+		assert(filter < 5);
+		const int k0 = K0_1024[filter];
+		const int k1 = K1_1024[filter];
+		const int flag = *src++;
+		assert(flag < 7);
+		for (int i = 0; i < 14; ++i) {
+			const uint8_t b = *src++;
+			const int s1 = (sext8(b & 15, 4) << shift) + ((l0 * k0 + l1 * k1 + 512) >> 10);
+			dst[0] = (l0 + s1) >> 1;
+			dst[1] = CLIP(s1, -32768, 32767);
+			const int s2 = (sext8(b >> 4, 4) << shift) + ((s1 * k0 + l0 * k1 + 512) >> 10);
+			dst[2] = (s1 + s2) >> 1;
+			dst[3] = CLIP(s2, -32768, 32767);
+			dst += 4;
+			l1 = s1;
+			l0 = s2;
+		}
+	}
+
+	// the state is reset on each stride
+	static void decodeStride(const uint8_t *src, int16_t *dst) { // src: 512 bytes, dst: 1792 samples
+		int l0 = 0;
+		int l1 = 0;
+		for (int i = 0; i < 512; i += 16) {
+			decode(src + i, dst, l0, l1);
+			dst += 56;
+		}
+	}
+};
+
+static void decodeSssPcm(SssPcm *pcm, const uint8_t *src, bool isPsx) {
+	int16_t *p = pcm->ptr;
+	if (isPsx) {
+		assert(pcm->strideSize == 512);
+		for (int i = 0; i < pcm->strideCount; ++i) {
+			SpuAdpcmDecoder::decodeStride(src, p);
+			src += 512;
+			p += 56 * 32;
+		}
+	} else {
+		const uint32_t strideSize = pcm->strideSize;
+		assert(strideSize == 2276 || strideSize == 4040);
+		for (int i = 0; i < pcm->strideCount; ++i) {
+			for (unsigned int j = 256 * sizeof(int16_t); j < strideSize; ++j) {
+				*p++ = READ_LE_UINT16(src + src[j] * sizeof(int16_t));
+			}
+			src += strideSize;
+		}
+	}
+	assert((p - pcm->ptr) * sizeof(int16_t) == pcm->pcmSize);
+}
+
+struct SssPcmDecodeJob {
+	SssPcm *pcm;
+	uint8_t *data;
+};
+
+struct SssPcmDecodeWorker {
+	SssPcmDecodeJob *jobs;
+	int jobsCount;
+	int first, step;
+	bool isPsx;
+};
+
+static int decodeSssPcmWorker(void *arg) {
+	const SssPcmDecodeWorker *worker = (const SssPcmDecodeWorker *)arg;
+	for (int i = worker->first; i < worker->jobsCount; i += worker->step) {
+		decodeSssPcm(worker->jobs[i].pcm, worker->jobs[i].data, worker->isPsx);
+	}
+	return 0;
+}
+
+static int getSssPcmDecodeThreadsCount() {
+	return MIN(System_getCpuCount(), (int)kMaxSssPcmDecodeThreads);
+}
+
+// the PCMs are independent, the jobs are statically split between the threads
+static void decodeSssPcmJobs(SssPcmDecodeJob *jobs, int count, bool isPsx) {
+	SssPcmDecodeWorker workers[kMaxSssPcmDecodeThreads];
+	void *threads[kMaxSssPcmDecodeThreads];
+	const int threadsCount = CLIP(getSssPcmDecodeThreadsCount(), 1, count);
+	for (int i = 0; i < threadsCount; ++i) {
+		workers[i].jobs = jobs;
+		workers[i].jobsCount = count;
+		workers[i].first = i;
+		workers[i].step = threadsCount;
+		workers[i].isPsx = isPsx;
+		threads[i] = (i == 0) ? 0 : System_createThread(decodeSssPcmWorker, &workers[i]);
+	}
+	for (int i = 0; i < threadsCount; ++i) {
+		if (threads[i]) {
+			System_waitThread(threads[i]);
+		} else {
+			decodeSssPcmWorker(&workers[i]);
+		}
+	}
+	for (int i = 0; i < count; ++i) {
+		free(jobs[i].data);
+		jobs[i].data = 0;
+	}
+}
+
 void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 
 	assert(fp == _sssFile || fp == _datFile || fp == _lvlFile);
@@ -847,7 +1517,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 	// _sssBuffer1
 	int bytesRead = 0;
 
-	_sssInfosData.allocate(_sssHdr.infosDataCount);
+	_sssInfosData.allocate(_sssHdr.infosDataCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.infosDataCount; ++i) {
 		_sssInfosData[i].sssBankIndex = fp->readUint16(); // index _sssBanksData
 		_sssInfosData[i].sampleIndex = fp->readByte();
@@ -858,7 +1528,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		fp->skipByte(); // padding to 8 bytes
 		bytesRead += 8;
 	}
-	_sssDefaultsData.allocate(_sssHdr.filtersDataCount);
+	_sssDefaultsData.allocate(_sssHdr.filtersDataCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.filtersDataCount; ++i) {
 		_sssDefaultsData[i].defaultVolume   = fp->readByte();
 		_sssDefaultsData[i].defaultPriority = fp->readByte();
@@ -866,7 +1536,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		fp->skipByte(); // padding to 4 bytes
 		bytesRead += 4;
 	}
-	_sssBanksData.allocate(_sssHdr.banksDataCount);
+	_sssBanksData.allocate(_sssHdr.banksDataCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.banksDataCount; ++i) {
 		_sssBanksData[i].flags = fp->readByte();
 		_sssBanksData[i].count = fp->readByte();
@@ -876,7 +1546,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		debug(kDebug_RESOURCE, "SssBank #%d count %d codeOffset 0x%x", i, _sssBanksData[i].count, _sssBanksData[i].firstSampleIndex);
 		bytesRead += 8;
 	}
-	_sssSamplesData.allocate(_sssHdr.samplesDataCount);
+	_sssSamplesData.allocate(_sssHdr.samplesDataCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.samplesDataCount; ++i) {
 		_sssSamplesData[i].pcm = fp->readUint16();
 		_sssSamplesData[i].framesCount = fp->readUint16();
@@ -891,9 +1561,11 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		debug(kDebug_RESOURCE, "SssSample #%d pcm %d frames %d", i, _sssSamplesData[i].pcm, _sssSamplesData[i].framesCount);
 		bytesRead += 24;
 	}
-	_sssCodeData = (uint8_t *)malloc(_sssHdr.codeSize);
-	fp->read(_sssCodeData, _sssHdr.codeSize);
+	uint8_t *codeData = (uint8_t *)malloc(_sssHdr.codeSize);
+	fp->read(codeData, _sssHdr.codeSize);
 	bytesRead += _sssHdr.codeSize;
+	decodeSssCode(codeData, _sssHdr.codeSize);
+	free(codeData);
 	if (_sssHdr.version == 10 || _sssHdr.version == 12) {
 
 		// _sssPreloadData1
@@ -906,7 +1578,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		fp->seek(_sssHdr.preloadData3Count * 4, SEEK_CUR);
 		bytesRead += _sssHdr.preloadData3Count * 4;
 
-		_sssPreload1Table.allocate(_sssHdr.preloadData1Count);
+		_sssPreload1Table.allocate(_sssHdr.preloadData1Count, &_sssArena);
 		const int ptrSize = (_sssHdr.version == 12) ? 2 : 1;
 		for (int i = 0; i < _sssHdr.preloadData1Count; ++i) {
 			const int count = (ptrSize == 2) ? fp->readUint16() : fp->readByte();
@@ -914,7 +1586,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 			_sssPreload1Table[i].count = count;
 			_sssPreload1Table[i].ptrSize = ptrSize;
 			const int tableSize = ptrSize * count;
-			_sssPreload1Table[i].ptr = (uint8_t *)malloc(tableSize);
+			_sssPreload1Table[i].ptr = (uint8_t *)_sssArena.allocate(tableSize);
 			fp->read(_sssPreload1Table[i].ptr, tableSize);
 			bytesRead += tableSize + ptrSize;
 		}
@@ -937,7 +1609,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		}
 		// _sssPreloadInfosData = data;
 	}
-	_sssPreloadInfosData.allocate(_sssHdr.preloadInfoCount);
+	_sssPreloadInfosData.allocate(_sssHdr.preloadInfoCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.preloadInfoCount; ++i) {
 		_sssPreloadInfosData[i].count = fp->readUint32();
 		fp->readUint32();
@@ -948,7 +1620,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		static const int kSizeOfPreloadInfoData_V10 = 32;
 		for (int i = 0; i < _sssHdr.preloadInfoCount; ++i) {
 			const int count = _sssPreloadInfosData[i].count;
-			_sssPreloadInfosData[i].data = (SssPreloadInfoData *)calloc(count, sizeof(SssPreloadInfoData));
+			_sssPreloadInfosData[i].data = (SssPreloadInfoData *)_sssArena.allocateZero(count * sizeof(SssPreloadInfoData));
 			for (int j = 0; j < count; ++j) {
 				SssPreloadInfoData *preloadInfoData = &_sssPreloadInfosData[i].data[j];
 				preloadInfoData->pcmBlockOffset = fp->readUint16();
@@ -980,7 +1652,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 
 		for (int i = 0; i < _sssHdr.preloadInfoCount; ++i) {
 			const int count = _sssPreloadInfosData[i].count;
-			_sssPreloadInfosData[i].data = (SssPreloadInfoData *)calloc(count, sizeof(SssPreloadInfoData));
+			_sssPreloadInfosData[i].data = (SssPreloadInfoData *)_sssArena.allocateZero(count * sizeof(SssPreloadInfoData));
 
 			fp->read(buffer, kSizeOfPreloadInfoData_V6 * count);
 			bytesRead += kSizeOfPreloadInfoData_V6 * count;
@@ -993,7 +1665,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 				preloadInfoData->preload1Data_V6.count = READ_LE_UINT32(buffer + j * kSizeOfPreloadInfoData_V6 + 0x2C);
 				preloadInfoData->preload1Data_V6.ptrSize = 2;
 				const int preload1DataLen = ((preloadInfoData->preload1Data_V6.count * 2) + 3) & ~3;
-				preloadInfoData->preload1Data_V6.ptr = (uint8_t *)malloc(preload1DataLen);
+				preloadInfoData->preload1Data_V6.ptr = (uint8_t *)_sssArena.allocate(preload1DataLen);
 				bytesRead += fp->read(preloadInfoData->preload1Data_V6.ptr, preload1DataLen);
 
 				static const int8_t offsets[7] = { 0x30, 0x34, 0x04, 0x08, 0x0C, 0x10, 0x14 };
@@ -1006,7 +1678,7 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 		}
 	}
 
-	_sssPcmTable.allocate(_sssHdr.pcmCount);
+	_sssPcmTable.allocate(_sssHdr.pcmCount, &_sssArena);
 	uint32_t sssPcmOffset = baseOffset;
 	for (int i = 0; i < _sssHdr.pcmCount; ++i) {
 		_sssPcmTable[i].ptr = 0; fp->skipUint32();
@@ -1040,10 +1712,10 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 	// allocate structure but skip read as table is cleared and initialized in clearSoundObjects()
 	static const int kSizeOfSssFilter = 52;
 	fp->seek(_sssHdr.filtersDataCount * kSizeOfSssFilter, SEEK_CUR);
-	_sssFilters.allocate(_sssHdr.filtersDataCount);
+	_sssFilters.allocate(_sssHdr.filtersDataCount, &_sssArena);
 	bytesRead += _sssHdr.filtersDataCount * kSizeOfSssFilter;
 
-	_sssDataUnk6.allocate(_sssHdr.banksDataCount);
+	_sssDataUnk6.allocate(_sssHdr.banksDataCount, &_sssArena);
 	for (int i = 0; i < _sssHdr.banksDataCount; ++i) {
 		_sssDataUnk6[i].unk0[0] = fp->readUint32();
 		_sssDataUnk6[i].unk0[1] = fp->readUint32();
@@ -1059,15 +1731,12 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 	fp->seek(lutSize * 3 * 3, SEEK_CUR);
 	bytesRead += lutSize * 3 * 3;
 	for (int i = 0; i < 3; ++i) {
-		_sssGroup1[i] = (uint32_t *)malloc(lutSize);
-		_sssGroup2[i] = (uint32_t *)malloc(lutSize);
-		_sssGroup3[i] = (uint32_t *)malloc(lutSize);
+		_sssGroup1[i] = (uint32_t *)_sssArena.allocate(lutSize);
+		_sssGroup2[i] = (uint32_t *)_sssArena.allocate(lutSize);
+		_sssGroup3[i] = (uint32_t *)_sssArena.allocate(lutSize);
 	}
 	// _sssPreloadedPcmTotalSize = 0;
 
-	if (kCheckSssBytecode) {
-		checkSssCode(_sssCodeData, _sssHdr.codeSize);
-	}
 	for (int i = 0; i < _sssHdr.banksDataCount; ++i) {
 		if (_sssBanksData[i].count != 0) {
 			// const int num = _sssBanksData[i].firstSampleIndex;
@@ -1076,18 +1745,33 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 			_sssBanksData[i].firstSampleIndex = kNone;
 		}
 	}
-	// fixup _sssSamplesData[i].codeOffset
 	debug(kDebug_RESOURCE, "bufferSize %d bytesRead %d", bufferSize, bytesRead);
 	if (bufferSize != bytesRead) {
 		error("Unexpected number of bytes read %d (%d)", bytesRead, bufferSize);
 	}
 	if (preloadPcm) {
 		fp->seek(_sssPcmTable[0].offset, SEEK_SET);
+		const bool decodeJobs = getSssPcmDecodeThreadsCount() > 1;
+		SssPcmDecodeJob *jobs = decodeJobs ? (SssPcmDecodeJob *)malloc(_sssHdr.pcmCount * sizeof(SssPcmDecodeJob)) : 0;
+		int jobsCount = 0;
 		for (int i = 0; i < _sssHdr.pcmCount; ++i) {
 			if (_sssPcmTable[i].pcmSize != 0) {
-				loadSssPcm(fp, &_sssPcmTable[i]);
+				if (!jobs) {
+					loadSssPcm(fp, &_sssPcmTable[i]);
+					continue;
+				}
+				uint8_t *data = readSssPcm(fp, &_sssPcmTable[i]);
+				if (data) {
+					jobs[jobsCount].pcm = &_sssPcmTable[i];
+					jobs[jobsCount].data = data;
+					++jobsCount;
+				}
 			}
 		}
+		if (jobsCount != 0) {
+			decodeSssPcmJobs(jobs, jobsCount, _isPsx);
+		}
+		free(jobs);
 	}
 	for (int i = 0; i < _sssHdr.banksDataCount; ++i) {
 		uint32_t mask = 1;
@@ -1113,158 +1797,179 @@ void Resource::loadSssData(File *fp, const uint32_t baseOffset) {
 }
 
 void Resource::unloadSssData() {
-	for (unsigned int i = 0; i < _sssPreload1Table.count; ++i) {
-		free(_sssPreload1Table[i].ptr);
-		_sssPreload1Table[i].ptr = 0;
-	}
-	for (unsigned int i = 0; i < _sssPreloadInfosData.count; ++i) {
-		if (_sssHdr.version == 6) {
-			for (unsigned int j = 0; j < _sssPreloadInfosData[i].count; ++j) {
-				SssPreloadInfoData *preloadInfoData = &_sssPreloadInfosData[i].data[j];
-				free(preloadInfoData->preload1Data_V6.ptr);
-				preloadInfoData->preload1Data_V6.ptr = 0;
-			}
-		}
-		free(_sssPreloadInfosData[i].data);
-		_sssPreloadInfosData[i].data = 0;
-	}
-	for (unsigned int i = 0; i < _sssPcmTable.count; ++i) {
-		free(_sssPcmTable[i].ptr);
-		_sssPcmTable[i].ptr = 0;
-	}
+	// the tables and the PCM are allocated from the arenas
+	_sssArena.reset();
+	_sssPcmArena.reset();
+	_sssInfosData.deallocate();
+	_sssDefaultsData.deallocate();
+	_sssBanksData.deallocate();
+	_sssSamplesData.deallocate();
+	_sssPreload1Table.deallocate();
+	_sssPreloadInfosData.deallocate();
+	_sssFilters.deallocate();
+	_sssPcmTable.deallocate();
+	_sssDataUnk6.deallocate();
 	for (int i = 0; i < 3; ++i) {
-		free(_sssGroup1[i]);
 		_sssGroup1[i] = 0;
-		free(_sssGroup2[i]);
 		_sssGroup2[i] = 0;
-		free(_sssGroup3[i]);
 		_sssGroup3[i] = 0;
 	}
-	free(_sssCodeData);
-	_sssCodeData = 0;
+	_sssOpcodesData.deallocate();
+}
+
+static uint32_t sssCodeOffsetToIndex(const uint32_t *offsetsTable, int size, uint32_t offset) {
+	if (offset == kNone) {
+		return kNone;
+	}
+	if ((offset & 3) != 0 || offset > (uint32_t)size) {
+		return kNone;
+	}
+	return offsetsTable[offset >> 2];
+}
+
+// the lowest code offset of the samples after 'offset'
+uint32_t Resource::findNextSssCodeOffset(uint32_t offset) const {
+	uint32_t next = kNone;
+	for (int i = 0; i < _sssHdr.samplesDataCount; ++i) {
+		const SssSample *sample = &_sssSamplesData[i];
+		const uint32_t codeOffsets[4] = { sample->codeOffset1, sample->codeOffset2, sample->codeOffset3, sample->codeOffset4 };
+		for (int j = 0; j < 4; ++j) {
+			if ((codeOffsets[j] & 3) == 0 && codeOffsets[j] > offset && codeOffsets[j] < next) {
+				next = codeOffsets[j];
+			}
+		}
+	}
+	return next;
 }
 
-void Resource::checkSssCode(const uint8_t *buf, int size) const {
-	static const uint8_t opcodesLength[] = {
+// translate the bytecode to fixed size instructions, the operands are read once and the jumps are resolved
+void Resource::decodeSssCode(const uint8_t *buf, int size) {
+	static const uint8_t opcodesLength[kSssOpcodesCount] = {
 		4, 0, 4, 0, 4, 12, 8, 0, 16, 4, 4, 4, 4, 8, 12, 0, 4, 8, 8, 4, 4, 4, 8, 4, 8, 4, 8, 16, 8, 4
 	};
+	// maps the 4 bytes aligned code offsets to the instruction indexes
+	const int offsetsCount = (size >> 2) + 1;
+	uint32_t *offsetsTable = (uint32_t *)malloc(offsetsCount * sizeof(uint32_t));
+	for (int i = 0; i < offsetsCount; ++i) {
+		offsetsTable[i] = kNone;
+	}
+	_sssOpcodesData.allocate(offsetsCount, &_sssArena);
+	int count = 0;
 	int offset = 0;
-	while (offset < size) {
-		const int len = opcodesLength[buf[offset]];
+	while (offset + 4 <= size) {
+		const uint8_t *code = buf + offset;
+		SssOpcode *op = &_sssOpcodesData[count];
+		offsetsTable[offset >> 2] = count;
+		op->op = code[0];
+		op->arg0 = code[1];
+		op->arg1 = READ_LE_UINT16(code + 2);
+		op->arg2 = op->arg3 = op->arg4 = 0;
+		op->target = 0;
+		int len = (code[0] < kSssOpcodesCount) ? opcodesLength[code[0]] : 0;
 		if (len == 0) {
-			warning("Invalid .sss opcode %d", buf[offset]);
-			break;
+			// the length is unknown, the decoding resumes at the next sample code
+			uint32_t next = findNextSssCodeOffset(offset);
+			if (next > (uint32_t)size) {
+				next = size;
+			}
+			warning("Invalid .sss opcode %d at offset 0x%x, skipping to 0x%x", code[0], offset, next);
+			op->op = kSssOpcodesCount;
+			op->arg1 = code[0];
+			len = next - offset;
+		} else if (offset + len > size) {
+			warning("Truncated .sss opcode %d at offset 0x%x", code[0], offset);
+			op->op = kSssOpcodesCount;
+			op->arg1 = code[0];
+			len = size - offset;
+		} else {
+			if (len >= 8) {
+				op->arg2 = READ_LE_UINT32(code + 4);
+			}
+			if (len >= 12) {
+				op->arg3 = READ_LE_UINT32(code + 8);
+			}
+			if (len >= 16) {
+				op->arg4 = READ_LE_UINT32(code + 12);
+			}
+			switch (code[0]) {
+			case 5: // pcm byte offset
+				op->arg3 = READ_LE_UINT32(code + 8) / sizeof(int16_t);
+				break;
+			case 8:
+			case 27:
+				op->arg2 = READ_LE_UINT32(code + 4) / sizeof(int16_t);
+				break;
+			}
 		}
 		offset += len;
+		++count;
+	}
+	// sentinel, executing past the end of the bytecode is an error
+	offsetsTable[offset >> 2] = count;
+	SssOpcode *end = &_sssOpcodesData[count];
+	end->op = kSssOpcodesCount;
+	end->arg0 = 0;
+	end->arg1 = 0xFF;
+	end->arg2 = end->arg3 = end->arg4 = 0;
+	end->target = 0;
+	++count;
+	_sssOpcodesData.count = count;
+
+	offset = 0;
+	for (int i = 0; i < count - 1; ++i) {
+		while (offsetsTable[offset >> 2] != (uint32_t)i) {
+			offset += 4;
+		}
+		SssOpcode *op = &_sssOpcodesData[i];
+		if (op->op == 6 || op->op == 28) {
+			const uint32_t index = sssCodeOffsetToIndex(offsetsTable, size, offset - op->arg2);
+			if (index == kNone) {
+				warning("Invalid .sss jump offset %d at offset 0x%x", op->arg2, offset);
+			} else {
+				op->target = &_sssOpcodesData[index];
+			}
+		}
 	}
-	assert(offset == size);
-}
-
-static int8_t sext8(uint8_t x, int bits) {
-	const int shift = 8 - bits;
-	return ((int8_t)(x << shift)) >> shift;
-}
-
-static int _pcmL1, _pcmL0;
-
-static void decodeSssSpuAdpcmUnit(const uint8_t *src, int16_t *dst) { // src: 16bytes, dst: 112bytes
-	static const int16_t K0_1024[] = { 0, 960, 1840, 1568, 1952 };
-	static const int16_t K1_1024[] = { 0,   0, -832, -880, -960 };
-	const uint8_t param = *src++;
-	const int shift = 12 - (param & 15);
-	assert(shift >= 0);
-	const int filter = param >> 4;
-	assert(filter < 5);
-	const int flag = *src++;
-	assert(flag < 7);
-	for (int i = 0; i < 14; ++i) {
-		const uint8_t b = *src++;
-		const int t1 = sext8(b & 15, 4);
-		const int s1 = (t1 << shift) + ((_pcmL0 * K0_1024[filter] + _pcmL1 * K1_1024[filter] + 512) >> 10);
-		_pcmL1 = _pcmL0;
-		_pcmL0 = s1;
-		dst[0] = (_pcmL1 + _pcmL0) >> 1;
-		dst[1] = CLIP(_pcmL0, -32768, 32767);
-		dst += 2;
-		const int t2 = sext8(b >> 4, 4);
-		const int s2 = (t2 << shift) + ((_pcmL0 * K0_1024[filter] + _pcmL1 * K1_1024[filter] + 512) >> 10);
-		_pcmL1 = _pcmL0;
-		_pcmL0 = s2;
-		dst[0] = (_pcmL1 + _pcmL0) >> 1;
-		dst[1] = CLIP(_pcmL0, -32768, 32767);
-		dst += 2;
+	for (int i = 0; i < _sssHdr.samplesDataCount; ++i) {
+		SssSample *sample = &_sssSamplesData[i];
+		uint32_t *codeOffsets[4] = { &sample->codeOffset1, &sample->codeOffset2, &sample->codeOffset3, &sample->codeOffset4 };
+		for (int j = 0; j < 4; ++j) {
+			const uint32_t index = sssCodeOffsetToIndex(offsetsTable, size, *codeOffsets[j]);
+			if (index == kNone && *codeOffsets[j] != kNone) {
+				warning("Invalid .sss code offset 0x%x for sample %d", *codeOffsets[j], i);
+			}
+			*codeOffsets[j] = index;
+		}
 	}
+	free(offsetsTable);
 }
 
-void Resource::loadSssPcm(File *fp, SssPcm *pcm) {
+uint8_t *Resource::readSssPcm(File *fp, SssPcm *pcm) {
 	assert(!pcm->ptr);
 	const uint32_t decompressedSize = pcm->pcmSize;
 	debug(kDebug_SOUND, "Loading PCM %p decompressedSize %d", pcm, decompressedSize);
-	int16_t *p = (int16_t *)malloc(decompressedSize);
-	if (!p) {
-		warning("Failed to allocate %d bytes for PCM", decompressedSize);
-		return;
-	}
-#ifndef __3DS__
-	pcm->ptr = p;
-	if (_isPsx) {
-		assert(pcm->strideSize == 512);
-		uint8_t strideBuffer[512];
-		for (int i = 0; i < pcm->strideCount; ++i) {
-			fp->read(strideBuffer, sizeof(strideBuffer));
-			_pcmL1 = _pcmL0 = 0;
-			for (unsigned int j = 0; j < 512; j += 16) {
-				decodeSssSpuAdpcmUnit(strideBuffer + j, p);
-				p += 56;
-			}
-		}
-	} else {
-		if (fp != _datFile) {
-			fp->seek(pcm->offset, SEEK_SET);
-		}
-		const uint32_t strideSize = pcm->strideSize;
-		assert(strideSize == 2276 || strideSize == 4040);
-		uint8_t strideBuffer[4040]; // maximum stride size
-		for (int i = 0; i < pcm->strideCount; ++i) {
-			fp->read(strideBuffer, strideSize);
-			for (unsigned int j = 256 * sizeof(int16_t); j < strideSize; ++j) {
-				*p++ = READ_LE_UINT16(strideBuffer + strideBuffer[j] * sizeof(int16_t));
-			}
-		}
+	if (!_isPsx && fp != _datFile) {
+		fp->seek(pcm->offset, SEEK_SET);
 	}
-#else
-	pcm->ptr = p;
-	if (_isPsx) {
-		uint8_t buf[512*(pcm->strideCount)];
-		fp->read(buf, sizeof(buf));
-
-		for (int i = 0; i < pcm->strideCount; ++i) {
-			_pcmL1 = _pcmL0 = 0;
-			for (int j = 0; j < 512; j += 16) {
-				decodeSssSpuAdpcmUnit(&buf[j*(pcm->strideCount)] + j, p);
-				p += 56;
-			}
+	uint8_t *data = (uint8_t *)malloc(pcm->totalSize);
+	if (!data) {
+		warning("Failed to allocate %d bytes for PCM", pcm->totalSize);
+		if (_isPsx) {
+			fp->seek(pcm->totalSize, SEEK_CUR);
 		}
-		return;
-	}
-	if (fp != _datFile) {
-		fp->seek(pcm->offset, SEEK_SET);
+		return 0;
 	}
+	fp->read(data, pcm->totalSize);
+	pcm->ptr = (int16_t *)_sssPcmArena.allocate(decompressedSize);
+	return data;
+}
 
-	int bytesize = pcm->strideSize - (256 * sizeof(int16_t));
-	for (int i = 0; i < pcm->strideCount; ++i) {
-		int counter = 0;
-		uint8_t samples[256 * sizeof(int16_t)+bytesize];
-		//uint8_t bytes[bytesize];
-		fp->read(samples, sizeof(samples));
-		//fp->read(bytes, sizeof(bytes));
-		for (unsigned int j = 256 * sizeof(int16_t); j < pcm->strideSize; ++j) {
-			*p++ = READ_LE_UINT16(samples + samples[256 * sizeof(int16_t)+counter] * sizeof(int16_t));
-			++counter;
-		}
+void Resource::loadSssPcm(File *fp, SssPcm *pcm) {
+	uint8_t *data = readSssPcm(fp, pcm);
+	if (data) {
+		decodeSssPcm(pcm, data, _isPsx);
+		free(data);
 	}
-#endif
-	assert((p - pcm->ptr) * sizeof(int16_t) == decompressedSize);
 }
 
 void Resource::clearSssGroup3() {
@@ -1303,24 +2008,726 @@ void Resource::preloadSssPcmList(const SssPreloadInfoData *preloadInfoData) {
 		return;
 	}
 	const SssPreloadList *preloadList = (_sssHdr.version == 6) ? &preloadInfoData->preload1Data_V6 : &_sssPreload1Table[preloadInfoData->preload1Index];
+	const bool decodeJobs = getSssPcmDecodeThreadsCount() > 1;
+	SssPcmDecodeJob *jobs = decodeJobs ? (SssPcmDecodeJob *)malloc(preloadList->count * sizeof(SssPcmDecodeJob)) : 0;
+	int jobsCount = 0;
 	for (int i = 0; i < preloadList->count; ++i) {
 		const int num = (preloadList->ptrSize == 2) ? READ_LE_UINT16(preloadList->ptr + i * 2) : preloadList->ptr[i];
 		if (_sssPcmTable[num].pcmSize != 0) {
 			if (!_sssPcmTable[num].ptr) {
-				loadSssPcm(fp, &_sssPcmTable[num]);
+				if (!jobs) {
+					loadSssPcm(fp, &_sssPcmTable[num]);
+					continue;
+				}
+				uint8_t *data = readSssPcm(fp, &_sssPcmTable[num]);
+				if (data) {
+					jobs[jobsCount].pcm = &_sssPcmTable[num];
+					jobs[jobsCount].data = data;
+					++jobsCount;
+				}
 			} else if (_isPsx) {
 				fp->seek(_sssPcmTable[num].strideCount * 512, SEEK_CUR);
 			}
 		}
 	}
+	if (jobsCount != 0) {
+		decodeSssPcmJobs(jobs, jobsCount, _isPsx);
+	}
+	free(jobs);
+}
+
+struct LvlScreenPrefetchData {
+	uint8_t num;
+	bool done; // the data can be taken
+	uint8_t *ptr;
+	uint32_t size;
+	uint32_t readSize;
+	uint8_t hdr[160];
+};
+
+struct SssPcmPrefetchData {
+	SssPcm *pcm; // the table entry, only accessed by the main thread
+	SssPcm info; // copy of the entry for the worker
+	uint32_t offset; // sector aligned
+	uint32_t skip;
+	int16_t *ptr;
+	bool done;
+};
+
+// the worker only reads the fields set by the main thread before it is started, the flags are shared under the mutex
+struct LvlScreensPrefetch {
+	enum {
+		kMaxScreens = 4
+	};
+
+	FileSystem *fs;
+	bool isPsx;
+	bool sectorAligned;
+	char lvlFileName[32];
+	char sssFileName[32];
+	uint32_t backgroundsOffset;
+	uint32_t backgroundsDataOffset;
+
+	LvlScreenPrefetchData screens[kMaxScreens];
+	int screensCount;
+	SssPcmPrefetchData *pcm;
+	int pcmCount;
+
+	void *thread;
+	void *mutex;
+	bool cancel; // the worker stops before the next entry
+	bool finished; // the worker returned, the thread can be waited without blocking
+	LvlScreensPrefetch *next;
+};
+
+static bool isLvlScreensPrefetchCancelled(LvlScreensPrefetch *p) {
+	System_lockMutex(p->mutex);
+	const bool cancel = p->cancel;
+	System_unlockMutex(p->mutex);
+	return cancel;
+}
+
+static void setLvlScreensPrefetchFlag(LvlScreensPrefetch *p, bool *flag) {
+	System_lockMutex(p->mutex);
+	*flag = true;
+	System_unlockMutex(p->mutex);
+}
+
+static void freeLvlScreensPrefetch(LvlScreensPrefetch *p) {
+	System_waitThread(p->thread);
+	for (int i = 0; i < p->screensCount; ++i) {
+		free(p->screens[i].ptr);
+	}
+	for (int i = 0; i < p->pcmCount; ++i) {
+		free(p->pcm[i].ptr);
+	}
+	System_destroyMutex(p->mutex);
+	free(p->pcm);
+	free(p);
+}
+
+static File *openPrefetchDat(FileSystem *fs, const char *name, bool sectorAligned) {
+	File *packed = fs->openPackedFile(name);
+	if (packed) {
+		return packed;
+	}
+	FILE *fp = fs->openAssetFile(name);
+	if (!fp) {
+		return 0;
+	}
+	File *f = sectorAligned ? new SectorFile : new File;
+	f->setFp(fp);
+	f->seek(0, SEEK_SET);
+	return f;
+}
+
+static void closePrefetchDat(FileSystem *fs, File *f) {
+	if (f) {
+		fs->closeFile(f->_fp);
+		delete f;
+	}
+}
+
+static int prefetchLvlScreensWorker(void *arg) {
+	LvlScreensPrefetch *p = (LvlScreensPrefetch *)arg;
+	if (p->screensCount != 0) {
+		File *f = openPrefetchDat(p->fs, p->lvlFileName, p->sectorAligned);
+		if (f) {
+			for (int i = 0; i < p->screensCount && !isLvlScreensPrefetchCancelled(p); ++i) {
+				LvlScreenPrefetchData *data = &p->screens[i];
+				data->ptr = readLvlScreenBackgroundData(f, data->num, 0, p->backgroundsOffset, p->backgroundsDataOffset, &data->size, &data->readSize, data->hdr, 0);
+				setLvlScreensPrefetchFlag(p, &data->done);
+			}
+			closePrefetchDat(p->fs, f);
+		}
+	}
+	if (p->pcmCount != 0) {
+		// the .lvl file contains the PCM on PSX
+		File *f = openPrefetchDat(p->fs, p->isPsx ? p->lvlFileName : p->sssFileName, p->sectorAligned);
+		if (f) {
+			for (int i = 0; i < p->pcmCount && !isLvlScreensPrefetchCancelled(p); ++i) {
+				SssPcmPrefetchData *data = &p->pcm[i];
+				SssPcm pcm = data->info;
+				pcm.ptr = (int16_t *)malloc(pcm.pcmSize);
+				uint8_t *buf = (uint8_t *)malloc(pcm.totalSize);
+				if (pcm.ptr && buf) {
+					f->seek(data->offset, SEEK_SET);
+					if (data->skip != 0) {
+						f->seek(data->skip, SEEK_CUR);
+					}
+					f->read(buf, pcm.totalSize);
+					decodeSssPcm(&pcm, buf, p->isPsx);
+				} else {
+					free(pcm.ptr);
+					pcm.ptr = 0;
+				}
+				free(buf);
+				data->ptr = pcm.ptr;
+				setLvlScreensPrefetchFlag(p, &data->done);
+			}
+			closePrefetchDat(p->fs, f);
+		}
+	}
+	setLvlScreensPrefetchFlag(p, &p->finished);
+	return 0;
+}
+
+void Resource::startLvlScreensPrefetch(const uint8_t *screens, int count, uint8_t currentScreen) {
+	if (_preloadLvlBackgroundData || !_levelName) {
+		return;
+	}
+	_lvlScreensLastUse[currentScreen] = ++_lvlScreensUseCounter;
+
+	LvlScreensPrefetch *p = (LvlScreensPrefetch *)calloc(1, sizeof(LvlScreensPrefetch));
+	if (!p) {
+		return;
+	}
+	p->fs = _fs;
+	p->isPsx = _isPsx;
+	p->sectorAligned = (_version == V1_2);
+	snprintf(p->lvlFileName, sizeof(p->lvlFileName), "%s_HOD.LVL", _levelName);
+	snprintf(p->sssFileName, sizeof(p->sssFileName), "%s_HOD.SSS", _levelName);
+	p->backgroundsOffset = _lvlBackgroundsOffset;
+	p->backgroundsDataOffset = _isPsx ? _lvlSssOffset : 0;
+	for (int i = 0; i < count && p->screensCount < LvlScreensPrefetch::kMaxScreens; ++i) {
+		const uint8_t num = screens[i];
+		if (num == kNoScreen || isLvlBackgroundDataLoaded(num)) {
+			continue;
+		}
+		p->screens[p->screensCount++].num = num;
+		// sounds played when entering the screen from the current one
+		if ((_isPsx || !kPreloadSssPcm) && num < _sssPreloadInfosData.count) {
+			const SssPreloadInfo *preloadInfo = &_sssPreloadInfosData[num];
+			for (unsigned int j = 0; j < preloadInfo->count; ++j) {
+				const SssPreloadInfoData *preloadData = &preloadInfo->data[j];
+				if (preloadData->screenNum == currentScreen) {
+					addSssPcmPrefetch(p, preloadData);
+					break;
+				}
+			}
+		}
+	}
+	if (p->screensCount == 0 && p->pcmCount == 0) {
+		free(p->pcm);
+		free(p);
+		return;
+	}
+	evictLvlScreensData(currentScreen, p->screensCount);
+	p->mutex = System_createMutex();
+	p->thread = p->mutex ? System_createThread(prefetchLvlScreensWorker, p) : 0;
+	if (!p->thread) {
+		// no threads, the screens are loaded when entered
+		if (p->mutex) {
+			System_destroyMutex(p->mutex);
+		}
+		free(p->pcm);
+		free(p);
+		return;
+	}
+	// the batches cancelled when entering the previous screens may still be running
+	p->next = _lvlScreensPrefetch;
+	_lvlScreensPrefetch = p;
+}
+
+void Resource::addSssPcmPrefetch(LvlScreensPrefetch *p, const SssPreloadInfoData *preloadInfoData) {
+	uint32_t blockOffset = 0;
+	uint32_t skip = 0;
+	if (_isPsx) {
+		if (preloadInfoData->pcmBlockOffset == 0xFFFF) {
+			return;
+		}
+		blockOffset = preloadInfoData->pcmBlockOffset * 2048;
+	}
+	const SssPreloadList *preloadList = (_sssHdr.version == 6) ? &preloadInfoData->preload1Data_V6 : &_sssPreload1Table[preloadInfoData->preload1Index];
+	p->pcm = (SssPcmPrefetchData *)realloc(p->pcm, (p->pcmCount + preloadList->count) * sizeof(SssPcmPrefetchData));
+	if (!p->pcm) {
+		p->pcmCount = 0;
+		return;
+	}
+	for (int i = 0; i < preloadList->count; ++i) {
+		const int num = (preloadList->ptrSize == 2) ? READ_LE_UINT16(preloadList->ptr + i * 2) : preloadList->ptr[i];
+		SssPcm *pcm = &_sssPcmTable[num];
+		if (pcm->pcmSize == 0) {
+			continue;
+		}
+		if (!pcm->ptr) {
+			SssPcmPrefetchData *data = &p->pcm[p->pcmCount++];
+			data->pcm = pcm;
+			data->info = *pcm;
+			data->offset = _isPsx ? blockOffset : pcm->offset;
+			data->skip = skip;
+			data->ptr = 0;
+			data->done = false;
+		}
+		if (_isPsx) {
+			// the PCM of a preload list is stored contiguously, see preloadSssPcmList
+			skip += pcm->ptr ? pcm->strideCount * 512 : pcm->totalSize;
+		}
+	}
+}
+
+void Resource::collectLvlScreensPrefetch() {
+	LvlScreensPrefetch **prev = &_lvlScreensPrefetch;
+	while (*prev) {
+		LvlScreensPrefetch *p = *prev;
+		System_lockMutex(p->mutex);
+		// the screens not read yet are requested again from the entered screen
+		p->cancel = true;
+		const bool finished = p->finished;
+		for (int i = 0; i < p->screensCount; ++i) {
+			LvlScreenPrefetchData *data = &p->screens[i];
+			if (!data->done || !data->ptr) {
+				continue;
+			}
+			if (!isLvlBackgroundDataLoaded(data->num)) {
+				_lvlScreenArenas[data->num].adopt(data->ptr, data->size);
+				installLvlScreenBackgroundData(data->num, data->ptr, data->size, data->readSize, data->hdr);
+			} else {
+				free(data->ptr);
+			}
+			data->ptr = 0;
+		}
+		for (int i = 0; i < p->pcmCount; ++i) {
+			SssPcmPrefetchData *data = &p->pcm[i];
+			if (!data->done || !data->ptr) {
+				continue;
+			}
+			if (!data->pcm->ptr) {
+				data->pcm->ptr = data->ptr;
+				_sssPcmArena.adopt(data->ptr, data->pcm->pcmSize);
+			} else {
+				free(data->ptr);
+			}
+			data->ptr = 0;
+		}
+		System_unlockMutex(p->mutex);
+		if (finished) {
+			*prev = p->next;
+			freeLvlScreensPrefetch(p);
+		} else {
+			prev = &p->next;
+		}
+	}
+}
+
+void Resource::finishLvlScreensPrefetch() {
+	while (_lvlScreensPrefetch) {
+		LvlScreensPrefetch *p = _lvlScreensPrefetch;
+		System_lockMutex(p->mutex);
+		p->cancel = true;
+		System_unlockMutex(p->mutex);
+		_lvlScreensPrefetch = p->next;
+		freeLvlScreensPrefetch(p);
+	}
+}
+
+void Resource::evictLvlScreensData(uint8_t currentScreen, int reserved) {
+	if (_lvlScreensResidentMax <= 0) {
+		return;
+	}
+	int residentCount = 0;
+	for (int i = 0; i < _lvlHdr.screensCount; ++i) {
+		if (isLvlBackgroundDataLoaded(i)) {
+			++residentCount;
+		}
+	}
+	while (residentCount + reserved > _lvlScreensResidentMax) {
+		// least recently used, but not the current screen or its neighbours
+		int num = -1;
+		for (int i = 0; i < _lvlHdr.screensCount; ++i) {
+			if (!isLvlBackgroundDataLoaded(i) || i == currentScreen) {
+				continue;
+			}
+			const uint8_t *grid = _screensGrid[currentScreen];
+			if (grid[0] == i || grid[1] == i || grid[2] == i || grid[3] == i) {
+				continue;
+			}
+			if (num < 0 || _lvlScreensLastUse[i] < _lvlScreensLastUse[num]) {
+				num = i;
+			}
+		}
+		if (num < 0) {
+			break;
+		}
+		debug(kDebug_RESOURCE, "Evicting screen %d background data", num);
+		evictLvlScreenBackgroundData(num);
+		--residentCount;
+	}
+}
+
+// the parsed .mst data is saved as a single block, with the pointers stored as offsets
+static const uint32_t _mstSnapshotTag = 0x5354534D; // 'MSTS'
+static const uint32_t _mstSnapshotVersion = 1;
+
+struct MstSnapshotHeader {
+	uint32_t tag;
+	uint32_t version;
+	uint32_t pointerSize;
+	uint32_t sourceSize;
+	uint32_t sourceChecksum;
+	uint32_t dataSize;
+	uint32_t relocationsCount;
+};
+
+struct MstSnapshotArray {
+	void *ptr;
+	uint32_t count;
+};
+
+struct MstSnapshotRoot {
+	MstHdr hdr;
+	uint32_t tickDelay;
+	uint32_t tickCodeData;
+	uint8_t *monsterInfos;
+	uint8_t *codeData;
+	MstSnapshotArray pointOffsets;
+	MstSnapshotArray walkBox;
+	MstSnapshotArray walkCode;
+	MstSnapshotArray movingBoundsIndex;
+	MstSnapshotArray levelCheckpointCode;
+	MstSnapshotArray screenArea;
+	MstSnapshotArray screenAreaByValueIndex;
+	MstSnapshotArray screenAreaByPosIndex;
+	MstSnapshotArray unk41;
+	MstSnapshotArray behaviorIndex;
+	MstSnapshotArray monsterActionIndex;
+	MstSnapshotArray walkPath;
+	MstSnapshotArray infoMonster2;
+	MstSnapshotArray behavior;
+	MstSnapshotArray attackBox;
+	MstSnapshotArray monsterAction;
+	MstSnapshotArray movingBounds;
+	MstSnapshotArray shoot;
+	MstSnapshotArray shootIndex;
+	MstSnapshotArray actionDirection;
+	MstSnapshotArray op223;
+	MstSnapshotArray op227;
+	MstSnapshotArray op234;
+	MstSnapshotArray op2;
+	MstSnapshotArray op197;
+	MstSnapshotArray op211;
+	MstSnapshotArray op240;
+	MstSnapshotArray unk60;
+	MstSnapshotArray op204;
+	MstSnapshotArray op226;
+};
+
+struct MstSnapshotWriter {
+	uint8_t *_data;
+	uint32_t _size, _capacity;
+	uint32_t *_relocations;
+	uint32_t _relocationsCount, _relocationsCapacity;
+	bool _error;
+
+	MstSnapshotWriter()
+		: _data(0), _size(0), _capacity(0), _relocations(0), _relocationsCount(0), _relocationsCapacity(0), _error(false) {
+	}
+	~MstSnapshotWriter() {
+		free(_data);
+		free(_relocations);
+	}
+
+	// returns 0 for a null pointer, the root is stored at offset 0
+	uint32_t append(const void *ptr, uint32_t size, bool root = false) {
+		if (!ptr && !root) {
+			return 0;
+		}
+		const uint32_t offset = (_size + 7) & ~7;
+		const uint32_t alignedSize = (MAX<uint32_t>(size, 1) + 7) & ~7;
+		if (offset + alignedSize > _capacity) {
+			const uint32_t capacity = MAX<uint32_t>(_capacity * 2, offset + alignedSize + 4096);
+			uint8_t *data = (uint8_t *)realloc(_data, capacity);
+			if (!data) {
+				_error = true;
+				return 0;
+			}
+			_data = data;
+			_capacity = capacity;
+		}
+		memset(_data + _size, 0, offset + alignedSize - _size);
+		if (ptr) {
+			memcpy(_data + offset, ptr, size);
+		}
+		_size = offset + alignedSize;
+		return offset;
+	}
+	void setPointer(uint32_t fieldOffset, uint32_t targetOffset) {
+		if (_error) {
+			return;
+		}
+		uintptr_t value = targetOffset;
+		memcpy(_data + fieldOffset, &value, sizeof(value));
+		if (targetOffset == 0) {
+			return;
+		}
+		if (_relocationsCount == _relocationsCapacity) {
+			_relocationsCapacity = MAX<uint32_t>(_relocationsCapacity * 2, 1024);
+			uint32_t *relocations = (uint32_t *)realloc(_relocations, _relocationsCapacity * sizeof(uint32_t));
+			if (!relocations) {
+				_error = true;
+				return;
+			}
+			_relocations = relocations;
+		}
+		_relocations[_relocationsCount++] = fieldOffset;
+	}
+	// appends the pointed data and stores its offset in the field
+	uint32_t appendPointer(uint32_t fieldOffset, const void *ptr, uint32_t size) {
+		const uint32_t offset = append(ptr, size);
+		setPointer(fieldOffset, offset);
+		return offset;
+	}
+	template <typename T>
+	uint32_t appendArray(uint32_t rootOffset, const ResStruct<T> &r) {
+		const uint32_t offset = appendPointer(rootOffset + offsetof(MstSnapshotArray, ptr), r.ptr, r.count * sizeof(T));
+		if (!_error) {
+			((MstSnapshotArray *)(_data + rootOffset))->count = r.count;
+		}
+		return offset;
+	}
+	template <typename T>
+	const T *get(uint32_t offset) const {
+		return (const T *)(_data + offset);
+	}
+};
+
+template <typename T>
+static void setSnapshotArray(ResStruct<T> &r, const MstSnapshotArray &a) {
+	r.ptr = (T *)a.ptr;
+	r.count = a.count;
+	r.arena = true;
+}
+
+static uint32_t mstSnapshotChecksum(File *fp, uint32_t *size) {
+	const uint32_t checksum = fp->checksum(size);
+	fp->seek(0, SEEK_SET);
+	return checksum;
+}
+
+bool Resource::loadMstSnapshot(uint32_t sourceSize, uint32_t sourceChecksum) {
+	char filename[32];
+	snprintf(filename, sizeof(filename), "%s_hod.mst.snapshot", _levelName);
+	FILE *fp = _fs->openSaveFile(filename, false);
+	if (!fp) {
+		return false;
+	}
+	MstSnapshotHeader hdr;
+	uint8_t *data = 0;
+	if (fread(&hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && hdr.tag == _mstSnapshotTag && hdr.version == _mstSnapshotVersion && hdr.pointerSize == sizeof(void *) && hdr.sourceSize == sourceSize && hdr.sourceChecksum == sourceChecksum && hdr.dataSize >= sizeof(MstSnapshotRoot)) {
+		const uint32_t size = hdr.dataSize + hdr.relocationsCount * sizeof(uint32_t);
+		data = (uint8_t *)_mstArena.allocate(size);
+		if (data && fread(data, 1, size, fp) != size) {
+			_mstArena.reset();
+			data = 0;
+		}
+	}
+	_fs->closeFile(fp);
+	if (!data) {
+		debug(kDebug_RESOURCE, "Ignoring outdated '%s'", filename);
+		return false;
+	}
+	const uint32_t *relocations = (const uint32_t *)(data + hdr.dataSize);
+	for (uint32_t i = 0; i < hdr.relocationsCount; ++i) {
+		const uint32_t offset = relocations[i];
+		if (offset > hdr.dataSize - sizeof(uintptr_t)) {
+			warning("Invalid relocation 0x%x in '%s'", offset, filename);
+			_mstArena.reset();
+			return false;
+		}
+		uintptr_t *p = (uintptr_t *)(data + offset);
+		*p += (uintptr_t)data;
+	}
+
+	const MstSnapshotRoot *root = (const MstSnapshotRoot *)data;
+	_mstHdr = root->hdr;
+	_mstTickDelay = root->tickDelay;
+	_mstTickCodeData = root->tickCodeData;
+	_mstMonsterInfos = root->monsterInfos;
+	_mstCodeData = root->codeData;
+	setSnapshotArray(_mstPointOffsets, root->pointOffsets);
+	setSnapshotArray(_mstWalkBoxData, root->walkBox);
+	setSnapshotArray(_mstWalkCodeData, root->walkCode);
+	setSnapshotArray(_mstMovingBoundsIndexData, root->movingBoundsIndex);
+	setSnapshotArray(_mstLevelCheckpointCodeData, root->levelCheckpointCode);
+	setSnapshotArray(_mstScreenAreaData, root->screenArea);
+	setSnapshotArray(_mstScreenAreaByValueIndexData, root->screenAreaByValueIndex);
+	setSnapshotArray(_mstScreenAreaByPosIndexData, root->screenAreaByPosIndex);
+	setSnapshotArray(_mstUnk41, root->unk41);
+	setSnapshotArray(_mstBehaviorIndexData, root->behaviorIndex);
+	setSnapshotArray(_mstMonsterActionIndexData, root->monsterActionIndex);
+	setSnapshotArray(_mstWalkPathData, root->walkPath);
+	setSnapshotArray(_mstInfoMonster2Data, root->infoMonster2);
+	setSnapshotArray(_mstBehaviorData, root->behavior);
+	setSnapshotArray(_mstAttackBoxData, root->attackBox);
+	setSnapshotArray(_mstMonsterActionData, root->monsterAction);
+	setSnapshotArray(_mstMovingBoundsData, root->movingBounds);
+	setSnapshotArray(_mstShootData, root->shoot);
+	setSnapshotArray(_mstShootIndexData, root->shootIndex);
+	setSnapshotArray(_mstActionDirectionData, root->actionDirection);
+	setSnapshotArray(_mstOp223Data, root->op223);
+	setSnapshotArray(_mstOp227Data, root->op227);
+	setSnapshotArray(_mstOp234Data, root->op234);
+	setSnapshotArray(_mstOp2Data, root->op2);
+	setSnapshotArray(_mstOp197Data, root->op197);
+	setSnapshotArray(_mstOp211Data, root->op211);
+	setSnapshotArray(_mstOp240Data, root->op240);
+	setSnapshotArray(_mstUnk60, root->unk60);
+	setSnapshotArray(_mstOp204Data, root->op204);
+	setSnapshotArray(_mstOp226Data, root->op226);
+	_mstSnapshotData = data;
+	return true;
+}
+
+void Resource::saveMstSnapshot(uint32_t sourceSize, uint32_t sourceChecksum) {
+	MstSnapshotWriter w;
+	w.append(0, sizeof(MstSnapshotRoot), true);
+	{
+		MstSnapshotRoot *root = (MstSnapshotRoot *)w._data;
+		root->hdr = _mstHdr;
+		root->tickDelay = _mstTickDelay;
+		root->tickCodeData = _mstTickCodeData;
+	}
+	w.appendPointer(offsetof(MstSnapshotRoot, monsterInfos), _mstMonsterInfos, _mstHdr.infoMonster1Count * kMonsterInfoDataSize);
+	w.appendPointer(offsetof(MstSnapshotRoot, codeData), _mstCodeData, _mstHdr.codeSize * 4);
+	w.appendArray(offsetof(MstSnapshotRoot, pointOffsets), _mstPointOffsets);
+	w.appendArray(offsetof(MstSnapshotRoot, walkBox), _mstWalkBoxData);
+	uint32_t offset = w.appendArray(offsetof(MstSnapshotRoot, walkCode), _mstWalkCodeData);
+	for (unsigned int i = 0; i < _mstWalkCodeData.count; ++i) {
+		const MstWalkCode *m = &_mstWalkCodeData[i];
+		const uint32_t base = offset + i * sizeof(MstWalkCode);
+		w.appendPointer(base + offsetof(MstWalkCode, codeData), m->codeData, m->codeDataCount * sizeof(uint32_t));
+		w.appendPointer(base + offsetof(MstWalkCode, indexData), m->indexData, m->indexDataCount);
+	}
+	w.appendArray(offsetof(MstSnapshotRoot, movingBoundsIndex), _mstMovingBoundsIndexData);
+	w.appendArray(offsetof(MstSnapshotRoot, levelCheckpointCode), _mstLevelCheckpointCodeData);
+	w.appendArray(offsetof(MstSnapshotRoot, screenArea), _mstScreenAreaData);
+	w.appendArray(offsetof(MstSnapshotRoot, screenAreaByValueIndex), _mstScreenAreaByValueIndexData);
+	w.appendArray(offsetof(MstSnapshotRoot, screenAreaByPosIndex), _mstScreenAreaByPosIndexData);
+	w.appendArray(offsetof(MstSnapshotRoot, unk41), _mstUnk41);
+	offset = w.appendArray(offsetof(MstSnapshotRoot, behaviorIndex), _mstBehaviorIndexData);
+	for (unsigned int i = 0; i < _mstBehaviorIndexData.count; ++i) {
+		const MstBehaviorIndex *m = &_mstBehaviorIndexData[i];
+		const uint32_t base = offset + i * sizeof(MstBehaviorIndex);
+		w.appendPointer(base + offsetof(MstBehaviorIndex, behavior), m->behavior, m->count1 * sizeof(uint32_t));
+		w.appendPointer(base + offsetof(MstBehaviorIndex, data), m->data, m->dataCount);
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, monsterActionIndex), _mstMonsterActionIndexData);
+	for (unsigned int i = 0; i < _mstMonsterActionIndexData.count; ++i) {
+		const MstMonsterActionIndex *m = &_mstMonsterActionIndexData[i];
+		const uint32_t base = offset + i * sizeof(MstMonsterActionIndex);
+		w.appendPointer(base + offsetof(MstMonsterActionIndex, indexUnk48), m->indexUnk48, m->count1 * sizeof(uint32_t));
+		w.appendPointer(base + offsetof(MstMonsterActionIndex, data), m->data, m->dataCount);
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, walkPath), _mstWalkPathData);
+	for (unsigned int i = 0; i < _mstWalkPathData.count; ++i) {
+		const MstWalkPath *m = &_mstWalkPathData[i];
+		const uint32_t base = offset + i * sizeof(MstWalkPath);
+		const uint32_t nodesOffset = w.appendPointer(base + offsetof(MstWalkPath, data), m->data, m->count * sizeof(MstWalkNode));
+		for (uint32_t j = 0; j < m->count; ++j) {
+			const uint32_t nodeBase = nodesOffset + j * sizeof(MstWalkNode);
+			for (int k = 0; k < 2; ++k) {
+				w.appendPointer(nodeBase + offsetof(MstWalkNode, unk60) + k * sizeof(uint8_t *), m->data[j].unk60[k], m->count);
+			}
+		}
+		w.appendPointer(base + offsetof(MstWalkPath, walkNodeData), m->walkNodeData, _mstHdr.screensCount * sizeof(uint32_t));
+	}
+	w.appendArray(offsetof(MstSnapshotRoot, infoMonster2), _mstInfoMonster2Data);
+	offset = w.appendArray(offsetof(MstSnapshotRoot, behavior), _mstBehaviorData);
+	for (unsigned int i = 0; i < _mstBehaviorData.count; ++i) {
+		const MstBehavior *m = &_mstBehaviorData[i];
+		w.appendPointer(offset + i * sizeof(MstBehavior) + offsetof(MstBehavior, data), m->data, m->count * sizeof(MstBehaviorState));
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, attackBox), _mstAttackBoxData);
+	for (unsigned int i = 0; i < _mstAttackBoxData.count; ++i) {
+		const MstAttackBox *m = &_mstAttackBoxData[i];
+		w.appendPointer(offset + i * sizeof(MstAttackBox) + offsetof(MstAttackBox, data), m->data, m->count * 20);
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, monsterAction), _mstMonsterActionData);
+	for (unsigned int i = 0; i < _mstMonsterActionData.count; ++i) {
+		const MstMonsterAction *m = &_mstMonsterActionData[i];
+		const uint32_t base = offset + i * sizeof(MstMonsterAction);
+		for (int j = 0; j < 2; ++j) {
+			w.appendPointer(base + offsetof(MstMonsterAction, data1) + j * sizeof(uint32_t *), m->data1[j], m->count[j] * sizeof(uint32_t));
+			w.appendPointer(base + offsetof(MstMonsterAction, data2) + j * sizeof(uint32_t *), m->data2[j], m->count[j] * sizeof(uint32_t));
+		}
+		const uint32_t areaOffset = w.appendPointer(base + offsetof(MstMonsterAction, area), m->area, m->areaCount * sizeof(MstMonsterArea));
+		for (int j = 0; j < m->areaCount; ++j) {
+			w.appendPointer(areaOffset + j * sizeof(MstMonsterArea) + offsetof(MstMonsterArea, data), m->area[j].data, m->area[j].count * sizeof(MstMonsterAreaAction));
+		}
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, movingBounds), _mstMovingBoundsData);
+	for (unsigned int i = 0; i < _mstMovingBoundsData.count; ++i) {
+		const MstMovingBounds *m = &_mstMovingBoundsData[i];
+		const uint32_t base = offset + i * sizeof(MstMovingBounds);
+		w.appendPointer(base + offsetof(MstMovingBounds, data1), m->data1, m->count1 * sizeof(MstMovingBoundsUnk1));
+		w.appendPointer(base + offsetof(MstMovingBounds, indexData), m->indexData, m->indexDataCount);
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, shoot), _mstShootData);
+	for (unsigned int i = 0; i < _mstShootData.count; ++i) {
+		const MstShoot *m = &_mstShootData[i];
+		w.appendPointer(offset + i * sizeof(MstShoot) + offsetof(MstShoot, data), m->data, m->count * sizeof(MstShootAction));
+	}
+	offset = w.appendArray(offsetof(MstSnapshotRoot, shootIndex), _mstShootIndexData);
+	for (unsigned int i = 0; i < _mstShootIndexData.count; ++i) {
+		const MstShootIndex *m = &_mstShootIndexData[i];
+		w.appendPointer(offset + i * sizeof(MstShootIndex) + offsetof(MstShootIndex, indexUnk50Unk1), m->indexUnk50Unk1, m->count * 9 * sizeof(uint32_t));
+	}
+	w.appendArray(offsetof(MstSnapshotRoot, actionDirection), _mstActionDirectionData);
+	w.appendArray(offsetof(MstSnapshotRoot, op223), _mstOp223Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op227), _mstOp227Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op234), _mstOp234Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op2), _mstOp2Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op197), _mstOp197Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op211), _mstOp211Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op240), _mstOp240Data);
+	w.appendArray(offsetof(MstSnapshotRoot, unk60), _mstUnk60);
+	w.appendArray(offsetof(MstSnapshotRoot, op204), _mstOp204Data);
+	w.appendArray(offsetof(MstSnapshotRoot, op226), _mstOp226Data);
+	if (w._error) {
+		warning("Failed to allocate memory for the .mst snapshot");
+		return;
+	}
+
+	char filename[32];
+	snprintf(filename, sizeof(filename), "%s_hod.mst.snapshot", _levelName);
+	FILE *fp = _fs->openSaveFile(filename, true);
+	if (!fp) {
+		warning("Unable to open '%s' for writing", filename);
+		return;
+	}
+	MstSnapshotHeader hdr;
+	hdr.tag = _mstSnapshotTag;
+	hdr.version = _mstSnapshotVersion;
+	hdr.pointerSize = sizeof(void *);
+	hdr.sourceSize = sourceSize;
+	hdr.sourceChecksum = sourceChecksum;
+	hdr.dataSize = w._size;
+	hdr.relocationsCount = w._relocationsCount;
+	fwrite(&hdr, 1, sizeof(hdr), fp);
+	fwrite(w._data, 1, w._size, fp);
+	fwrite(w._relocations, sizeof(uint32_t), w._relocationsCount, fp);
+	if (_fs->closeFile(fp) != 0) {
+		warning("I/O error writing '%s'", filename);
+	}
 }
 
 void Resource::loadMstData(File *fp) {
 	assert(fp == _mstFile);
 
-	if (_mstHdr.dataSize != 0) {
-		unloadMstData();
-		_mstHdr.dataSize = 0;
+	unloadMstData();
+	_mstHdr.dataSize = 0;
+
+	uint32_t sourceSize = 0, sourceChecksum = 0;
+	if (kMstSnapshot && _levelName) {
+		const uint32_t t0 = System_getTimeStampUs();
+		sourceChecksum = mstSnapshotChecksum(fp, &sourceSize);
+		if (loadMstSnapshot(sourceSize, sourceChecksum)) {
+			debug(kDebug_RESOURCE, "Loaded .mst snapshot in %d us", System_getTimeStampUs() - t0);
+			decodeMstCode();
+			initMstWalkPathRoutes();
+			initMstAreaGrids();
+			return;
+		}
 	}
 
 	_mstHdr.version = fp->readUint32();
@@ -1368,14 +2775,14 @@ void Resource::loadMstData(File *fp) {
 
 	int bytesRead = 0;
 
-	_mstPointOffsets.allocate(_mstHdr.screensCount);
+	_mstPointOffsets.allocate(_mstHdr.screensCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.screensCount; ++i) {
 		_mstPointOffsets[i].xOffset = fp->readUint32();
 		_mstPointOffsets[i].yOffset = fp->readUint32();
 		bytesRead += 8;
 	}
 
-	_mstWalkBoxData.allocate(_mstHdr.walkBoxDataCount);
+	_mstWalkBoxData.allocate(_mstHdr.walkBoxDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.walkBoxDataCount; ++i) {
 		_mstWalkBoxData[i].right  = fp->readUint32();
 		_mstWalkBoxData[i].left   = fp->readUint32();
@@ -1388,15 +2795,15 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 20;
 	}
 
-	_mstWalkCodeData.allocate(_mstHdr.walkCodeDataCount);
+	_mstWalkCodeData.allocate(_mstHdr.walkCodeDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.walkCodeDataCount; ++i) {
 		fp->skipUint32();
 		_mstWalkCodeData[i].codeDataCount = fp->readUint32();
-		_mstWalkCodeData[i].codeData = (uint32_t *)malloc(_mstWalkCodeData[i].codeDataCount * sizeof(uint32_t));
+		_mstWalkCodeData[i].codeData = (uint32_t *)_mstArena.allocate(_mstWalkCodeData[i].codeDataCount * sizeof(uint32_t));
 		fp->skipUint32();
 		_mstWalkCodeData[i].indexDataCount = fp->readUint32();
 		if (_mstWalkCodeData[i].indexDataCount != 0) {
-			_mstWalkCodeData[i].indexData = (uint8_t *)malloc(_mstWalkCodeData[i].indexDataCount);
+			_mstWalkCodeData[i].indexData = (uint8_t *)_mstArena.allocate(_mstWalkCodeData[i].indexDataCount);
 		} else {
 			_mstWalkCodeData[i].indexData = 0;
 		}
@@ -1412,7 +2819,7 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstMovingBoundsIndexData.allocate(_mstHdr.movingBoundsIndexDataCount);
+	_mstMovingBoundsIndexData.allocate(_mstHdr.movingBoundsIndexDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.movingBoundsIndexDataCount; ++i) {
 		_mstMovingBoundsIndexData[i].indexUnk49 = fp->readUint32();
 		_mstMovingBoundsIndexData[i].unk4 = fp->readUint32();
@@ -1424,13 +2831,13 @@ void Resource::loadMstData(File *fp) {
 	_mstTickCodeData = fp->readUint32();
 	bytesRead += 8;
 
-	_mstLevelCheckpointCodeData.allocate(_mstHdr.levelCheckpointCodeDataCount);
+	_mstLevelCheckpointCodeData.allocate(_mstHdr.levelCheckpointCodeDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.levelCheckpointCodeDataCount; ++i) {
 		_mstLevelCheckpointCodeData[i] = fp->readUint32();
 		bytesRead += 4;
 	}
 
-	_mstScreenAreaData.allocate(_mstHdr.screenAreaDataCount);
+	_mstScreenAreaData.allocate(_mstHdr.screenAreaDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.screenAreaDataCount; ++i) {
 		MstScreenArea *msac = &_mstScreenAreaData[i];
 		msac->x1 = fp->readUint32();
@@ -1447,33 +2854,33 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 36;
 	}
 
-	_mstScreenAreaByValueIndexData.allocate(_mstHdr.screenAreaIndexDataCount);
+	_mstScreenAreaByValueIndexData.allocate(_mstHdr.screenAreaIndexDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.screenAreaIndexDataCount; ++i) {
 		_mstScreenAreaByValueIndexData[i] = fp->readUint32();
 		bytesRead += 4;
 	}
 
-	_mstScreenAreaByPosIndexData.allocate(_mstHdr.screensCount);
+	_mstScreenAreaByPosIndexData.allocate(_mstHdr.screensCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.screensCount; ++i) {
 		_mstScreenAreaByPosIndexData[i] = fp->readUint32();
 		bytesRead += 4;
 	}
 
-	_mstUnk41.allocate(_mstHdr.screensCount);
+	_mstUnk41.allocate(_mstHdr.screensCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.screensCount; ++i) {
 		_mstUnk41[i] = fp->readUint32();
 		bytesRead += 4;
 	}
 
-	_mstBehaviorIndexData.allocate(_mstHdr.behaviorIndexDataCount);
+	_mstBehaviorIndexData.allocate(_mstHdr.behaviorIndexDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.behaviorIndexDataCount; ++i) {
 		fp->skipUint32();
 		_mstBehaviorIndexData[i].count1 = fp->readUint32();
-		_mstBehaviorIndexData[i].behavior = (uint32_t *)malloc(_mstBehaviorIndexData[i].count1 * sizeof(uint32_t));
+		_mstBehaviorIndexData[i].behavior = (uint32_t *)_mstArena.allocate(_mstBehaviorIndexData[i].count1 * sizeof(uint32_t));
 		fp->skipUint32();
 		_mstBehaviorIndexData[i].dataCount = fp->readUint32();
 		if (_mstBehaviorIndexData[i].dataCount != 0) {
-			_mstBehaviorIndexData[i].data = (uint8_t *)malloc(_mstBehaviorIndexData[i].dataCount);
+			_mstBehaviorIndexData[i].data = (uint8_t *)_mstArena.allocate(_mstBehaviorIndexData[i].dataCount);
 		} else {
 			_mstBehaviorIndexData[i].data = 0;
 		}
@@ -1489,15 +2896,15 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstMonsterActionIndexData.allocate(_mstHdr.monsterActionIndexDataCount);
+	_mstMonsterActionIndexData.allocate(_mstHdr.monsterActionIndexDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.monsterActionIndexDataCount; ++i) {
 		fp->skipUint32();
 		_mstMonsterActionIndexData[i].count1 = fp->readUint32();
-		_mstMonsterActionIndexData[i].indexUnk48 = (uint32_t *)malloc(_mstMonsterActionIndexData[i].count1 * sizeof(uint32_t));
+		_mstMonsterActionIndexData[i].indexUnk48 = (uint32_t *)_mstArena.allocate(_mstMonsterActionIndexData[i].count1 * sizeof(uint32_t));
 		fp->skipUint32();
 		_mstMonsterActionIndexData[i].dataCount = fp->readUint32();
 		if (_mstMonsterActionIndexData[i].dataCount != 0) {
-			_mstMonsterActionIndexData[i].data = (uint8_t *)malloc(_mstMonsterActionIndexData[i].dataCount);
+			_mstMonsterActionIndexData[i].data = (uint8_t *)_mstArena.allocate(_mstMonsterActionIndexData[i].dataCount);
 		} else {
 			_mstMonsterActionIndexData[i].data = 0;
 		}
@@ -1513,7 +2920,7 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstWalkPathData.allocate(_mstHdr.walkPathDataCount);
+	_mstWalkPathData.allocate(_mstHdr.walkPathDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.walkPathDataCount; ++i) {
 		fp->skipUint32();
 		fp->skipUint32();
@@ -1523,7 +2930,7 @@ void Resource::loadMstData(File *fp) {
 	}
 	for (int i = 0; i < _mstHdr.walkPathDataCount; ++i) {
 		const int count = _mstWalkPathData[i].count;
-		_mstWalkPathData[i].data = (MstWalkNode *)malloc(sizeof(MstWalkNode) * count);
+		_mstWalkPathData[i].data = (MstWalkNode *)_mstArena.allocate(sizeof(MstWalkNode) * count);
 		for (int j = 0; j < count; ++j) {
 			uint8_t data[104];
 			fp->read(data, sizeof(data));
@@ -1549,14 +2956,14 @@ void Resource::loadMstData(File *fp) {
 			_mstWalkPathData[i].data[j].neighborWalkNode[3] = READ_LE_UINT32(data + 88); // sizeof == 104
 			_mstWalkPathData[i].data[j].nextWalkNode = READ_LE_UINT32(data + 92); // sizeof == 104
 			if (count != 0) {
-				_mstWalkPathData[i].data[j].unk60[0] = (uint8_t *)malloc(count);
-				_mstWalkPathData[i].data[j].unk60[1] = (uint8_t *)malloc(count);
+				_mstWalkPathData[i].data[j].unk60[0] = (uint8_t *)_mstArena.allocate(count);
+				_mstWalkPathData[i].data[j].unk60[1] = (uint8_t *)_mstArena.allocate(count);
 			} else {
 				_mstWalkPathData[i].data[j].unk60[0] = 0;
 				_mstWalkPathData[i].data[j].unk60[1] = 0;
 			}
 		}
-		_mstWalkPathData[i].walkNodeData = (uint32_t *)malloc(_mstHdr.screensCount * sizeof(uint32_t));
+		_mstWalkPathData[i].walkNodeData = (uint32_t *)_mstArena.allocate(_mstHdr.screensCount * sizeof(uint32_t));
 		for (int j = 0; j < _mstHdr.screensCount; ++j) {
 			_mstWalkPathData[i].walkNodeData[j] = fp->readUint32();
 			bytesRead += 4;
@@ -1568,7 +2975,7 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstInfoMonster2Data.allocate(_mstHdr.infoMonster2Count);
+	_mstInfoMonster2Data.allocate(_mstHdr.infoMonster2Count, &_mstArena);
 	for (int i = 0; i < _mstHdr.infoMonster2Count; ++i) {
 		_mstInfoMonster2Data[i].type = fp->readByte();
 		_mstInfoMonster2Data[i].shootMask = fp->readByte();
@@ -1578,14 +2985,14 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 12;
 	}
 
-	_mstBehaviorData.allocate(_mstHdr.behaviorDataCount);
+	_mstBehaviorData.allocate(_mstHdr.behaviorDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.behaviorDataCount; ++i) {
 		fp->skipUint32();
 		_mstBehaviorData[i].count = fp->readUint32();
 		bytesRead += 8;
 	}
 	for (int i = 0; i < _mstHdr.behaviorDataCount; ++i) {
-		_mstBehaviorData[i].data  = (MstBehaviorState *)malloc(_mstBehaviorData[i].count * sizeof(MstBehaviorState));
+		_mstBehaviorData[i].data  = (MstBehaviorState *)_mstArena.allocate(_mstBehaviorData[i].count * sizeof(MstBehaviorState));
 		for (uint32_t j = 0; j < _mstBehaviorData[i].count; ++j) {
 			uint8_t data[44];
 			fp->read(data, sizeof(data));
@@ -1605,19 +3012,19 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstAttackBoxData.allocate(_mstHdr.attackBoxDataCount);
+	_mstAttackBoxData.allocate(_mstHdr.attackBoxDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.attackBoxDataCount; ++i) {
 		fp->skipUint32();
 		_mstAttackBoxData[i].count = fp->readUint32();
 		bytesRead += 8;
 	}
 	for (int i = 0; i < _mstHdr.attackBoxDataCount; ++i) {
-		_mstAttackBoxData[i].data = (uint8_t *)malloc(_mstAttackBoxData[i].count * 20);
+		_mstAttackBoxData[i].data = (uint8_t *)_mstArena.allocate(_mstAttackBoxData[i].count * 20);
 		fp->read(_mstAttackBoxData[i].data, _mstAttackBoxData[i].count * 20);
 		bytesRead += _mstAttackBoxData[i].count * 20;
 	}
 
-	_mstMonsterActionData.allocate(_mstHdr.monsterActionDataCount);
+	_mstMonsterActionData.allocate(_mstHdr.monsterActionDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.monsterActionDataCount; ++i) {
 		MstMonsterAction *m = &_mstMonsterActionData[i];
 		m->xRange = fp->readUint16();
@@ -1639,12 +3046,12 @@ void Resource::loadMstData(File *fp) {
 		for (int j = 0; j < 2; ++j) {
 			const int count = m->count[j];
 			if (count != 0) {
-				m->data1[j] = (uint32_t *)malloc(count * sizeof(uint32_t));
+				m->data1[j] = (uint32_t *)_mstArena.allocate(count * sizeof(uint32_t));
 				for (int k = 0; k < count; ++k) {
 					m->data1[j][k] = fp->readUint32();
 				}
 				bytesRead += count * 4;
-				m->data2[j] = (uint32_t *)malloc(count * sizeof(uint32_t));
+				m->data2[j] = (uint32_t *)_mstArena.allocate(count * sizeof(uint32_t));
 				for (int k = 0; k < count; ++k) {
 					m->data2[j][k] = fp->readUint32();
 				}
@@ -1654,7 +3061,7 @@ void Resource::loadMstData(File *fp) {
 				m->data2[j] = 0;
 			}
 		}
-		MstMonsterArea *m12 = (MstMonsterArea *)malloc(m->areaCount * sizeof(MstMonsterArea));
+		MstMonsterArea *m12 = (MstMonsterArea *)_mstArena.allocate(m->areaCount * sizeof(MstMonsterArea));
 		for (int j = 0; j < m->areaCount; ++j) {
 			m12[j].unk0  = fp->readByte();
 			fp->skipByte();
@@ -1665,7 +3072,7 @@ void Resource::loadMstData(File *fp) {
 			bytesRead += 12;
 		}
 		for (int j = 0; j < m->areaCount; ++j) {
-			m12[j].data = (MstMonsterAreaAction *)malloc(m12[j].count * sizeof(MstMonsterAreaAction));
+			m12[j].data = (MstMonsterAreaAction *)_mstArena.allocate(m12[j].count * sizeof(MstMonsterAreaAction));
 			for (uint32_t k = 0; k < m12[j].count; ++k) {
 				uint8_t data[28];
 				fp->read(data, sizeof(data));
@@ -1686,11 +3093,11 @@ void Resource::loadMstData(File *fp) {
 	}
 
 	const int mapDataSize = _mstHdr.infoMonster1Count * kMonsterInfoDataSize;
-	_mstMonsterInfos = (uint8_t *)malloc(mapDataSize);
+	_mstMonsterInfos = (uint8_t *)_mstArena.allocate(mapDataSize);
 	fp->read(_mstMonsterInfos, mapDataSize);
 	bytesRead += mapDataSize;
 
-	_mstMovingBoundsData.allocate(_mstHdr.movingBoundsDataCount);
+	_mstMovingBoundsData.allocate(_mstHdr.movingBoundsDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.movingBoundsDataCount; ++i) {
 		_mstMovingBoundsData[i].indexMonsterInfo = fp->readUint32();
 		fp->skipUint32();
@@ -1704,7 +3111,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 24;
 	}
 	for (int i = 0; i < _mstHdr.movingBoundsDataCount; ++i) {
-		_mstMovingBoundsData[i].data1 = (MstMovingBoundsUnk1 *)malloc(_mstMovingBoundsData[i].count1 * sizeof(MstMovingBoundsUnk1));
+		_mstMovingBoundsData[i].data1 = (MstMovingBoundsUnk1 *)_mstArena.allocate(_mstMovingBoundsData[i].count1 * sizeof(MstMovingBoundsUnk1));
 		const int start = _mstMovingBoundsData[i].indexMonsterInfo;
 		assert(start < _mstHdr.infoMonster1Count);
 		for (uint32_t j = 0; j < _mstMovingBoundsData[i].count1; ++j) {
@@ -1724,7 +3131,7 @@ void Resource::loadMstData(File *fp) {
 			bytesRead += 16;
 		}
 		if (_mstMovingBoundsData[i].indexDataCount != 0) {
-			_mstMovingBoundsData[i].indexData = (uint8_t *)malloc(_mstMovingBoundsData[i].indexDataCount);
+			_mstMovingBoundsData[i].indexData = (uint8_t *)_mstArena.allocate(_mstMovingBoundsData[i].indexDataCount);
 			fp->read(_mstMovingBoundsData[i].indexData, _mstMovingBoundsData[i].indexDataCount);
 			bytesRead += _mstMovingBoundsData[i].indexDataCount;
 		} else {
@@ -1732,14 +3139,14 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstShootData.allocate(_mstHdr.shootDataCount);
+	_mstShootData.allocate(_mstHdr.shootDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.shootDataCount; ++i) {
 		_mstShootData[i].data  = 0; fp->skipUint32();
 		_mstShootData[i].count = fp->readUint32();
 		bytesRead += 8;
 	}
 	for (int i = 0; i < _mstHdr.shootDataCount; ++i) {
-		_mstShootData[i].data = (MstShootAction *)malloc(_mstShootData[i].count * sizeof(MstShootAction));
+		_mstShootData[i].data = (MstShootAction *)_mstArena.allocate(_mstShootData[i].count * sizeof(MstShootAction));
 		for (uint32_t j = 0; j < _mstShootData[i].count; ++j) {
 			_mstShootData[i].data[j].codeData = fp->readUint32();
 			_mstShootData[i].data[j].unk4 = fp->readUint32();
@@ -1755,7 +3162,7 @@ void Resource::loadMstData(File *fp) {
 		}
 	}
 
-	_mstShootIndexData.allocate(_mstHdr.shootIndexDataCount);
+	_mstShootIndexData.allocate(_mstHdr.shootIndexDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.shootIndexDataCount; ++i) {
 		_mstShootIndexData[i].indexUnk50 = fp->readUint32();
 		assert(_mstShootIndexData[i].indexUnk50 < (uint32_t)_mstHdr.shootDataCount);
@@ -1764,14 +3171,14 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 12;
 	}
 	for (int i = 0; i < _mstHdr.shootIndexDataCount; ++i) {
-		_mstShootIndexData[i].indexUnk50Unk1 = (uint32_t *)malloc(_mstShootIndexData[i].count * 9 * sizeof(uint32_t));
+		_mstShootIndexData[i].indexUnk50Unk1 = (uint32_t *)_mstArena.allocate(_mstShootIndexData[i].count * 9 * sizeof(uint32_t));
 		for (uint32_t j = 0; j < _mstShootIndexData[i].count * 9; ++j) {
 			_mstShootIndexData[i].indexUnk50Unk1[j] = fp->readUint32();
 			assert(_mstShootIndexData[i].indexUnk50Unk1[j] < _mstShootData[_mstShootIndexData[i].indexUnk50].count);
 			bytesRead += 4;
 		}
 	}
-	_mstActionDirectionData.allocate(_mstHdr.actionDirectionDataCount);
+	_mstActionDirectionData.allocate(_mstHdr.actionDirectionDataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.actionDirectionDataCount; ++i) {
 		_mstActionDirectionData[i].unk0 = fp->readByte();
 		_mstActionDirectionData[i].unk1 = fp->readByte();
@@ -1780,7 +3187,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 4;
 	}
 
-	_mstOp223Data.allocate(_mstHdr.op223DataCount);
+	_mstOp223Data.allocate(_mstHdr.op223DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op223DataCount; ++i) {
 		_mstOp223Data[i].indexVar1 = fp->readUint16();
 		_mstOp223Data[i].indexVar2 = fp->readUint16();
@@ -1796,7 +3203,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 20;
 	}
 
-	_mstOp226Data.allocate(_mstHdr.op226DataCount);
+	_mstOp226Data.allocate(_mstHdr.op226DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op226DataCount; ++i) {
 		_mstOp226Data[i].unk0 = fp->readByte();
 		_mstOp226Data[i].unk1 = fp->readByte();
@@ -1809,7 +3216,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 8;
 	}
 
-	_mstOp227Data.allocate(_mstHdr.op227DataCount);
+	_mstOp227Data.allocate(_mstHdr.op227DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op227DataCount; ++i) {
 		_mstOp227Data[i].indexVar1 = fp->readUint16();
 		_mstOp227Data[i].indexVar2 = fp->readUint16();
@@ -1819,7 +3226,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 8;
 	}
 
-	_mstOp234Data.allocate(_mstHdr.op234DataCount);
+	_mstOp234Data.allocate(_mstHdr.op234DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op234DataCount; ++i) {
 		_mstOp234Data[i].indexVar1 = fp->readUint16();
 		_mstOp234Data[i].indexVar2 = fp->readUint16();
@@ -1829,7 +3236,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 8;
 	}
 
-	_mstOp2Data.allocate(_mstHdr.op2DataCount);
+	_mstOp2Data.allocate(_mstHdr.op2DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op2DataCount; ++i) {
 		_mstOp2Data[i].indexVar1 = fp->readUint32();
 		_mstOp2Data[i].indexVar2 = fp->readUint32();
@@ -1840,7 +3247,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 12;
 	}
 
-	_mstOp197Data.allocate(_mstHdr.op197DataCount);
+	_mstOp197Data.allocate(_mstHdr.op197DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op197DataCount; ++i) {
 		_mstOp197Data[i].unk0 = fp->readUint16();
 		_mstOp197Data[i].unk2 = fp->readUint16();
@@ -1853,7 +3260,7 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 16;
 	}
 
-	_mstOp211Data.allocate(_mstHdr.op211DataCount);
+	_mstOp211Data.allocate(_mstHdr.op211DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op211DataCount; ++i) {
 		_mstOp211Data[i].indexVar1 = fp->readUint16();
 		_mstOp211Data[i].indexVar2 = fp->readUint16();
@@ -1869,14 +3276,14 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 16;
 	}
 
-	_mstOp240Data.allocate(_mstHdr.op240DataCount);
+	_mstOp240Data.allocate(_mstHdr.op240DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op240DataCount; ++i) {
 		_mstOp240Data[i].flags    = fp->readUint32();
 		_mstOp240Data[i].codeData = fp->readUint32();
 		bytesRead += 8;
 	}
 
-	_mstUnk60.allocate(_mstHdr.unk0x70);
+	_mstUnk60.allocate(_mstHdr.unk0x70, &_mstArena);
 	for (int i = 0; i < _mstHdr.unk0x70; ++i) {
 		_mstUnk60[i] = fp->readUint32();
 		bytesRead += 4;
@@ -1885,7 +3292,7 @@ void Resource::loadMstData(File *fp) {
 	fp->seek(_mstHdr.unk0x74 * 4, SEEK_CUR); // _mstUnk61
 	bytesRead += _mstHdr.unk0x74 * 4;
 
-	_mstOp204Data.allocate(_mstHdr.op204DataCount);
+	_mstOp204Data.allocate(_mstHdr.op204DataCount, &_mstArena);
 	for (int i = 0; i < _mstHdr.op204DataCount; ++i) {
 		_mstOp204Data[i].arg0 = fp->readUint32();
 		_mstOp204Data[i].arg1 = fp->readUint32();
@@ -1894,90 +3301,293 @@ void Resource::loadMstData(File *fp) {
 		bytesRead += 16;
 	}
 
-	_mstCodeData = (uint8_t *)malloc(_mstHdr.codeSize * 4);
+	_mstCodeData = (uint8_t *)_mstArena.allocate(_mstHdr.codeSize * 4);
 	fp->read(_mstCodeData, _mstHdr.codeSize * 4);
 	bytesRead += _mstHdr.codeSize * 4;
 
 	if (bytesRead != _mstHdr.dataSize) {
 		warning("Unexpected .mst bytesRead %d dataSize %d", bytesRead, _mstHdr.dataSize);
+	} else if (kMstSnapshot && _levelName) {
+		saveMstSnapshot(sourceSize, sourceChecksum);
 	}
+	decodeMstCode();
+	initMstWalkPathRoutes();
+	initMstAreaGrids();
 }
 
-void Resource::unloadMstData() {
-	for (int i = 0; i < _mstHdr.walkCodeDataCount; ++i) {
-		free(_mstWalkCodeData[i].codeData);
-		_mstWalkCodeData[i].codeData = 0;
-		free(_mstWalkCodeData[i].indexData);
-		_mstWalkCodeData[i].indexData = 0;
+// the instructions are checked once, the interpreter skips the checks for the decoded ones
+// returns false if the opcode is unknown or an operand is out of range
+bool Resource::decodeMstInstruction(const uint8_t *code, MstInstruction *ins) const {
+	const uint32_t size = _mstHdr.codeSize;
+	const uint16_t num = READ_LE_UINT16(code + 2);
+	ins->handler = 0;
+	ins->target = 0;
+	ins->num = num;
+	ins->op = code[0];
+	ins->arg1 = code[1];
+	ins->arg2 = code[2];
+	ins->arg3 = code[3];
+	bool valid = (code[0] < kMstOpcodesCount);
+	uint32_t codeData = kNone;
+	switch (code[0]) {
+	case 33:
+	case 229: // jmp_imm
+		codeData = num;
+		valid = (codeData < size);
+		break;
+	case 198: // call_task
+	case 238: // jmp
+	case 239: // create_task
+		if (num < _mstUnk60.count) {
+			codeData = _mstUnk60[num];
+		}
+		valid = (codeData < size);
+		break;
+	case 227:
+	case 228: // compare_vars, compare_flags
+		if (num < _mstOp227Data.count) {
+			codeData = _mstOp227Data[num].codeData;
+		}
+		valid = (codeData < size);
+		break;
+	case 231:
+	case 232:
+	case 233:
+	case 234: // compare_flags_monster, compare_vars_monster
+		valid = (num < _mstOp234Data.count && _mstOp234Data[num].codeData < size);
+		break;
+	case 240: // update_task, kNone removes the tasks
+		if (num < _mstOp240Data.count) {
+			codeData = _mstOp240Data[num].codeData;
+			valid = (codeData == kNone || codeData < size);
+		} else {
+			valid = false;
+		}
+		break;
 	}
-	for (int i = 0; i < _mstHdr.behaviorIndexDataCount; ++i) {
-		free(_mstBehaviorIndexData[i].behavior);
-		_mstBehaviorIndexData[i].behavior = 0;
-		free(_mstBehaviorIndexData[i].data);
-		_mstBehaviorIndexData[i].data = 0;
+	if (codeData < size) {
+		ins->target = _mstCodeData + codeData * 4;
 	}
-	for (int i = 0; i < _mstHdr.monsterActionIndexDataCount; ++i) {
-		free(_mstMonsterActionIndexData[i].indexUnk48);
-		_mstMonsterActionIndexData[i].indexUnk48 = 0;
-		free(_mstMonsterActionIndexData[i].data);
-		_mstMonsterActionIndexData[i].data = 0;
+	ins->valid = valid;
+	return valid;
+}
+
+void Resource::decodeMstCode() {
+	const uint32_t size = _mstHdr.codeSize;
+	MstInstruction *instructions = (MstInstruction *)_mstArena.allocateZero((size + 2) * sizeof(MstInstruction));
+	_mstInstructions = instructions + 1;
+	_mstInstructionsLinked = false;
+	int invalidCount = 0;
+	for (uint32_t i = 0; i < size; ++i) {
+		if (!decodeMstInstruction(_mstCodeData + i * 4, &_mstInstructions[i])) {
+			++invalidCount;
+		}
 	}
-	for (int i = 0; i < _mstHdr.walkPathDataCount; ++i) {
-		free(_mstWalkPathData[i].data);
-		_mstWalkPathData[i].data = 0;
-		free(_mstWalkPathData[i].walkNodeData);
-		_mstWalkPathData[i].walkNodeData = 0;
+	// executing past the end of the code goes through the checked switch
+	_mstInstructions[size].valid = false;
+	if (invalidCount != 0) {
+		warning("%d .mst instructions failed validation", invalidCount);
 	}
-	for (int i = 0; i < _mstHdr.behaviorDataCount; ++i) {
-		free(_mstBehaviorData[i].data);
-		_mstBehaviorData[i].data = 0;
+}
+
+void Resource::initMstWalkPathRoutes() {
+	const int count = _mstHdr.walkPathDataCount;
+	_mstWalkPathRoutes = (MstWalkPathRoutes *)_mstArena.allocateZero(count * sizeof(MstWalkPathRoutes));
+	for (int i = 0; i < count; ++i) {
+		const MstWalkPath *walkPath = &_mstWalkPathData[i];
+		MstWalkPathRoutes *routes = &_mstWalkPathRoutes[i];
+		for (uint32_t j = 0; j < walkPath->count; ++j) {
+			const MstWalkBox *m34 = &_mstWalkBoxData[walkPath->data[j].walkBox];
+			for (int k = 0; k < 4; ++k) {
+				const uint8_t flags = m34->flags[k];
+				if (flags & 0x80) {
+					routes->varMask |= 1 << (flags & 0x7F);
+				}
+			}
+		}
+		for (int k = 0; k < 2; ++k) {
+			routes->sourceVarMask[k] = (uint32_t *)_mstArena.allocateZero(walkPath->count * sizeof(uint32_t));
+		}
 	}
-	for (int i = 0; i < _mstHdr.attackBoxDataCount; ++i) {
-		free(_mstAttackBoxData[i].data);
-		_mstAttackBoxData[i].data = 0;
+}
+
+struct MstGridRect {
+	int32_t x1, y1, x2, y2;
+	uint32_t index;
+};
+
+static void getAreaGridCells(const MstAreaGrid *grid, const MstGridRect *r, int *cx1, int *cy1, int *cx2, int *cy2) {
+	*cx1 = (r->x1 - grid->x) / grid->cellW;
+	*cy1 = (r->y1 - grid->y) / grid->cellH;
+	*cx2 = (r->x2 - grid->x) / grid->cellW;
+	*cy2 = (r->y2 - grid->y) / grid->cellH;
+}
+
+// the rects are expected non empty
+static void buildAreaGrid(MstAreaGrid *grid, const MstGridRect *rects, int count, Arena *arena) {
+	memset(grid, 0, sizeof(MstAreaGrid));
+	if (count == 0) {
+		return;
 	}
-	for (int i = 0; i < _mstHdr.monsterActionDataCount; ++i) {
-		MstMonsterAction *m = &_mstMonsterActionData[i];
-		for (int j = 0; j < 2; ++j) {
-			free(m->data1[j]);
-			m->data1[j] = 0;
-			free(m->data2[j]);
-			m->data2[j] = 0;
+	int32_t x2 = rects[0].x2, y2 = rects[0].y2;
+	grid->x = rects[0].x1;
+	grid->y = rects[0].y1;
+	for (int i = 1; i < count; ++i) {
+		grid->x = MIN(grid->x, rects[i].x1);
+		grid->y = MIN(grid->y, rects[i].y1);
+		x2 = MAX(x2, rects[i].x2);
+		y2 = MAX(y2, rects[i].y2);
+	}
+	const int32_t spanX = x2 - grid->x + 1;
+	const int32_t spanY = y2 - grid->y + 1;
+	grid->w = CLIP((spanX + MstAreaGrid::kMinCellSize - 1) / MstAreaGrid::kMinCellSize, 1, (int)MstAreaGrid::kMaxCells);
+	grid->h = CLIP((spanY + MstAreaGrid::kMinCellSize - 1) / MstAreaGrid::kMinCellSize, 1, (int)MstAreaGrid::kMaxCells);
+	grid->cellW = (spanX + grid->w - 1) / grid->w;
+	grid->cellH = (spanY + grid->h - 1) / grid->h;
+	const int cellsCount = grid->w * grid->h;
+	grid->cells = (uint32_t *)arena->allocateZero((cellsCount + 1) * sizeof(uint32_t));
+	int cx1, cy1, cx2, cy2;
+	for (int i = 0; i < count; ++i) {
+		getAreaGridCells(grid, &rects[i], &cx1, &cy1, &cx2, &cy2);
+		for (int y = cy1; y <= cy2; ++y) {
+			for (int x = cx1; x <= cx2; ++x) {
+				++grid->cells[y * grid->w + x];
+			}
+		}
+	}
+	for (int i = 1; i < cellsCount; ++i) {
+		grid->cells[i] += grid->cells[i - 1];
+	}
+	grid->cells[cellsCount] = grid->cells[cellsCount - 1];
+	grid->indexes = (uint32_t *)arena->allocate(grid->cells[cellsCount] * sizeof(uint32_t));
+	// filled backwards, the cells offsets are moved from the end to the start of each cell
+	for (int i = count - 1; i >= 0; --i) {
+		getAreaGridCells(grid, &rects[i], &cx1, &cy1, &cx2, &cy2);
+		for (int y = cy1; y <= cy2; ++y) {
+			for (int x = cx1; x <= cx2; ++x) {
+				grid->indexes[--grid->cells[y * grid->w + x]] = rects[i].index;
+			}
 		}
-		free(m->area);
-		m->area = 0;
 	}
+}
 
-	free(_mstMonsterInfos);
-	_mstMonsterInfos = 0;
+const uint32_t *MstAreaGrid::find(int xPos, int yPos, uint32_t *count) const {
+	if (!cells || xPos < x || yPos < y) {
+		*count = 0;
+		return 0;
+	}
+	const int cx = (xPos - x) / cellW;
+	const int cy = (yPos - y) / cellH;
+	if (cx >= w || cy >= h) {
+		*count = 0;
+		return 0;
+	}
+	const int num = cy * w + cx;
+	*count = cells[num + 1] - cells[num];
+	return indexes + cells[num];
+}
 
-	for (int i = 0; i < _mstHdr.movingBoundsDataCount; ++i) {
-		free(_mstMovingBoundsData[i].data1);
-		_mstMovingBoundsData[i].data1 = 0;
-		free(_mstMovingBoundsData[i].indexData);
-		_mstMovingBoundsData[i].indexData = 0;
+void Resource::initMstAreaGrids() {
+	int rectsSize = _mstHdr.screenAreaDataCount;
+	for (int i = 0; i < _mstHdr.walkPathDataCount; ++i) {
+		rectsSize = MAX(rectsSize, (int)_mstWalkPathData[i].count);
 	}
-	for (int i = 0; i < _mstHdr.shootDataCount; ++i) {
-		free(_mstShootData[i].data);
-		_mstShootData[i].data = 0;
+	MstGridRect *rects = (MstGridRect *)malloc(MAX(rectsSize, 1) * sizeof(MstGridRect));
+	if (!rects) {
+		error("Unable to allocate %d bytes", (int)(rectsSize * sizeof(MstGridRect)));
 	}
-	for (int i = 0; i < _mstHdr.shootIndexDataCount; ++i) {
-		free(_mstShootIndexData[i].indexUnk50Unk1);
-		_mstShootIndexData[i].indexUnk50Unk1 = 0;
+	_mstScreenAreaGrids = (MstAreaGrid *)_mstArena.allocate(_mstHdr.screensCount * sizeof(MstAreaGrid));
+	for (int i = 0; i < _mstHdr.screensCount; ++i) {
+		int count = 0;
+		for (uint32_t j = _mstScreenAreaByPosIndexData[i]; j != kNone; j = _mstScreenAreaData[j].nextByPos) {
+			const MstScreenArea *msac = &_mstScreenAreaData[j];
+			if (msac->x1 <= msac->x2 && msac->y1 <= msac->y2) {
+				assert(count < rectsSize);
+				MstGridRect *r = &rects[count++];
+				r->x1 = msac->x1;
+				r->y1 = msac->y1;
+				r->x2 = msac->x2;
+				r->y2 = msac->y2;
+				r->index = j;
+			}
+		}
+		buildAreaGrid(&_mstScreenAreaGrids[i], rects, count, &_mstArena);
+	}
+	_mstWalkPathGrids = (MstAreaGrid *)_mstArena.allocate(_mstHdr.walkPathDataCount * sizeof(MstAreaGrid));
+	for (int i = 0; i < _mstHdr.walkPathDataCount; ++i) {
+		const MstWalkPath *walkPath = &_mstWalkPathData[i];
+		int count = 0;
+		for (uint32_t j = 0; j < walkPath->count; ++j) {
+			const MstWalkBox *m34 = &_mstWalkBoxData[walkPath->data[j].walkBox];
+			if (m34->left <= m34->right && m34->top <= m34->bottom) {
+				MstGridRect *r = &rects[count++];
+				r->x1 = m34->left;
+				r->y1 = m34->top;
+				r->x2 = m34->right;
+				r->y2 = m34->bottom;
+				r->index = j;
+			}
+		}
+		buildAreaGrid(&_mstWalkPathGrids[i], rects, count, &_mstArena);
 	}
+	free(rects);
+}
 
-	free(_mstCodeData);
+void Resource::unloadMstData() {
+	// the arrays and the snapshot data are allocated from the arena
+	_mstArena.reset();
+	_mstSnapshotData = 0;
+	_mstMonsterInfos = 0;
 	_mstCodeData = 0;
+	_mstInstructions = 0;
+	_mstInstructionsLinked = false;
+	_mstWalkPathRoutes = 0;
+	_mstScreenAreaGrids = 0;
+	_mstWalkPathGrids = 0;
+	releaseMstArrays();
+}
+
+void Resource::releaseMstArrays() {
+	_mstPointOffsets.deallocate();
+	_mstWalkBoxData.deallocate();
+	_mstWalkCodeData.deallocate();
+	_mstMovingBoundsIndexData.deallocate();
+	_mstLevelCheckpointCodeData.deallocate();
+	_mstScreenAreaData.deallocate();
+	_mstScreenAreaByValueIndexData.deallocate();
+	_mstScreenAreaByPosIndexData.deallocate();
+	_mstUnk41.deallocate();
+	_mstBehaviorIndexData.deallocate();
+	_mstMonsterActionIndexData.deallocate();
+	_mstWalkPathData.deallocate();
+	_mstInfoMonster2Data.deallocate();
+	_mstBehaviorData.deallocate();
+	_mstAttackBoxData.deallocate();
+	_mstMonsterActionData.deallocate();
+	_mstMovingBoundsData.deallocate();
+	_mstShootData.deallocate();
+	_mstShootIndexData.deallocate();
+	_mstActionDirectionData.deallocate();
+	_mstOp223Data.deallocate();
+	_mstOp227Data.deallocate();
+	_mstOp234Data.deallocate();
+	_mstOp2Data.deallocate();
+	_mstOp197Data.deallocate();
+	_mstOp211Data.deallocate();
+	_mstOp240Data.deallocate();
+	_mstUnk60.deallocate();
+	_mstOp204Data.deallocate();
+	_mstOp226Data.deallocate();
 }
 
 const MstScreenArea *Resource::findMstCodeForPos(int num, int xPos, int yPos) const {
-	uint32_t i = _mstScreenAreaByPosIndexData[num];
-	while (i != kNone) {
-		const MstScreenArea *msac = &_mstScreenAreaData[i];
+	uint32_t count;
+	const uint32_t *indexes = _mstScreenAreaGrids[num].find(xPos, yPos, &count);
+	for (uint32_t i = 0; i < count; ++i) {
+		const MstScreenArea *msac = &_mstScreenAreaData[indexes[i]];
 		if (msac->x1 <= xPos && msac->x2 >= xPos && msac->unk0x1D != 0 && msac->y1 <= yPos && msac->y2 >= yPos) {
 			return msac;
 		}
-		i = msac->nextByPos;
 	}
 	return 0;
 }
@@ -2059,32 +3669,56 @@ static void persistSetupCfg(FILE *fp, T *config) {
 
 static const uint32_t _demTag = 0x31434552; // 'REC1'
 
+bool Resource::loadDem(File *f) {
+	const uint32_t tag = f->readUint32();
+	if (tag != _demTag) {
+		return false;
+	}
+	unloadHodDem();
+	f->skipUint32();
+	_dem.randSeed = f->readUint32();
+	_dem.keyMaskLen = f->readUint32();
+	_dem.level = f->readByte();
+	_dem.checkpoint = f->readByte();
+	_dem.difficulty = f->readByte();
+	_dem.randRounds = f->readByte();
+	_dem.stateChecksum = f->readUint32();
+	f->skipUint32();
+	_dem.actionKeyMask = (uint8_t *)malloc(_dem.keyMaskLen);
+	f->read(_dem.actionKeyMask, _dem.keyMaskLen);
+	_dem.directionKeyMask = (uint8_t *)malloc(_dem.keyMaskLen);
+	f->read(_dem.directionKeyMask, _dem.keyMaskLen);
+	return true;
+}
+
 bool Resource::loadHodDem() {
 	bool ret = false;
-	File f;
-	if (openDat(_fs, _hodDem, &f)) {
-		const uint32_t tag = f.readUint32();
-		if (tag == _demTag) {
-			f.skipUint32();
-			_dem.randSeed = f.readUint32();
-			_dem.keyMaskLen = f.readUint32();
-			_dem.level = f.readByte();
-			_dem.checkpoint = f.readByte();
-			_dem.difficulty = f.readByte();
-			_dem.randRounds = f.readByte();
-			f.skipUint32();
-			f.skipUint32();
-			_dem.actionKeyMask = (uint8_t *)malloc(_dem.keyMaskLen);
-			f.read(_dem.actionKeyMask, _dem.keyMaskLen);
-			_dem.directionKeyMask = (uint8_t *)malloc(_dem.keyMaskLen);
-			f.read(_dem.directionKeyMask, _dem.keyMaskLen);
-			ret = true;
-		}
-		closeDat(_fs, &f);
+	File *f = openAssetDat(_fs, _hodDem);
+	if (f) {
+		ret = loadDem(f);
+		closeAssetDat(_fs, f);
 	}
 	return ret;
 }
 
+// same layout as 'HOD.DEM'
+void Resource::writeDem(FILE *fp, const Dem *dem) {
+	uint8_t hdr[28];
+	WRITE_LE_UINT32(hdr, _demTag);
+	WRITE_LE_UINT32(hdr + 4, 0);
+	WRITE_LE_UINT32(hdr + 8, dem->randSeed);
+	WRITE_LE_UINT32(hdr + 12, dem->keyMaskLen);
+	hdr[16] = dem->level;
+	hdr[17] = dem->checkpoint;
+	hdr[18] = dem->difficulty;
+	hdr[19] = dem->randRounds;
+	WRITE_LE_UINT32(hdr + 20, dem->stateChecksum);
+	WRITE_LE_UINT32(hdr + 24, 0);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	fwrite(dem->actionKeyMask, 1, dem->keyMaskLen, fp);
+	fwrite(dem->directionKeyMask, 1, dem->keyMaskLen, fp);
+}
+
 void Resource::unloadHodDem() {
 	free(_dem.actionKeyMask);
 	free(_dem.directionKeyMask);
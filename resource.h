@@ -6,6 +6,7 @@
 #ifndef RESOURCE_H__
 #define RESOURCE_H__
 
+#include "arena.h"
 #include "defs.h"
 #include "intern.h"
 
@@ -183,6 +184,36 @@ struct MstWalkPath { // u44
 	uint32_t count; // 0xC
 }; // sizeof == 16
 
+// static areas bucketed in a grid over their bounds, the indexes of each cell are in the lookup order
+struct MstAreaGrid {
+	enum {
+		kMaxCells = 8,
+		kMinCellSize = 32
+	};
+	int32_t x, y; // top left of the first cell
+	int32_t cellW, cellH;
+	int w, h;
+	uint32_t *cells; // w * h + 1 offsets in indexes
+	uint32_t *indexes;
+
+	const uint32_t *find(int xPos, int yPos, uint32_t *count) const;
+};
+
+// the walk nodes coords and unk60 tables only depend on the _mstAndyVarMask bits tested by the walk boxes
+struct MstWalkPathRoutes {
+	enum {
+		kCacheSize = 4
+	};
+	uint32_t varMask; // _mstAndyVarMask bits tested by the walk boxes of the path
+	uint32_t key; // varMask bits the MstWalkNode tables were computed with
+	bool keyValid; // false until the tables loaded from the .mst are recomputed
+	uint32_t *sourceVarMask[2]; // per walk node, the bits tested by the search from that node
+	int cacheCount;
+	int cacheNext;
+	uint32_t cacheKeys[kCacheSize];
+	uint8_t *cacheData[kCacheSize]; // coords, sourceVarMask and unk60 tables
+};
+
 struct MstInfoMonster2 { // u45
 	uint8_t type; // 0x0
 	uint8_t shootMask; // 0x1
@@ -438,12 +469,41 @@ struct SssSample {
 	uint8_t unk5; // unused
 	int8_t initPriority; // 0x6
 	int8_t initPanning; // 0x7
-	uint32_t codeOffset1; // 0x8 indexes _sssCodeData
-	uint32_t codeOffset2; // 0xC indexes _sssCodeData
-	uint32_t codeOffset3; // 0x10 indexes _sssCodeData
-	uint32_t codeOffset4; // 0x14 indexes _sssCodeData
+	uint32_t codeOffset1; // 0x8 indexes _sssOpcodesData
+	uint32_t codeOffset2; // 0xC indexes _sssOpcodesData
+	uint32_t codeOffset3; // 0x10 indexes _sssOpcodesData
+	uint32_t codeOffset4; // 0x14 indexes _sssOpcodesData
 }; // sizeof == 24
 
+enum {
+	kSssOpcodesCount = 30 // invalid and unknown opcodes are decoded as kSssOpcodesCount
+};
+
+enum {
+	kMstOpcodesCount = 243
+};
+
+struct SssOpcode { // pre-decoded .sss bytecode instruction
+	uint8_t op;
+	uint8_t arg0; // code[1]
+	uint16_t arg1; // code[2..3]
+	int32_t arg2; // code[4..7]
+	int32_t arg3; // code[8..11]
+	int32_t arg4; // code[12..15]
+	const SssOpcode *target; // resolved jump (opcodes 6 and 28)
+};
+
+struct MstInstruction { // pre-decoded .mst bytecode instruction, indexed as _mstCodeData
+	const void *handler; // label in Game::mstTask_main, set on the first run
+	const uint8_t *target; // resolved jump, call and task code (opcodes 33, 198, 227, 228, 229, 238, 239, 240)
+	uint16_t num; // code[2..3]
+	uint8_t op; // code[0]
+	uint8_t arg1; // code[1]
+	uint8_t arg2; // code[2]
+	uint8_t arg3; // code[3]
+	bool valid; // false for the unknown opcodes and the out of range operands, run through the checked switch
+};
+
 struct SssPreloadList {
 	int count;
 	int ptrSize;
@@ -502,6 +562,7 @@ struct Dem {
 	uint8_t checkpoint;
 	uint8_t difficulty;
 	uint8_t randRounds;
+	uint32_t stateChecksum; // save states, Game::computeStateChecksum() after the last input
 	uint8_t *actionKeyMask;
 	uint8_t *directionKeyMask;
 };
@@ -510,23 +571,33 @@ template <typename T>
 struct ResStruct {
 	T *ptr;
 	unsigned int count;
+	bool arena; // ptr is released with the arena
 
 	ResStruct()
-		: ptr(0), count(0) {
+		: ptr(0), count(0), arena(false) {
 	}
 	~ResStruct() {
 		deallocate();
 	}
 
 	void deallocate() {
-		free(ptr);
+		if (!arena) {
+			memFree(ptr);
+		}
 		ptr = 0;
 		count = 0;
+		arena = false;
 	}
 	void allocate(unsigned int size) {
-		free(ptr);
+		deallocate();
 		count = size;
-		ptr = (T *)malloc(size * sizeof(T));
+		ptr = (T *)memAlloc(kMemTag_Resource, size * sizeof(T));
+	}
+	void allocate(unsigned int size, Arena *a) {
+		deallocate();
+		count = size;
+		ptr = (T *)a->allocate(size * sizeof(T));
+		arena = true;
 	}
 
 	const T& operator[](int i) const {
@@ -540,6 +611,7 @@ struct ResStruct {
 };
 
 struct FileSystem;
+struct LvlScreensPrefetch;
 
 struct Resource {
 	enum {
@@ -581,6 +653,8 @@ struct Resource {
 	uint8_t *_resLevelData0x470CTable; // masks
 	uint8_t *_resLevelData0x470CTablePtrHdr;
 	uint8_t *_resLevelData0x470CTablePtrData;
+	uint8_t *_lvlScreenMasksTable[kMaxScreens * 4]; // 32x24, decoded on first use
+	uint8_t *_lvlScreenPosTable[kMaxScreens * 4];
 	uint32_t _lvlSpritesOffset;
 	uint32_t _lvlBackgroundsOffset;
 	uint32_t _lvlMasksOffset;
@@ -593,6 +667,22 @@ struct Resource {
 	LvlBackgroundData _resLvlScreenBackgroundDataTable[kMaxScreens];
 	uint8_t *_resLvlScreenBackgroundDataPtrTable[kMaxScreens];
 
+	// background data loaded on demand (_preloadLvlBackgroundData disabled)
+	bool _preloadLvlBackgroundData; // load all the screens on level start
+	const char *_levelName;
+	LvlScreensPrefetch *_lvlScreensPrefetch; // running batches, newest first
+	int _lvlScreensResidentMax; // 0 for no limit
+	uint32_t _lvlScreensUseCounter;
+	uint32_t _lvlScreensLastUse[kMaxScreens];
+	bool _lvlScreensEvicted[kMaxScreens];
+
+	// per-level allocations, released at once when the level changes
+	Arena _lvlArena; // sprites and masks
+	Arena _lvlScreenArenas[kMaxScreens]; // backgrounds, released on eviction
+	Arena _sssArena;
+	Arena _sssPcmArena;
+	Arena _mstArena;
+
 	LvlObject _resLvlScreenObjectDataTable[104];
 	LvlObject _dummyObject; // (LvlObject *)0xFFFFFFFF
 
@@ -608,7 +698,7 @@ struct Resource {
 	uint32_t *_sssGroup1[3];
 	uint32_t *_sssGroup2[3];
 	uint32_t *_sssGroup3[3];
-	uint8_t *_sssCodeData;
+	ResStruct<SssOpcode> _sssOpcodesData;
 
 	ResStruct<MstPointOffset> _mstPointOffsets;
 	ResStruct<MstWalkBox> _mstWalkBoxData;
@@ -643,7 +733,13 @@ struct Resource {
 	ResStruct<uint32_t> _mstUnk60; // indexes _mstCodeData
 	ResStruct<MstOp204Data> _mstOp204Data;
 	uint8_t *_mstCodeData;
+	MstInstruction *_mstInstructions; // pre-decoded _mstCodeData, with an entry before the first instruction and an invalid one after the last
+	bool _mstInstructionsLinked; // the handlers are set
+	MstWalkPathRoutes *_mstWalkPathRoutes; // indexed as _mstWalkPathData, not part of the snapshot
+	MstAreaGrid *_mstScreenAreaGrids; // indexed by screen, the _mstScreenAreaByPosIndexData lists
+	MstAreaGrid *_mstWalkPathGrids; // indexed as _mstWalkPathData, the walk boxes of the nodes
 	ResStruct<MstOp226Data> _mstOp226Data;
+	uint8_t *_mstSnapshotData; // the _mst arrays point inside when loaded from a snapshot
 
 	Resource(FileSystem *fs);
 	~Resource();
@@ -656,7 +752,14 @@ struct Resource {
 	void loadDatMenuBuffers();
 	void unloadDatMenuBuffers();
 
+	bool openLevelDat(const char *name, File *&f);
+	void flattenSectorDat(const char *name);
+	void flattenSectorFiles();
+	void packDataFiles();
+	bool verifyDataFiles();
+
 	void loadLevelData(int levelNum);
+	void dumpArenasUsage();
 
 	void loadLvlScreenObjectData(LvlObject *dat, const uint8_t *src);
 	void loadLvlData(File *fp);
@@ -664,9 +767,19 @@ struct Resource {
 	void loadLvlSpriteData(int num, const uint8_t *buf = 0);
 	const uint8_t *getLvlScreenMaskDataPtr(int num) const;
 	const uint8_t *getLvlScreenPosDataPtr(int num) const;
+	uint8_t *decodeLvlScreenGrid(const uint8_t *data);
+	const uint8_t *getLvlScreenMask(int num);
+	const uint8_t *getLvlScreenPos(int num);
 	void loadLvlScreenMaskData();
 	void loadLvlScreenBackgroundData(int num, const uint8_t *buf = 0);
+	void installLvlScreenBackgroundData(int num, uint8_t *ptr, uint32_t size, uint32_t readSize, const uint8_t *hdr);
 	void unloadLvlScreenBackgroundData(int num);
+	void evictLvlScreenBackgroundData(int num);
+	void startLvlScreensPrefetch(const uint8_t *screens, int count, uint8_t currentScreen);
+	void addSssPcmPrefetch(LvlScreensPrefetch *p, const SssPreloadInfoData *preloadInfoData);
+	void collectLvlScreensPrefetch(); // takes the finished entries and cancels the rest, does not wait
+	void finishLvlScreensPrefetch(); // cancels and waits for the workers, the data is discarded
+	void evictLvlScreensData(uint8_t currentScreen, int reserved);
 	bool isLvlSpriteDataLoaded(int num) const;
 	bool isLvlBackgroundDataLoaded(int num) const;
 	void incLvlSpriteDataRefCounter(LvlObject *ptr);
@@ -677,18 +790,34 @@ struct Resource {
 
 	void loadSssData(File *fp, const uint32_t baseOffset = 0);
 	void unloadSssData();
-	void checkSssCode(const uint8_t *buf, int size) const;
+	uint32_t findNextSssCodeOffset(uint32_t offset) const;
+	void decodeSssCode(const uint8_t *buf, int size);
+	uint8_t *readSssPcm(File *fp, SssPcm *pcm);
 	void loadSssPcm(File *fp, SssPcm *pcm);
 	void clearSssGroup3();
 	void resetSssFilters();
 	void preloadSssPcmList(const SssPreloadInfoData *preloadInfoData);
 
+	bool loadMstSnapshot(uint32_t sourceSize, uint32_t sourceChecksum);
+	void saveMstSnapshot(uint32_t sourceSize, uint32_t sourceChecksum);
 	void loadMstData(File *fp);
+	void releaseMstArrays();
+	bool decodeMstInstruction(const uint8_t *code, MstInstruction *ins) const;
+	void decodeMstCode();
+	const MstInstruction *getMstInstruction(const uint8_t *code) const {
+		const uint32_t index = (uint32_t)(code - _mstCodeData) >> 2;
+		const uint32_t count = _mstHdr.codeSize;
+		return &_mstInstructions[(index < count) ? index : count];
+	}
+	void initMstWalkPathRoutes();
+	void initMstAreaGrids();
 	void unloadMstData();
 	const MstScreenArea *findMstCodeForPos(int num, int xPos, int yPos) const;
 	void flagMstCodeForPos(int num, uint8_t value);
 
+	bool loadDem(File *f);
 	bool loadHodDem();
+	void writeDem(FILE *fp, const Dem *dem);
 	void unloadHodDem();
 
 	bool writeSetupCfg(const SetupConfig *config);
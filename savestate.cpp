@@ -0,0 +1,670 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "game.h"
+#include "fileio.h"
+#include "level.h"
+#include "lz4.h"
+#include "paf.h"
+#include "stats.h"
+#include "system.h"
+#include "util.h"
+#include "video.h"
+
+static const char *_replayDem = "hode_replay.dem";
+
+enum {
+	kModeSize,
+	kModeSave,
+	kModeLoad
+};
+
+struct StateBuffer {
+	uint8_t *ptr;
+	uint32_t offset;
+};
+
+template <int M>
+static void persistData(StateBuffer *b, void *ptr, uint32_t size) {
+	if (M == kModeSave) {
+		memcpy(b->ptr + b->offset, ptr, size);
+	} else if (M == kModeLoad) {
+		memcpy(ptr, b->ptr + b->offset, size);
+	}
+	b->offset += size;
+}
+
+template <int M, typename T>
+static void persistValue(StateBuffer *b, T &value) {
+	persistData<M>(b, &value, sizeof(T));
+}
+
+// the free entries, the table and the stats are not saved
+template <int M, typename T, int N>
+static void persistPool(StateBuffer *b, Pool<T, N> *pool) {
+	persistValue<M>(b, pool->_free);
+	persistValue<M>(b, pool->_freePos);
+	persistValue<M>(b, pool->_freeCount);
+	persistValue<M>(b, pool->_freeMask);
+	persistValue<M>(b, pool->_ordered);
+	if (M == kModeLoad) {
+		pool->_stats.used = N - pool->_freeCount;
+	}
+}
+
+template <int M>
+static void persistGameState(StateBuffer *b, Game *g, const GameState *state) {
+	// game.cpp, the settings are not saved and the sprites are rebuilt on each frame
+	persistValue<M>(b, g->_rnd);
+	persistValue<M>(b, g->_screenLvlObjectsList);
+	persistValue<M>(b, g->_andyObject);
+	persistValue<M>(b, g->_plasmaExplosionObject);
+	persistValue<M>(b, g->_plasmaCannonObject);
+	persistValue<M>(b, g->_specialAnimLvlObject);
+	persistValue<M>(b, g->_currentSoundLvlObject);
+	persistValue<M>(b, g->_currentLevel);
+	persistValue<M>(b, g->_currentLevelCheckpoint);
+	persistValue<M>(b, g->_endLevel);
+	persistValue<M>(b, g->_directionKeyMask);
+	persistValue<M>(b, g->_actionKeyMask);
+	persistValue<M>(b, g->_currentRightScreen);
+	persistValue<M>(b, g->_currentLeftScreen);
+	persistValue<M>(b, g->_currentScreen);
+	persistValue<M>(b, g->_levelRestartCounter);
+	persistValue<M>(b, g->_fadePalette);
+	persistValue<M>(b, g->_hideAndyObjectFlag);
+	persistValue<M>(b, g->_prevAndyFlags0);
+	persistValue<M>(b, g->_shootLvlObjectDataTable);
+	persistPool<M>(b, &g->_shootLvlObjectDataPool);
+	persistValue<M>(b, g->_lvlObjectsList0);
+	persistValue<M>(b, g->_lvlObjectsList1);
+	persistValue<M>(b, g->_lvlObjectsList2);
+	persistValue<M>(b, g->_lvlObjectsList3);
+	persistValue<M>(b, g->_screenPosTable);
+	persistValue<M>(b, g->_screenMaskBuffer);
+	persistValue<M>(b, g->_mstAndyCurrentScreenNum);
+	persistValue<M>(b, g->_shakeScreenDuration);
+	persistValue<M>(b, g->_shakeScreenTable);
+	persistValue<M>(b, g->_plasmaCannonDirection);
+	persistValue<M>(b, g->_plasmaCannonPrevDirection);
+	persistValue<M>(b, g->_plasmaCannonPointsSetupCounter);
+	persistValue<M>(b, g->_plasmaCannonLastIndex1);
+	persistValue<M>(b, g->_plasmaCannonExplodeFlag);
+	persistValue<M>(b, g->_plasmaCannonPointsMask);
+	persistValue<M>(b, g->_plasmaCannonFirstIndex);
+	persistValue<M>(b, g->_plasmaCannonLastIndex2);
+	persistValue<M>(b, g->_plasmaCannonFlags);
+	persistValue<M>(b, g->_actionDirectionKeyMaskCounter);
+	persistValue<M>(b, g->_fallingAndyFlag);
+	persistValue<M>(b, g->_fallingAndyCounter);
+	persistValue<M>(b, g->_actionDirectionKeyMaskIndex);
+	persistValue<M>(b, g->_andyActionKeyMaskAnd);
+	persistValue<M>(b, g->_andyActionKeyMaskOr);
+	persistValue<M>(b, g->_andyDirectionKeyMaskAnd);
+	persistValue<M>(b, g->_andyDirectionKeyMaskOr);
+	persistValue<M>(b, g->_plasmaCannonPosX);
+	persistValue<M>(b, g->_plasmaCannonPosY);
+	persistValue<M>(b, g->_plasmaCannonXPointsTable1);
+	persistValue<M>(b, g->_plasmaCannonYPointsTable1);
+	persistValue<M>(b, g->_plasmaCannonXPointsTable2);
+	persistValue<M>(b, g->_plasmaCannonYPointsTable2);
+	persistValue<M>(b, g->_shadowScreenMasksTable);
+	persistValue<M>(b, g->_declaredLvlObjectsList);
+	persistPool<M>(b, &g->_declaredLvlObjectsPool);
+	persistValue<M>(b, g->_andyObjectScreenData);
+	persistValue<M>(b, g->_animBackgroundDataTable);
+	persistValue<M>(b, g->_animBackgroundDataCount);
+	persistValue<M>(b, g->_andyActionKeysFlags);
+	persistValue<M>(b, g->_wormHoleSpritesCount);
+	persistValue<M>(b, g->_wormHoleSpritesTable);
+	// monsters.cpp
+	persistValue<M>(b, g->_mstCurrentAnim);
+	persistValue<M>(b, g->_specialAnimMask);
+	persistValue<M>(b, g->_mstOriginPosX);
+	persistValue<M>(b, g->_mstOriginPosY);
+	persistValue<M>(b, g->_specialAnimFlag);
+	persistValue<M>(b, g->_andyShootsTable);
+	persistValue<M>(b, g->_andyShootsCount);
+	persistValue<M>(b, g->_mstOp68_type);
+	persistValue<M>(b, g->_mstOp68_flags1);
+	persistValue<M>(b, g->_mstOp67_type);
+	persistValue<M>(b, g->_mstOp67_flags1);
+	persistValue<M>(b, g->_mstOp67_x1);
+	persistValue<M>(b, g->_mstOp67_x2);
+	persistValue<M>(b, g->_mstOp67_y1);
+	persistValue<M>(b, g->_mstOp67_y2);
+	persistValue<M>(b, g->_mstOp67_screenNum);
+	persistValue<M>(b, g->_mstOp68_flags2);
+	persistValue<M>(b, g->_mstOp68_x1);
+	persistValue<M>(b, g->_mstOp68_x2);
+	persistValue<M>(b, g->_mstOp68_y1);
+	persistValue<M>(b, g->_mstOp68_y2);
+	persistValue<M>(b, g->_mstOp68_screenNum);
+	persistValue<M>(b, g->_mstLevelGatesMask);
+	persistValue<M>(b, g->_runTaskOpcodesCount);
+	persistValue<M>(b, g->_mstVars);
+	persistValue<M>(b, g->_mstFlags);
+	persistValue<M>(b, g->_clipBoxOffsetX);
+	persistValue<M>(b, g->_clipBoxOffsetY);
+	persistValue<M>(b, g->_currentTask);
+	persistValue<M>(b, g->_mstOp54Counter);
+	persistValue<M>(b, g->_mstOp56Counter);
+	persistValue<M>(b, g->_executeMstLogicCounter);
+	persistValue<M>(b, g->_executeMstLogicPrevCounter);
+	persistValue<M>(b, g->_tasksTable);
+	persistPool<M>(b, &g->_tasksPool);
+	persistValue<M>(b, g->_tasksList);
+	persistValue<M>(b, g->_monsterObjects1TasksList);
+	persistValue<M>(b, g->_monsterObjects2TasksList);
+	persistValue<M>(b, g->_mstAndyLevelPrevPosX);
+	persistValue<M>(b, g->_mstAndyLevelPrevPosY);
+	persistValue<M>(b, g->_mstAndyLevelPosX);
+	persistValue<M>(b, g->_mstAndyLevelPosY);
+	persistValue<M>(b, g->_mstAndyScreenPosX);
+	persistValue<M>(b, g->_mstAndyScreenPosY);
+	persistValue<M>(b, g->_mstAndyRectNum);
+	persistValue<M>(b, g->_m43Num1);
+	persistValue<M>(b, g->_m43Num2);
+	persistValue<M>(b, g->_m43Num3);
+	persistValue<M>(b, g->_xMstPos1);
+	persistValue<M>(b, g->_yMstPos1);
+	persistValue<M>(b, g->_xMstPos2);
+	persistValue<M>(b, g->_yMstPos2);
+	persistValue<M>(b, g->_xMstPos3);
+	persistValue<M>(b, g->_yMstPos3);
+	persistValue<M>(b, g->_mstActionNum);
+	persistValue<M>(b, g->_mstAndyVarMask);
+	persistValue<M>(b, g->_mstChasingMonstersCount);
+	persistValue<M>(b, g->_mstPosXmin);
+	persistValue<M>(b, g->_mstPosXmax);
+	persistValue<M>(b, g->_mstPosYmin);
+	persistValue<M>(b, g->_mstPosYmax);
+	persistValue<M>(b, g->_mstTemp_x1);
+	persistValue<M>(b, g->_mstTemp_x2);
+	persistValue<M>(b, g->_mstTemp_y1);
+	persistValue<M>(b, g->_mstTemp_y2);
+	persistValue<M>(b, g->_monsterObjects1Table);
+	persistValue<M>(b, g->_monsterObjects2Table);
+	persistValue<M>(b, g->_mstTickDelay);
+	persistValue<M>(b, g->_mstCurrentActionKeyMask);
+	persistValue<M>(b, g->_mstCurrentPosX);
+	persistValue<M>(b, g->_mstCurrentPosY);
+	persistValue<M>(b, g->_mstBoundingBoxesCount);
+	persistValue<M>(b, g->_mstBoundingBoxesTable);
+	persistValue<M>(b, g->_mstBoundingBoxesGrid);
+	persistValue<M>(b, g->_mstCurrentTask);
+	persistValue<M>(b, g->_mstCollisionTable);
+	// sound.cpp
+	persistValue<M>(b, g->_sssObjectsTable);
+	persistValue<M>(b, g->_sssObjectsChanged);
+	persistValue<M>(b, g->_sssObjectsCount);
+	persistValue<M>(b, g->_sssObjectsList1);
+	persistValue<M>(b, g->_sssObjectsList2);
+	persistValue<M>(b, g->_lowPrioritySssObject);
+	persistValue<M>(b, g->_sssObjectsUsedMask);
+	persistValue<M>(b, g->_sssObjectsByFlags0);
+	persistValue<M>(b, g->_sssObjectsByFlags1);
+	persistValue<M>(b, g->_sssObjectsPriorityHeap);
+	persistValue<M>(b, g->_sssObjectsPriorityHeapSize);
+	persistValue<M>(b, g->_sssObjectsPriorityOrder);
+	persistValue<M>(b, g->_sssUpdatedObjectsTable);
+	persistValue<M>(b, g->_playingSssObjectsCount);
+	// andy.cpp
+	persistValue<M>(b, g->_andyMoveData);
+	persistValue<M>(b, g->_andyPosX);
+	persistValue<M>(b, g->_andyPosY);
+	persistValue<M>(b, g->_andyMoveMask);
+	persistValue<M>(b, g->_andyUpdatePositionFlag);
+	persistValue<M>(b, g->_andyLevelData0x288PosTablePtr);
+	persistValue<M>(b, g->_andyMoveState);
+	persistValue<M>(b, g->_andyMaskBufferPos1);
+	persistValue<M>(b, g->_andyMaskBufferPos2);
+	persistValue<M>(b, g->_andyMaskBufferPos4);
+	persistValue<M>(b, g->_andyMaskBufferPos5);
+	persistValue<M>(b, g->_andyMaskBufferPos3);
+	persistValue<M>(b, g->_andyMaskBufferPos0);
+	persistValue<M>(b, g->_andyMaskBufferPos7);
+	persistValue<M>(b, g->_andyMaskBufferPos6);
+
+	Level *level = g->_level;
+	persistData<M>(b, level->_screenCounterTable, sizeof(level->_screenCounterTable));
+	persistData<M>(b, &level->_checkpoint, sizeof(level->_checkpoint));
+	LevelStateData levelData[Level::kMaxStateData];
+	const int levelDataCount = level->getStateData(levelData);
+	for (int i = 0; i < levelDataCount; ++i) {
+		persistData<M>(b, levelData[i].ptr, levelData[i].size);
+	}
+
+	Resource *res = g->_res;
+	persistData<M>(b, &res->_currentScreenResourceNum, sizeof(res->_currentScreenResourceNum));
+	persistData<M>(b, res->_screensState, sizeof(res->_screensState));
+	for (unsigned int i = 0; i < kMaxScreens; ++i) {
+		if (state->backgroundData[i]) {
+			persistData<M>(b, &res->_resLvlScreenBackgroundDataTable[i], sizeof(LvlBackgroundData));
+		}
+	}
+	persistData<M>(b, res->_resLevelData0x2988Table, sizeof(res->_resLevelData0x2988Table));
+	persistData<M>(b, res->_resLvlScreenObjectDataTable, sizeof(res->_resLvlScreenObjectDataTable));
+	if (res->_sssFilters.count != 0) {
+		persistData<M>(b, res->_sssFilters.ptr, res->_sssFilters.count * sizeof(SssFilter));
+	}
+	const uint32_t groupSize = res->_sssHdr.banksDataCount * sizeof(uint32_t);
+	if (groupSize != 0) {
+		for (int i = 0; i < 3; ++i) {
+			persistData<M>(b, res->_sssGroup1[i], groupSize);
+			persistData<M>(b, res->_sssGroup2[i], groupSize);
+			persistData<M>(b, res->_sssGroup3[i], groupSize);
+		}
+	}
+
+	// monsters.cpp, the .mst tables modified by the code
+	for (unsigned int i = 0; i < res->_mstWalkPathData.count; ++i) {
+		MstWalkPath *walkPath = &res->_mstWalkPathData[i];
+		for (uint32_t j = 0; j < walkPath->count; ++j) {
+			MstWalkNode *walkNode = &walkPath->data[j];
+			persistData<M>(b, walkNode->coords, sizeof(walkNode->coords));
+			for (int k = 0; k < 2; ++k) {
+				if (walkNode->unk60[k]) {
+					persistData<M>(b, walkNode->unk60[k], walkPath->count);
+				}
+			}
+		}
+	}
+	for (unsigned int i = 0; i < res->_mstScreenAreaData.count; ++i) {
+		persistData<M>(b, &res->_mstScreenAreaData[i].unk0x1D, sizeof(uint8_t));
+	}
+	for (unsigned int i = 0; i < res->_mstMonsterActionIndexData.count; ++i) {
+		MstMonsterActionIndex *m43 = &res->_mstMonsterActionIndexData[i];
+		if (m43->dataCount != 0) {
+			persistData<M>(b, m43->data, m43->dataCount);
+		}
+	}
+	for (unsigned int i = 0; i < res->_mstMonsterActionData.count; ++i) {
+		MstMonsterAction *m48 = &res->_mstMonsterActionData[i];
+		persistData<M>(b, &m48->direction, sizeof(m48->direction));
+		for (int j = 0; j < m48->areaCount; ++j) {
+			if (m48->area[j].count != 0) {
+				persistData<M>(b, m48->area[j].data, m48->area[j].count * sizeof(MstMonsterAreaAction));
+			}
+		}
+	}
+
+	Video *video = g->_video;
+	persistData<M>(b, video->_palette, sizeof(video->_palette));
+	persistData<M>(b, video->_displayPaletteBuffer, sizeof(video->_displayPaletteBuffer));
+	persistData<M>(b, video->_fadePaletteBuffer, sizeof(video->_fadePaletteBuffer));
+	persistData<M>(b, &video->_displayShadowLayer, sizeof(video->_displayShadowLayer));
+	persistData<M>(b, &video->_transformShadowLayerDelta, sizeof(video->_transformShadowLayerDelta));
+	persistData<M>(b, video->_shadowColorLut, sizeof(video->_shadowColorLut));
+	persistData<M>(b, &video->_backgroundPsx, sizeof(video->_backgroundPsx));
+	persistData<M>(b, video->_backgroundLayer, Video::W * Video::H);
+	persistData<M>(b, video->_shadowScreenMaskBuffer, 256 * 192 * 2 + 256 * 4);
+	if (video->_shadowColorLookupTable) {
+		persistData<M>(b, video->_shadowColorLookupTable, 256 * 256);
+	}
+	if (state->transformShadowLayer) {
+		persistData<M>(b, video->_transformShadowBuffer, 256 * 192 + 256);
+	}
+}
+
+static uint32_t updateChecksum(uint32_t checksum, const void *ptr, uint32_t size) {
+	const uint8_t *p = (const uint8_t *)ptr;
+	for (uint32_t i = 0; i < size; ++i) {
+		checksum = (checksum ^ p[i]) * 0x01000193;
+	}
+	return checksum;
+}
+
+static uint32_t updateChecksum(uint32_t checksum, const LvlObject *o) {
+	checksum = updateChecksum(checksum, &o->xPos, sizeof(o->xPos));
+	checksum = updateChecksum(checksum, &o->yPos, sizeof(o->yPos));
+	checksum = updateChecksum(checksum, &o->screenNum, sizeof(o->screenNum));
+	checksum = updateChecksum(checksum, &o->frame, sizeof(o->frame));
+	checksum = updateChecksum(checksum, &o->anim, sizeof(o->anim));
+	checksum = updateChecksum(checksum, &o->type, sizeof(o->type));
+	checksum = updateChecksum(checksum, &o->spriteNum, sizeof(o->spriteNum));
+	checksum = updateChecksum(checksum, &o->flags0, sizeof(o->flags0));
+	checksum = updateChecksum(checksum, &o->flags1, sizeof(o->flags1));
+	checksum = updateChecksum(checksum, &o->flags2, sizeof(o->flags2));
+	return checksum;
+}
+
+// the fields hashed are not pointers, the values can be compared across runs
+void Game::computeStateHashes(uint32_t *hashes) const {
+	static const uint32_t kFnvOffsetBasis = 0x811C9DC5;
+
+	uint32_t checksum = updateChecksum(kFnvOffsetBasis, _andyObject);
+	const AndyLvlObjectData *andyData = (const AndyLvlObjectData *)_andyObject->dataPtr;
+	checksum = updateChecksum(checksum, &andyData->boundingBox, sizeof(andyData->boundingBox));
+	checksum = updateChecksum(checksum, &_andyMoveData, sizeof(_andyMoveData));
+	hashes[StateTrace::kHashAndy] = checksum;
+
+	checksum = kFnvOffsetBasis;
+	LvlObject *lists[] = { _lvlObjectsList0, _lvlObjectsList1, _lvlObjectsList2, _lvlObjectsList3 };
+	for (unsigned int i = 0; i < ARRAYSIZE(lists); ++i) {
+		for (const LvlObject *o = lists[i]; o; o = o->nextPtr) {
+			checksum = updateChecksum(checksum, o);
+		}
+	}
+	hashes[StateTrace::kHashLvlObjects] = checksum;
+
+	checksum = kFnvOffsetBasis;
+	for (int i = 0; i < kMaxMonsterObjects1; ++i) {
+		const MonsterObject1 *m = &_monsterObjects1Table[i];
+		if (!m->m46) {
+			continue;
+		}
+		// from the index to the positions, no pointer and no padding
+		checksum = updateChecksum(checksum, &m->monster1Index, (const uint8_t *)(&m->unkC0 + 1) - (const uint8_t *)&m->monster1Index);
+		checksum = updateChecksum(checksum, m->rnd_m49, sizeof(m->rnd_m49));
+		checksum = updateChecksum(checksum, m->rnd_m35, sizeof(m->rnd_m35));
+		checksum = updateChecksum(checksum, &m->indexUnk49Unk1, sizeof(m->indexUnk49Unk1));
+		checksum = updateChecksum(checksum, &m->unkE4, sizeof(m->unkE4));
+		checksum = updateChecksum(checksum, &m->unkE5, sizeof(m->unkE5));
+		checksum = updateChecksum(checksum, &m->lut4Index, sizeof(m->lut4Index));
+		checksum = updateChecksum(checksum, &m->directionKeyMask, sizeof(m->directionKeyMask));
+		checksum = updateChecksum(checksum, &m->o_flags2, sizeof(m->o_flags2));
+		checksum = updateChecksum(checksum, &m->collideDistance, sizeof(m->collideDistance));
+		checksum = updateChecksum(checksum, &m->shootActionIndex, sizeof(m->shootActionIndex));
+		checksum = updateChecksum(checksum, &m->shootSource, sizeof(m->shootSource));
+		checksum = updateChecksum(checksum, &m->goalDirectionKeyMask, sizeof(m->goalDirectionKeyMask));
+		checksum = updateChecksum(checksum, &m->shootDirection, sizeof(m->shootDirection));
+	}
+	hashes[StateTrace::kHashMonsters1] = checksum;
+
+	checksum = kFnvOffsetBasis;
+	for (int i = 0; i < kMaxMonsterObjects2; ++i) {
+		const MonsterObject2 *mo = &_monsterObjects2Table[i];
+		if (!mo->monster2Info) {
+			continue;
+		}
+		checksum = updateChecksum(checksum, &mo->monster2Index, sizeof(mo->monster2Index));
+		checksum = updateChecksum(checksum, &mo->xPos, sizeof(mo->xPos));
+		checksum = updateChecksum(checksum, &mo->yPos, sizeof(mo->yPos));
+		checksum = updateChecksum(checksum, &mo->xMstPos, sizeof(mo->xMstPos));
+		checksum = updateChecksum(checksum, &mo->yMstPos, sizeof(mo->yMstPos));
+		checksum = updateChecksum(checksum, &mo->flags24, sizeof(mo->flags24));
+		checksum = updateChecksum(checksum, &mo->x1, sizeof(mo->x1));
+		checksum = updateChecksum(checksum, &mo->x2, sizeof(mo->x2));
+		checksum = updateChecksum(checksum, &mo->y1, sizeof(mo->y1));
+		checksum = updateChecksum(checksum, &mo->y2, sizeof(mo->y2));
+		checksum = updateChecksum(checksum, &mo->hPosIndex, sizeof(mo->hPosIndex));
+		checksum = updateChecksum(checksum, &mo->vPosIndex, sizeof(mo->vPosIndex));
+		checksum = updateChecksum(checksum, &mo->hDir, sizeof(mo->hDir));
+		checksum = updateChecksum(checksum, &mo->vDir, sizeof(mo->vDir));
+	}
+	hashes[StateTrace::kHashMonsters2] = checksum;
+
+	checksum = updateChecksum(kFnvOffsetBasis, _mstVars, sizeof(_mstVars));
+	checksum = updateChecksum(checksum, &_mstFlags, sizeof(_mstFlags));
+	checksum = updateChecksum(checksum, &_mstLevelGatesMask, sizeof(_mstLevelGatesMask));
+	hashes[StateTrace::kHashMstVars] = checksum;
+
+	hashes[StateTrace::kHashRandom] = updateChecksum(kFnvOffsetBasis, &_rnd, sizeof(Random));
+	hashes[StateTrace::kHashScreenMask] = updateChecksum(kFnvOffsetBasis, _screenMaskBuffer, sizeof(_screenMaskBuffer));
+
+	checksum = updateChecksum(kFnvOffsetBasis, &_currentLevel, sizeof(_currentLevel));
+	checksum = updateChecksum(checksum, &_level->_checkpoint, sizeof(_level->_checkpoint));
+	checksum = updateChecksum(checksum, _res->_screensState, sizeof(_res->_screensState));
+	hashes[StateTrace::kHashLevel] = checksum;
+}
+
+uint32_t Game::computeStateChecksum() const {
+	uint32_t hashes[StateTrace::kHashesCount];
+	computeStateHashes(hashes);
+	return updateChecksum(0x811C9DC5, hashes, sizeof(hashes));
+}
+
+void Game::updateStateTrace() {
+	uint32_t hashes[StateTrace::kHashesCount];
+	computeStateHashes(hashes);
+	g_stateTrace.update(hashes);
+}
+
+void Game::startStateInputs(uint32_t randSeed, int randRounds) {
+	_stateInputs.randSeed = randSeed;
+	_stateInputs.keyMaskLen = 0;
+	_stateInputs.level = _currentLevel;
+	_stateInputs.checkpoint = _level->_checkpoint;
+	_stateInputs.difficulty = _difficulty;
+	_stateInputs.randRounds = randRounds;
+}
+
+void Game::recordStateInputs() {
+	if (_stateInputs.keyMaskLen == _stateInputsCapacity) {
+		const uint32_t capacity = _stateInputsCapacity + 4096;
+		uint8_t *actionKeyMask = (uint8_t *)realloc(_stateInputs.actionKeyMask, capacity);
+		if (actionKeyMask) {
+			_stateInputs.actionKeyMask = actionKeyMask;
+			uint8_t *directionKeyMask = (uint8_t *)realloc(_stateInputs.directionKeyMask, capacity);
+			if (directionKeyMask) {
+				_stateInputs.directionKeyMask = directionKeyMask;
+				_stateInputsCapacity = capacity;
+			}
+		}
+		if (_stateInputsCapacity != capacity) {
+			warning("Unable to allocate %d bytes for the save states inputs", capacity);
+			_saveStates = false;
+			return;
+		}
+	}
+	_stateInputs.actionKeyMask[_stateInputs.keyMaskLen] = _andyObject->actionKeyMask;
+	_stateInputs.directionKeyMask[_stateInputs.keyMaskLen] = _andyObject->directionKeyMask;
+	++_stateInputs.keyMaskLen;
+}
+
+bool Game::saveGameState(GameState *state) {
+	freeGameState(state);
+	for (unsigned int i = 0; i < kMaxScreens; ++i) {
+		state->backgroundData[i] = _res->_resLvlScreenBackgroundDataPtrTable[i];
+	}
+	state->transformShadowLayer = (_video->_transformShadowBuffer != 0);
+
+	MixerLock ml(&_mix);
+	StateBuffer b;
+	b.ptr = 0;
+	b.offset = 0;
+	persistGameState<kModeSize>(&b, this, state);
+	const uint32_t rawSize = b.offset;
+	const uint32_t dataSize = rawSize + rawSize / 255 + 16;
+	uint8_t *raw = (uint8_t *)malloc(rawSize);
+	state->data = (uint8_t *)malloc(dataSize);
+	if (!raw || !state->data) {
+		warning("Unable to allocate %d bytes for the save state", rawSize + dataSize);
+		free(raw);
+		freeGameState(state);
+		return false;
+	}
+	b.ptr = raw;
+	b.offset = 0;
+	persistGameState<kModeSave>(&b, this, state);
+	state->size = encodeLZ4(raw, rawSize, state->data, dataSize);
+	free(raw);
+	if (state->size == 0) {
+		warning("Failed to compress the save state");
+		freeGameState(state);
+		return false;
+	}
+	state->rawSize = rawSize;
+	state->checksum = computeStateChecksum();
+	state->inputsCount = _stateInputs.keyMaskLen;
+	state->levelSerial = _levelSerial;
+	state->checkpoint = _level->_checkpoint;
+	return true;
+}
+
+bool Game::loadGameState(GameState *state) {
+	if (!state->data || state->levelSerial != _levelSerial) {
+		warning("No save state for the current level");
+		return false;
+	}
+	for (unsigned int i = 0; i < kMaxScreens; ++i) {
+		if (state->backgroundData[i] && state->backgroundData[i] != _res->_resLvlScreenBackgroundDataPtrTable[i]) {
+			// the screen was evicted, the objects of the state point to the previous data
+			warning("Unable to restore the save state, screen %d was reloaded", (int)i);
+			return false;
+		}
+	}
+	uint8_t *raw = (uint8_t *)malloc(state->rawSize);
+	if (!raw) {
+		warning("Unable to allocate %d bytes for the save state", state->rawSize);
+		return false;
+	}
+	if (decodeLZ4(state->data, state->size, raw, state->rawSize) != (int)state->rawSize) {
+		warning("Failed to decompress the save state");
+		free(raw);
+		return false;
+	}
+	if (!state->transformShadowLayer) {
+		unloadTransformLayerData();
+	} else if (!_video->_transformShadowBuffer) {
+		_video->_transformShadowBuffer = (uint8_t *)malloc(256 * 192 + 256);
+		if (!_video->_transformShadowBuffer) {
+			warning("Unable to allocate the transform layer of the save state");
+			free(raw);
+			return false;
+		}
+	}
+
+	{
+		MixerLock ml(&_mix);
+		StateBuffer b;
+		b.ptr = raw;
+		b.offset = 0;
+		persistGameState<kModeLoad>(&b, this, state);
+		assert(b.offset == state->rawSize);
+		_mix._mixingQueueSize = 0;
+		_snd_bufferOffset = _snd_bufferSize = 0;
+	}
+	free(raw);
+
+	// the routes are computed again for the restored gates
+	if (_res->_mstWalkPathRoutes) {
+		for (unsigned int i = 0; i < _res->_mstWalkPathData.count; ++i) {
+			_res->_mstWalkPathRoutes[i].keyValid = false;
+		}
+	}
+	_video->_paletteChanged = true;
+
+	const uint32_t checksum = computeStateChecksum();
+	if (checksum != state->checksum) {
+		warning("Save state checksum mismatch 0x%08x (0x%08x)", checksum, state->checksum);
+	}
+	return true;
+}
+
+void Game::freeGameState(GameState *state) {
+	free(state->data);
+	memset(state, 0, sizeof(GameState));
+}
+
+// taken at the end of the first restart from a checkpoint, the next restarts from it restore the state instead of resetting the level
+void Game::saveCheckpointState() {
+	if (!_checkpointStates || _playDemo) {
+		return;
+	}
+	if (saveGameState(&_checkpointState)) {
+		debug(kDebug_GAME, "Saved checkpoint %d state, %d bytes (%d compressed)", _checkpointState.checkpoint, _checkpointState.rawSize, _checkpointState.size);
+	}
+}
+
+bool Game::restoreCheckpointState() {
+	const GameState *state = &_checkpointState;
+	if (!_checkpointStates || _playDemo || !state->data || state->levelSerial != _levelSerial || state->checkpoint != _level->_checkpoint) {
+		return false;
+	}
+	// the random numbers carry on, the restarts do not repeat the same sequence
+	const Random rnd = _rnd;
+	if (!loadGameState(&_checkpointState)) {
+		freeGameState(&_checkpointState);
+		return false;
+	}
+	_rnd = rnd;
+	debug(kDebug_GAME, "Restored checkpoint %d state", _level->_checkpoint);
+	return true;
+}
+
+// the disk file is an inputs replay, not a copy of the state: the inputs since the level start are replayed to reach it
+bool Game::writeReplayFile(const char *name) {
+	FILE *fp = _fs.openSaveFile(name, true);
+	if (!fp) {
+		warning("Failed to save '%s'", name);
+		return false;
+	}
+	_stateInputs.stateChecksum = computeStateChecksum();
+	_res->writeDem(fp, &_stateInputs);
+	const bool ret = !ferror(fp);
+	_fs.closeFile(fp);
+	if (!ret) {
+		warning("Failed to write '%s'", name);
+	}
+	return ret;
+}
+
+bool Game::readReplayFile(const char *name) {
+	FILE *fp = _fs.openSaveFile(name, false);
+	if (!fp) {
+		warning("Unable to open '%s'", name);
+		return false;
+	}
+	File f;
+	f.setFp(fp);
+	const bool ret = _res->loadDem(&f);
+	_fs.closeFile(fp);
+	if (!ret) {
+		warning("Invalid replay '%s'", name);
+		return false;
+	}
+	_res->_demOffset = 0;
+	return true;
+}
+
+void Game::finishStateReplay() {
+	const uint32_t checksum = computeStateChecksum();
+	if (checksum != _res->_dem.stateChecksum) {
+		warning("Replay checksum mismatch 0x%08x (0x%08x) after %d frames", checksum, _res->_dem.stateChecksum, _res->_dem.keyMaskLen);
+	} else {
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Replayed state level %d frame %d", _currentLevel, _res->_dem.keyMaskLen);
+		System_printLog(stdout, buffer);
+	}
+	_res->unloadHodDem();
+	_stateReplay = false;
+	_paf->_skipCutscenes = _stateReplaySkipCutscenes;
+	if (_saveStates) {
+		// F9 restarts from here
+		saveGameState(&_gameState);
+	}
+}
+
+// called between two frames
+void Game::updateSaveStates() {
+	if (_stateReplay) {
+		if (_res->_demOffset >= _res->_dem.keyMaskLen) {
+			finishStateReplay();
+		}
+		return;
+	}
+	const bool save = g_system->inp.saveState;
+	const bool load = g_system->inp.loadState;
+	g_system->inp.saveState = false;
+	g_system->inp.loadState = false;
+	if (!_saveStates || _playDemo) {
+		return;
+	}
+	if (save && saveGameState(&_gameState)) {
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Saved state level %d frame %d, %d bytes (%d compressed)", _currentLevel, _gameState.inputsCount, _gameState.rawSize, _gameState.size);
+		System_printLog(stdout, buffer);
+		writeReplayFile(_replayDem);
+	}
+	if (load && loadGameState(&_gameState)) {
+		// the inputs recorded after the state are dropped
+		_stateInputs.keyMaskLen = _gameState.inputsCount;
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Restored state level %d frame %d", _currentLevel, _gameState.inputsCount);
+		System_printLog(stdout, buffer);
+	}
+}
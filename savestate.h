@@ -0,0 +1,26 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef SAVESTATE_H__
+#define SAVESTATE_H__
+
+#include "intern.h"
+#include "defs.h"
+
+// copy of the level simulation state, the tables are saved as is (with their
+// pointers) and can only be restored while the same level data is loaded
+struct GameState {
+	uint8_t *data; // LZ4 compressed
+	uint32_t size;
+	uint32_t rawSize;
+	uint32_t checksum; // Game::computeStateChecksum()
+	uint32_t inputsCount; // frames recorded in Game::_stateInputs
+	int levelSerial;
+	int checkpoint;
+	bool transformShadowLayer;
+	const uint8_t *backgroundData[kMaxScreens]; // the screens loaded, their objects point to this data
+};
+
+#endif // SAVESTATE_H__
@@ -43,6 +43,50 @@ static bool compareSssGroup(uint32_t flags_a, uint32_t flags_b) {
 	return compare_bits(flags_a, flags_b, 0xFFF00FFF);
 }
 
+static int sssObjectHash(uint32_t flags) {
+	return (((flags >> 20) & 15) * 37 + (flags & 0xFFF)) & (Game::kSssObjectsHashSize - 1);
+}
+
+// returns the index of the lowest bit set
+static int findFirstBit(uint32_t mask) {
+	static const uint8_t _deBruijnTable[32] = {
+		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8, 31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+	};
+	return _deBruijnTable[((mask & -mask) * 0x077CB531U) >> 27];
+}
+
+static bool testSssObjectBit(const uint32_t *mask, int num) {
+	return (mask[num >> 5] & (1U << (num & 31))) != 0;
+}
+
+static void setSssObjectBit(uint32_t *mask, int num) {
+	mask[num >> 5] |= 1U << (num & 31);
+}
+
+static void clearSssObjectBit(uint32_t *mask, int num) {
+	mask[num >> 5] &= ~(1U << (num & 31));
+}
+
+// returns the lowest slot set and clears it, -1 if the mask is empty
+static int popFirstSssObject(uint32_t *mask) {
+	for (int i = 0; i < Game::kSssObjectsMaskSize; ++i) {
+		if (mask[i] != 0) {
+			const int num = i * 32 + findFirstBit(mask[i]);
+			mask[i] &= mask[i] - 1;
+			return num;
+		}
+	}
+	return -1;
+}
+
+// returns true if 'a' is to be stopped before 'b', ties are ordered as in _sssObjectsList1
+static bool compareSoundObjectPriority(const SssObject *a, const SssObject *b) {
+	if (a->currentPriority != b->currentPriority) {
+		return a->currentPriority < b->currentPriority;
+	}
+	return a->priorityOrder < b->priorityOrder;
+}
+
 // returns the active samples for the table/source/bank
 static uint32_t *getSssGroupPtr(Resource *res, int num, uint32_t flags) {
 	const int source = (flags >> 20) & 15; // 0,1,2
@@ -94,16 +138,101 @@ void Game::setSoundPanning(SssObject *so, int panning) {
 SssObject *Game::findLowPrioritySoundObject() const {
 	SssObject *so = 0;
 	if (_playingSssObjectsCount >= _playingSssObjectsMax && _sssObjectsList1) {
-		so = _sssObjectsList1;
-		for (SssObject *current = so->nextPtr; current; current = current->nextPtr) {
-			if (so->currentPriority > current->currentPriority) {
-				so = current;
-			}
-		}
+		assert(_sssObjectsPriorityHeapSize == _playingSssObjectsCount);
+		so = _sssObjectsPriorityHeap[0];
 	}
 	return so;
 }
 
+void Game::linkSoundObject(SssObject *so) {
+	if (!testSssObjectBit(_sssObjectsUsedMask, so->num)) {
+		setSssObjectBit(_sssObjectsUsedMask, so->num);
+		setSssObjectBit(_sssObjectsByFlags0[sssObjectHash(so->flags0)], so->num);
+		setSssObjectBit(_sssObjectsByFlags1[sssObjectHash(so->flags1)], so->num);
+	}
+}
+
+void Game::unlinkSoundObject(SssObject *so) {
+	if (testSssObjectBit(_sssObjectsUsedMask, so->num)) {
+		clearSssObjectBit(_sssObjectsUsedMask, so->num);
+		clearSssObjectBit(_sssObjectsByFlags0[sssObjectHash(so->flags0)], so->num);
+		clearSssObjectBit(_sssObjectsByFlags1[sssObjectHash(so->flags1)], so->num);
+	}
+}
+
+void Game::updateSoundObjectPriorityHeap(int index) {
+	SssObject **heap = _sssObjectsPriorityHeap;
+	SssObject *so = heap[index];
+	while (index > 0) {
+		const int parent = (index - 1) / 2;
+		if (!compareSoundObjectPriority(so, heap[parent])) {
+			break;
+		}
+		heap[index] = heap[parent];
+		heap[index]->priorityHeapIndex = index;
+		index = parent;
+	}
+	while (1) {
+		int child = index * 2 + 1;
+		if (child >= _sssObjectsPriorityHeapSize) {
+			break;
+		}
+		if (child + 1 < _sssObjectsPriorityHeapSize && compareSoundObjectPriority(heap[child + 1], heap[child])) {
+			++child;
+		}
+		if (!compareSoundObjectPriority(heap[child], so)) {
+			break;
+		}
+		heap[index] = heap[child];
+		heap[index]->priorityHeapIndex = index;
+		index = child;
+	}
+	heap[index] = so;
+	so->priorityHeapIndex = index;
+}
+
+void Game::addSoundObjectToPriorityHeap(SssObject *so, uint32_t order) {
+	assert(_sssObjectsPriorityHeapSize < kMaxSssObjects);
+	so->priorityOrder = order;
+	const int index = _sssObjectsPriorityHeapSize++;
+	_sssObjectsPriorityHeap[index] = so;
+	updateSoundObjectPriorityHeap(index);
+}
+
+void Game::removeSoundObjectFromPriorityHeap(SssObject *so) {
+	const int index = so->priorityHeapIndex;
+	assert(index >= 0 && index < _sssObjectsPriorityHeapSize && _sssObjectsPriorityHeap[index] == so);
+	--_sssObjectsPriorityHeapSize;
+	if (index != _sssObjectsPriorityHeapSize) {
+		_sssObjectsPriorityHeap[index] = _sssObjectsPriorityHeap[_sssObjectsPriorityHeapSize];
+		updateSoundObjectPriorityHeap(index);
+	}
+	so->priorityHeapIndex = -1;
+	if (_sssObjectsPriorityHeapSize == 0) {
+		_sssObjectsPriorityOrder = kNone;
+	}
+}
+
+void Game::updateSoundObjectPriority(SssObject *so, int priority) {
+	so->currentPriority = priority;
+	if (so->priorityHeapIndex >= 0) {
+		updateSoundObjectPriorityHeap(so->priorityHeapIndex);
+	}
+}
+
+bool Game::hasSoundObjectInGroup(uint32_t flags) const {
+	uint32_t objectsMask[kSssObjectsMaskSize];
+	memcpy(objectsMask, _sssObjectsByFlags0[sssObjectHash(flags)], sizeof(objectsMask));
+	int num;
+	while ((num = popFirstSssObject(objectsMask)) >= 0) {
+		const SssObject *so = &_sssObjectsTable[num];
+		if (compareSssGroup(so->flags0, flags)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void Game::removeSoundObjectFromList(SssObject *so) {
 	debug(kDebug_SOUND, "removeSoundObjectFromList so %p flags 0x%x", so, so->flags);
 	so->pcm = 0;
@@ -122,6 +251,7 @@ void Game::removeSoundObjectFromList(SssObject *so) {
 			_sssObjectsList1 = next;
 		}
 		--_playingSssObjectsCount;
+		removeSoundObjectFromPriorityHeap(so);
 
 		if (_playingSssObjectsMax > 0) {
 			if (_lowPrioritySssObject == so || (_playingSssObjectsCount < _playingSssObjectsMax && _lowPrioritySssObject)) {
@@ -143,6 +273,7 @@ void Game::removeSoundObjectFromList(SssObject *so) {
 			_sssObjectsList2 = next;
 		}
 	}
+	unlinkSoundObject(so);
 }
 
 void Game::updateSoundObject(SssObject *so) {
@@ -236,17 +367,11 @@ void Game::sssOp12_removeSounds2(int num, uint8_t source, uint8_t sampleIndex) {
 	assert(sampleIndex < 32);
 	const uint32_t mask = (1 << sampleIndex);
 	_res->_sssGroup1[source][num] &= ~mask;
-	for (SssObject *so = _sssObjectsList1; so; so = so->nextPtr) {
-		if (so->bankIndex == num && ((so->flags1 >> 20) & 15) == source && (so->flags1 >> 24) == sampleIndex) {
-			so->codeDataStage3 = 0;
-			if (so->codeDataStage4 == 0) {
-				removeSoundObjectFromList(so);
-			}
-			so->nextSoundBank = -1;
-			so->delayCounter = -2;
-		}
-	}
-	for (SssObject *so = _sssObjectsList2; so; so = so->nextPtr) {
+	uint32_t objectsMask[kSssObjectsMaskSize];
+	memcpy(objectsMask, _sssObjectsByFlags1[sssObjectHash((source << 20) | num)], sizeof(objectsMask));
+	int slot;
+	while ((slot = popFirstSssObject(objectsMask)) >= 0) {
+		SssObject *so = &_sssObjectsTable[slot];
 		if (so->bankIndex == num && ((so->flags1 >> 20) & 15) == source && (so->flags1 >> 24) == sampleIndex) {
 			so->codeDataStage3 = 0;
 			if (so->codeDataStage4 == 0) {
@@ -301,6 +426,7 @@ void Game::sssOp17_pauseSound(SssObject *so) {
 				_sssObjectsList1 = next;
 			}
 			--_playingSssObjectsCount;
+			removeSoundObjectFromPriorityHeap(so);
 
 			if (_playingSssObjectsMax > 0) {
 				if (so == _lowPrioritySssObject || (_playingSssObjectsCount < _playingSssObjectsMax && _lowPrioritySssObject)) {
@@ -327,17 +453,11 @@ void Game::sssOp17_pauseSound(SssObject *so) {
 void Game::sssOp4_removeSounds(uint32_t flags) {
 	const uint32_t mask = 1 << (flags >> 24);
 	*getSssGroupPtr(_res, 1, flags) &= ~mask;
-	for (SssObject *so = _sssObjectsList1; so; so = so->nextPtr) {
-		if (compare_bits(so->flags1, flags, 0xFFFF0FFF)) {
-			so->codeDataStage3 = 0;
-			if (so->codeDataStage4 == 0) {
-				removeSoundObjectFromList(so);
-			}
-			so->nextSoundBank = -1;
-			so->delayCounter = -2;
-		}
-	}
-	for (SssObject *so = _sssObjectsList2; so; so = so->nextPtr) {
+	uint32_t objectsMask[kSssObjectsMaskSize];
+	memcpy(objectsMask, _sssObjectsByFlags1[sssObjectHash(flags)], sizeof(objectsMask));
+	int slot;
+	while ((slot = popFirstSssObject(objectsMask)) >= 0) {
+		SssObject *so = &_sssObjectsTable[slot];
 		if (compare_bits(so->flags1, flags, 0xFFFF0FFF)) {
 			so->codeDataStage3 = 0;
 			if (so->codeDataStage4 == 0) {
@@ -352,297 +472,365 @@ void Game::sssOp4_removeSounds(uint32_t flags) {
 	}
 }
 
-const uint8_t *Game::executeSssCode(SssObject *so, const uint8_t *code, bool tempSssObject) {
-	while (1) {
-		debug(kDebug_SOUND, "executeSssCode() code %d", *code);
-		switch (*code) {
-		case 0:
-			return 0;
-		case 2: // add_sound
-			if (so->delayCounter >= -1) {
-				LvlObject *tmp = _currentSoundLvlObject;
-				_currentSoundLvlObject = so->lvlObject;
-				createSoundObject(READ_LE_UINT16(code + 2), (int8_t)code[1], so->flags0);
-				_currentSoundLvlObject = tmp;
-			}
-			code += 4;
-			if (so->pcm == 0) {
-				return code;
-			}
-			break;
-		case 4: { // remove_sound
-				const uint8_t sampleIndex = code[1];
-				const uint16_t bankIndex = READ_LE_UINT16(code + 2);
-				uint32_t flags = (so->flags0 & 0xFFF0F000);
-				flags |= ((sampleIndex & 0xF) << 16) | (bankIndex & 0xFFF);
-				sssOp4_removeSounds(flags);
-				code += 4;
-			}
-			break;
-		case 5: { // seek_forward
-				const int32_t frame = READ_LE_UINT32(code + 4);
-				if (so->currentPcmFrame < frame) {
-					so->currentPcmFrame = frame;
-					if (so->pcm) {
-						const int16_t *ptr = so->pcm->ptr;
-						if (ptr) {
-							so->currentPcmPtr = ptr + READ_LE_UINT32(code + 8) / sizeof(int16_t);
-						}
-					}
-				}
-				code += 12;
-			}
-			break;
-		case 6: { // repeat_jge
-				--so->repeatCounter;
-				if (so->repeatCounter < 0) {
-					code += 8;
-				} else {
-					const int32_t offset = READ_LE_UINT32(code + 4);
-					code -= offset;
-				}
-			}
-			break;
-		case 8: { // seek_backward_delay
-				const int32_t frame = READ_LE_UINT32(code + 12);
-				if (so->currentPcmFrame > frame) {
-					--so->pauseCounter;
-					if (so->pauseCounter < 0) {
-						code += 16;
-						break;
-					}
-					so->currentPcmFrame = READ_LE_UINT32(code + 8);
-					if (so->pcm) {
-						const int16_t *ptr = so->pcm->ptr;
-						if (ptr) {
-							so->currentPcmPtr = ptr + READ_LE_UINT32(code + 4) / sizeof(int16_t);
-						}
-					}
-				}
-				return code;
-			}
-			break;
-		case 9: { // modulate_panning
-				so->panningModulateCurrent += so->panningModulateDelta;
-				const int panning = (so->panningModulateCurrent + 0x8000) >> 16;
-				if (panning != so->panning) {
-					so->panning = panning;
-					_sssObjectsChanged = true;
-				}
-				--so->panningModulateSteps;
-				if (so->panningModulateSteps >= 0) {
-					return code;
-				}
-				code += 4;
-			}
-			break;
-		case 10: { // modulate_volume
-				if (so->volumeModulateSteps >= 0) {
-					so->volumeModulateCurrent += so->volumeModulateDelta;
-					const int volume = (so->volumeModulateCurrent + 0x8000) >> 16;
-					if (volume != so->volume) {
-						so->volume = volume;
-						_sssObjectsChanged = true;
-					}
-					--so->volumeModulateSteps;
-					if (so->volumeModulateSteps >= 0) {
-						return code;
-					}
-				}
-				code += 4;
-			}
-			break;
-		case 11: { // set_volume
-				if (so->volume != code[1]) {
-					so->volume = code[1];
-					_sssObjectsChanged = true;
-				}
-				code += 4;
-			}
-			break;
-		case 12: { // remove_sounds2
-				uint32_t va =  so->flags1 >> 24;
-				uint32_t vd = (so->flags1 >> 20) & 0xF;
-				uint16_t vc = READ_LE_UINT16(code + 2);
-				sssOp12_removeSounds2(vc, vd, va);
-				code += 4;
-			}
-			break;
-		case 13: { // init_volume_modulation
-				const int count = READ_LE_UINT32(code + 4);
-				so->volumeModulateSteps = count - 1;
-				const int16_t value = READ_LE_UINT16(code + 2);
-				if (value == -1) {
-					so->volumeModulateCurrent = so->volume << 16;
-				} else {
-					assert(value >= 0);
-					so->volumeModulateCurrent = value << 16;
-					so->volume = value;
-					_sssObjectsChanged = true;
-				}
-				so->volumeModulateDelta = ((code[1] << 16) - so->volumeModulateCurrent) / count;
-				return code + 8;
-			}
-			break;
-		case 14: { // init_panning_modulation
-				const int count = READ_LE_UINT32(code + 8);
-				so->panningModulateSteps = count - 1;
-				const int16_t value = READ_LE_UINT16(code + 2);
-				if (value == -1) {
-					so->panningModulateCurrent = so->panning << 16;
-				} else {
-					assert(value >= 0);
-					so->panningModulateCurrent = value << 16;
-					so->panning = value;
-					_sssObjectsChanged = true;
-				}
-				so->panningModulateDelta = ((code[1] << 16) - so->panningModulateCurrent) / count;
-				return code + 12;
-			}
-			break;
-		case 16: { // resume_sound
-				if (tempSssObject) {
-					// 'tempSssObject' is allocated on the stack, it must not be added to the linked list
-					warning("Invalid call to .sss opcode 16 with temporary SssObject");
-					return 0;
-				}
-				--so->pauseCounter;
-				if (so->pauseCounter >= 0) {
-					return code;
-				}
-				sssOp16_resumeSound(so);
-				code += 4;
-				if (so->pcm == 0) {
-					return code;
-				}
-				_sssObjectsChanged = true;
-			}
-			break;
-		case 17: { // pause_sound
-				if (tempSssObject) {
-					// 'tempSssObject' is allocated on the stack, it must not be added to the linked list
-					warning("Invalid call to .sss opcode 17 with temporary SssObject");
-					return 0;
-				}
-				sssOp17_pauseSound(so);
-				so->pauseCounter = READ_LE_UINT32(code + 4);
-				return code + 8;
-			}
-			break;
-		case 18: { // decrement_repeat_counter
-				if (so->repeatCounter < 0) {
-					so->repeatCounter = READ_LE_UINT32(code + 4);
-				}
-				code += 8;
-			}
-			break;
-		case 19: { // set_panning
-				if (so->panning != code[1]) {
-					so->panning = code[1];
-					_sssObjectsChanged = true;
-				}
-				code += 4;
-			}
-			break;
-		case 20: { // set_pause_counter
-				so->pauseCounter = READ_LE_UINT16(code + 2);
-				code += 4;
-			}
-			break;
-		case 21: { // decrement_delay_counter
-				--so->delayCounter;
-				if (so->delayCounter >= 0) {
-					return code;
-				}
-				code += 4;
-			}
-			break;
-		case 22: { // set_delay_counter
-				so->delayCounter = READ_LE_UINT32(code + 4);
-				return code + 8;
-			}
-			break;
-		case 23: { // decrement_volume_modulate_steps
-				--so->volumeModulateSteps;
-				if (so->volumeModulateSteps >= 0) {
-					return code;
-				}
-				code += 4;
-			}
-			break;
-		case 24: { // set_volume_modulate_steps
-				so->volumeModulateSteps = READ_LE_UINT32(code + 4);
-				return code + 8;
-			}
-			break;
-		case 25: { // decrement_panning_modulate_steps
-				--so->panningModulateSteps;
-				if (so->panningModulateSteps >= 0) {
-					return code;
-				}
-				code += 4;
-			}
-			break;
-		case 26: { // set_panning_modulate_steps
-				so->panningModulateSteps = READ_LE_UINT32(code + 4);
-				return code + 8;
-			}
-			break;
-		case 27: { // seek_backward
-				const int32_t frame = READ_LE_UINT32(code + 12);
-				if (so->currentPcmFrame > frame) {
-					so->currentPcmFrame = READ_LE_UINT32(code + 8);
-					if (so->pcm) {
-						const int16_t *ptr = so->pcm->ptr;
-						if (ptr) {
-							so->currentPcmPtr = ptr + READ_LE_UINT32(code + 4) / sizeof(int16_t);
-						}
-					}
-				}
-				return code;
+// the handlers return false to yield, 'code' is then the instruction to resume from (0 ends the stage)
+typedef bool (*SssOpcodeProc)(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject);
+
+static bool sssOp0_stop(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	code = 0;
+	return false;
+}
+
+static bool sssOp2_addSound(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (so->delayCounter >= -1) {
+		LvlObject *tmp = g->_currentSoundLvlObject;
+		g->_currentSoundLvlObject = so->lvlObject;
+		g->createSoundObject(code->arg1, (int8_t)code->arg0, so->flags0);
+		g->_currentSoundLvlObject = tmp;
+	}
+	++code;
+	return so->pcm != 0;
+}
+
+static bool sssOp4_removeSound(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const uint8_t sampleIndex = code->arg0;
+	const uint16_t bankIndex = code->arg1;
+	uint32_t flags = (so->flags0 & 0xFFF0F000);
+	flags |= ((sampleIndex & 0xF) << 16) | (bankIndex & 0xFFF);
+	g->sssOp4_removeSounds(flags);
+	++code;
+	return true;
+}
+
+static bool sssOp5_seekForward(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const int32_t frame = code->arg2;
+	if (so->currentPcmFrame < frame) {
+		so->currentPcmFrame = frame;
+		if (so->pcm) {
+			const int16_t *ptr = so->pcm->ptr;
+			if (ptr) {
+				so->currentPcmPtr = ptr + code->arg3;
 			}
-			break;
-		case 28: { // jump
-				const int32_t offset = READ_LE_UINT32(code + 4);
-				code -= offset;
+		}
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp6_repeatJge(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	--so->repeatCounter;
+	if (so->repeatCounter < 0) {
+		++code;
+	} else {
+		if (!code->target) {
+			error("Invalid .sss jump offset %d", code->arg2);
+		}
+		code = code->target;
+	}
+	return true;
+}
+
+static bool sssOp8_seekBackwardDelay(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const int32_t frame = code->arg4;
+	if (so->currentPcmFrame > frame) {
+		--so->pauseCounter;
+		if (so->pauseCounter < 0) {
+			++code;
+			return true;
+		}
+		so->currentPcmFrame = code->arg3;
+		if (so->pcm) {
+			const int16_t *ptr = so->pcm->ptr;
+			if (ptr) {
+				so->currentPcmPtr = ptr + code->arg2;
 			}
-			break;
-		case 29: // end
-			so->pcmFramesCount = 0;
-			return 0;
-		default:
-			error("Invalid .sss opcode %d", *code);
-			break;
 		}
 	}
-	return code;
+	return false;
 }
 
-SssObject *Game::addSoundObject(SssPcm *pcm, int priority, uint32_t flags_a, uint32_t flags_b) {
-	int minIndex = -1;
-	int minPriority = -1;
-	for (int i = 0; i < kMaxSssObjects; ++i) {
-		if (!_sssObjectsTable[i].pcm) {
-			minPriority = 0;
-			minIndex = i;
-			break;
+static bool sssOp9_modulatePanning(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->panningModulateCurrent += so->panningModulateDelta;
+	const int panning = (so->panningModulateCurrent + 0x8000) >> 16;
+	if (panning != so->panning) {
+		so->panning = panning;
+		g->_sssObjectsChanged = true;
+	}
+	--so->panningModulateSteps;
+	if (so->panningModulateSteps >= 0) {
+		return false;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp10_modulateVolume(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (so->volumeModulateSteps >= 0) {
+		so->volumeModulateCurrent += so->volumeModulateDelta;
+		const int volume = (so->volumeModulateCurrent + 0x8000) >> 16;
+		if (volume != so->volume) {
+			so->volume = volume;
+			g->_sssObjectsChanged = true;
 		}
-		if (_sssObjectsTable[i].currentPriority < minPriority) {
-			minPriority = _sssObjectsTable[i].currentPriority;
-			minIndex = i;
+		--so->volumeModulateSteps;
+		if (so->volumeModulateSteps >= 0) {
+			return false;
 		}
 	}
-	if (minIndex == -1) {
-		return 0;
+	++code;
+	return true;
+}
+
+static bool sssOp11_setVolume(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (so->volume != code->arg0) {
+		so->volume = code->arg0;
+		g->_sssObjectsChanged = true;
 	}
-	assert(minIndex != -1);
-	SssObject *so = &_sssObjectsTable[minIndex];
-	if (so->pcm && minPriority >= priority) {
-		return 0;
+	++code;
+	return true;
+}
+
+static bool sssOp12_removeSounds2(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	uint32_t va =  so->flags1 >> 24;
+	uint32_t vd = (so->flags1 >> 20) & 0xF;
+	uint16_t vc = code->arg1;
+	g->sssOp12_removeSounds2(vc, vd, va);
+	++code;
+	return true;
+}
+
+static bool sssOp13_initVolumeModulation(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const int count = code->arg2;
+	so->volumeModulateSteps = count - 1;
+	const int16_t value = code->arg1;
+	if (value == -1) {
+		so->volumeModulateCurrent = so->volume << 16;
+	} else {
+		assert(value >= 0);
+		so->volumeModulateCurrent = value << 16;
+		so->volume = value;
+		g->_sssObjectsChanged = true;
 	}
-	if (so->pcm) {
-		removeSoundObjectFromList(so);
+	so->volumeModulateDelta = ((code->arg0 << 16) - so->volumeModulateCurrent) / count;
+	++code;
+	return false;
+}
+
+static bool sssOp14_initPanningModulation(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const int count = code->arg3;
+	so->panningModulateSteps = count - 1;
+	const int16_t value = code->arg1;
+	if (value == -1) {
+		so->panningModulateCurrent = so->panning << 16;
+	} else {
+		assert(value >= 0);
+		so->panningModulateCurrent = value << 16;
+		so->panning = value;
+		g->_sssObjectsChanged = true;
+	}
+	so->panningModulateDelta = ((code->arg0 << 16) - so->panningModulateCurrent) / count;
+	++code;
+	return false;
+}
+
+static bool sssOp16_resumeSound(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (tempSssObject) {
+		// 'tempSssObject' is allocated on the stack, it must not be added to the linked list
+		warning("Invalid call to .sss opcode 16 with temporary SssObject");
+		code = 0;
+		return false;
+	}
+	--so->pauseCounter;
+	if (so->pauseCounter >= 0) {
+		return false;
+	}
+	g->sssOp16_resumeSound(so);
+	++code;
+	if (so->pcm == 0) {
+		return false;
+	}
+	g->_sssObjectsChanged = true;
+	return true;
+}
+
+static bool sssOp17_pauseSound(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (tempSssObject) {
+		// 'tempSssObject' is allocated on the stack, it must not be added to the linked list
+		warning("Invalid call to .sss opcode 17 with temporary SssObject");
+		code = 0;
+		return false;
+	}
+	g->sssOp17_pauseSound(so);
+	so->pauseCounter = code->arg2;
+	++code;
+	return false;
+}
+
+static bool sssOp18_decrementRepeatCounter(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (so->repeatCounter < 0) {
+		so->repeatCounter = code->arg2;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp19_setPanning(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (so->panning != code->arg0) {
+		so->panning = code->arg0;
+		g->_sssObjectsChanged = true;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp20_setPauseCounter(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->pauseCounter = code->arg1;
+	++code;
+	return true;
+}
+
+static bool sssOp21_decrementDelayCounter(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	--so->delayCounter;
+	if (so->delayCounter >= 0) {
+		return false;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp22_setDelayCounter(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->delayCounter = code->arg2;
+	++code;
+	return false;
+}
+
+static bool sssOp23_decrementVolumeModulateSteps(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	--so->volumeModulateSteps;
+	if (so->volumeModulateSteps >= 0) {
+		return false;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp24_setVolumeModulateSteps(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->volumeModulateSteps = code->arg2;
+	++code;
+	return false;
+}
+
+static bool sssOp25_decrementPanningModulateSteps(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	--so->panningModulateSteps;
+	if (so->panningModulateSteps >= 0) {
+		return false;
+	}
+	++code;
+	return true;
+}
+
+static bool sssOp26_setPanningModulateSteps(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->panningModulateSteps = code->arg2;
+	++code;
+	return false;
+}
+
+static bool sssOp27_seekBackward(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	const int32_t frame = code->arg4;
+	if (so->currentPcmFrame > frame) {
+		so->currentPcmFrame = code->arg3;
+		if (so->pcm) {
+			const int16_t *ptr = so->pcm->ptr;
+			if (ptr) {
+				so->currentPcmPtr = ptr + code->arg2;
+			}
+		}
 	}
+	return false;
+}
+
+static bool sssOp28_jump(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	if (!code->target) {
+		error("Invalid .sss jump offset %d", code->arg2);
+	}
+	code = code->target;
+	return true;
+}
+
+static bool sssOp29_end(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	so->pcmFramesCount = 0;
+	code = 0;
+	return false;
+}
+
+static bool sssOpInvalid(Game *g, SssObject *so, const SssOpcode *&code, bool tempSssObject) {
+	error("Invalid .sss opcode %d", (code->op < kSssOpcodesCount) ? code->op : code->arg1);
+	code = 0;
+	return false;
+}
+
+// the handlers are small functions, a table of pointers keeps the dispatch portable.
+// The .mst code of monsters.cpp is one large switch, it uses computed gotos with GCC
+static const SssOpcodeProc _sssOpcodesTable[kSssOpcodesCount + 1] = {
+	/* 0 */
+	&sssOp0_stop,
+	&sssOpInvalid,
+	&sssOp2_addSound,
+	&sssOpInvalid,
+	/* 4 */
+	&sssOp4_removeSound,
+	&sssOp5_seekForward,
+	&sssOp6_repeatJge,
+	&sssOpInvalid,
+	/* 8 */
+	&sssOp8_seekBackwardDelay,
+	&sssOp9_modulatePanning,
+	&sssOp10_modulateVolume,
+	&sssOp11_setVolume,
+	/* 12 */
+	&sssOp12_removeSounds2,
+	&sssOp13_initVolumeModulation,
+	&sssOp14_initPanningModulation,
+	&sssOpInvalid,
+	/* 16 */
+	&sssOp16_resumeSound,
+	&sssOp17_pauseSound,
+	&sssOp18_decrementRepeatCounter,
+	&sssOp19_setPanning,
+	/* 20 */
+	&sssOp20_setPauseCounter,
+	&sssOp21_decrementDelayCounter,
+	&sssOp22_setDelayCounter,
+	&sssOp23_decrementVolumeModulateSteps,
+	/* 24 */
+	&sssOp24_setVolumeModulateSteps,
+	&sssOp25_decrementPanningModulateSteps,
+	&sssOp26_setPanningModulateSteps,
+	&sssOp27_seekBackward,
+	/* 28 */
+	&sssOp28_jump,
+	&sssOp29_end,
+	/* kSssOpcodesCount */
+	&sssOpInvalid
+};
+
+const SssOpcode *Game::executeSssCode(SssObject *so, const SssOpcode *code, bool tempSssObject) {
+	do {
+		debug(kDebug_SOUND, "executeSssCode() code %d", code->op);
+	} while ((*_sssOpcodesTable[code->op])(this, so, code, tempSssObject));
+	return code;
+}
+
+SssObject *Game::addSoundObject(SssPcm *pcm, int priority, uint32_t flags_a, uint32_t flags_b) {
+	// use the first free slot, the objects in use are never replaced here
+	uint32_t freeMask[kSssObjectsMaskSize];
+	for (int i = 0; i < kSssObjectsMaskSize; ++i) {
+		freeMask[i] = ~_sssObjectsUsedMask[i];
+	}
+	const int num = popFirstSssObject(freeMask);
+	if (num < 0 || num >= kMaxSssObjects) {
+		return 0;
+	}
+	SssObject *so = &_sssObjectsTable[num];
+	assert(!so->pcm);
 	so->flags1 = flags_a;
 	so->currentPriority = priority;
 	so->pcm = pcm;
@@ -675,6 +863,7 @@ void Game::prependSoundObjectToList(SssObject *so) {
 			_sssObjectsList2->prevPtr = so;
 		}
 		_sssObjectsList2 = so;
+		linkSoundObject(so);
 	} else {
 		debug(kDebug_SOUND, "Adding so %p to list1 flags 0x%x", so, so->flags);
 		SssObject *stopSo = so;
@@ -699,6 +888,8 @@ void Game::prependSoundObjectToList(SssObject *so) {
 						assert(stopSo == _sssObjectsList1);
 						_sssObjectsList1 = so;
 					}
+					removeSoundObjectFromPriorityHeap(stopSo);
+					addSoundObjectToPriorityHeap(so, stopSo->priorityOrder);
 					_lowPrioritySssObject = findLowPrioritySoundObject();
 				}
 			} else {
@@ -711,6 +902,7 @@ void Game::prependSoundObjectToList(SssObject *so) {
 					_sssObjectsList1->prevPtr = so;
 				}
 				_sssObjectsList1 = so;
+				addSoundObjectToPriorityHeap(so, --_sssObjectsPriorityOrder);
 				if (_playingSssObjectsMax > 0) {
 					if (_playingSssObjectsCount < _playingSssObjectsMax) {
 						_lowPrioritySssObject = 0;
@@ -723,9 +915,13 @@ void Game::prependSoundObjectToList(SssObject *so) {
 			}
 			so->flags |= kFlagPlaying;
 		}
+		if (stopSo != so) {
+			linkSoundObject(so);
+		}
 		if (stopSo) {
 			stopSo->flags &= ~kFlagPlaying;
 			stopSo->pcm = 0;
+			unlinkSoundObject(stopSo);
 			updateSssGroup2(stopSo->flags0);
 		}
 	}
@@ -737,17 +933,7 @@ void Game::prependSoundObjectToList(SssObject *so) {
 void Game::updateSssGroup2(uint32_t flags) {
 	const uint32_t mask = 1 << (flags >> 24);
 	uint32_t *sssGroupPtr = getSssGroupPtr(_res, 2, flags);
-	if ((*sssGroupPtr & mask) != 0) {
-		for (SssObject *so = _sssObjectsList1; so; so = so->nextPtr) {
-			if (compareSssGroup(so->flags0, flags)) {
-				return;
-			}
-		}
-		for (SssObject *so = _sssObjectsList2; so; so = so->nextPtr) {
-			if (compareSssGroup(so->flags0, flags)) {
-				return;
-			}
-		}
+	if ((*sssGroupPtr & mask) != 0 && !hasSoundObjectInGroup(flags)) {
 		*sssGroupPtr &= ~mask;
 	}
 }
@@ -841,10 +1027,10 @@ SssObject *Game::startSoundObject(int bankIndex, int sampleIndex, uint32_t flags
 			if (sample->codeOffset1 == kNone && sample->codeOffset2 == kNone && sample->codeOffset3 == kNone && sample->codeOffset4 == kNone) {
 				so->flags |= kFlagNoCode;
 			}
-			so->codeDataStage1 = (sample->codeOffset1 == kNone) ? 0 : _res->_sssCodeData + sample->codeOffset1;
-			so->codeDataStage2 = (sample->codeOffset2 == kNone) ? 0 : _res->_sssCodeData + sample->codeOffset2;
-			so->codeDataStage3 = (sample->codeOffset3 == kNone) ? 0 : _res->_sssCodeData + sample->codeOffset3;
-			so->codeDataStage4 = (sample->codeOffset4 == kNone) ? 0 : _res->_sssCodeData + sample->codeOffset4;
+			so->codeDataStage1 = (sample->codeOffset1 == kNone) ? 0 : &_res->_sssOpcodesData[sample->codeOffset1];
+			so->codeDataStage2 = (sample->codeOffset2 == kNone) ? 0 : &_res->_sssOpcodesData[sample->codeOffset2];
+			so->codeDataStage3 = (sample->codeOffset3 == kNone) ? 0 : &_res->_sssOpcodesData[sample->codeOffset3];
+			so->codeDataStage4 = (sample->codeOffset4 == kNone) ? 0 : &_res->_sssOpcodesData[sample->codeOffset4];
 			so->lvlObject = _currentSoundLvlObject;
 			so->repeatCounter = -1;
 			so->pauseCounter = -1;
@@ -893,7 +1079,7 @@ SssObject *Game::startSoundObject(int bankIndex, int sampleIndex, uint32_t flags
 	debug(kDebug_SOUND, "startSoundObject dpcm %d", sample->pcm);
 	tmpObj.pcm = pcm;
 	if (sample->codeOffset1 != kNone) {
-		const uint8_t *code = _res->_sssCodeData + sample->codeOffset1;
+		const SssOpcode *code = &_res->_sssOpcodesData[sample->codeOffset1];
 		executeSssCode(&tmpObj, code, true);
 	}
 	updateSssGroup2(flags);
@@ -945,7 +1131,7 @@ SssObject *Game::playSoundObject(SssInfo *s, int source, int mask) {
 		for (int i = 0; i < _sssObjectsCount; ++i) {
 			SssObject *so = &_sssObjectsTable[i];
 			if (so->pcm != 0 && so->filter == filter) {
-				so->currentPriority = CLIP(va + so->priority, 0, 7);
+				updateSoundObjectPriority(so, CLIP(va + so->priority, 0, 7));
 				if (_playingSssObjectsMax > 0) {
 					setLowPrioritySoundObject(so);
 				}
@@ -971,15 +1157,8 @@ SssObject *Game::playSoundObject(SssInfo *s, int source, int mask) {
 		}
 		*sssGroupPtr1 |= mask;
 	} else if (_al & 4) {
-		for (SssObject *so = _sssObjectsList1; so; so = so->nextPtr) {
-			if (compareSssGroup(so->flags0, ve)) {
-				return 0;
-			}
-		}
-		for (SssObject *so = _sssObjectsList2; so; so = so->nextPtr) {
-			if (compareSssGroup(so->flags0, ve)) {
-				return 0;
-			}
+		if (hasSoundObjectInGroup(ve)) {
+			return 0;
 		}
 	}
 	return createSoundObject(s->sssBankIndex, s->sampleIndex, ve);
@@ -992,7 +1171,13 @@ void Game::clearSoundObjects() {
 	_lowPrioritySssObject = 0;
 	for (int i = 0; i < kMaxSssObjects; ++i) {
 		_sssObjectsTable[i].num = i;
+		_sssObjectsTable[i].priorityHeapIndex = -1;
 	}
+	memset(_sssObjectsUsedMask, 0, sizeof(_sssObjectsUsedMask));
+	memset(_sssObjectsByFlags0, 0, sizeof(_sssObjectsByFlags0));
+	memset(_sssObjectsByFlags1, 0, sizeof(_sssObjectsByFlags1));
+	_sssObjectsPriorityHeapSize = 0;
+	_sssObjectsPriorityOrder = kNone;
 	_sssObjectsCount = 0;
 	_playingSssObjectsCount = 0;
 	_snd_bufferOffset = _snd_bufferSize = 0;
@@ -1063,7 +1248,7 @@ void Game::setSoundObjectPanning(SssObject *so) {
 				priority /= 2;
 			}
 			if (so->currentPriority != priority) {
-				so->currentPriority = priority;
+				updateSoundObjectPriority(so, priority);
 				if (_playingSssObjectsMax > 0) {
 					_lowPrioritySssObject = findLowPrioritySoundObject();
 				}
@@ -1124,17 +1309,11 @@ void Game::expireSoundObjects(uint32_t flags) {
 	const uint32_t mask = 1 << (flags >> 24);
 	*getSssGroupPtr(_res, 1, flags) &= ~mask;
 	*getSssGroupPtr(_res, 2, flags) &= ~mask;
-	for (SssObject *so = _sssObjectsList1; so; so = so->nextPtr) {
-		if (compare_bits(so->flags0, flags, 0xFFFF0FFF)) {
-			so->codeDataStage3 = 0;
-			if (so->codeDataStage4 == 0) {
-				removeSoundObjectFromList(so);
-			}
-			so->nextSoundBank = -1;
-			so->delayCounter = -2;
-		}
-	}
-	for (SssObject *so = _sssObjectsList2; so; so = so->nextPtr) {
+	uint32_t objectsMask[kSssObjectsMaskSize];
+	memcpy(objectsMask, _sssObjectsByFlags0[sssObjectHash(flags)], sizeof(objectsMask));
+	int slot;
+	while ((slot = popFirstSssObject(objectsMask)) >= 0) {
+		SssObject *so = &_sssObjectsTable[slot];
 		if (compare_bits(so->flags0, flags, 0xFFFF0FFF)) {
 			so->codeDataStage3 = 0;
 			if (so->codeDataStage4 == 0) {
@@ -0,0 +1,636 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "stats.h"
+#include "system.h"
+#include "util.h"
+
+AudioStats g_audioStats;
+AudioRender g_audioRender;
+MemoryStats g_memoryStats;
+MstProfiler g_mstProfiler;
+StateTrace g_stateTrace;
+
+void CallbackTimings::reset() {
+	count = 0;
+	totalUs = 0;
+	maxUs = 0;
+	memset(histogram, 0, sizeof(histogram));
+}
+
+void CallbackTimings::add(uint32_t us) {
+	int bucket = 0;
+	for (uint32_t limit = 64; bucket < kHistogramSize - 1 && us >= limit; limit <<= 1) {
+		++bucket;
+	}
+	++histogram[bucket];
+	++count;
+	totalUs += us;
+	if (us > maxUs) {
+		maxUs = us;
+	}
+}
+
+AudioStats::AudioStats()
+	: _enabled(false), _csv(0), _intervalMs(kDefaultIntervalMs), _nextTimeStamp(0) {
+	memset(&_mixAudio, 0, sizeof(_mixAudio));
+	memset(&_pafMix, 0, sizeof(_pafMix));
+	_mixingQueueOverflows = 0;
+	_pafUnderruns = _pafUnderrunSamples = 0;
+	_ticksCount = _voicesTotal = 0;
+	_voicesMax = _playingMax = 0;
+	_carryOverSize = _carryOverMax = 0;
+	_summary[0] = 0;
+}
+
+void AudioStats::openCsv(const char *path) {
+	closeCsv();
+	_csv = fopen(path, "w");
+	if (!_csv) {
+		warning("Failed to open '%s' for writing", path);
+		return;
+	}
+	fprintf(_csv, "time_ms,mix_calls,mix_avg_us,mix_max_us,paf_calls,paf_avg_us,paf_max_us,queue_overflows,paf_underruns,paf_underrun_samples,ticks,voices_avg,voices_max,playing_max,carry_over,carry_over_max");
+	for (int i = 0; i < CallbackTimings::kHistogramSize; ++i) {
+		fprintf(_csv, ",mix_hist%d", i);
+	}
+	for (int i = 0; i < CallbackTimings::kHistogramSize; ++i) {
+		fprintf(_csv, ",paf_hist%d", i);
+	}
+	fputc('\n', _csv);
+}
+
+void AudioStats::closeCsv() {
+	if (_csv) {
+		fclose(_csv);
+		_csv = 0;
+	}
+}
+
+void AudioStats::addTick(int voices, int playing) {
+	++_ticksCount;
+	_voicesTotal += voices;
+	if (voices > _voicesMax) {
+		_voicesMax = voices;
+	}
+	if (playing > _playingMax) {
+		_playingMax = playing;
+	}
+}
+
+void AudioStats::setCarryOver(int size) {
+	_carryOverSize = size;
+	if (size > _carryOverMax) {
+		_carryOverMax = size;
+	}
+}
+
+void AudioStats::addPafUnderrun(int samples) {
+	++_pafUnderruns;
+	_pafUnderrunSamples += samples;
+}
+
+void AudioStats::update(uint32_t timeStamp) {
+	if (!_enabled) {
+		return;
+	}
+	if (_nextTimeStamp == 0) {
+		_nextTimeStamp = timeStamp + _intervalMs;
+		return;
+	}
+	if ((int32_t)(timeStamp - _nextTimeStamp) < 0) {
+		return;
+	}
+	_nextTimeStamp = timeStamp + _intervalMs;
+
+	// the interval counters are swapped out with the audio callback locked
+	g_system->lockAudio();
+	const CallbackTimings mixAudio = _mixAudio;
+	const CallbackTimings pafMix = _pafMix;
+	const uint32_t mixingQueueOverflows = _mixingQueueOverflows;
+	const uint32_t pafUnderruns = _pafUnderruns;
+	const uint32_t pafUnderrunSamples = _pafUnderrunSamples;
+	const uint32_t ticksCount = _ticksCount;
+	const uint32_t voicesTotal = _voicesTotal;
+	const int voicesMax = _voicesMax;
+	const int playingMax = _playingMax;
+	const int carryOverSize = _carryOverSize;
+	const int carryOverMax = _carryOverMax;
+	_mixAudio.reset();
+	_pafMix.reset();
+	_ticksCount = _voicesTotal = 0;
+	_voicesMax = _playingMax = 0;
+	_carryOverMax = 0;
+	g_system->unlockAudio();
+
+	const uint32_t mixAvg = (mixAudio.count != 0) ? mixAudio.totalUs / mixAudio.count : 0;
+	const uint32_t pafAvg = (pafMix.count != 0) ? pafMix.totalUs / pafMix.count : 0;
+	const uint32_t voicesAvg = (ticksCount != 0) ? voicesTotal / ticksCount : 0;
+	if (_csv) {
+		fprintf(_csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%d,%d,%d,%d", timeStamp,
+			mixAudio.count, mixAvg, mixAudio.maxUs, pafMix.count, pafAvg, pafMix.maxUs,
+			mixingQueueOverflows, pafUnderruns, pafUnderrunSamples,
+			ticksCount, voicesAvg, voicesMax, playingMax, carryOverSize, carryOverMax);
+		for (int i = 0; i < CallbackTimings::kHistogramSize; ++i) {
+			fprintf(_csv, ",%u", mixAudio.histogram[i]);
+		}
+		for (int i = 0; i < CallbackTimings::kHistogramSize; ++i) {
+			fprintf(_csv, ",%u", pafMix.histogram[i]);
+		}
+		fputc('\n', _csv);
+		fflush(_csv);
+	} else {
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Audio mix %u calls avg %uus max %uus, paf %u calls avg %uus max %uus, overflows %u underruns %u, voices avg %u max %d, carry over %d max %d",
+			mixAudio.count, mixAvg, mixAudio.maxUs, pafMix.count, pafAvg, pafMix.maxUs,
+			mixingQueueOverflows, pafUnderruns, voicesAvg, voicesMax, carryOverSize, carryOverMax);
+		System_printLog(stdout, buffer);
+	}
+	// the overlay font has no punctuation
+	snprintf(_summary, sizeof(_summary), "MIX %u %uUS Q%u U%u V%d C%d", mixAvg, mixAudio.maxUs, mixingQueueOverflows, pafUnderruns, voicesMax, carryOverMax);
+}
+
+AudioStatsTimer::AudioStatsTimer(CallbackTimings *timings)
+	: _timings(g_audioStats._enabled ? timings : 0), _t0(0) {
+	if (_timings) {
+		_t0 = System_getTimeStampUs();
+	}
+}
+
+AudioStatsTimer::~AudioStatsTimer() {
+	if (_timings) {
+		_timings->add(System_getTimeStampUs() - _t0);
+	}
+}
+
+static const uint32_t kFnvOffsetBasis = 0x811C9DC5;
+static const uint32_t kFnvPrime = 0x01000193;
+
+static void writeWavHeader(FILE *fp, uint32_t dataSize) {
+	static const int kChannels = 2;
+	static const int kBitsPerSample = 16;
+	uint8_t hdr[44];
+	memcpy(hdr, "RIFF", 4);
+	WRITE_LE_UINT32(hdr + 4, 36 + dataSize);
+	memcpy(hdr + 8, "WAVEfmt ", 8);
+	WRITE_LE_UINT32(hdr + 16, 16);
+	WRITE_LE_UINT16(hdr + 20, 1); // PCM
+	WRITE_LE_UINT16(hdr + 22, kChannels);
+	WRITE_LE_UINT32(hdr + 24, AudioRender::kSampleRate);
+	WRITE_LE_UINT32(hdr + 28, AudioRender::kSampleRate * kChannels * kBitsPerSample / 8);
+	WRITE_LE_UINT16(hdr + 32, kChannels * kBitsPerSample / 8);
+	WRITE_LE_UINT16(hdr + 34, kBitsPerSample);
+	memcpy(hdr + 36, "data", 4);
+	WRITE_LE_UINT32(hdr + 40, dataSize);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+}
+
+AudioRender::AudioRender()
+	: _fp(0), _samplesCount(0), _hash(kFnvOffsetBasis), _mixUs(0), _frameRemainder(0) {
+}
+
+bool AudioRender::open(const char *path) {
+	close();
+	_fp = fopen(path, "wb");
+	if (!_fp) {
+		warning("Failed to open '%s' for writing", path);
+		return false;
+	}
+	writeWavHeader(_fp, 0);
+	_samplesCount = 0;
+	_hash = kFnvOffsetBasis;
+	_mixUs = 0;
+	_frameRemainder = 0;
+	return true;
+}
+
+void AudioRender::close() {
+	if (!_fp) {
+		return;
+	}
+	fseek(_fp, 0, SEEK_SET);
+	writeWavHeader(_fp, _samplesCount * 2 * sizeof(int16_t));
+	fclose(_fp);
+	_fp = 0;
+
+	const uint32_t seconds = _samplesCount / kSampleRate;
+	const uint32_t ms = (_samplesCount % kSampleRate) * 1000 / kSampleRate;
+	const double samplesPerSec = (_mixUs != 0) ? _samplesCount * 1000000. / _mixUs : 0.;
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Rendered %u samples (%u.%03u seconds) in %u us, %.0f samples/s (%.1fx realtime), hash 0x%08x",
+		_samplesCount, seconds, ms, _mixUs, samplesPerSec, samplesPerSec / kSampleRate, _hash);
+	System_printLog(stdout, buffer);
+}
+
+int AudioRender::getFrameSamples(int frameMs) {
+	// keep the fractional part so the output stays in sync with the game frames
+	const int num = kSampleRate * frameMs + _frameRemainder;
+	_frameRemainder = num % 1000;
+	return num / 1000;
+}
+
+void AudioRender::write(const int16_t *buf, int len) {
+	_samplesCount += len / 2;
+	uint8_t data[1024];
+	while (len > 0) {
+		const int count = MIN<int>(len, sizeof(data) / sizeof(int16_t));
+		for (int i = 0; i < count; ++i) {
+			WRITE_LE_UINT16(data + i * 2, buf[i]);
+		}
+		for (int i = 0; i < count * 2; ++i) {
+			_hash = (_hash ^ data[i]) * kFnvPrime;
+		}
+		fwrite(data, 1, count * 2, _fp);
+		buf += count;
+		len -= count;
+	}
+}
+
+static const char *_stateHashNames[] = {
+	"andy",
+	"objects",
+	"monsters1",
+	"monsters2",
+	"mstVars",
+	"random",
+	"screenMask",
+	"level"
+};
+
+StateTrace::StateTrace()
+	: _fp(0), _path(0), _compare(false), _diverged(false), _level(-1), _frame(0), _framesCount(0) {
+}
+
+bool StateTrace::open(const char *path, bool compare) {
+	close();
+	_fp = fopen(path, compare ? "r" : "w");
+	if (!_fp) {
+		warning("Failed to open '%s'", path);
+		return false;
+	}
+	_path = path;
+	_compare = compare;
+	_diverged = false;
+	_level = -1;
+	_frame = 0;
+	_framesCount = 0;
+	if (!_compare) {
+		fprintf(_fp, "# level frame");
+		for (int i = 0; i < kHashesCount; ++i) {
+			fprintf(_fp, " %s", _stateHashNames[i]);
+		}
+		fprintf(_fp, "\n");
+	}
+	return true;
+}
+
+void StateTrace::close() {
+	if (!_fp) {
+		return;
+	}
+	fclose(_fp);
+	_fp = 0;
+
+	char buffer[256];
+	if (!_compare) {
+		snprintf(buffer, sizeof(buffer), "Recorded the state hashes of %u frames to '%s'", _framesCount, _path);
+	} else if (!_diverged) {
+		snprintf(buffer, sizeof(buffer), "Compared the state hashes of %u frames with '%s', no difference", _framesCount, _path);
+	} else {
+		return;
+	}
+	System_printLog(stdout, buffer);
+}
+
+void StateTrace::startLevel(int level) {
+	_level = level;
+	_frame = 0;
+}
+
+// the lines are 'level frame hash0 hash1 ...', the comments start with '#'
+static bool readStateHashes(FILE *fp, int *level, uint32_t *frame, uint32_t *hashes) {
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#') {
+			continue;
+		}
+		char *p = line;
+		char *end;
+		*level = strtol(p, &end, 10);
+		if (end == p) {
+			return false;
+		}
+		p = end;
+		*frame = strtoul(p, &end, 10);
+		for (int i = 0; i < StateTrace::kHashesCount; ++i) {
+			if (end == p) {
+				return false;
+			}
+			p = end;
+			hashes[i] = strtoul(p, &end, 16);
+		}
+		return end != p;
+	}
+	return false;
+}
+
+void StateTrace::update(const uint32_t *hashes) {
+	if (!_compare) {
+		fprintf(_fp, "%d %u", _level, _frame);
+		for (int i = 0; i < kHashesCount; ++i) {
+			fprintf(_fp, " %08x", hashes[i]);
+		}
+		fprintf(_fp, "\n");
+	} else if (!_diverged) {
+		char buffer[256];
+		int level;
+		uint32_t frame;
+		uint32_t expected[kHashesCount];
+		if (!readStateHashes(_fp, &level, &frame, expected)) {
+			snprintf(buffer, sizeof(buffer), "State trace '%s' ends before level %d frame %u", _path, _level, _frame);
+			System_printLog(stdout, buffer);
+			_diverged = true;
+		} else if (level != _level || frame != _frame) {
+			snprintf(buffer, sizeof(buffer), "State diverges at level %d frame %u, the trace is at level %d frame %u", _level, _frame, level, frame);
+			System_printLog(stdout, buffer);
+			_diverged = true;
+		} else {
+			for (int i = 0; i < kHashesCount; ++i) {
+				if (hashes[i] != expected[i]) {
+					snprintf(buffer, sizeof(buffer), "State diverges at level %d frame %u: %s 0x%08x (expected 0x%08x)", _level, _frame, _stateHashNames[i], hashes[i], expected[i]);
+					System_printLog(stdout, buffer);
+					_diverged = true;
+				}
+			}
+		}
+		if (_diverged) {
+			return;
+		}
+	}
+	++_frame;
+	++_framesCount;
+}
+
+static const char *_memTagNames[] = {
+	"res",
+	"menu",
+	"lvl",
+	"sss",
+	"pcm",
+	"mst",
+	"video",
+	"paf"
+};
+
+MemoryStats::MemoryStats()
+	: _enabled(false), _level(kNoLevel) {
+	memset(_tags, 0, sizeof(_tags));
+	memset(_summary, 0, sizeof(_summary));
+}
+
+void MemoryStats::add(int tag, uint32_t size, int level) {
+	MemoryTagStats *t = &_tags[tag];
+	t->size += size;
+	if (t->size > t->peakSize) {
+		t->peakSize = t->size;
+	}
+	++t->count;
+	++t->allocationsCount;
+	t->levelSize[level] += size;
+}
+
+void MemoryStats::remove(int tag, uint32_t size, int level) {
+	MemoryTagStats *t = &_tags[tag];
+	assert(t->size >= size && t->count != 0);
+	t->size -= size;
+	--t->count;
+	t->levelSize[level] -= size;
+}
+
+void MemoryStats::startLevel(int level) {
+	_level = (level >= 0 && level < kNoLevel) ? level : kNoLevel;
+	for (int i = 0; i < kMemTagsCount; ++i) {
+		_tags[i].peakSize = _tags[i].size;
+		_tags[i].allocationsCount = 0;
+	}
+}
+
+void MemoryStats::dump() {
+	if (!_enabled) {
+		return;
+	}
+	char buffer[256];
+	uint32_t totalSize = 0, totalPeakSize = 0;
+	for (int i = 0; i < kMemTagsCount; ++i) {
+		const MemoryTagStats *t = &_tags[i];
+		// bytes still in use from the other levels and from the menus
+		const uint32_t otherSize = t->size - t->levelSize[_level];
+		snprintf(buffer, sizeof(buffer), "Memory level %d %-5s size %u peak %u, %u allocations (%u in use), %u bytes allocated outside the level",
+			_level, _memTagNames[i], t->size, t->peakSize, t->allocationsCount, t->count, otherSize);
+		System_printLog(stdout, buffer);
+		totalSize += t->size;
+		totalPeakSize += t->peakSize;
+	}
+	snprintf(buffer, sizeof(buffer), "Memory level %d total size %u peak %u (sum of the subsystems peaks)", _level, totalSize, totalPeakSize);
+	System_printLog(stdout, buffer);
+}
+
+void MemoryStats::updateSummary() {
+	uint32_t size = 0, peakSize = 0;
+	for (int i = 0; i < kMemTagsCount; ++i) {
+		size += _tags[i].size;
+		peakSize += _tags[i].peakSize;
+	}
+	// kilobytes, the overlay font has no punctuation
+	snprintf(_summary[0], sizeof(_summary[0]), "MEM %uK PEAK %uK", size >> 10, peakSize >> 10);
+	snprintf(_summary[1], sizeof(_summary[1]), "LVL%u SSS%u PCM%u MST%u", _tags[kMemTag_Lvl].size >> 10, _tags[kMemTag_Sss].size >> 10, _tags[kMemTag_SssPcm].size >> 10, _tags[kMemTag_Mst].size >> 10);
+	snprintf(_summary[2], sizeof(_summary[2]), "VID%u PAF%u RES%u MENU%u", _tags[kMemTag_Video].size >> 10, _tags[kMemTag_Paf].size >> 10, _tags[kMemTag_Resource].size >> 10, _tags[kMemTag_Menu].size >> 10);
+}
+
+// the header keeps the allocations aligned on 16 bytes
+struct MemoryHeader {
+	uint32_t size;
+	uint8_t tag;
+	uint8_t level;
+};
+
+static const uint32_t kMemoryHeaderSize = 16;
+
+void *memAlloc(int tag, uint32_t size) {
+	uint8_t *p = (uint8_t *)malloc(kMemoryHeaderSize + size);
+	if (!p) {
+		return 0;
+	}
+	MemoryHeader *hdr = (MemoryHeader *)p;
+	hdr->size = size;
+	hdr->tag = tag;
+	hdr->level = g_memoryStats._level;
+	g_memoryStats.add(tag, size, hdr->level);
+	return p + kMemoryHeaderSize;
+}
+
+void *memCalloc(int tag, uint32_t count, uint32_t size) {
+	void *p = memAlloc(tag, count * size);
+	if (p) {
+		memset(p, 0, count * size);
+	}
+	return p;
+}
+
+void memFree(void *ptr) {
+	if (ptr) {
+		uint8_t *p = (uint8_t *)ptr - kMemoryHeaderSize;
+		const MemoryHeader *hdr = (const MemoryHeader *)p;
+		g_memoryStats.remove(hdr->tag, hdr->size, hdr->level);
+		free(p);
+	}
+}
+
+MstProfiler::MstProfiler()
+	: _enabled(false), _level(-1), _handlerNames(0), _handlersCount(0), _codeOffsets(0), _codeSize(0) {
+	startLevel(-1, 0, 0, 0);
+}
+
+MstProfiler::~MstProfiler() {
+	free(_codeOffsets);
+}
+
+void MstProfiler::startLevel(int level, uint32_t codeSize, const char *const *handlerNames, int handlersCount) {
+	_level = level;
+	_handlerNames = handlerNames;
+	_handlersCount = MIN<int>(handlersCount, kMaxHandlers);
+	memset(_opcodes, 0, sizeof(_opcodes));
+	memset(_handlers, 0, sizeof(_handlers));
+	memset(_screens, 0, sizeof(_screens));
+	memset(_runHistogram, 0, sizeof(_runHistogram));
+	free(_codeOffsets);
+	_codeOffsets = 0;
+	_codeSize = 0;
+	if (_enabled && codeSize != 0) {
+		_codeOffsets = (MstProfileCounter *)calloc(codeSize, sizeof(MstProfileCounter));
+		if (_codeOffsets) {
+			_codeSize = codeSize;
+		}
+	}
+}
+
+void MstProfiler::addHandler(int num, uint32_t us) {
+	if (num >= 0 && num < kMaxHandlers) {
+		++_handlers[num].count;
+		_handlers[num].totalUs += us;
+	}
+}
+
+void MstProfiler::addTaskRun(uint32_t codeOffset, int screen, int opcodesCount, uint32_t us) {
+	if (codeOffset < _codeSize) {
+		++_codeOffsets[codeOffset].count;
+		_codeOffsets[codeOffset].totalUs += us;
+	}
+	if (screen >= 0 && screen < kMaxScreens) {
+		++_screens[screen].count;
+		_screens[screen].totalUs += us;
+	}
+	int bucket = 0;
+	while (bucket < kRunHistogramSize - 1 && opcodesCount >= (1 << bucket)) {
+		++bucket;
+	}
+	++_runHistogram[bucket];
+}
+
+static const MstProfileCounter *_sortedCounters;
+
+static int compareCountersTime(const void *a, const void *b) {
+	const MstProfileCounter *ca = &_sortedCounters[*(const int *)a];
+	const MstProfileCounter *cb = &_sortedCounters[*(const int *)b];
+	if (ca->totalUs != cb->totalUs) {
+		return (ca->totalUs > cb->totalUs) ? -1 : 1;
+	}
+	return (int)cb->count - (int)ca->count;
+}
+
+// logs the counters with the highest accumulated time first
+static void dumpCounters(const char *title, const MstProfileCounter *counters, int count, const char *const *names, int namesCount) {
+	int *order = (int *)malloc(count * sizeof(int));
+	if (!order) {
+		return;
+	}
+	int used = 0;
+	for (int i = 0; i < count; ++i) {
+		if (counters[i].count != 0) {
+			order[used++] = i;
+		}
+	}
+	_sortedCounters = counters;
+	qsort(order, used, sizeof(int), compareCountersTime);
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "MST profile level %d %s, %d entries", g_mstProfiler._level, title, used);
+	System_printLog(stdout, buffer);
+	for (int i = 0; i < used && i < MstProfiler::kReportLines; ++i) {
+		const int num = order[i];
+		const MstProfileCounter *c = &counters[num];
+		if (names && num < namesCount) {
+			snprintf(buffer, sizeof(buffer), "  %-20s count %u total %u us avg %u us", names[num], c->count, c->totalUs, c->totalUs / c->count);
+		} else {
+			snprintf(buffer, sizeof(buffer), "  %-20d count %u total %u us avg %u us", num, c->count, c->totalUs, c->totalUs / c->count);
+		}
+		System_printLog(stdout, buffer);
+	}
+	free(order);
+}
+
+static const uint32_t *_sortedCounts;
+
+static int compareCounts(const void *a, const void *b) {
+	const uint32_t ca = _sortedCounts[*(const int *)a];
+	const uint32_t cb = _sortedCounts[*(const int *)b];
+	if (ca != cb) {
+		return (ca > cb) ? -1 : 1;
+	}
+	return *(const int *)a - *(const int *)b;
+}
+
+static void dumpOpcodes(const uint32_t *counts, int count) {
+	int order[MstProfiler::kOpcodesCount];
+	int used = 0;
+	uint32_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		if (counts[i] != 0) {
+			order[used++] = i;
+			total += counts[i];
+		}
+	}
+	_sortedCounts = counts;
+	qsort(order, used, sizeof(int), compareCounts);
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "MST profile level %d opcodes, %d entries, %u executed", g_mstProfiler._level, used, total);
+	System_printLog(stdout, buffer);
+	for (int i = 0; i < used && i < MstProfiler::kReportLines; ++i) {
+		const int num = order[i];
+		snprintf(buffer, sizeof(buffer), "  %-20d count %u", num, counts[num]);
+		System_printLog(stdout, buffer);
+	}
+}
+
+void MstProfiler::dump() {
+	if (!_enabled || _level < 0) {
+		return;
+	}
+	dumpOpcodes(_opcodes, kOpcodesCount);
+	dumpCounters("task handlers", _handlers, _handlersCount, _handlerNames, _handlersCount);
+	dumpCounters("code offsets", _codeOffsets, _codeSize, 0, 0);
+	dumpCounters("screens", _screens, kMaxScreens, 0, 0);
+	char buffer[256];
+	int len = snprintf(buffer, sizeof(buffer), "MST profile level %d opcodes per task run", _level);
+	for (int i = 0; i < kRunHistogramSize && len < (int)sizeof(buffer); ++i) {
+		const int lo = (i == 0) ? 0 : (1 << (i - 1));
+		const int hi = (i == 0 || i == kRunHistogramSize - 1) ? lo : ((1 << i) - 1);
+		if (lo == hi) {
+			len += snprintf(buffer + len, sizeof(buffer) - len, " %d:%u", lo, _runHistogram[i]);
+		} else {
+			len += snprintf(buffer + len, sizeof(buffer) - len, " %d-%d:%u", lo, hi, _runHistogram[i]);
+		}
+	}
+	System_printLog(stdout, buffer);
+}
@@ -0,0 +1,219 @@
+/*
+ * Heart of Darkness engine rewrite
+ * Copyright (C) 2009-2011 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef STATS_H__
+#define STATS_H__
+
+#include "intern.h"
+
+struct CallbackTimings {
+	enum {
+		kHistogramSize = 10 // 64us buckets doubling in size, the last one counts the calls >= 16ms
+	};
+
+	uint32_t histogram[kHistogramSize];
+	uint32_t count;
+	uint32_t totalUs;
+	uint32_t maxUs;
+
+	void reset();
+	void add(uint32_t us);
+};
+
+// the counters are updated from the audio thread, the main thread copies and resets them with the audio locked
+struct AudioStats {
+	enum {
+		kDefaultIntervalMs = 1000
+	};
+
+	bool _enabled;
+	FILE *_csv;
+	uint32_t _intervalMs;
+	uint32_t _nextTimeStamp;
+
+	CallbackTimings _mixAudio;
+	CallbackTimings _pafMix;
+	uint32_t _mixingQueueOverflows;
+	uint32_t _pafUnderruns;
+	uint32_t _pafUnderrunSamples;
+	uint32_t _ticksCount; // mixSoundObjects17640 calls
+	uint32_t _voicesTotal; // channels queued to the mixer
+	int _voicesMax;
+	int _playingMax;
+	int _carryOverSize; // _snd_buffer samples left for the next callback
+	int _carryOverMax;
+
+	char _summary[64]; // last interval, for the overlay
+
+	AudioStats();
+
+	void openCsv(const char *path);
+	void closeCsv();
+
+	void addTick(int voices, int playing);
+	void setCarryOver(int size);
+	void addPafUnderrun(int samples);
+
+	void update(uint32_t timeStamp);
+};
+
+struct AudioStatsTimer {
+	CallbackTimings *_timings;
+	uint32_t _t0;
+
+	AudioStatsTimer(CallbackTimings *timings);
+	~AudioStatsTimer();
+};
+
+// renders the game sound output to a .wav file, driven by the game frames instead of the audio device
+struct AudioRender {
+	enum {
+		kSampleRate = 22050
+	};
+
+	FILE *_fp;
+	uint32_t _samplesCount; // stereo frames written
+	uint32_t _hash; // FNV-1a of the little endian samples
+	uint32_t _mixUs;
+	int _frameRemainder;
+
+	AudioRender();
+
+	bool open(const char *path);
+	void close();
+	bool isOpen() const { return _fp != 0; }
+
+	int getFrameSamples(int frameMs);
+	void write(const int16_t *buf, int len);
+};
+
+// per frame hashes of the simulation state, written to a file or compared with a previous run
+struct StateTrace {
+	enum {
+		kHashAndy,
+		kHashLvlObjects,
+		kHashMonsters1,
+		kHashMonsters2,
+		kHashMstVars,
+		kHashRandom,
+		kHashScreenMask,
+		kHashLevel, // checkpoint, screens state
+		kHashesCount
+	};
+
+	FILE *_fp;
+	const char *_path;
+	bool _compare; // read the hashes from the file
+	bool _diverged; // the first difference has been reported
+	int _level;
+	uint32_t _frame; // since the level start
+	uint32_t _framesCount;
+
+	StateTrace();
+
+	bool open(const char *path, bool compare);
+	void close();
+	bool isOpen() const { return _fp != 0; }
+
+	void startLevel(int level);
+	void update(const uint32_t *hashes);
+};
+
+enum MemoryTag {
+	kMemTag_Resource, // setup.dat
+	kMemTag_Menu,
+	kMemTag_Lvl,
+	kMemTag_Sss,
+	kMemTag_SssPcm,
+	kMemTag_Mst,
+	kMemTag_Video,
+	kMemTag_Paf,
+	kMemTagsCount
+};
+
+struct MemoryTagStats {
+	enum {
+		kLevelsCount = 16 // the last slot counts the allocations made outside a level
+	};
+
+	uint32_t size; // bytes in use
+	uint32_t peakSize; // high-water mark since the level start
+	uint32_t count; // allocations in use
+	uint32_t allocationsCount; // since the level start
+	uint32_t levelSize[kLevelsCount]; // bytes in use, by level of allocation
+};
+
+// the counters of a tag are only updated from one thread at a time, the level
+// loader threads use different tags and the buffers allocated by the prefetch
+// thread are accounted when they are installed
+struct MemoryStats {
+	enum {
+		kNoLevel = MemoryTagStats::kLevelsCount - 1,
+		kSummaryLines = 3
+	};
+
+	bool _enabled;
+	int _level;
+	MemoryTagStats _tags[kMemTagsCount];
+	char _summary[kSummaryLines][48]; // for the overlay, 4 labels and 4 values of up to 7 digits (KB of a 32 bits size)
+
+	MemoryStats();
+
+	void add(int tag, uint32_t size, int level);
+	void remove(int tag, uint32_t size, int level);
+
+	void startLevel(int level);
+	void dump();
+	void updateSummary();
+};
+
+// allocations tracked per subsystem, released with memFree()
+void *memAlloc(int tag, uint32_t size);
+void *memCalloc(int tag, uint32_t count, uint32_t size);
+void memFree(void *ptr);
+
+struct MstProfileCounter {
+	uint32_t count;
+	uint32_t totalUs;
+};
+
+// .mst code execution counts and timings, reset on level start
+struct MstProfiler {
+	enum {
+		kOpcodesCount = 256,
+		kMaxHandlers = 32,
+		kMaxScreens = 64,
+		kRunHistogramSize = 9, // opcodes executed per task run : 0, 1, 2-3, 4-7 ... 128
+		kReportLines = 16
+	};
+
+	bool _enabled;
+	int _level;
+	const char *const *_handlerNames;
+	int _handlersCount;
+	uint32_t _opcodes[kOpcodesCount]; // executions, too short to be timed
+	MstProfileCounter _handlers[kMaxHandlers]; // mstTask_* calls
+	MstProfileCounter _screens[kMaxScreens]; // task runs by Andy screen
+	MstProfileCounter *_codeOffsets; // task runs by starting instruction
+	uint32_t _codeSize;
+	uint32_t _runHistogram[kRunHistogramSize];
+
+	MstProfiler();
+	~MstProfiler();
+
+	void startLevel(int level, uint32_t codeSize, const char *const *handlerNames, int handlersCount);
+	void countOpcode(int opcode) { ++_opcodes[opcode]; }
+	void addHandler(int num, uint32_t us);
+	void addTaskRun(uint32_t codeOffset, int screen, int opcodesCount, uint32_t us);
+	void dump();
+};
+
+extern AudioStats g_audioStats;
+extern AudioRender g_audioRender;
+extern MemoryStats g_memoryStats;
+extern MstProfiler g_mstProfiler;
+extern StateTrace g_stateTrace;
+
+#endif // STATS_H__
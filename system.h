@@ -23,6 +23,8 @@ struct PlayerInput {
 	bool exit;
 	bool quit;
 	bool screenshot;
+	bool saveState;
+	bool loadState;
 
 	bool keyPressed(int keyMask) const {
 		return (prevMask & keyMask) == 0 && (mask & keyMask) == keyMask;
@@ -72,6 +74,14 @@ extern void System_earlyInit();
 extern void System_printLog(FILE *, const char *s);
 extern void System_fatalError(const char *s);
 extern bool System_hasCommandLine();
+extern uint32_t System_getTimeStampUs(); // microseconds, wraps around
+extern int System_getCpuCount();
+extern void *System_createThread(int (*proc)(void *), void *arg); // returns 0 if not supported
+extern int System_waitThread(void *thread);
+extern void *System_createMutex(); // returns 0 if not supported
+extern void System_destroyMutex(void *mutex);
+extern void System_lockMutex(void *mutex);
+extern void System_unlockMutex(void *mutex);
 
 extern System *const g_system;
 
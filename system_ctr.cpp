@@ -112,6 +112,40 @@ bool System_hasCommandLine() {
 	return true;
 }
 
+uint32_t System_getTimeStampUs() {
+	return (uint32_t)(svcGetSystemTick() / (SYSCLOCK_ARM11 / 1000000));
+}
+
+int System_getCpuCount() {
+	return 1; // the application runs on the syscore
+}
+
+void *System_createThread(int (*proc)(void *), void *arg) {
+	return SDL_CreateThread(proc, arg);
+}
+
+int System_waitThread(void *thread) {
+	int status = 0;
+	SDL_WaitThread((SDL_Thread *)thread, &status);
+	return status;
+}
+
+void *System_createMutex() {
+	return SDL_CreateMutex();
+}
+
+void System_destroyMutex(void *mutex) {
+	SDL_DestroyMutex((SDL_mutex *)mutex);
+}
+
+void System_lockMutex(void *mutex) {
+	SDL_mutexP((SDL_mutex *)mutex);
+}
+
+void System_unlockMutex(void *mutex) {
+	SDL_mutexV((SDL_mutex *)mutex);
+}
+
 System_CTR::System_CTR() :
 	_offscreenLut(0),
 	_texture(0), _backgroundTexture(0), _widescreenTexture(0),
@@ -414,6 +448,10 @@ void System_CTR::processEvents() {
 		case SDL_KEYUP:
 			if (ev.key.keysym.sym == SDLK_s) {
 				inp.screenshot = true;
+			} else if (ev.key.keysym.sym == SDLK_F5) {
+				inp.saveState = true;
+			} else if (ev.key.keysym.sym == SDLK_F9) {
+				inp.loadState = true;
 			}
 			break;
 		case SDL_JOYHATMOTION:
@@ -114,6 +114,35 @@ bool System_hasCommandLine() {
 	return false;
 }
 
+uint32_t System_getTimeStampUs() {
+	return sceKernelGetSystemTimeLow();
+}
+
+int System_getCpuCount() {
+	return 1;
+}
+
+void *System_createThread(int (*proc)(void *), void *arg) {
+	return 0;
+}
+
+int System_waitThread(void *thread) {
+	return 0;
+}
+
+void *System_createMutex() {
+	return 0;
+}
+
+void System_destroyMutex(void *mutex) {
+}
+
+void System_lockMutex(void *mutex) {
+}
+
+void System_unlockMutex(void *mutex) {
+}
+
 static int exitCallback(int arg1, int arg2, void *common) {
 	g_system->inp.quit = true;
 	return 0;
@@ -118,6 +118,42 @@ bool System_hasCommandLine() {
 	return true;
 }
 
+uint32_t System_getTimeStampUs() {
+	static const uint64_t frequency = SDL_GetPerformanceFrequency();
+	const uint64_t counter = SDL_GetPerformanceCounter();
+	return (uint32_t)((counter / frequency) * 1000000 + (counter % frequency) * 1000000 / frequency);
+}
+
+int System_getCpuCount() {
+	return SDL_GetCPUCount();
+}
+
+void *System_createThread(int (*proc)(void *), void *arg) {
+	return SDL_CreateThread(proc, "hode", arg);
+}
+
+int System_waitThread(void *thread) {
+	int status = 0;
+	SDL_WaitThread((SDL_Thread *)thread, &status);
+	return status;
+}
+
+void *System_createMutex() {
+	return SDL_CreateMutex();
+}
+
+void System_destroyMutex(void *mutex) {
+	SDL_DestroyMutex((SDL_mutex *)mutex);
+}
+
+void System_lockMutex(void *mutex) {
+	SDL_LockMutex((SDL_mutex *)mutex);
+}
+
+void System_unlockMutex(void *mutex) {
+	SDL_UnlockMutex((SDL_mutex *)mutex);
+}
+
 System_SDL2::System_SDL2() :
 	_offscreenLut(0),
 	_window(0), _renderer(0), _texture(0), _backgroundTexture(0), _fmt(0), _widescreenTexture(0),
@@ -494,6 +530,10 @@ void System_SDL2::processEvents() {
 		case SDL_KEYUP:
 			if (ev.key.keysym.sym == SDLK_s) {
 				inp.screenshot = true;
+			} else if (ev.key.keysym.sym == SDLK_F5) {
+				inp.saveState = true;
+			} else if (ev.key.keysym.sym == SDLK_F9) {
+				inp.loadState = true;
 			}
 			break;
 		case SDL_JOYDEVICEADDED:
@@ -107,6 +107,35 @@ bool System_hasCommandLine() {
 	return false;
 }
 
+uint32_t System_getTimeStampUs() {
+	return ticks_to_microsecs(diff_ticks(system_wii._startTime, gettime()));
+}
+
+int System_getCpuCount() {
+	return 1;
+}
+
+void *System_createThread(int (*proc)(void *), void *arg) {
+	return 0;
+}
+
+int System_waitThread(void *thread) {
+	return 0;
+}
+
+void *System_createMutex() {
+	return 0;
+}
+
+void System_destroyMutex(void *mutex) {
+}
+
+void System_lockMutex(void *mutex) {
+}
+
+void System_unlockMutex(void *mutex) {
+}
+
 System_Wii::System_Wii() {
 	_rmodeObj = 0;
 }
@@ -5,6 +5,7 @@
 
 #include "video.h"
 #include "mdec.h"
+#include "stats.h"
 #include "system.h"
 
 static const bool kUseShadowColorLut = false;
@@ -15,15 +16,15 @@ Video::Video() {
 	_drawLine.y1 = 0;
 	_drawLine.x2 = W - 1;
 	_drawLine.y2 = H - 1;
-	_shadowLayer = (uint8_t *)malloc(W * H + 1); // projectionData offset can be equal to W * H
-	_frontLayer = (uint8_t *)malloc(W * H);
-	_backgroundLayer = (uint8_t *)malloc(W * H);
+	_shadowLayer = (uint8_t *)memAlloc(kMemTag_Video, W * H + 1); // projectionData offset can be equal to W * H
+	_frontLayer = (uint8_t *)memAlloc(kMemTag_Video, W * H);
+	_backgroundLayer = (uint8_t *)memAlloc(kMemTag_Video, W * H);
 	if (kUseShadowColorLut) {
-		_shadowColorLookupTable = (uint8_t *)malloc(256 * 256); // shadowLayer, frontLayer
+		_shadowColorLookupTable = (uint8_t *)memAlloc(kMemTag_Video, 256 * 256); // shadowLayer, frontLayer
 	} else {
 		_shadowColorLookupTable = 0;
 	}
-	_shadowScreenMaskBuffer = (uint8_t *)malloc(256 * 192 * 2 + 256 * 4);
+	_shadowScreenMaskBuffer = (uint8_t *)memAlloc(kMemTag_Video, 256 * 192 * 2 + 256 * 4);
 	for (int i = 144; i < 256; ++i) {
 		_shadowColorLut[i] = i;
 	}
@@ -34,14 +35,14 @@ Video::Video() {
 }
 
 Video::~Video() {
-	free(_shadowLayer);
-	free(_frontLayer);
-	free(_backgroundLayer);
-	free(_shadowColorLookupTable);
-	free(_shadowScreenMaskBuffer);
-	free(_mdec.planes[kOutputPlaneY].ptr);
-	free(_mdec.planes[kOutputPlaneCb].ptr);
-	free(_mdec.planes[kOutputPlaneCr].ptr);
+	memFree(_shadowLayer);
+	memFree(_frontLayer);
+	memFree(_backgroundLayer);
+	memFree(_shadowColorLookupTable);
+	memFree(_shadowScreenMaskBuffer);
+	memFree(_mdec.planes[kOutputPlaneY].ptr);
+	memFree(_mdec.planes[kOutputPlaneCb].ptr);
+	memFree(_mdec.planes[kOutputPlaneCr].ptr);
 }
 
 void Video::initPsx() {
@@ -49,11 +50,11 @@ void Video::initPsx() {
 	static const int h = (H + 15) & ~15;
 	static const int w2 = w / 2;
 	static const int h2 = h / 2;
-	_mdec.planes[kOutputPlaneY].ptr = (uint8_t *)malloc(w * h);
+	_mdec.planes[kOutputPlaneY].ptr = (uint8_t *)memAlloc(kMemTag_Video, w * h);
 	_mdec.planes[kOutputPlaneY].pitch = w;
-	_mdec.planes[kOutputPlaneCb].ptr = (uint8_t *)malloc(w2 * h2);
+	_mdec.planes[kOutputPlaneCb].ptr = (uint8_t *)memAlloc(kMemTag_Video, w2 * h2);
 	_mdec.planes[kOutputPlaneCb].pitch = w2;
-	_mdec.planes[kOutputPlaneCr].ptr = (uint8_t *)malloc(w2 * h2);
+	_mdec.planes[kOutputPlaneCr].ptr = (uint8_t *)memAlloc(kMemTag_Video, w2 * h2);
 	_mdec.planes[kOutputPlaneCr].pitch = w2;
 }
 